@@ -0,0 +1,140 @@
+/*
+ * Low-latency actuation path
+ *
+ * Validated set-pin requests are handed to a dedicated high-priority task
+ * instead of being executed inline with JSON parsing, logging and state
+ * publishing. The task is pinned to the Arduino loop core with a priority
+ * well above loopTask, so submit() preempts the caller and the pin has
+ * changed by the time submit() returns.
+ *
+ * Everything on the path from queue to pin is IRAM/DRAM resident:
+ * - the task entry and handler are IRAM_ATTR
+ * - the queue storage, task stack and stats live in this object (.bss, DRAM)
+ * - pins are driven with direct W1TS/W1TC register writes, not digitalWrite()
+ * so the path never takes a flash-cache miss, e.g. while OTA or NVS code is
+ * thrashing the cache. (While flash is actually being written the scheduler
+ * is suspended on both cores; a request submitted then is applied as soon as
+ * the write finishes.)
+ *
+ * Pins must already be configured as outputs - the fast path does no setup.
+ *
+ * Latency from receipt (caller supplied timestamp, normally taken at the top
+ * of the MQTT callback) to pin change is recorded in a log2 histogram.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <soc/gpio_reg.h>
+
+#define ACTUATION_QUEUE_LENGTH 8
+#define ACTUATION_TASK_STACK 2048
+#define ACTUATION_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+#define ACTUATION_HISTOGRAM_BUCKETS 8  // <16us, <32us, ... <1024us, >=1024us
+
+struct ActuationRequest {
+  uint8_t pin;
+  uint8_t level;
+  uint32_t receivedUs;  // Low 32 bits of esp_timer_get_time() at receipt
+};
+
+struct ActuationStats {
+  uint32_t applied;
+  uint32_t dropped;     // Queue full at submit()
+  uint32_t minUs;
+  uint32_t maxUs;
+  uint64_t totalUs;
+  uint32_t histogram[ACTUATION_HISTOGRAM_BUCKETS];
+};
+
+class ActuationPath {
+public:
+  static uint32_t nowUs() { return (uint32_t)esp_timer_get_time(); }
+
+  bool begin() {
+    queue_ = xQueueCreateStatic(ACTUATION_QUEUE_LENGTH, sizeof(ActuationRequest),
+                                queueStorage_, &queueBuffer_);
+    if (queue_ == NULL) return false;
+    resetStats();
+    task_ = xTaskCreateStaticPinnedToCore(taskEntry, "actuate", ACTUATION_TASK_STACK, this,
+                                          ACTUATION_TASK_PRIORITY, taskStack_, &taskBuffer_,
+                                          ARDUINO_RUNNING_CORE);
+    return task_ != NULL;
+  }
+
+  // Queue a pin change. Returns false if the path is not running or full.
+  bool submit(uint8_t pin, bool level, uint32_t receivedUs) {
+    ActuationRequest request = {pin, (uint8_t)(level ? 1 : 0), receivedUs};
+    if (queue_ == NULL || xQueueSend(queue_, &request, 0) != pdTRUE) {
+      portENTER_CRITICAL(&statsMux_);
+      stats_.dropped++;
+      portEXIT_CRITICAL(&statsMux_);
+      return false;
+    }
+    return true;
+  }
+
+  ActuationStats stats() {
+    portENTER_CRITICAL(&statsMux_);
+    ActuationStats copy = stats_;
+    portEXIT_CRITICAL(&statsMux_);
+    return copy;
+  }
+
+  void resetStats() {
+    portENTER_CRITICAL(&statsMux_);
+    memset(&stats_, 0, sizeof(stats_));
+    stats_.minUs = UINT32_MAX;
+    portEXIT_CRITICAL(&statsMux_);
+  }
+
+private:
+  static void IRAM_ATTR taskEntry(void* arg) {
+    ActuationPath* self = (ActuationPath*)arg;
+    ActuationRequest request;
+    for (;;) {
+      if (xQueueReceive(self->queue_, &request, portMAX_DELAY) == pdTRUE) {
+        self->apply(request);
+      }
+    }
+  }
+
+  void IRAM_ATTR apply(const ActuationRequest& request) {
+    if (request.pin < 32) {
+      REG_WRITE(request.level ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG, 1UL << request.pin);
+    }
+#if SOC_GPIO_PIN_COUNT > 32
+    else {
+      REG_WRITE(request.level ? GPIO_OUT1_W1TS_REG : GPIO_OUT1_W1TC_REG, 1UL << (request.pin - 32));
+    }
+#endif
+    record(nowUs() - request.receivedUs);
+  }
+
+  void IRAM_ATTR record(uint32_t latencyUs) {
+    uint8_t bucket = 0;
+    for (uint32_t limit = 16; bucket < ACTUATION_HISTOGRAM_BUCKETS - 1 && latencyUs >= limit; limit <<= 1) {
+      bucket++;
+    }
+    portENTER_CRITICAL(&statsMux_);
+    stats_.applied++;
+    stats_.totalUs += latencyUs;
+    if (latencyUs < stats_.minUs) stats_.minUs = latencyUs;
+    if (latencyUs > stats_.maxUs) stats_.maxUs = latencyUs;
+    stats_.histogram[bucket]++;
+    portEXIT_CRITICAL(&statsMux_);
+  }
+
+  QueueHandle_t queue_ = NULL;
+  TaskHandle_t task_ = NULL;
+  StaticQueue_t queueBuffer_;
+  StaticTask_t taskBuffer_;
+  uint8_t queueStorage_[ACTUATION_QUEUE_LENGTH * sizeof(ActuationRequest)];
+  StackType_t taskStack_[ACTUATION_TASK_STACK];
+  ActuationStats stats_;
+  portMUX_TYPE statsMux_ = portMUX_INITIALIZER_UNLOCKED;
+};
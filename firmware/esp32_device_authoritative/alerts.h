@@ -0,0 +1,334 @@
+/*
+ * Device-side edge-triggered alerts
+ *
+ * Alert rules (channel, direction, threshold, hysteresis, minimum duration,
+ * severity) are pushed with a config command, stored in NVS (namespace
+ * "alerts") and evaluated against every sample as it is taken, instead of
+ * by the backend against periodic state snapshots. Only transitions are
+ * reported, so the alerts topic is silent while nothing changes and the
+ * state period no longer bounds alert latency.
+ *
+ * Each rule runs a small state machine:
+ *
+ *   CLEAR --trip--> PENDING --held for_ms--> ACTIVE --clear--> CLEARING --held for_ms--> CLEAR
+ *
+ * "above" trips at value > threshold and clears at value < threshold -
+ * hysteresis ("below" mirrors this), so a reading hovering at the threshold
+ * does not flap. A condition that does not hold for the full minimum
+ * duration is dropped without a transition. update() completes pending
+ * transitions between samples, so for_ms is honoured to the loop tick rather
+ * than to the sample period.
+ *
+ * Channels are names: the sketch feeds sensor readings and Modbus points by
+ * name through sample(). A rule whose channel is never sampled stays CLEAR.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+
+#define ALERT_MAX_RULES 16
+#define ALERT_MAX_NAME 15
+#define ALERT_MAX_DURATION_MS 3600000UL
+#define ALERT_QUEUE 8
+#define ALERT_FORMAT_VERSION 1
+
+enum AlertDirection : uint8_t {
+  ALERT_ABOVE = 0,
+  ALERT_BELOW = 1
+};
+
+enum AlertSeverity : uint8_t {
+  ALERT_INFO = 0,
+  ALERT_WARNING = 1,
+  ALERT_CRITICAL = 2
+};
+
+struct AlertRule {
+  char id[ALERT_MAX_NAME + 1];
+  char channel[ALERT_MAX_NAME + 1];
+  uint8_t direction;
+  uint8_t severity;
+  float threshold;
+  float hysteresis;      // Distance back past the threshold needed to clear
+  uint32_t minDurationMs; // Condition must hold this long to trip or clear
+};
+
+struct AlertSet {
+  uint8_t version;
+  uint8_t count;
+  AlertRule rules[ALERT_MAX_RULES];
+};
+
+// One edge, queued for publishing
+struct AlertTransition {
+  uint8_t rule;
+  bool active;           // true = raised, false = cleared
+  float value;           // Sample that completed the transition
+  unsigned long atMs;
+  uint32_t seq;
+};
+
+inline const char* alertSeverityName(uint8_t severity) {
+  switch (severity) {
+    case ALERT_INFO: return "info";
+    case ALERT_WARNING: return "warning";
+    default: return "critical";
+  }
+}
+
+inline bool copyAlertName(const char* src, char* dst, String& error, const char* what) {
+  size_t len = src ? strlen(src) : 0;
+  if (len == 0 || len > ALERT_MAX_NAME) {
+    error = String("Invalid alert ") + what;
+    return false;
+  }
+  memcpy(dst, src, len + 1);
+  return true;
+}
+
+// Build a rule set from the command's "rules" array
+inline bool parseAlertSet(JsonArrayConst rules, AlertSet& set, String& error) {
+  memset(&set, 0, sizeof(set));
+  set.version = ALERT_FORMAT_VERSION;
+
+  if (rules.isNull()) {
+    error = "Missing rules";
+    return false;
+  }
+  if (rules.size() > ALERT_MAX_RULES) {
+    error = "Too many rules (max " + String(ALERT_MAX_RULES) + ")";
+    return false;
+  }
+
+  for (JsonObjectConst r : rules) {
+    AlertRule& rule = set.rules[set.count];
+    if (!copyAlertName(r["id"] | "", rule.id, error, "id")) return false;
+    if (!copyAlertName(r["channel"] | "", rule.channel, error, "channel")) return false;
+    for (uint8_t i = 0; i < set.count; i++) {
+      if (strcmp(set.rules[i].id, rule.id) == 0) {
+        error = "Duplicate alert id: " + String(rule.id);
+        return false;
+      }
+    }
+
+    const char* direction = r["op"] | "above";
+    if (strcmp(direction, "above") == 0) rule.direction = ALERT_ABOVE;
+    else if (strcmp(direction, "below") == 0) rule.direction = ALERT_BELOW;
+    else { error = "Alert op must be above or below"; return false; }
+
+    const char* severity = r["severity"] | "warning";
+    if (strcmp(severity, "info") == 0) rule.severity = ALERT_INFO;
+    else if (strcmp(severity, "warning") == 0) rule.severity = ALERT_WARNING;
+    else if (strcmp(severity, "critical") == 0) rule.severity = ALERT_CRITICAL;
+    else { error = "Unknown severity: " + String(severity); return false; }
+
+    if (!r["threshold"].is<float>()) { error = "Alert " + String(rule.id) + " needs a threshold"; return false; }
+    rule.threshold = r["threshold"].as<float>();
+    rule.hysteresis = r["hysteresis"] | 0.0f;
+    long minDurationMs = r["for_ms"] | 0L;
+    if (isnan(rule.threshold) || isnan(rule.hysteresis) || rule.hysteresis < 0) {
+      error = "Invalid threshold or hysteresis";
+      return false;
+    }
+    if (minDurationMs < 0 || (unsigned long)minDurationMs > ALERT_MAX_DURATION_MS) {
+      error = "Invalid for_ms";
+      return false;
+    }
+    rule.minDurationMs = (uint32_t)minDurationMs;
+    set.count++;
+  }
+  return true;
+}
+
+class AlertStore {
+public:
+  bool save(const AlertSet& set) {
+    Preferences prefs;
+    if (!prefs.begin("alerts", false)) return false;
+    size_t size = offsetof(AlertSet, rules) + set.count * sizeof(AlertRule);
+    bool ok = prefs.putBytes("rules", &set, size) == size;
+    prefs.end();
+    return ok;
+  }
+
+  bool load(AlertSet& set) {
+    Preferences prefs;
+    if (!prefs.begin("alerts", true)) return false;
+    size_t size = prefs.getBytesLength("rules");
+    bool ok = size >= offsetof(AlertSet, rules) && size <= sizeof(AlertSet) &&
+              prefs.getBytes("rules", &set, size) == size;
+    prefs.end();
+    return ok && set.version == ALERT_FORMAT_VERSION && set.count <= ALERT_MAX_RULES &&
+           size == offsetof(AlertSet, rules) + set.count * sizeof(AlertRule);
+  }
+
+  bool remove() {
+    Preferences prefs;
+    if (!prefs.begin("alerts", false)) return false;
+    bool ok = prefs.remove("rules");
+    prefs.end();
+    return ok;
+  }
+};
+
+class AlertEngine {
+public:
+  // Start evaluating a rule set; every rule starts CLEAR
+  void begin(const AlertSet& set) {
+    set_ = set;
+    memset(states_, 0, sizeof(states_));
+    queueHead_ = queueCount_ = 0;
+  }
+
+  void clear() {
+    set_.count = 0;
+    queueHead_ = queueCount_ = 0;
+  }
+
+  uint8_t ruleCount() const { return set_.count; }
+  const AlertRule& rule(uint8_t index) const { return set_.rules[index]; }
+
+  // Feed one reading; NaN (no valid reading) leaves the rules untouched
+  void sample(const char* channel, float value, unsigned long now) {
+    if (isnan(value)) return;
+    for (uint8_t i = 0; i < set_.count; i++) {
+      if (strcmp(set_.rules[i].channel, channel) == 0) step(i, value, now);
+    }
+  }
+
+  // Complete transitions whose minimum duration elapsed since the last sample
+  void update(unsigned long now) {
+    for (uint8_t i = 0; i < set_.count; i++) {
+      RuleState& state = states_[i];
+      if ((state.phase == PHASE_PENDING || state.phase == PHASE_CLEARING) &&
+          now - state.since >= set_.rules[i].minDurationMs) {
+        settle(i, now);
+      }
+    }
+  }
+
+  // Time until update() has a pending transition to complete (UINT32_MAX if none)
+  uint32_t msUntilNextDeadline(unsigned long now) const {
+    uint32_t next = UINT32_MAX;
+    for (uint8_t i = 0; i < set_.count; i++) {
+      const RuleState& state = states_[i];
+      if (state.phase != PHASE_PENDING && state.phase != PHASE_CLEARING) continue;
+      unsigned long elapsed = now - state.since;
+      uint32_t duration = set_.rules[i].minDurationMs;
+      uint32_t remaining = elapsed >= duration ? 0 : (uint32_t)(duration - elapsed);
+      if (remaining < next) next = remaining;
+    }
+    return next;
+  }
+
+  bool takeTransition(AlertTransition& out) {
+    if (queueCount_ == 0) return false;
+    out = queue_[queueHead_];
+    queueHead_ = (queueHead_ + 1) % ALERT_QUEUE;
+    queueCount_--;
+    return true;
+  }
+
+  // Put back a transition that could not be published
+  void requeue(const AlertTransition& transition) {
+    if (queueCount_ == ALERT_QUEUE) return;
+    queueHead_ = (queueHead_ + ALERT_QUEUE - 1) % ALERT_QUEUE;
+    queue_[queueHead_] = transition;
+    queueCount_++;
+  }
+
+  // Ids of the rules currently raised, for the state snapshot
+  void reportActive(JsonArray out) const {
+    for (uint8_t i = 0; i < set_.count; i++) {
+      if (raised(i)) out.add(set_.rules[i].id);
+    }
+  }
+
+  void report(JsonObject out) const {
+    out["rules"] = set_.count;
+    out["transitions"] = seq_;
+    out["dropped"] = dropped_;
+    JsonArray active = out.createNestedArray("active");
+    reportActive(active);
+  }
+
+private:
+  enum Phase : uint8_t {
+    PHASE_CLEAR = 0,
+    PHASE_PENDING = 1,   // Tripped, waiting out minDurationMs
+    PHASE_ACTIVE = 2,
+    PHASE_CLEARING = 3   // Back past the hysteresis band, waiting out minDurationMs
+  };
+
+  struct RuleState {
+    uint8_t phase;
+    unsigned long since;
+    float lastValue;
+  };
+
+  bool raised(uint8_t index) const {
+    return states_[index].phase == PHASE_ACTIVE || states_[index].phase == PHASE_CLEARING;
+  }
+
+  void step(uint8_t index, float value, unsigned long now) {
+    const AlertRule& rule = set_.rules[index];
+    RuleState& state = states_[index];
+    bool above = rule.direction == ALERT_ABOVE;
+    bool tripped = above ? value > rule.threshold : value < rule.threshold;
+    bool cleared = above ? value < rule.threshold - rule.hysteresis
+                         : value > rule.threshold + rule.hysteresis;
+    state.lastValue = value;
+
+    switch (state.phase) {
+      case PHASE_CLEAR:
+        if (!tripped) return;
+        state.phase = PHASE_PENDING;
+        state.since = now;
+        break;
+      case PHASE_PENDING:
+        if (!tripped) { state.phase = PHASE_CLEAR; return; }
+        break;
+      case PHASE_ACTIVE:
+        if (!cleared) return;
+        state.phase = PHASE_CLEARING;
+        state.since = now;
+        break;
+      case PHASE_CLEARING:
+        if (!cleared) { state.phase = PHASE_ACTIVE; return; }
+        break;
+    }
+    if (now - state.since >= rule.minDurationMs) settle(index, now);
+  }
+
+  // PENDING -> ACTIVE or CLEARING -> CLEAR, queueing the edge
+  void settle(uint8_t index, unsigned long now) {
+    RuleState& state = states_[index];
+    bool active = state.phase == PHASE_PENDING;
+    state.phase = active ? PHASE_ACTIVE : PHASE_CLEAR;
+
+    if (queueCount_ == ALERT_QUEUE) {
+      // Oldest edge is lost; the state snapshot still lists raised alerts
+      queueHead_ = (queueHead_ + 1) % ALERT_QUEUE;
+      queueCount_--;
+      dropped_++;
+    }
+    AlertTransition& transition = queue_[(queueHead_ + queueCount_) % ALERT_QUEUE];
+    transition.rule = index;
+    transition.active = active;
+    transition.value = state.lastValue;
+    transition.atMs = now;
+    transition.seq = ++seq_;
+    queueCount_++;
+  }
+
+  AlertSet set_ = {};
+  RuleState states_[ALERT_MAX_RULES] = {};
+  AlertTransition queue_[ALERT_QUEUE];
+  uint8_t queueHead_ = 0;
+  uint8_t queueCount_ = 0;
+  uint32_t seq_ = 0;
+  uint32_t dropped_ = 0;
+};
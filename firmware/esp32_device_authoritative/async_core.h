@@ -0,0 +1,446 @@
+/*
+ * Coroutine runtime for the loop task
+ *
+ * Lets blocking flows (WiFi/broker reconnect, DNS, TCP probes) be written as
+ * straight-line C++20 coroutines that co_await instead of calling delay().
+ * All coroutines run on the task that calls AsyncScheduler::run() - normally
+ * loop() - so they share its stack and need no locking against the rest of
+ * the sketch. A suspended flow costs only its coroutine frame (typically a
+ * few hundred bytes, see frameStats()) instead of a task stack.
+ *
+ * Awaitables:
+ *   co_await scheduler.sleep(ms)                   - timer
+ *   co_await scheduler.sleepUntil(deadlineMs)      - drift-free periodic timer
+ *   co_await scheduler.readable(fd, timeoutMs)     - socket I/O, false on timeout
+ *   co_await scheduler.writable(fd, timeoutMs)
+ *   co_await scheduler.until(flag, timeoutMs)      - flag set by a callback/ISR/task
+ *   co_await scheduler.connect(ip, port, timeoutMs) - non-blocking TCP connect, fd or -1
+ *   co_await scheduler.resolve(host, ip, timeoutMs) - lwIP DNS without blocking
+ *   co_await otherFlow()                           - Async<T> sub-flows
+ *
+ * run() never blocks: it polls sockets with a zero-timeout select() and
+ * resumes whatever is due. Waiter and task tables are fixed size; an await
+ * that finds the waiter table full completes immediately as a timeout.
+ *
+ * Needs C++20 coroutines: Arduino-ESP32 3.x (GCC 12+, -std=gnu++2b) or
+ * -std=gnu++20 on older toolchains that support it. Sketches include this
+ * only when built with -DASYNC_CORE.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#if !defined(__cpp_impl_coroutine)
+#error "async_core.h needs C++20 coroutines (Arduino-ESP32 3.x, or build with -std=gnu++20)"
+#endif
+
+#include <coroutine>
+#include <utility>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#if defined(ESP_PLATFORM)
+#include <esp_netif.h>
+#include <lwip/dns.h>
+#else
+#include <netdb.h>
+#endif
+
+#define ASYNC_MAX_TASKS 8
+#define ASYNC_MAX_WAITERS 16
+#define ASYNC_MAX_DNS_QUERIES 2
+#define ASYNC_IO_POLL_MS 10             // Loop wakeup while a socket or flag wait is pending
+
+struct AsyncFrameStats {
+  uint32_t frames;      // Live coroutine frames
+  uint32_t liveBytes;
+  uint32_t peakBytes;
+  uint32_t allocFailures;
+};
+
+template <typename T> class Async;
+
+// Frame allocation, final-suspend hand-off to the awaiting coroutine
+struct AsyncPromiseBase {
+  std::coroutine_handle<> continuation;
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+      std::coroutine_handle<> next = handle.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() { abort(); }
+
+  // Frames come from the heap; a failed allocation yields an empty Async
+  // (see get_return_object_on_allocation_failure) rather than a crash
+  static void* operator new(size_t size) noexcept {
+    void* frame = malloc(size);
+    if (frame == NULL) {
+      stats.allocFailures++;
+      return NULL;
+    }
+    stats.frames++;
+    stats.liveBytes += size;
+    if (stats.liveBytes > stats.peakBytes) stats.peakBytes = stats.liveBytes;
+    return frame;
+  }
+  static void operator delete(void* frame, size_t size) noexcept {
+    stats.frames--;
+    stats.liveBytes -= size;
+    free(frame);
+  }
+
+  static inline AsyncFrameStats stats = {0, 0, 0, 0};
+};
+
+template <typename T>
+struct AsyncPromise : AsyncPromiseBase {
+  T value{};
+
+  Async<T> get_return_object() noexcept;
+  static Async<T> get_return_object_on_allocation_failure() noexcept;
+  void return_value(T result) { value = std::move(result); }
+  T take() { return std::move(value); }
+};
+
+template <>
+struct AsyncPromise<void> : AsyncPromiseBase {
+  Async<void> get_return_object() noexcept;
+  static Async<void> get_return_object_on_allocation_failure() noexcept;
+  void return_void() {}
+  void take() {}
+};
+
+// Lazily started coroutine. co_await it from another coroutine, or hand an
+// Async<void> to AsyncScheduler::spawn() to run it as a top-level flow.
+// An empty Async (frame allocation failed) completes at once with T().
+template <typename T = void>
+class Async {
+public:
+  using promise_type = AsyncPromise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  explicit Async(Handle handle) : handle_(handle) {}
+  Async(Async&& other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+  Async(const Async&) = delete;
+  Async& operator=(const Async&) = delete;
+  ~Async() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return !handle_; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+    handle_.promise().continuation = caller;
+    return handle_;
+  }
+  T await_resume() { return handle_ ? handle_.promise().take() : T(); }
+
+  Handle release() {
+    Handle handle = handle_;
+    handle_ = nullptr;
+    return handle;
+  }
+
+private:
+  Handle handle_;
+};
+
+template <typename T>
+Async<T> AsyncPromise<T>::get_return_object() noexcept {
+  return Async<T>(Async<T>::Handle::from_promise(*this));
+}
+template <typename T>
+Async<T> AsyncPromise<T>::get_return_object_on_allocation_failure() noexcept {
+  return Async<T>(nullptr);
+}
+inline Async<void> AsyncPromise<void>::get_return_object() noexcept {
+  return Async<void>(Async<void>::Handle::from_promise(*this));
+}
+inline Async<void> AsyncPromise<void>::get_return_object_on_allocation_failure() noexcept {
+  return Async<void>(nullptr);
+}
+
+class AsyncScheduler {
+public:
+  enum WaitKind : uint8_t { WAIT_TIMER, WAIT_READABLE, WAIT_WRITABLE, WAIT_FLAG };
+
+  // Awaiter for every primitive wait; resumes with true when the condition
+  // was met, false on timeout (timers always resume with true)
+  class Wait {
+  public:
+    Wait(AsyncScheduler& scheduler, WaitKind kind, int fd, const volatile bool* flag, uint32_t timeoutMs)
+      : scheduler_(scheduler), kind_(kind), fd_(fd), flag_(flag), timeoutMs_(timeoutMs) {}
+
+    bool await_ready() const noexcept {
+      return (kind_ == WAIT_FLAG && *flag_) || (kind_ == WAIT_TIMER && timeoutMs_ == 0);
+    }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+      // Table full: don't suspend, report a timeout
+      return scheduler_.addWaiter(handle, kind_, fd_, flag_, timeoutMs_, &result_);
+    }
+    bool await_resume() const noexcept {
+      return await_ready() || result_;
+    }
+
+  private:
+    AsyncScheduler& scheduler_;
+    WaitKind kind_;
+    int fd_;
+    const volatile bool* flag_;
+    uint32_t timeoutMs_;
+    bool result_ = false;
+  };
+
+  Wait sleep(uint32_t ms) { return Wait(*this, WAIT_TIMER, -1, NULL, ms); }
+  Wait sleepUntil(uint32_t deadlineMs) {
+    int32_t remaining = (int32_t)(deadlineMs - millis());
+    return sleep(remaining > 0 ? (uint32_t)remaining : 0);
+  }
+  Wait readable(int fd, uint32_t timeoutMs) { return Wait(*this, WAIT_READABLE, fd, NULL, timeoutMs); }
+  Wait writable(int fd, uint32_t timeoutMs) { return Wait(*this, WAIT_WRITABLE, fd, NULL, timeoutMs); }
+  Wait until(const volatile bool& flag, uint32_t timeoutMs) { return Wait(*this, WAIT_FLAG, -1, &flag, timeoutMs); }
+
+  // Start a top-level flow; it first runs on the next run(). The scheduler
+  // owns the frame and frees it when the flow returns.
+  bool spawn(Async<void>&& flow) {
+    Async<void>::Handle handle = flow.release();
+    if (!handle) return false;
+    for (uint8_t i = 0; i < ASYNC_MAX_TASKS; i++) {
+      if (tasks_[i]) continue;
+      if (!addWaiter(handle, WAIT_TIMER, -1, NULL, 0, &spawnResult_)) break;
+      tasks_[i] = handle;
+      return true;
+    }
+    handle.destroy();
+    return false;
+  }
+
+  // Resume everything that is due. Call from loop(); never blocks.
+  void run() {
+    uint32_t now = millis();
+    pass_++;
+
+    fd_set readSet, writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    int maxFd = -1;
+    for (uint8_t i = 0; i < ASYNC_MAX_WAITERS; i++) {
+      Waiter& waiter = waiters_[i];
+      if (!waiter.handle || waiter.fd < 0) continue;
+      FD_SET(waiter.fd, waiter.kind == WAIT_READABLE ? &readSet : &writeSet);
+      if (waiter.fd > maxFd) maxFd = waiter.fd;
+    }
+    if (maxFd >= 0) {
+      struct timeval poll = {0, 0};
+      if (select(maxFd + 1, &readSet, &writeSet, NULL, &poll) < 0) {
+        FD_ZERO(&readSet);
+        FD_ZERO(&writeSet);
+      }
+    }
+
+    for (uint8_t i = 0; i < ASYNC_MAX_WAITERS; i++) {
+      Waiter& waiter = waiters_[i];
+      // Waiters added by a coroutine resumed in this pass wait for the next
+      if (!waiter.handle || waiter.pass == pass_) continue;
+
+      bool met = false;
+      switch (waiter.kind) {
+        case WAIT_TIMER:    met = false; break;
+        case WAIT_READABLE: met = FD_ISSET(waiter.fd, &readSet); break;
+        case WAIT_WRITABLE: met = FD_ISSET(waiter.fd, &writeSet); break;
+        case WAIT_FLAG:     met = *waiter.flag; break;
+      }
+      bool expired = now - waiter.startMs >= waiter.timeoutMs;
+      if (!met && !expired) continue;
+
+      std::coroutine_handle<> handle = waiter.handle;
+      *waiter.result = met || waiter.kind == WAIT_TIMER;
+      waiter.handle = nullptr;
+      handle.resume();
+    }
+
+    for (uint8_t i = 0; i < ASYNC_MAX_TASKS; i++) {
+      if (tasks_[i] && tasks_[i].done()) {
+        tasks_[i].destroy();
+        tasks_[i] = nullptr;
+      }
+    }
+  }
+
+  // Milliseconds until run() has something to do (0 if something is due,
+  // UINT32_MAX if nothing is waiting). Socket and flag waits are only
+  // noticed by run() polling them, and the loop does not select() on those
+  // fds, so while one is pending this is at most ASYNC_IO_POLL_MS.
+  uint32_t msUntilNextWake() const {
+    uint32_t now = millis();
+    uint32_t next = UINT32_MAX;
+    for (uint8_t i = 0; i < ASYNC_MAX_WAITERS; i++) {
+      const Waiter& waiter = waiters_[i];
+      if (!waiter.handle) continue;
+      uint32_t elapsed = now - waiter.startMs;
+      uint32_t remaining = elapsed >= waiter.timeoutMs ? 0 : waiter.timeoutMs - elapsed;
+      if (waiter.kind != WAIT_TIMER && remaining > ASYNC_IO_POLL_MS) remaining = ASYNC_IO_POLL_MS;
+      if (remaining < next) next = remaining;
+    }
+    return next;
+  }
+
+  uint8_t taskCount() const {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < ASYNC_MAX_TASKS; i++) {
+      if (tasks_[i]) count++;
+    }
+    return count;
+  }
+
+  static const AsyncFrameStats& frameStats() { return AsyncPromiseBase::stats; }
+
+  // Non-blocking TCP connect. Returns the connected socket (caller closes it)
+  // or -1 on failure/timeout.
+  Async<int> connect(IPAddress ip, uint16_t port, uint32_t timeoutMs) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) co_return -1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = (uint32_t)ip;
+    if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      bool ok = errno == EINPROGRESS && co_await writable(fd, timeoutMs);
+      int error = 0;
+      socklen_t len = sizeof(error);
+      if (!ok || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+        close(fd);
+        co_return -1;
+      }
+    }
+    co_return fd;
+  }
+
+  // Resolve an IPv4 address. Answers from the lwIP cache complete at once;
+  // a query in flight suspends the caller instead of the loop.
+  Async<bool> resolve(const char* host, IPAddress& result, uint32_t timeoutMs) {
+    if (result.fromString(host)) co_return true;
+#if defined(ESP_PLATFORM)
+    // The lwIP callback can arrive after we gave up, so queries live in a
+    // static table and a slot is reused only once its callback has fired
+    DnsQuery* query = NULL;
+    for (uint8_t i = 0; i < ASYNC_MAX_DNS_QUERIES && query == NULL; i++) {
+      if (!dnsQueries_[i].busy) query = &dnsQueries_[i];
+    }
+    if (query == NULL) co_return false;
+    query->busy = true;
+    query->done = false;
+    query->abandoned = false;
+    query->found = false;
+    query->host = host;
+
+    err_t err = (err_t)esp_netif_tcpip_exec(startDnsQuery, query);
+    if (err == ERR_OK) {
+      query->found = true;
+      query->busy = false;
+    } else if (err != ERR_INPROGRESS) {
+      query->busy = false;
+      co_return false;
+    } else if (!co_await until(query->done, timeoutMs)) {
+      // Whichever of us comes second releases the slot
+      query->abandoned = true;
+      if (query->done) query->busy = false;
+      co_return false;
+    }
+    bool found = query->found;
+    if (found) result = IPAddress(ip4_addr_get_u32(ip_2_ip4(&query->address)));
+    query->busy = false;
+    co_return found;
+#else
+    // Host builds resolve synchronously
+    (void)timeoutMs;
+    struct addrinfo hints;
+    struct addrinfo* info = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(host, NULL, &hints, &info) != 0 || info == NULL) co_return false;
+    result = IPAddress((uint32_t)((struct sockaddr_in*)info->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(info);
+    co_return true;
+#endif
+  }
+
+private:
+  struct Waiter {
+    std::coroutine_handle<> handle;
+    WaitKind kind;
+    int fd;
+    const volatile bool* flag;
+    uint32_t startMs;
+    uint32_t timeoutMs;
+    uint32_t pass;
+    bool* result;
+  };
+
+  bool addWaiter(std::coroutine_handle<> handle, WaitKind kind, int fd, const volatile bool* flag,
+                 uint32_t timeoutMs, bool* result) {
+    for (uint8_t i = 0; i < ASYNC_MAX_WAITERS; i++) {
+      Waiter& waiter = waiters_[i];
+      if (waiter.handle) continue;
+      waiter.handle = handle;
+      waiter.kind = kind;
+      waiter.fd = fd;
+      waiter.flag = flag;
+      waiter.startMs = millis();
+      waiter.timeoutMs = timeoutMs;
+      waiter.pass = pass_;
+      waiter.result = result;
+      return true;
+    }
+    *result = false;
+    return false;
+  }
+
+#if defined(ESP_PLATFORM)
+  struct DnsQuery {
+    volatile bool busy;
+    volatile bool done;
+    volatile bool abandoned;  // Caller timed out, the callback frees the slot
+    bool found;
+    const char* host;
+    ip_addr_t address;
+  };
+
+  // Runs in the lwIP thread; esp_netif_tcpip_exec() hands the err_t back as is
+  static esp_err_t startDnsQuery(void* context) {
+    DnsQuery* query = (DnsQuery*)context;
+    return (esp_err_t)dns_gethostbyname(query->host, &query->address, dnsFound, query);
+  }
+
+  static void dnsFound(const char* name, const ip_addr_t* address, void* context) {
+    DnsQuery* query = (DnsQuery*)context;
+    query->found = address != NULL && IP_IS_V4(address);
+    if (query->found) query->address = *address;
+    query->done = true;
+    if (query->abandoned) query->busy = false;
+  }
+
+  DnsQuery dnsQueries_[ASYNC_MAX_DNS_QUERIES] = {};
+#endif
+
+  Waiter waiters_[ASYNC_MAX_WAITERS] = {};
+  std::coroutine_handle<> tasks_[ASYNC_MAX_TASKS] = {};
+  uint32_t pass_ = 0;
+  bool spawnResult_ = false;
+};
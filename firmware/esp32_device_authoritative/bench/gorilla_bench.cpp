@@ -0,0 +1,215 @@
+/*
+ * Host benchmark for the Gorilla telemetry codec (gorilla.h)
+ *
+ * Reports compression ratio against the JSON arrays we publish today and
+ * against raw binary, plus encode/decode cost per sample, and checks every
+ * batch round-trips bit-exactly.
+ *
+ * Build and run (from firmware/esp32_device_authoritative):
+ *   g++ -O2 -std=c++11 -I. bench/gorilla_bench.cpp -o gorilla_bench
+ *   ./gorilla_bench                   # built-in sensor-like traces
+ *   ./gorilla_bench trace.csv [...]   # recorded traces
+ *
+ * A trace CSV has one sample per line: timestamp_ms,value[,value...]
+ * (a header line, if present, is skipped). Record one from a device by
+ * logging the history topic or the state topic.
+ *
+ * Output is one JSON object per trace and batch size on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "gorilla.h"
+
+struct Trace {
+  std::string name;
+  std::vector<uint32_t> timestamps;
+  std::vector<std::vector<float> > columns;
+};
+
+static double nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Deterministic noise so runs are comparable
+static uint32_t rngState = 12345;
+static double noise() {
+  rngState = rngState * 1664525u + 1013904223u;
+  return (rngState >> 8) / 16777216.0 - 0.5;
+}
+
+static float quantize(double value, double step) {
+  return (float)(round(value / step) * step);
+}
+
+// One hour at ~1s with a few ms of scheduling jitter, shaped like our sensors
+static Trace sensorTrace() {
+  Trace trace;
+  trace.name = "sensors-1s";
+  trace.columns.resize(4);
+  uint32_t t = 120000;
+  for (int i = 0; i < 3600; i++) {
+    t += 1000 + (int)(noise() * 8);
+    trace.timestamps.push_back(t);
+    double hours = i / 3600.0;
+    trace.columns[0].push_back(quantize(24.0 + 2.0 * sin(hours * 3.1) + noise() * 0.3, 0.1));  // tempC
+    trace.columns[1].push_back(quantize(58.0 + 4.0 * cos(hours * 2.0) + noise() * 1.5, 1.0));  // humidity
+    trace.columns[2].push_back(quantize(70.0 - 20.0 * hours + noise() * 0.8, 1.0));            // waterLevel
+    trace.columns[3].push_back(quantize(96.0 - 3.0 * hours, 1.0));                             // battery
+  }
+  return trace;
+}
+
+// What the firmware simulates today: uniform random readings, worst case
+static Trace randomTrace() {
+  Trace trace;
+  trace.name = "random-1s";
+  trace.columns.resize(4);
+  uint32_t t = 0;
+  for (int i = 0; i < 3600; i++) {
+    t += 1000;
+    trace.timestamps.push_back(t);
+    trace.columns[0].push_back((float)(25.3 + ((rngState = rngState * 1664525u + 1013904223u) >> 8) % 100 / 10.0));
+    trace.columns[1].push_back((float)(60 + (noise() + 0.5) * 20));
+    trace.columns[2].push_back((float)(int)((noise() + 0.5) * 100));
+    trace.columns[3].push_back((float)(80 + (int)((noise() + 0.5) * 20)));
+  }
+  return trace;
+}
+
+static bool loadTrace(const char* path, Trace& trace) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) return false;
+  trace.name = path;
+  char line[1024];
+  while (fgets(line, sizeof(line), f)) {
+    char* p = line;
+    char* end;
+    double t = strtod(p, &end);
+    if (end == p) continue;  // Header or blank line
+    trace.timestamps.push_back((uint32_t)t);
+    size_t c = 0;
+    for (p = end; *p == ','; p = end, c++) {
+      double v = strtod(p + 1, &end);
+      if (c >= trace.columns.size()) trace.columns.resize(c + 1);
+      trace.columns[c].resize(trace.timestamps.size() - 1, NAN);
+      trace.columns[c].push_back((float)v);
+    }
+  }
+  fclose(f);
+  for (size_t c = 0; c < trace.columns.size(); c++) {
+    trace.columns[c].resize(trace.timestamps.size(), NAN);
+  }
+  return !trace.timestamps.empty() && trace.columns.size() <= GORILLA_MAX_COLUMNS;
+}
+
+// Size of the same batch as JSON arrays, as ArduinoJson would print it
+static size_t jsonBytes(const Trace& trace, size_t begin, size_t count) {
+  std::string json = "{\"t\":[";
+  char number[32];
+  for (size_t i = 0; i < count; i++) {
+    snprintf(number, sizeof(number), i ? ",%u" : "%u", trace.timestamps[begin + i]);
+    json += number;
+  }
+  json += "]";
+  for (size_t c = 0; c < trace.columns.size(); c++) {
+    snprintf(number, sizeof(number), ",\"c%u\":[", (unsigned)c);
+    json += number;
+    for (size_t i = 0; i < count; i++) {
+      snprintf(number, sizeof(number), i ? ",%.7g" : "%.7g", trace.columns[c][begin + i]);
+      json += number;
+    }
+    json += "]";
+  }
+  json += "}";
+  return json.size();
+}
+
+static bool runBatches(const Trace& trace, size_t batch) {
+  size_t columnCount = trace.columns.size();
+  size_t total = trace.timestamps.size();
+  std::vector<uint8_t> encoded(GORILLA_MAX_BYTES(batch, columnCount));
+  std::vector<uint32_t> decodedTimes(batch);
+  std::vector<std::vector<float> > decoded(columnCount, std::vector<float>(batch));
+  std::vector<float*> decodedColumns(columnCount);
+  std::vector<const float*> columns(columnCount);
+  for (size_t c = 0; c < columnCount; c++) decodedColumns[c] = &decoded[c][0];
+
+  size_t gorilla = 0, json = 0, raw = 0, samples = 0;
+  double encodeNs = 0, decodeNs = 0;
+  bool exact = true;
+
+  for (size_t begin = 0; begin + batch <= total; begin += batch) {
+    for (size_t c = 0; c < columnCount; c++) columns[c] = &trace.columns[c][begin];
+
+    double start = nowNs();
+    size_t bytes = gorillaEncodeBatch(&trace.timestamps[begin], &columns[0], columnCount, batch,
+                                      &encoded[0], encoded.size());
+    encodeNs += nowNs() - start;
+    if (bytes == 0) return false;
+
+    start = nowNs();
+    bool ok = gorillaDecodeBatch(&encoded[0], bytes, &decodedTimes[0], &decodedColumns[0]);
+    decodeNs += nowNs() - start;
+
+    ok = ok && memcmp(&decodedTimes[0], &trace.timestamps[begin], batch * sizeof(uint32_t)) == 0;
+    for (size_t c = 0; ok && c < columnCount; c++) {
+      ok = memcmp(&decoded[c][0], columns[c], batch * sizeof(float)) == 0;
+    }
+    exact = exact && ok;
+
+    gorilla += bytes;
+    json += jsonBytes(trace, begin, batch);
+    raw += batch * (sizeof(uint32_t) + columnCount * sizeof(float));
+    samples += batch;
+  }
+  if (samples == 0) return true;
+
+  printf("{\"trace\":\"%s\",\"columns\":%u,\"batch\":%u,\"samples\":%u,"
+         "\"json_bytes\":%u,\"raw_bytes\":%u,\"gorilla_bytes\":%u,"
+         "\"bits_per_value\":%.2f,\"ratio_vs_json\":%.2f,\"ratio_vs_raw\":%.2f,"
+         "\"encode_ns_per_sample\":%.1f,\"decode_ns_per_sample\":%.1f,\"roundtrip\":%s}\n",
+         trace.name.c_str(), (unsigned)columnCount, (unsigned)batch, (unsigned)samples,
+         (unsigned)json, (unsigned)raw, (unsigned)gorilla,
+         gorilla * 8.0 / (samples * (columnCount + 1)), (double)json / gorilla, (double)raw / gorilla,
+         encodeNs / samples, decodeNs / samples, exact ? "true" : "false");
+  return exact;
+}
+
+int main(int argc, char** argv) {
+  std::vector<Trace> traces;
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      Trace trace;
+      if (!loadTrace(argv[i], trace)) {
+        fprintf(stderr, "Cannot read trace %s\n", argv[i]);
+        return 2;
+      }
+      traces.push_back(trace);
+    }
+  } else {
+    traces.push_back(sensorTrace());
+    traces.push_back(randomTrace());
+  }
+
+  const size_t batches[] = {10, 60, 300};
+  bool ok = true;
+  for (size_t t = 0; t < traces.size(); t++) {
+    size_t size = traces[t].timestamps.size();
+    for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+      // Short traces run as one batch
+      size_t batch = batches[b] < size ? batches[b] : size;
+      ok = runBatches(traces[t], batch) && ok;
+      if (batch == size) break;
+    }
+  }
+  if (!ok) fprintf(stderr, "Round-trip mismatch\n");
+  return ok ? 0 : 1;
+}
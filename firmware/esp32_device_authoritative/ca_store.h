@@ -0,0 +1,169 @@
+/*
+ * Shared CA store with optional public-key pinning
+ *
+ * WiFiClientSecure::setCACert() keeps the PEM string and ssl_client parses
+ * it again (base64 decode, then X.509) on every connect. esp_https_ota does
+ * the same with cert_pem on every download. CaStore parses the trust
+ * anchors once at boot into a single mbedtls_x509_crt chain, and every TLS
+ * configuration points at it:
+ *
+ *   - MbedTlsClient::setTrust() for the MQTT connection (tls_profile.h)
+ *   - attach() from esp_http_client's crt_bundle_attach hook for OTA
+ *
+ * The anchors are DER arrays in flash (ca_certs.h), parsed without copying,
+ * so the store's heap is the parsed structures only.
+ *
+ * SpkiPins narrows one connection further. The verified chain must contain
+ * a certificate whose public key is listed, as the base64 SHA-256 of its
+ * SubjectPublicKeyInfo ("pin-sha256"):
+ *
+ *   openssl x509 -in cert.pem -pubkey -noout | openssl pkey -pubin -outform der |
+ *     openssl dgst -sha256 -binary | base64
+ *
+ * Pin an intermediate or a backup key next to the leaf, so a certificate
+ * renewal does not lock the device out. Pins are checked while mbedTLS
+ * walks the verified chain, so a pinned certificate the server merely
+ * appends to its chain does not count.
+ *
+ * The chain must outlive every configuration that uses it. Do not enable
+ * CONFIG_MBEDTLS_DYNAMIC_FREE_CA_CERT, which frees a configuration's CA
+ * chain after the handshake. Handshakes using the same SpkiPins must not
+ * overlap (here they all run on the loop task).
+ *
+ * Host builds have no TLS stack; the store only counts certificates.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#if defined(ESP_PLATFORM)
+#include <mbedtls/version.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/base64.h>
+#endif
+
+#define SPKI_PINS_MAX 4
+
+struct CaCert {
+  const char* name;
+  const uint8_t* der;
+  size_t length;
+};
+
+class SpkiPins {
+public:
+  // Base64 SHA-256 of a SubjectPublicKeyInfo; false if malformed or full
+  bool add(const char* base64) {
+    if (base64 == NULL || base64[0] == '\0' || count_ >= SPKI_PINS_MAX) return false;
+#if defined(ESP_PLATFORM)
+    size_t length = 0;
+    int ret = mbedtls_base64_decode(pins_[count_], sizeof(pins_[count_]), &length,
+                                    (const unsigned char*)base64, strlen(base64));
+    if (ret != 0 || length != sizeof(pins_[count_])) return false;
+#endif
+    count_++;
+    return true;
+  }
+
+  uint8_t count() const { return count_; }
+  uint32_t rejected() const { return rejected_; }
+
+#if defined(ESP_PLATFORM)
+  // mbedTLS verify callback: called for each certificate of the verified
+  // chain, root first, leaf (depth 0) last
+  static int verify(void* context, mbedtls_x509_crt* crt, int depth, uint32_t* flags) {
+    SpkiPins* pins = (SpkiPins*)context;
+    if (pins->matches(crt)) pins->matched_ = true;
+    if (depth == 0) {
+      if (!pins->matched_) {
+        *flags |= MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+        pins->rejected_++;
+      }
+      pins->matched_ = false;
+    }
+    return 0;
+  }
+#endif
+
+private:
+#if defined(ESP_PLATFORM)
+  bool matches(const mbedtls_x509_crt* crt) const {
+    uint8_t hash[32];
+#if MBEDTLS_VERSION_MAJOR >= 3
+    const mbedtls_x509_buf& spki = crt->MBEDTLS_PRIVATE(pk_raw);
+    if (mbedtls_sha256(spki.p, spki.len, hash, 0) != 0) return false;
+#else
+    const mbedtls_x509_buf& spki = crt->pk_raw;
+    if (mbedtls_sha256_ret(spki.p, spki.len, hash, 0) != 0) return false;
+#endif
+    for (uint8_t i = 0; i < count_; i++) {
+      if (memcmp(hash, pins_[i], sizeof(hash)) == 0) return true;
+    }
+    return false;
+  }
+
+  uint8_t pins_[SPKI_PINS_MAX][32];
+  bool matched_ = false;
+#endif
+  uint8_t count_ = 0;
+  uint32_t rejected_ = 0;
+};
+
+class CaStore {
+public:
+#if defined(ESP_PLATFORM)
+  CaStore() { mbedtls_x509_crt_init(&chain_); }
+  ~CaStore() { mbedtls_x509_crt_free(&chain_); }
+#endif
+
+  // Parse every certificate once; ones that fail are logged and skipped.
+  // Returns the number of usable anchors.
+  uint8_t begin(const CaCert* certs, size_t count) {
+    unsigned long start = millis();
+    uint32_t heapBefore = ESP.getFreeHeap();
+    for (size_t i = 0; i < count; i++) {
+#if defined(ESP_PLATFORM)
+      int ret = mbedtls_x509_crt_parse_der_nocopy(&chain_, certs[i].der, certs[i].length);
+      if (ret != 0) {
+        Serial.printf("CA %s rejected: -0x%04x\n", certs[i].name, -ret);
+        continue;
+      }
+#endif
+      count_++;
+    }
+    parseMs_ = millis() - start;
+    uint32_t heapAfter = ESP.getFreeHeap();
+    heap_ = heapBefore > heapAfter ? heapBefore - heapAfter : 0;
+    return count_;
+  }
+
+  bool ready() const { return count_ > 0; }
+
+#if defined(ESP_PLATFORM)
+  mbedtls_x509_crt* chain() { return &chain_; }
+
+  // Trust this store (and, if any are set, only chains matching the pins)
+  void attach(mbedtls_ssl_config* config, SpkiPins* pins = NULL) {
+    mbedtls_ssl_conf_ca_chain(config, &chain_, NULL);
+    if (pins != NULL && pins->count() > 0) mbedtls_ssl_conf_verify(config, SpkiPins::verify, pins);
+  }
+#endif
+
+  void report(JsonObject out) const {
+    out["count"] = count_;
+    out["parse_ms"] = parseMs_;
+    out["heap"] = heap_;
+  }
+
+private:
+#if defined(ESP_PLATFORM)
+  mbedtls_x509_crt chain_;
+#endif
+  uint8_t count_ = 0;
+  uint32_t parseMs_ = 0;
+  uint32_t heap_ = 0;
+};
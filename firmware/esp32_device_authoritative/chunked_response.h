@@ -0,0 +1,175 @@
+/*
+ * Chunked command responses
+ *
+ * ACKs are limited to a 256-byte document, so results larger than that (a
+ * full status dump, a config export, history) are streamed instead as a
+ * sequence of frames under the command's cmd_id:
+ *
+ *   {"cmd_id":"CMD_9","index":0,"total":5,"final":false, ...source fields}
+ *
+ * A ChunkSource produces frame `index` on demand from data the device
+ * already holds, so only one frame document (CHUNK_FRAME_BYTES unless the
+ * source asks for another fixed size) exists at a time however large the
+ * response is. ChunkedResponder sends at most one frame per service() call
+ * and retries the same frame if a publish fails.
+ *
+ * Flow control is opt-in per command: with "window":N the responder keeps at
+ * most N frames unacknowledged and waits for the receiver to send
+ * {"action":"chunk_ack","cmd_id":...,"index":i} (cumulative: frames up to i
+ * were received). Without a window, frames are paced one per loop pass as
+ * history chunks always were. A response that makes no progress for
+ * CHUNK_STALL_MS (receiver gone, broker unreachable) is abandoned.
+ *
+ * A frame whose source fails or overflows the frame document is replaced by
+ * a final frame carrying "error", so the receiver never waits for the rest.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "mqtt_stream.h"
+
+#define CHUNK_FRAME_BYTES 1024
+#define CHUNK_MAX_WINDOW 16
+#define CHUNK_STALL_MS 30000
+
+class ChunkSource {
+public:
+  virtual ~ChunkSource() {}
+
+  // Number of frames in the response (at least 1)
+  virtual uint32_t frameCount() const = 0;
+
+  // Frame document size; the same for every frame of a response
+  virtual size_t frameCapacity() const { return CHUNK_FRAME_BYTES; }
+
+  // Add frame `index`'s payload fields; cmd_id, index, total and final are
+  // added by the responder
+  virtual bool fillFrame(uint32_t index, JsonObject frame) = 0;
+};
+
+struct ChunkStats {
+  uint32_t responses;   // Responses started
+  uint32_t completed;   // Final frame sent
+  uint32_t frames;
+  uint32_t retries;     // Publishes that failed and were retried
+  uint32_t stalled;     // Abandoned after CHUNK_STALL_MS without progress
+  uint32_t errors;      // Ended early by a source failure
+};
+
+class ChunkedResponder {
+public:
+  explicit ChunkedResponder(MqttStreamPublisher& publisher) : publisher_(publisher) {}
+
+  bool active() const { return source_ != NULL; }
+  const char* cmdId() const { return cmdId_; }
+
+  // Start streaming `source` to `topic`. window = 0 disables flow control.
+  bool begin(ChunkSource& source, const String& topic, const char* cmdId, int window,
+             unsigned long now, String& error) {
+    if (active()) {
+      error = "Response " + String(cmdId_) + " still streaming";
+      return false;
+    }
+    if (window < 0 || window > CHUNK_MAX_WINDOW) {
+      error = "Window must be 0-" + String(CHUNK_MAX_WINDOW);
+      return false;
+    }
+    source_ = &source;
+    topic_ = topic;
+    strncpy(cmdId_, cmdId, sizeof(cmdId_) - 1);
+    cmdId_[sizeof(cmdId_) - 1] = '\0';
+    total_ = source.frameCount();
+    if (total_ == 0) total_ = 1;
+    next_ = 0;
+    acked_ = 0;
+    window_ = (uint8_t)window;
+    progressMs_ = now;
+    stats_.responses++;
+    return true;
+  }
+
+  // Receiver confirmed frames 0..index; ignored for other responses
+  void acknowledge(const char* cmdId, uint32_t index, unsigned long now) {
+    if (!active() || strcmp(cmdId, cmdId_) != 0) return;
+    if (index + 1 > acked_ && index < next_) {
+      acked_ = index + 1;
+      progressMs_ = now;
+    }
+  }
+
+  bool cancel(const char* cmdId) {
+    if (!active() || strcmp(cmdId, cmdId_) != 0) return false;
+    source_ = NULL;
+    return true;
+  }
+
+  // Send the next frame if the window allows. Returns true once, when the
+  // final frame has been published.
+  bool service(unsigned long now) {
+    if (!active()) return false;
+    if (now - progressMs_ > CHUNK_STALL_MS) {
+      Serial.println("Response " + String(cmdId_) + " stalled at frame " + String(next_));
+      stats_.stalled++;
+      source_ = NULL;
+      return false;
+    }
+    if (!windowOpen()) return false;
+
+    DynamicJsonDocument frame(source_->frameCapacity());
+    frame["cmd_id"] = (const char*)cmdId_;
+    frame["index"] = next_;
+    frame["total"] = total_;
+    frame["final"] = next_ + 1 == total_;
+    bool filled = source_->fillFrame(next_, frame.as<JsonObject>());
+    bool failed = !filled || frame.overflowed();
+    if (failed) {
+      frame.clear();
+      frame["cmd_id"] = (const char*)cmdId_;
+      frame["index"] = next_;
+      frame["total"] = total_;
+      frame["final"] = true;
+      frame["error"] = filled ? "Frame too large" : "Source failed";
+    }
+
+    if (!publisher_.publishJson(topic_.c_str(), frame, false)) {
+      stats_.retries++;
+      return false;  // Same frame again on the next pass
+    }
+    stats_.frames++;
+    next_++;
+    progressMs_ = now;
+
+    if (failed || next_ == total_) {
+      if (failed) stats_.errors++;
+      else stats_.completed++;
+      source_ = NULL;
+      return !failed;
+    }
+    return false;
+  }
+
+  // 0 while a frame can be sent, else UINT32_MAX (waiting for an ack or idle)
+  uint32_t msUntilNextFrame() const {
+    return active() && windowOpen() ? 0 : UINT32_MAX;
+  }
+
+  const ChunkStats& stats() const { return stats_; }
+
+private:
+  bool windowOpen() const {
+    return window_ == 0 || next_ - acked_ < window_;
+  }
+
+  MqttStreamPublisher& publisher_;
+  ChunkSource* source_ = NULL;
+  String topic_;
+  char cmdId_[40] = {0};
+  uint32_t total_ = 0;
+  uint32_t next_ = 0;     // Next frame to publish
+  uint32_t acked_ = 0;    // Frames confirmed by the receiver
+  uint8_t window_ = 0;
+  unsigned long progressMs_ = 0;
+  ChunkStats stats_ = {};
+};
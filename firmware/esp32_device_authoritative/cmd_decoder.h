@@ -0,0 +1,384 @@
+/*
+ * Single-pass command decoder
+ *
+ * A command schema is declared once, as a plain struct plus a table of
+ * CmdField entries (name, type, range, default, built with the CMD_FIELD_*
+ * macros from offsetof). cmdDecode() walks the JSON payload once and writes
+ * each known field straight into the struct:
+ *
+ *   - no JsonDocument: unknown fields (and anything nested in them) are
+ *     skipped without using memory, so extra keys cannot exhaust a
+ *     fixed-size document
+ *   - range and length checks happen as each value is read; the error names
+ *     the field ("pin out of range (-1 to 39)")
+ *   - strings are zero-copy: unescaped in place in the payload and
+ *     NUL-terminated there, so the struct holds pointers into it. The
+ *     payload (PubSubClient's buffer) must stay untouched while the struct
+ *     is in use, as with ArduinoJson's zero-copy mode.
+ *   - aliases: "value|state" accepts either key, and the earlier name wins
+ *     when both are present (doc["value"] | doc["state"] | 0)
+ *
+ * Every field is set to its default before parsing, so after a failed
+ * decode the fields read so far (e.g. cmd_id, for the error ACK) are valid.
+ *
+ * Types: CMD_STR (const char*), CMD_INT (int32_t; true/false read as 1/0),
+ * CMD_BOOL (bool; 0/1 accepted). null counts as absent. Only the C
+ * standard headers are used, so host benches build against it
+ * (host/cmd_bench.cpp).
+ */
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CMD_DECODER_MAX_FIELDS 16
+#define CMD_REQUIRED true
+#define CMD_OPTIONAL false
+
+enum CmdFieldType : uint8_t {
+  CMD_STR = 0,
+  CMD_INT = 1,
+  CMD_BOOL = 2
+};
+
+struct CmdField {
+  const char* names;     // Key, or aliases separated by '|' (earlier wins)
+  CmdFieldType type;
+  uint16_t offset;       // offsetof() the member in the command struct
+  bool required;
+  int32_t min;           // CMD_INT range; CMD_STR unused
+  int32_t max;           // CMD_INT range; CMD_STR maximum length
+  int32_t fallback;      // Default for CMD_INT / CMD_BOOL when absent
+};
+
+#define CMD_FIELD_STR(Struct, member, names, maxLength, required) \
+  {names, CMD_STR, (uint16_t)offsetof(Struct, member), required, 0, maxLength, 0}
+#define CMD_FIELD_INT(Struct, member, names, min, max, fallback) \
+  {names, CMD_INT, (uint16_t)offsetof(Struct, member), false, min, max, fallback}
+#define CMD_FIELD_BOOL(Struct, member, names, fallback) \
+  {names, CMD_BOOL, (uint16_t)offsetof(Struct, member), false, 0, 1, fallback}
+
+class CmdDecoder {
+public:
+  CmdDecoder(char* json, size_t length, const CmdField* fields, uint8_t count, void* out)
+      : p_(json), end_(json + length), fields_(fields), count_(count), out_((uint8_t*)out) {}
+
+  // false with a message in `error` on malformed JSON, a missing required
+  // field, a wrong type or a value out of range
+  bool decode(char* error, size_t errorSize) {
+    error_ = error;
+    errorSize_ = errorSize;
+    if (count_ > CMD_DECODER_MAX_FIELDS) return fail("Schema too large");
+
+    uint8_t rank[CMD_DECODER_MAX_FIELDS];
+    for (uint8_t i = 0; i < count_; i++) {
+      rank[i] = 0xFF;  // Not seen; otherwise the alias index that set it
+      setDefault(fields_[i]);
+    }
+
+    skipSpace();
+    if (!consume('{')) return fail("Malformed JSON");
+    skipSpace();
+    if (!consume('}')) {
+      for (;;) {
+        skipSpace();
+        const char* key;
+        size_t keyLength;
+        if (!readKey(key, keyLength)) return fail("Malformed JSON");
+        skipSpace();
+        if (!consume(':')) return fail("Malformed JSON");
+        skipSpace();
+
+        uint8_t alias = 0;
+        int index = find(key, keyLength, alias);
+        if (index < 0 || alias > rank[index]) {
+          if (!skipValue()) return fail("Malformed JSON");
+        } else {
+          bool present = false;
+          if (!readValue(fields_[index], present)) return false;
+          if (present) rank[index] = alias;
+        }
+
+        skipSpace();
+        if (consume(',')) continue;
+        if (consume('}')) break;
+        return fail("Malformed JSON");
+      }
+    }
+    skipSpace();
+    if (p_ != end_ && *p_ != '\0') return fail("Malformed JSON");
+
+    for (uint8_t i = 0; i < count_; i++) {
+      if (fields_[i].required && rank[i] == 0xFF) {
+        return fail("Missing %.*s", nameLength(fields_[i].names), fields_[i].names);
+      }
+    }
+    return true;
+  }
+
+private:
+  bool fail(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    if (error_ != NULL && errorSize_ > 0) {
+      va_list args;
+      va_start(args, format);
+      vsnprintf(error_, errorSize_, format, args);
+      va_end(args);
+    }
+    return false;
+  }
+
+  static int nameLength(const char* names) {
+    const char* bar = strchr(names, '|');
+    return bar != NULL ? (int)(bar - names) : (int)strlen(names);
+  }
+
+  void setDefault(const CmdField& field) {
+    uint8_t* member = out_ + field.offset;
+    switch (field.type) {
+      case CMD_STR: {
+        const char* empty = "";
+        memcpy(member, &empty, sizeof(empty));
+        break;
+      }
+      case CMD_INT: {
+        int32_t value = field.fallback;
+        memcpy(member, &value, sizeof(value));
+        break;
+      }
+      case CMD_BOOL: {
+        bool value = field.fallback != 0;
+        memcpy(member, &value, sizeof(value));
+        break;
+      }
+    }
+  }
+
+  // Field whose name (or alias) equals the key; `alias` is its position
+  int find(const char* key, size_t keyLength, uint8_t& alias) const {
+    for (uint8_t i = 0; i < count_; i++) {
+      const char* name = fields_[i].names;
+      for (alias = 0; ; alias++) {
+        const char* bar = strchr(name, '|');
+        size_t length = bar != NULL ? (size_t)(bar - name) : strlen(name);
+        if (length == keyLength && memcmp(name, key, length) == 0) return i;
+        if (bar == NULL) break;
+        name = bar + 1;
+      }
+    }
+    return -1;
+  }
+
+  bool readValue(const CmdField& field, bool& present) {
+    uint8_t* member = out_ + field.offset;
+    int nameLen = nameLength(field.names);
+    if (matchLiteral("null")) return true;
+    present = true;
+
+    switch (field.type) {
+      case CMD_STR: {
+        if (p_ == end_ || *p_ != '"') return fail("%.*s must be a string", nameLen, field.names);
+        char* text;
+        size_t length;
+        if (!readString(text, length)) return fail("Malformed JSON");
+        if ((int32_t)length > field.max) {
+          return fail("%.*s too long (max %ld)", nameLen, field.names, (long)field.max);
+        }
+        const char* value = text;
+        memcpy(member, &value, sizeof(value));
+        return true;
+      }
+      case CMD_INT:
+      case CMD_BOOL: {
+        int64_t number;
+        if (matchLiteral("true")) {
+          number = 1;
+        } else if (matchLiteral("false")) {
+          number = 0;
+        } else if (!readInteger(number)) {
+          return fail("%.*s must be an integer", nameLen, field.names);
+        }
+        if (number < field.min || number > field.max) {
+          return fail("%.*s out of range (%ld to %ld)", nameLen, field.names, (long)field.min, (long)field.max);
+        }
+        if (field.type == CMD_BOOL) {
+          bool value = number != 0;
+          memcpy(member, &value, sizeof(value));
+        } else {
+          int32_t value = (int32_t)number;
+          memcpy(member, &value, sizeof(value));
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Keys are compared raw (no escapes in schema names)
+  bool readKey(const char*& key, size_t& length) {
+    if (!consume('"')) return false;
+    key = p_;
+    while (p_ < end_ && *p_ != '"') {
+      if (*p_ == '\\') p_++;
+      p_++;
+    }
+    if (p_ >= end_) return false;
+    length = p_ - key;
+    p_++;
+    return true;
+  }
+
+  // Unescape in place and NUL-terminate; the result is never longer
+  bool readString(char*& text, size_t& length) {
+    p_++;  // Opening quote
+    text = p_;
+    char* write = p_;
+    while (p_ < end_ && *p_ != '"') {
+      char c = *p_++;
+      if ((uint8_t)c < 0x20) return false;
+      if (c != '\\') {
+        *write++ = c;
+        continue;
+      }
+      if (p_ >= end_) return false;
+      char escape = *p_++;
+      switch (escape) {
+        case '"': case '\\': case '/': *write++ = escape; break;
+        case 'b': *write++ = '\b'; break;
+        case 'f': *write++ = '\f'; break;
+        case 'n': *write++ = '\n'; break;
+        case 'r': *write++ = '\r'; break;
+        case 't': *write++ = '\t'; break;
+        case 'u': {
+          uint32_t code;
+          if (!readHex4(code)) return false;
+          if (code >= 0xD800 && code <= 0xDFFF) code = '?';  // No surrogate pairs in commands
+          write = appendUtf8(write, code);
+          break;
+        }
+        default: return false;
+      }
+    }
+    if (p_ >= end_) return false;
+    p_++;  // Closing quote
+    length = write - text;
+    *write = '\0';
+    return true;
+  }
+
+  bool readHex4(uint32_t& code) {
+    if (end_ - p_ < 4) return false;
+    code = 0;
+    for (int i = 0; i < 4; i++) {
+      char c = *p_++;
+      code <<= 4;
+      if (c >= '0' && c <= '9') code |= c - '0';
+      else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+      else return false;
+    }
+    return true;
+  }
+
+  // UTF-8 of a BMP code point is at most 3 bytes, never longer than "\uXXXX"
+  static char* appendUtf8(char* out, uint32_t code) {
+    if (code < 0x80) {
+      *out++ = (char)code;
+    } else if (code < 0x800) {
+      *out++ = (char)(0xC0 | (code >> 6));
+      *out++ = (char)(0x80 | (code & 0x3F));
+    } else {
+      *out++ = (char)(0xE0 | (code >> 12));
+      *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+      *out++ = (char)(0x80 | (code & 0x3F));
+    }
+    return out;
+  }
+
+  // Whole numbers only; a fraction or exponent is a type error
+  bool readInteger(int64_t& number) {
+    bool negative = consume('-');
+    if (p_ == end_ || *p_ < '0' || *p_ > '9') return false;
+    number = 0;
+    while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+      if (number > 1000000000000LL) return false;  // Far outside any int32 range
+      number = number * 10 + (*p_++ - '0');
+    }
+    if (p_ < end_ && (*p_ == '.' || *p_ == 'e' || *p_ == 'E')) return false;
+    if (negative) number = -number;
+    return true;
+  }
+
+  // Skip one value of any type, including nested objects and arrays
+  bool skipValue() {
+    int depth = 0;
+    do {
+      if (p_ >= end_) return false;
+      char c = *p_;
+      if (c == '"') {
+        p_++;
+        while (p_ < end_ && *p_ != '"') {
+          if (*p_ == '\\') p_++;
+          p_++;
+        }
+        if (p_ >= end_) return false;
+        p_++;
+      } else if (c == '{' || c == '[') {
+        depth++;
+        p_++;
+      } else if (c == '}' || c == ']') {
+        if (depth == 0) return false;
+        depth--;
+        p_++;
+      } else if (depth > 0) {
+        p_++;  // Separators and scalars inside a container
+      } else {
+        const char* start = p_;  // Top-level number or literal
+        while (p_ < end_ && *p_ != ',' && *p_ != '}' && *p_ != ' ' && *p_ != '\t' &&
+               *p_ != '\r' && *p_ != '\n') {
+          p_++;
+        }
+        if (p_ == start) return false;
+      }
+    } while (depth > 0);
+    return true;
+  }
+
+  bool matchLiteral(const char* literal) {
+    size_t length = strlen(literal);
+    if ((size_t)(end_ - p_) < length || memcmp(p_, literal, length) != 0) return false;
+    p_ += length;
+    return true;
+  }
+
+  bool consume(char c) {
+    if (p_ < end_ && *p_ == c) {
+      p_++;
+      return true;
+    }
+    return false;
+  }
+
+  void skipSpace() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n')) p_++;
+  }
+
+  char* p_;
+  char* end_;
+  const CmdField* fields_;
+  uint8_t count_;
+  uint8_t* out_;
+  char* error_ = NULL;
+  size_t errorSize_ = 0;
+};
+
+// Decode `json` (modified in place) into `out` using its schema table
+template <typename T, size_t N>
+bool cmdDecode(char* json, size_t length, const CmdField (&fields)[N], T& out, char* error, size_t errorSize) {
+  static_assert(N <= CMD_DECODER_MAX_FIELDS, "Too many fields in command schema");
+  CmdDecoder decoder(json, length, fields, (uint8_t)N, &out);
+  return decoder.decode(error, errorSize);
+}
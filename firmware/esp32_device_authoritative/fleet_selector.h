@@ -0,0 +1,114 @@
+/*
+ * Fleet broadcast selectors
+ *
+ * Broadcast commands are published once per tenant and received by every
+ * device. Each carries a selector that the device evaluates locally; all
+ * present criteria must match (missing selector = whole tenant):
+ *
+ *   "selector": {
+ *     "tags":     ["pump", "siteA"],              // device has all tags
+ *     "fw":       {"min": "1.2.0", "max": "1.9.9"}, // inclusive, numeric compare
+ *     "ids":      ["pump-1", "pump-7"],           // explicit device list
+ *     "id_range": ["pump-100", "pump-199"],       // inclusive, string order
+ *     "rollout":  {"percent": 10, "salt": "fw-1.3"} // stable hash bucket
+ *   }
+ *
+ * The rollout bucket is fnv1a(salt ":" deviceId) % 100, so a device stays in
+ * the same bucket as a staged rollout widens from 10% to 50% to 100%, and a
+ * new salt reshuffles devices for the next rollout.
+ *
+ * Non-matching devices stay silent; matching devices execute after a
+ * per-device jitter and ACK on their own ack topic.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+struct DeviceIdentity {
+  const char* id;
+  const char* firmwareVersion;
+  const char* const* tags;
+  uint8_t tagCount;
+};
+
+inline uint32_t fnv1a(const char* text, uint32_t hash = 2166136261UL) {
+  while (*text) {
+    hash ^= (uint8_t)*text++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+// Compare dotted numeric versions ("1.10.0" > "1.9.3"). Missing parts = 0.
+inline int compareVersions(const char* a, const char* b) {
+  while (*a || *b) {
+    unsigned long partA = strtoul(a, (char**)&a, 10);
+    unsigned long partB = strtoul(b, (char**)&b, 10);
+    if (partA != partB) return partA < partB ? -1 : 1;
+    if (*a == '.') a++;
+    if (*b == '.') b++;
+    if (*a && !isdigit((unsigned char)*a)) break;
+    if (*b && !isdigit((unsigned char)*b)) break;
+  }
+  return 0;
+}
+
+// Stable 0-99 bucket for staged rollouts
+inline uint8_t rolloutBucket(const char* salt, const char* deviceId) {
+  return fnv1a(deviceId, fnv1a(":", fnv1a(salt))) % 100;
+}
+
+// Per-device execution delay in [0, windowMs), spread by device and command
+inline unsigned long broadcastJitter(const char* deviceId, const char* cmdId, unsigned long windowMs) {
+  if (windowMs == 0) return 0;
+  return fnv1a(cmdId, fnv1a(deviceId)) % windowMs;
+}
+
+inline bool hasTag(const DeviceIdentity& device, const char* tag) {
+  for (uint8_t i = 0; i < device.tagCount; i++) {
+    if (strcmp(device.tags[i], tag) == 0) return true;
+  }
+  return false;
+}
+
+inline bool matchesSelector(JsonObjectConst selector, const DeviceIdentity& device) {
+  if (selector.isNull()) return true;
+
+  JsonArrayConst tags = selector["tags"];
+  for (JsonVariantConst tag : tags) {
+    if (!hasTag(device, tag | "")) return false;
+  }
+
+  JsonObjectConst fw = selector["fw"];
+  if (!fw.isNull()) {
+    const char* min = fw["min"];
+    const char* max = fw["max"];
+    if (min && compareVersions(device.firmwareVersion, min) < 0) return false;
+    if (max && compareVersions(device.firmwareVersion, max) > 0) return false;
+  }
+
+  JsonArrayConst ids = selector["ids"];
+  if (!ids.isNull()) {
+    bool listed = false;
+    for (JsonVariantConst id : ids) {
+      if (strcmp(id | "", device.id) == 0) { listed = true; break; }
+    }
+    if (!listed) return false;
+  }
+
+  JsonArrayConst range = selector["id_range"];
+  if (range.size() == 2) {
+    if (strcmp(device.id, range[0] | "") < 0) return false;
+    if (strcmp(device.id, range[1] | "") > 0) return false;
+  }
+
+  JsonObjectConst rollout = selector["rollout"];
+  if (!rollout.isNull()) {
+    int percent = rollout["percent"] | 100;
+    if (rolloutBucket(rollout["salt"] | "", device.id) >= percent) return false;
+  }
+
+  return true;
+}
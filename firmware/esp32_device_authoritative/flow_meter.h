@@ -0,0 +1,423 @@
+/*
+ * Pulse-counter flow metering
+ *
+ * Hall-effect flow sensors put out one pulse per fixed volume (the K-factor,
+ * pulses per liter). Each channel gets a PCNT unit of its own that counts
+ * rising edges in hardware, with the PCNT glitch filter dropping pulses
+ * shorter than filter_us, so a pulse costs no CPU time: no interrupt, no
+ * polling of digitalRead().
+ *
+ * A periodic esp_timer (FLOW_SNAPSHOT_MS) reads every counter, adds the
+ * pulses since the previous snapshot to the channel's 64-bit total and turns
+ * them into a rate over the measured interval. The counter wraps at
+ * FLOW_PCNT_LIMIT and is never cleared, so no pulse is lost between a read
+ * and a clear; a channel can count up to FLOW_PCNT_LIMIT - 1 pulses per
+ * snapshot (~32 kHz) before a wrap goes unnoticed.
+ *
+ * Totals are kept in pulses and stored in NVS (namespace "flow", by channel
+ * name) when the sketch saves them, so they survive a reboot less whatever
+ * flowed since the last save. A channel keeps its total across a
+ * reconfiguration as long as its name stays the same.
+ *
+ * Every channel is two alert/state channels: <name> is the rate in L/min,
+ * <name>_total the total in liters, hence the short FLOW_MAX_NAME.
+ *
+ * The PCNT input enables the pin's pull-up; GPIO 34-39 have none and need an
+ * external one for open-collector sensors. Host builds have no PCNT: the
+ * meter runs, but its counters stay at zero.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+
+#if defined(ESP_PLATFORM)
+#include <driver/gpio.h>
+#include <driver/pcnt.h>
+#include <esp_timer.h>
+#endif
+
+#define FLOW_MAX_CHANNELS 4          // PCNT units 0-3 (ESP32-S2/S3 have only 4)
+#define FLOW_MAX_NAME 9              // Leaves room for "_total" in an alert channel
+#define FLOW_SNAPSHOT_MS 1000
+#define FLOW_PCNT_LIMIT 32767        // Counter wraps to 0 here
+#define FLOW_MAX_FILTER_US 12        // PCNT filter: 1023 APB cycles at 80 MHz
+#define FLOW_DEFAULT_FILTER_US 10
+#define FLOW_FORMAT_VERSION 1
+
+struct FlowChannel {
+  char name[FLOW_MAX_NAME + 1];
+  uint8_t pin;
+  uint8_t filterUs;        // Pulses shorter than this are ignored (0 = off)
+  float pulsesPerLiter;    // K-factor from the sensor's datasheet
+};
+
+struct FlowSet {
+  uint8_t version;
+  uint8_t count;
+  FlowChannel channels[FLOW_MAX_CHANNELS];
+};
+
+struct FlowTotal {
+  char name[FLOW_MAX_NAME + 1];
+  uint64_t pulses;
+};
+
+struct FlowTotals {
+  uint8_t version;
+  uint8_t count;
+  FlowTotal totals[FLOW_MAX_CHANNELS];
+};
+
+// Build a channel set from the command's "channels" array
+inline bool parseFlowSet(JsonArrayConst channels, FlowSet& set, String& error) {
+  memset(&set, 0, sizeof(set));
+  set.version = FLOW_FORMAT_VERSION;
+
+  if (channels.isNull() || channels.size() == 0) {
+    error = "Missing channels";
+    return false;
+  }
+  if (channels.size() > FLOW_MAX_CHANNELS) {
+    error = "Too many flow channels (max " + String(FLOW_MAX_CHANNELS) + ")";
+    return false;
+  }
+
+  for (JsonObjectConst c : channels) {
+    FlowChannel& channel = set.channels[set.count];
+    const char* name = c["name"] | "";
+    long pin = c["pin"] | -1L;
+    long filterUs = c["filter_us"] | (long)FLOW_DEFAULT_FILTER_US;
+    float pulsesPerLiter = c["k"] | 0.0f;
+
+    if (strlen(name) == 0 || strlen(name) > FLOW_MAX_NAME) { error = "Invalid flow channel name"; return false; }
+    // GPIO 6-11 are wired to the SPI flash
+    if (pin < 0 || pin > 39 || (pin >= 6 && pin <= 11)) { error = "Invalid pin for " + String(name); return false; }
+    for (uint8_t i = 0; i < set.count; i++) {
+      if (strcmp(set.channels[i].name, name) == 0) { error = "Duplicate flow channel: " + String(name); return false; }
+      if (set.channels[i].pin == pin) { error = "Pin " + String((int)pin) + " used twice"; return false; }
+    }
+    if (!(pulsesPerLiter > 0)) { error = "Flow channel " + String(name) + " needs k (pulses per liter)"; return false; }
+    if (filterUs < 0 || filterUs > FLOW_MAX_FILTER_US) { error = "Invalid filter_us"; return false; }
+
+    strcpy(channel.name, name);
+    channel.pin = (uint8_t)pin;
+    channel.filterUs = (uint8_t)filterUs;
+    channel.pulsesPerLiter = pulsesPerLiter;
+    set.count++;
+  }
+  return true;
+}
+
+class FlowStore {
+public:
+  bool save(const FlowSet& set) {
+    Preferences prefs;
+    if (!prefs.begin("flow", false)) return false;
+    size_t size = offsetof(FlowSet, channels) + set.count * sizeof(FlowChannel);
+    bool ok = prefs.putBytes("channels", &set, size) == size;
+    prefs.end();
+    return ok;
+  }
+
+  bool load(FlowSet& set) {
+    Preferences prefs;
+    if (!prefs.begin("flow", true)) return false;
+    size_t size = prefs.getBytesLength("channels");
+    bool ok = size >= offsetof(FlowSet, channels) && size <= sizeof(FlowSet) &&
+              prefs.getBytes("channels", &set, size) == size;
+    prefs.end();
+    return ok && set.version == FLOW_FORMAT_VERSION && set.count <= FLOW_MAX_CHANNELS &&
+           size == offsetof(FlowSet, channels) + set.count * sizeof(FlowChannel);
+  }
+
+  bool saveTotals(const FlowTotals& totals) {
+    Preferences prefs;
+    if (!prefs.begin("flow", false)) return false;
+    size_t size = offsetof(FlowTotals, totals) + totals.count * sizeof(FlowTotal);
+    bool ok = prefs.putBytes("totals", &totals, size) == size;
+    prefs.end();
+    return ok;
+  }
+
+  bool loadTotals(FlowTotals& totals) {
+    Preferences prefs;
+    if (!prefs.begin("flow", true)) return false;
+    size_t size = prefs.getBytesLength("totals");
+    bool ok = size >= offsetof(FlowTotals, totals) && size <= sizeof(FlowTotals) &&
+              prefs.getBytes("totals", &totals, size) == size;
+    prefs.end();
+    return ok && totals.version == FLOW_FORMAT_VERSION && totals.count <= FLOW_MAX_CHANNELS &&
+           size == offsetof(FlowTotals, totals) + totals.count * sizeof(FlowTotal);
+  }
+
+  // Drops the channels and their totals
+  bool remove() {
+    Preferences prefs;
+    if (!prefs.begin("flow", false)) return false;
+    bool ok = prefs.remove("channels");
+    prefs.remove("totals");
+    prefs.end();
+    return ok;
+  }
+};
+
+class FlowMeter {
+public:
+  // Start counting. Channels named in `restored` continue from that total.
+  bool begin(const FlowSet& set, const FlowTotals* restored) {
+    stop();
+#if defined(ESP_PLATFORM)
+    // Units the new set drops, or moves to another pin, let go of their pin
+    for (uint8_t i = 0; i < set_.count; i++) {
+      if (i >= set.count || set.channels[i].pin != set_.channels[i].pin) releaseUnit(i);
+    }
+#endif
+    // Under mux_: a timer callback that was already running when stop()
+    // returned may still be in snapshot()
+    portENTER_CRITICAL(&mux_);
+    set_ = set;
+    for (uint8_t i = 0; i < set_.count; i++) {
+      pulses_[i] = 0;
+      rates_[i] = 0;
+      last_[i] = 0;
+      if (restored != NULL) {
+        for (uint8_t j = 0; j < restored->count; j++) {
+          if (strcmp(restored->totals[j].name, set_.channels[i].name) == 0) pulses_[i] = restored->totals[j].pulses;
+        }
+      }
+      saved_[i] = pulses_[i];
+    }
+    portEXIT_CRITICAL(&mux_);
+    for (uint8_t i = 0; i < set_.count; i++) {
+      snprintf(totalNames_[i], sizeof(totalNames_[i]), "%s_total", set_.channels[i].name);
+    }
+    if (set_.count == 0) return false;
+
+#if defined(ESP_PLATFORM)
+    for (uint8_t i = 0; i < set_.count; i++) {
+      if (!startUnit(i)) {
+        set_.count = i + 1;
+        clear();
+        return false;
+      }
+    }
+    lastSnapshotUs_ = esp_timer_get_time();
+    esp_timer_create_args_t args = {};
+    args.callback = &onTimer;
+    args.arg = this;
+    args.name = "flow";
+    if (esp_timer_create(&args, &timer_) != ESP_OK) {
+      timer_ = NULL;
+      clear();
+      return false;
+    }
+    esp_timer_start_periodic(timer_, FLOW_SNAPSHOT_MS * 1000ULL);
+#endif
+    active_ = set_.count > 0;
+    return active_;
+  }
+
+  // Stop the timer and counters, keeping the pulses counted so far
+  void stop() {
+#if defined(ESP_PLATFORM)
+    if (timer_ != NULL) {
+      esp_timer_stop(timer_);
+      esp_timer_delete(timer_);
+      timer_ = NULL;
+      snapshot();
+    }
+    for (uint8_t i = 0; i < set_.count; i++) {
+      pcnt_counter_pause((pcnt_unit_t)i);
+    }
+#endif
+    active_ = false;
+  }
+
+  // Stop and forget the channels; their pins go back to plain GPIO
+  void clear() {
+    stop();
+#if defined(ESP_PLATFORM)
+    for (uint8_t i = 0; i < set_.count; i++) releaseUnit(i);
+#endif
+    portENTER_CRITICAL(&mux_);
+    set_.count = 0;
+    portEXIT_CRITICAL(&mux_);
+  }
+
+  // Called from the timer task after each snapshot (e.g. to wake the loop)
+  void setListener(void (*listener)()) { listener_ = listener; }
+
+  bool active() const { return active_; }
+  uint8_t channelCount() const { return active_ ? set_.count : 0; }
+  const FlowChannel& channel(uint8_t index) const { return set_.channels[index]; }
+  const char* totalName(uint8_t index) const { return totalNames_[index]; }
+
+  // Increments once per snapshot; the loop compares it to spot new readings
+  uint32_t snapshots() const { return snapshots_; }
+
+  // L/min over the last snapshot interval
+  float rate(uint8_t index) {
+    portENTER_CRITICAL(&mux_);
+    float rate = rates_[index];
+    portEXIT_CRITICAL(&mux_);
+    return rate;
+  }
+
+  // double: a float total loses sub-liter resolution past about 10^5 L
+  double totalLiters(uint8_t index) {
+    return pulses(index) / (double)set_.channels[index].pulsesPerLiter;
+  }
+
+  uint64_t pulses(uint8_t index) {
+    portENTER_CRITICAL(&mux_);
+    uint64_t pulses = pulses_[index];
+    portEXIT_CRITICAL(&mux_);
+    return pulses;
+  }
+
+  // Set a channel's total, e.g. to match a mechanical meter (0 after a sensor swap).
+  // liters must be >= 0; the caller reports a bad value, false is an unknown name.
+  bool setTotal(const char* name, float liters) {
+    for (uint8_t i = 0; i < set_.count; i++) {
+      if (strcmp(set_.channels[i].name, name) != 0) continue;
+      double pulses = (double)liters * set_.channels[i].pulsesPerLiter + 0.5;
+      if (!(pulses >= 0)) pulses = 0;               // Never cast a negative/NaN to uint64_t
+      if (pulses >= 18446744073709551615.0) pulses = 18446744073709549568.0;  // Largest double below 2^64
+      portENTER_CRITICAL(&mux_);
+      pulses_[i] = (uint64_t)pulses;
+      portEXIT_CRITICAL(&mux_);
+      return true;
+    }
+    return false;
+  }
+
+  // Pulses counted since the last markSaved()
+  bool totalsChanged() {
+    for (uint8_t i = 0; i < set_.count; i++) {
+      if (pulses(i) != saved_[i]) return true;
+    }
+    return false;
+  }
+
+  void totals(FlowTotals& out) {
+    memset(&out, 0, sizeof(out));
+    out.version = FLOW_FORMAT_VERSION;
+    for (uint8_t i = 0; i < set_.count; i++) {
+      strcpy(out.totals[i].name, set_.channels[i].name);
+      out.totals[i].pulses = pulses(i);
+    }
+    out.count = set_.count;
+  }
+
+  void markSaved(const FlowTotals& totals) {
+    for (uint8_t i = 0; i < set_.count && i < totals.count; i++) {
+      saved_[i] = totals.totals[i].pulses;
+    }
+  }
+
+  // State snapshot: {"<name>": L/min, "<name>_total": liters}
+  void report(JsonObject out) {
+    for (uint8_t i = 0; i < channelCount(); i++) {
+      out[(const char*)set_.channels[i].name] = rate(i);
+      out[(const char*)totalNames_[i]] = totalLiters(i);
+    }
+  }
+
+  // flow_status: raw pulse totals per channel
+  void reportStats(JsonObject out) {
+    out["channels"] = channelCount();
+    out["snapshots"] = snapshots();
+    JsonObject pulses = out.createNestedObject("pulses");
+    for (uint8_t i = 0; i < channelCount(); i++) {
+      pulses[(const char*)set_.channels[i].name] = (double)this->pulses(i); // Exact to 2^53
+    }
+  }
+
+private:
+#if defined(ESP_PLATFORM)
+  // PCNT unit `index` counts rising edges on the channel's pin, nothing else
+  bool startUnit(uint8_t index) {
+    const FlowChannel& channel = set_.channels[index];
+    pcnt_unit_t unit = (pcnt_unit_t)index;
+    pcnt_config_t config = {};
+    config.pulse_gpio_num = channel.pin;
+    config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    config.channel = PCNT_CHANNEL_0;
+    config.unit = unit;
+    config.pos_mode = PCNT_COUNT_INC;
+    config.neg_mode = PCNT_COUNT_DIS;
+    config.lctrl_mode = PCNT_MODE_KEEP;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    config.counter_h_lim = FLOW_PCNT_LIMIT;
+    config.counter_l_lim = -FLOW_PCNT_LIMIT; // Never reached: only rising edges count
+    if (pcnt_unit_config(&config) != ESP_OK) return false;
+
+    if (channel.filterUs > 0) {
+      uint16_t cycles = channel.filterUs * 80;
+      pcnt_set_filter_value(unit, cycles > 1023 ? 1023 : cycles);
+      pcnt_filter_enable(unit);
+    } else {
+      pcnt_filter_disable(unit);
+    }
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+    pcnt_counter_resume(unit);
+    return true;
+  }
+
+  // Detach a unit: counter cleared and its pin reset, so the pin no longer
+  // feeds PCNT (or keeps the pull-up) once no channel uses it
+  void releaseUnit(uint8_t index) {
+    pcnt_unit_t unit = (pcnt_unit_t)index;
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+    gpio_reset_pin((gpio_num_t)set_.channels[index].pin);
+  }
+
+  static void onTimer(void* arg) {
+    FlowMeter* meter = (FlowMeter*)arg;
+    meter->snapshot();
+    if (meter->listener_ != NULL) meter->listener_();
+  }
+
+  // Runs on the esp_timer task: fold each counter's progress into the totals.
+  // stop() runs a final one on the loop task, and esp_timer_stop() does not
+  // wait for a callback already running, so the counter reads and the
+  // updates of last_ and the totals all happen under mux_: two snapshots
+  // cannot both count the same pulses.
+  void snapshot() {
+    portENTER_CRITICAL(&mux_);
+    int64_t nowUs = esp_timer_get_time();
+    float minutes = (nowUs - lastSnapshotUs_) / 60000000.0f;
+    lastSnapshotUs_ = nowUs;
+    for (uint8_t i = 0; i < set_.count; i++) {
+      int16_t count;
+      if (pcnt_get_counter_value((pcnt_unit_t)i, &count) != ESP_OK) count = last_[i];
+      uint16_t delta = (uint16_t)((count - last_[i] + FLOW_PCNT_LIMIT) % FLOW_PCNT_LIMIT);
+      last_[i] = count;
+      pulses_[i] += delta;
+      rates_[i] = minutes > 0 ? delta / set_.channels[i].pulsesPerLiter / minutes : 0;
+    }
+    snapshots_++;
+    portEXIT_CRITICAL(&mux_);
+  }
+
+  esp_timer_handle_t timer_ = NULL;
+  int64_t lastSnapshotUs_ = 0;
+#endif
+
+  FlowSet set_ = {};
+  bool active_ = false;
+  void (*listener_)() = NULL;
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+  uint64_t pulses_[FLOW_MAX_CHANNELS] = {};
+  uint64_t saved_[FLOW_MAX_CHANNELS] = {};
+  float rates_[FLOW_MAX_CHANNELS] = {};
+  int16_t last_[FLOW_MAX_CHANNELS] = {};
+  volatile uint32_t snapshots_ = 0;
+  char totalNames_[FLOW_MAX_CHANNELS][FLOW_MAX_NAME + 7];
+};
@@ -0,0 +1,304 @@
+/*
+ * Gorilla-style telemetry batch codec
+ *
+ * Compact columnar encoding for a batch of samples that share timestamps
+ * (e.g. one row per second, one column per sensor), after Facebook's Gorilla
+ * TSDB paper:
+ *
+ * - timestamps (uint32 ms) are stored as delta-of-delta: a steady sampling
+ *   interval costs 1 bit per sample, a few ms of jitter 9 bits
+ * - values (float32) are XORed with the previous value of the same column:
+ *   a repeated value costs 1 bit, a small change only its meaningful bits
+ *
+ * Batch layout (bit stream is MSB first):
+ *
+ *   byte 0     format version (GORILLA_FORMAT_VERSION)
+ *   byte 1     number of value columns
+ *   byte 2-3   number of samples, little endian
+ *   bits       timestamp column, then each value column in order
+ *
+ *   timestamp column: first timestamp raw (32 bits), then per sample the
+ *   delta-of-delta (previous delta starts at 0):
+ *     '0'                 dod == 0
+ *     '10'   + 7 bits     dod in [-64, 63]
+ *     '110'  + 9 bits     dod in [-256, 255]
+ *     '1110' + 12 bits    dod in [-2048, 2047]
+ *     '1111' + 32 bits    anything else (modulo 2^32)
+ *
+ *   value column: first value raw (32 bits), then per sample xor = bits ^ prev:
+ *     '0'                 xor == 0
+ *     '10'  + bits        meaningful bits fit the previous leading/trailing window
+ *     '11'  + 5 bits leading zeros + 5 bits (length - 1) + length bits
+ *
+ * Only <stdint.h>/<string.h> are used so the same header builds for the
+ * ESP32 and for Linux tools. The bridge's TypeScript decoder
+ * (services/saphari-bridge/src/telemetry/gorilla.ts) mirrors this layout.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define GORILLA_FORMAT_VERSION 1
+#define GORILLA_HEADER_BYTES 4
+#define GORILLA_MAX_COLUMNS 16
+
+// Worst case encoded size, for sizing output buffers
+#define GORILLA_MAX_BYTES(samples, columns) \
+  (GORILLA_HEADER_BYTES + (((size_t)(samples) * (36 + (size_t)(columns) * 44)) + 7) / 8 + 1)
+
+class GorillaBitWriter {
+public:
+  GorillaBitWriter(uint8_t* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity) {}
+
+  // Append the low `bits` bits of value (bits <= 32). False once full.
+  bool write(uint32_t value, uint8_t bits) {
+    if (overflow_ || bitPos_ + bits > capacity_ * 8) {
+      overflow_ = true;
+      return false;
+    }
+    while (bits > 0) {
+      uint8_t used = bitPos_ & 7;
+      uint8_t room = 8 - used;
+      uint8_t n = bits < room ? bits : room;
+      uint8_t chunk = (uint8_t)((value >> (bits - n)) & ((1u << n) - 1));
+      if (used == 0) buffer_[bitPos_ >> 3] = 0;
+      buffer_[bitPos_ >> 3] |= (uint8_t)(chunk << (room - n));
+      bits -= n;
+      bitPos_ += n;
+    }
+    return true;
+  }
+
+  size_t bytes() const { return (bitPos_ + 7) / 8; }
+  bool overflowed() const { return overflow_; }
+
+private:
+  uint8_t* buffer_;
+  size_t capacity_;
+  size_t bitPos_ = 0;
+  bool overflow_ = false;
+};
+
+class GorillaBitReader {
+public:
+  GorillaBitReader(const uint8_t* buffer, size_t length) : buffer_(buffer), length_(length) {}
+
+  // Read `bits` bits (<= 32). Returns 0 and sets failed() past the end.
+  uint32_t read(uint8_t bits) {
+    if (failed_ || bitPos_ + bits > length_ * 8) {
+      failed_ = true;
+      return 0;
+    }
+    uint32_t value = 0;
+    while (bits > 0) {
+      uint8_t used = bitPos_ & 7;
+      uint8_t room = 8 - used;
+      uint8_t n = bits < room ? bits : room;
+      uint8_t chunk = (uint8_t)((buffer_[bitPos_ >> 3] >> (room - n)) & ((1u << n) - 1));
+      value = (value << n) | chunk;
+      bits -= n;
+      bitPos_ += n;
+    }
+    return value;
+  }
+
+  bool failed() const { return failed_; }
+
+private:
+  const uint8_t* buffer_;
+  size_t length_;
+  size_t bitPos_ = 0;
+  bool failed_ = false;
+};
+
+// Delta-of-delta timestamp column
+class GorillaTimestampEncoder {
+public:
+  bool append(GorillaBitWriter& out, uint32_t timestamp) {
+    if (first_) {
+      first_ = false;
+      prev_ = timestamp;
+      return out.write(timestamp, 32);
+    }
+    uint32_t delta = timestamp - prev_;
+    int32_t dod = (int32_t)(delta - prevDelta_);
+    prev_ = timestamp;
+    prevDelta_ = delta;
+
+    if (dod == 0) return out.write(0x0, 1);
+    if (dod >= -64 && dod <= 63) return out.write(0x2, 2) && out.write((uint32_t)dod & 0x7F, 7);
+    if (dod >= -256 && dod <= 255) return out.write(0x6, 3) && out.write((uint32_t)dod & 0x1FF, 9);
+    if (dod >= -2048 && dod <= 2047) return out.write(0xE, 4) && out.write((uint32_t)dod & 0xFFF, 12);
+    return out.write(0xF, 4) && out.write((uint32_t)dod, 32);
+  }
+
+private:
+  bool first_ = true;
+  uint32_t prev_ = 0;
+  uint32_t prevDelta_ = 0;
+};
+
+class GorillaTimestampDecoder {
+public:
+  uint32_t next(GorillaBitReader& in) {
+    if (first_) {
+      first_ = false;
+      prev_ = in.read(32);
+      return prev_;
+    }
+    uint32_t dod;
+    if (in.read(1) == 0) dod = 0;
+    else if (in.read(1) == 0) dod = signExtend(in.read(7), 7);
+    else if (in.read(1) == 0) dod = signExtend(in.read(9), 9);
+    else if (in.read(1) == 0) dod = signExtend(in.read(12), 12);
+    else dod = in.read(32);
+    prevDelta_ += dod;
+    prev_ += prevDelta_;
+    return prev_;
+  }
+
+private:
+  static uint32_t signExtend(uint32_t value, uint8_t bits) {
+    return (value & (1u << (bits - 1))) ? value | ~((1u << bits) - 1) : value;
+  }
+
+  bool first_ = true;
+  uint32_t prev_ = 0;
+  uint32_t prevDelta_ = 0;
+};
+
+inline uint32_t gorillaFloatBits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline float gorillaBitsFloat(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+inline uint8_t gorillaLeadingZeros(uint32_t x) {
+  uint8_t n = 0;
+  for (uint32_t mask = 0x80000000UL; mask && !(x & mask); mask >>= 1) n++;
+  return n;
+}
+
+inline uint8_t gorillaTrailingZeros(uint32_t x) {
+  uint8_t n = 0;
+  for (uint32_t mask = 1; mask && !(x & mask); mask <<= 1) n++;
+  return n;
+}
+
+// XOR float column
+class GorillaValueEncoder {
+public:
+  bool append(GorillaBitWriter& out, float value) {
+    uint32_t bits = gorillaFloatBits(value);
+    if (first_) {
+      first_ = false;
+      prev_ = bits;
+      return out.write(bits, 32);
+    }
+    uint32_t x = bits ^ prev_;
+    prev_ = bits;
+    if (x == 0) return out.write(0x0, 1);
+
+    uint8_t leading = gorillaLeadingZeros(x);
+    uint8_t trailing = gorillaTrailingZeros(x);
+    if (window_ && leading >= leading_ && trailing >= trailing_) {
+      uint8_t length = 32 - leading_ - trailing_;
+      return out.write(0x2, 2) && out.write(x >> trailing_, length);
+    }
+
+    uint8_t length = 32 - leading - trailing;
+    leading_ = leading;
+    trailing_ = trailing;
+    window_ = true;
+    return out.write(0x3, 2) && out.write(leading, 5) && out.write(length - 1, 5) &&
+           out.write(x >> trailing, length);
+  }
+
+private:
+  bool first_ = true;
+  bool window_ = false;
+  uint32_t prev_ = 0;
+  uint8_t leading_ = 0;
+  uint8_t trailing_ = 0;
+};
+
+class GorillaValueDecoder {
+public:
+  float next(GorillaBitReader& in) {
+    if (first_) {
+      first_ = false;
+      prev_ = in.read(32);
+      return gorillaBitsFloat(prev_);
+    }
+    if (in.read(1) == 1) {
+      if (in.read(1) == 1) {
+        leading_ = in.read(5);
+        uint8_t length = in.read(5) + 1;
+        trailing_ = 32 - leading_ - length;
+      }
+      uint8_t length = 32 - leading_ - trailing_;
+      prev_ ^= in.read(length) << trailing_;
+    }
+    return gorillaBitsFloat(prev_);
+  }
+
+private:
+  bool first_ = true;
+  uint32_t prev_ = 0;
+  uint8_t leading_ = 0;
+  uint8_t trailing_ = 0;
+};
+
+// Encode a batch: timestamps[count] and columns[c][count]. Returns the
+// encoded size, or 0 if out is too small (see GORILLA_MAX_BYTES).
+inline size_t gorillaEncodeBatch(const uint32_t* timestamps, const float* const* columns,
+                                 uint8_t columnCount, uint16_t count,
+                                 uint8_t* out, size_t capacity) {
+  if (capacity < GORILLA_HEADER_BYTES || columnCount > GORILLA_MAX_COLUMNS) return 0;
+  out[0] = GORILLA_FORMAT_VERSION;
+  out[1] = columnCount;
+  out[2] = count & 0xFF;
+  out[3] = count >> 8;
+
+  GorillaBitWriter writer(out + GORILLA_HEADER_BYTES, capacity - GORILLA_HEADER_BYTES);
+  GorillaTimestampEncoder time;
+  for (uint16_t i = 0; i < count; i++) time.append(writer, timestamps[i]);
+  for (uint8_t c = 0; c < columnCount; c++) {
+    GorillaValueEncoder column;
+    for (uint16_t i = 0; i < count; i++) column.append(writer, columns[c][i]);
+  }
+  return writer.overflowed() ? 0 : GORILLA_HEADER_BYTES + writer.bytes();
+}
+
+// Read the header of an encoded batch
+inline bool gorillaBatchInfo(const uint8_t* data, size_t length, uint8_t& columnCount, uint16_t& count) {
+  if (length < GORILLA_HEADER_BYTES || data[0] != GORILLA_FORMAT_VERSION) return false;
+  columnCount = data[1];
+  count = data[2] | (uint16_t)(data[3] << 8);
+  return columnCount <= GORILLA_MAX_COLUMNS;
+}
+
+// Decode a batch into caller-sized arrays (see gorillaBatchInfo)
+inline bool gorillaDecodeBatch(const uint8_t* data, size_t length,
+                               uint32_t* timestamps, float* const* columns) {
+  uint8_t columnCount;
+  uint16_t count;
+  if (!gorillaBatchInfo(data, length, columnCount, count)) return false;
+
+  GorillaBitReader reader(data + GORILLA_HEADER_BYTES, length - GORILLA_HEADER_BYTES);
+  GorillaTimestampDecoder time;
+  for (uint16_t i = 0; i < count; i++) timestamps[i] = time.next(reader);
+  for (uint8_t c = 0; c < columnCount; c++) {
+    GorillaValueDecoder column;
+    for (uint16_t i = 0; i < count; i++) columns[c][i] = column.next(reader);
+  }
+  return !reader.failed();
+}
@@ -0,0 +1,285 @@
+/*
+ * On-device time-series history
+ *
+ * Sensor values are recorded once per second into a fixed set of RAM rings,
+ * one per resolution tier. Each coarser tier is fed with the average of the
+ * finer tier's samples, so recent data is kept at full resolution and older
+ * data at progressively lower resolution:
+ *
+ *   tier 0:  1s x 3600  (last hour)
+ *   tier 1: 10s x  720  (last 2 hours)
+ *   tier 2: 60s x 1440  (last 24 hours)
+ *
+ * Values are stored as int16 fixed point (x10). Seconds the loop did not
+ * record (e.g. while blocked reconnecting) are stored as HISTORY_NO_DATA and
+ * skipped when averaging, so timestamps stay aligned across tiers.
+ *
+ * A query is planned against the finest tier that covers the requested range
+ * and read back point by point, so the caller can stream the answer in chunks
+ * without copying it. Times are seconds relative to boot.
+ *
+ * With -DHISTORY_PERSIST the most recent part of the coarsest tier is saved
+ * to NVS (namespace "history") and restored at boot as if it immediately
+ * preceded the boot - the length of the reboot gap is not recorded.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#ifdef HISTORY_PERSIST
+#include <Preferences.h>
+#endif
+
+#define HISTORY_MAX_SERIES 4
+#define HISTORY_TIER_COUNT 3
+#define HISTORY_TIER0_CAPACITY 3600
+#define HISTORY_TIER1_CAPACITY 720
+#define HISTORY_TIER2_CAPACITY 1440
+#define HISTORY_TIER1_RESOLUTION_S 10
+#define HISTORY_TIER2_RESOLUTION_S 60
+#define HISTORY_MAX_POINTS 3600        // Per query
+#define HISTORY_PERSIST_POINTS 360     // Coarsest-tier samples kept in NVS (6h)
+#define HISTORY_NO_DATA INT16_MIN
+#define HISTORY_SCALE 10
+
+struct HistoryQuery {
+  uint8_t series;
+  uint8_t tier;
+  uint16_t group;      // Tier samples averaged into one point
+  uint32_t firstSeq;   // Tier sequence number of the first sample of point 0
+  uint32_t points;
+  int32_t startS;      // Start of point 0, seconds relative to boot
+  uint32_t stepS;      // Seconds per point
+};
+
+class HistoryBuffer {
+public:
+  HistoryBuffer(const char* const* names, uint8_t count)
+    : names_(names), count_(count > HISTORY_MAX_SERIES ? HISTORY_MAX_SERIES : count) {
+    static const uint16_t resolutions[HISTORY_TIER_COUNT] = {
+      1, HISTORY_TIER1_RESOLUTION_S, HISTORY_TIER2_RESOLUTION_S
+    };
+    static const uint16_t capacities[HISTORY_TIER_COUNT] = {
+      HISTORY_TIER0_CAPACITY, HISTORY_TIER1_CAPACITY, HISTORY_TIER2_CAPACITY
+    };
+    int16_t* storage[HISTORY_TIER_COUNT] = {&tier0_[0][0], &tier1_[0][0], &tier2_[0][0]};
+    for (uint8_t t = 0; t < HISTORY_TIER_COUNT; t++) {
+      tiers_[t].resolutionS = resolutions[t];
+      tiers_[t].capacity = capacities[t];
+      tiers_[t].data = storage[t];
+    }
+    clear();
+  }
+
+  uint8_t seriesCount() const { return count_; }
+  const char* seriesName(uint8_t series) const { return series < count_ ? names_[series] : ""; }
+
+  int seriesIndex(const char* name) const {
+    for (uint8_t i = 0; i < count_; i++) {
+      if (strcmp(names_[i], name) == 0) return i;
+    }
+    return -1;
+  }
+
+  uint32_t retentionS(uint8_t tier) const {
+    return (uint32_t)tiers_[tier].capacity * tiers_[tier].resolutionS;
+  }
+
+  // Record one value per series for second nowS (seconds since boot).
+  // Call at least once per second; missed seconds are filled with gaps.
+  void record(uint32_t nowS, const float* values) {
+    uint32_t now = nowS + offsetS_;
+    uint32_t next = tiers_[0].pushed;
+    if (now < next) return;  // Already have this second
+
+    if (now - next > retentionS(HISTORY_TIER_COUNT - 1)) {
+      // Gap longer than everything we keep - start over at this second
+      clear();
+      for (uint8_t t = 0; t < HISTORY_TIER_COUNT; t++) tiers_[t].pushed = 0;
+      offsetS_ = -(int32_t)nowS;
+      now = next = 0;
+    }
+
+    int16_t gap[HISTORY_MAX_SERIES];
+    for (uint8_t i = 0; i < HISTORY_MAX_SERIES; i++) gap[i] = HISTORY_NO_DATA;
+    for (; next < now; next++) push(0, gap);
+
+    int16_t sample[HISTORY_MAX_SERIES];
+    for (uint8_t i = 0; i < HISTORY_MAX_SERIES; i++) {
+      sample[i] = i < count_ ? toFixed(values[i]) : HISTORY_NO_DATA;
+    }
+    push(0, sample);
+  }
+
+  // Plan a query for the last rangeS seconds at (at least) resolutionS
+  // seconds per point. Uses the finest tier that covers the range.
+  bool plan(uint8_t series, uint32_t rangeS, uint32_t resolutionS, HistoryQuery& query) const {
+    if (series >= count_ || rangeS == 0) return false;
+
+    uint8_t tier = 0;
+    while (tier < HISTORY_TIER_COUNT - 1 && retentionS(tier) < rangeS) tier++;
+    const Tier& t = tiers_[tier];
+    if (rangeS > retentionS(tier)) rangeS = retentionS(tier);
+
+    uint32_t group = (resolutionS + t.resolutionS - 1) / t.resolutionS;
+    if (group == 0) group = 1;
+    uint32_t samples = (rangeS + t.resolutionS - 1) / t.resolutionS;
+    if ((samples + group - 1) / group > HISTORY_MAX_POINTS) {
+      group = (samples + HISTORY_MAX_POINTS - 1) / HISTORY_MAX_POINTS;
+    }
+    if (group > t.capacity) group = t.capacity;
+
+    uint32_t points = (samples + group - 1) / group;
+    if ((uint64_t)points * group > t.pushed) points = t.pushed / group;
+    if (points == 0) return false;
+
+    query.series = series;
+    query.tier = tier;
+    query.group = group;
+    query.points = points;
+    query.firstSeq = t.pushed - points * group;
+    query.stepS = group * t.resolutionS;
+    query.startS = (int32_t)(query.firstSeq * t.resolutionS) - offsetS_;
+    return true;
+  }
+
+  // Average of point i of a planned query. False if no sample in that
+  // point is available (gap, or already overwritten by newer data).
+  bool point(const HistoryQuery& query, uint32_t i, float& value) const {
+    const Tier& t = tiers_[query.tier];
+    const int16_t* data = t.data + (size_t)query.series * t.capacity;
+    int32_t sum = 0;
+    uint16_t n = 0;
+    uint32_t seq = query.firstSeq + i * query.group;
+    for (uint16_t k = 0; k < query.group; k++, seq++) {
+      if (seq >= t.pushed || t.pushed - seq > t.capacity) continue;
+      int16_t v = data[seq % t.capacity];
+      if (v == HISTORY_NO_DATA) continue;
+      sum += v;
+      n++;
+    }
+    if (n == 0) return false;
+    value = (float)sum / n / HISTORY_SCALE;
+    return true;
+  }
+
+#ifdef HISTORY_PERSIST
+  // Save the newest coarsest-tier samples (oldest first) to NVS
+  bool save() {
+    const Tier& t = tiers_[HISTORY_TIER_COUNT - 1];
+    uint32_t n = t.pushed < HISTORY_PERSIST_POINTS ? t.pushed : HISTORY_PERSIST_POINTS;
+    if (n > t.capacity) n = t.capacity;
+
+    Preferences prefs;
+    if (!prefs.begin("history", false)) return false;
+    int16_t* chunk = (int16_t*)malloc(n * sizeof(int16_t) + 1);
+    bool ok = chunk != NULL;
+    for (uint8_t s = 0; ok && s < count_; s++) {
+      const int16_t* data = t.data + (size_t)s * t.capacity;
+      for (uint32_t i = 0; i < n; i++) {
+        chunk[i] = data[(t.pushed - n + i) % t.capacity];
+      }
+      char key[4] = {'s', (char)('0' + s), '\0'};
+      ok = prefs.putBytes(key, chunk, n * sizeof(int16_t)) == n * sizeof(int16_t);
+    }
+    free(chunk);
+    if (ok) ok = prefs.putUInt("n", n) == sizeof(uint32_t);
+    prefs.end();
+    return ok;
+  }
+
+  // Restore saved samples as the history immediately preceding boot.
+  // Call once, before the first record().
+  uint32_t restore() {
+    Preferences prefs;
+    if (!prefs.begin("history", true)) return 0;
+    Tier& t = tiers_[HISTORY_TIER_COUNT - 1];
+    uint32_t n = prefs.getUInt("n", 0);
+    if (n > HISTORY_PERSIST_POINTS || n > t.capacity) n = 0;
+    for (uint8_t s = 0; n > 0 && s < count_; s++) {
+      char key[4] = {'s', (char)('0' + s), '\0'};
+      int16_t* data = t.data + (size_t)s * t.capacity;
+      if (prefs.getBytes(key, data, n * sizeof(int16_t)) != n * sizeof(int16_t)) {
+        for (uint32_t i = 0; i < n; i++) data[i] = HISTORY_NO_DATA;
+      }
+    }
+    prefs.end();
+
+    // Shift the clock so the restored samples end at boot; finer tiers
+    // start out empty at the matching sequence numbers
+    t.pushed = n;
+    offsetS_ = n * t.resolutionS;
+    for (uint8_t i = 0; i < HISTORY_TIER_COUNT - 1; i++) {
+      tiers_[i].pushed = offsetS_ / tiers_[i].resolutionS;
+    }
+    return n;
+  }
+#endif
+
+private:
+  struct Tier {
+    uint16_t resolutionS;
+    uint16_t capacity;
+    int16_t* data;                    // [series][capacity]
+    uint32_t pushed;                  // Sequence number of the next sample
+    int32_t sum[HISTORY_MAX_SERIES];  // Finer samples accumulated toward the next one
+    uint8_t sumCount[HISTORY_MAX_SERIES];
+    uint8_t pending;
+  };
+
+  static int16_t toFixed(float value) {
+    if (isnan(value)) return HISTORY_NO_DATA;
+    float scaled = value * HISTORY_SCALE;
+    if (scaled > INT16_MAX) return INT16_MAX;
+    if (scaled < INT16_MIN + 1) return INT16_MIN + 1;
+    return (int16_t)lroundf(scaled);
+  }
+
+  void clear() {
+    for (uint8_t t = 0; t < HISTORY_TIER_COUNT; t++) {
+      Tier& tier = tiers_[t];
+      for (size_t i = 0; i < (size_t)HISTORY_MAX_SERIES * tier.capacity; i++) {
+        tier.data[i] = HISTORY_NO_DATA;
+      }
+      memset(tier.sum, 0, sizeof(tier.sum));
+      memset(tier.sumCount, 0, sizeof(tier.sumCount));
+      tier.pending = 0;
+    }
+  }
+
+  // Append a sample to a tier and cascade the average into the next one
+  void push(uint8_t t, const int16_t* sample) {
+    Tier& tier = tiers_[t];
+    size_t index = tier.pushed % tier.capacity;
+    for (uint8_t s = 0; s < HISTORY_MAX_SERIES; s++) {
+      tier.data[(size_t)s * tier.capacity + index] = sample[s];
+    }
+    tier.pushed++;
+
+    if (t + 1 >= HISTORY_TIER_COUNT) return;
+    Tier& next = tiers_[t + 1];
+    for (uint8_t s = 0; s < HISTORY_MAX_SERIES; s++) {
+      if (sample[s] == HISTORY_NO_DATA) continue;
+      next.sum[s] += sample[s];
+      next.sumCount[s]++;
+    }
+    if (++next.pending < next.resolutionS / tier.resolutionS) return;
+
+    int16_t average[HISTORY_MAX_SERIES];
+    for (uint8_t s = 0; s < HISTORY_MAX_SERIES; s++) {
+      average[s] = next.sumCount[s] ? (int16_t)(next.sum[s] / next.sumCount[s]) : HISTORY_NO_DATA;
+      next.sum[s] = 0;
+      next.sumCount[s] = 0;
+    }
+    next.pending = 0;
+    push(t + 1, average);
+  }
+
+  const char* const* names_;
+  uint8_t count_;
+  int32_t offsetS_ = 0;  // Internal clock = seconds since boot + offset
+  Tier tiers_[HISTORY_TIER_COUNT];
+  int16_t tier0_[HISTORY_MAX_SERIES][HISTORY_TIER0_CAPACITY];
+  int16_t tier1_[HISTORY_MAX_SERIES][HISTORY_TIER1_CAPACITY];
+  int16_t tier2_[HISTORY_MAX_SERIES][HISTORY_TIER2_CAPACITY];
+};
@@ -0,0 +1,229 @@
+/*
+ * Host (Linux) stand-in for the Arduino-ESP32 core
+ *
+ * Just enough of the core API for the firmware sketches, PubSubClient and
+ * ArduinoJson to build and run as a normal Linux process (see
+ * host/rtt_bench.cpp). GPIO, LEDC and ADC calls act on an in-memory pin
+ * table; time comes from the monotonic clock (a virtual clock with
+ * -DHOST_SIM, see host/soak_sim.cpp); Serial writes to stdout.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define DEC 10
+#define HEX 16
+#define SERIAL_8N1 0x800001c
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define ARDUINO_RUNNING_CORE 1
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+uint16_t analogRead(uint8_t pin);
+double ledcSetup(uint8_t channel, double freq, uint8_t resolutionBits);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcWrite(uint8_t channel, uint32_t duty);
+
+// Hardware timers (Arduino-ESP32 2.x API). Alarms fire synchronously the
+// next time the clock is read or the program sleeps.
+typedef struct hw_timer_s hw_timer_t;
+hw_timer_t* timerBegin(uint8_t num, uint16_t divider, bool countUp);
+void timerAttachInterrupt(hw_timer_t* timer, void (*fn)(void), bool edge);
+void timerAlarmWrite(hw_timer_t* timer, uint64_t alarmValue, bool autoreload);
+void timerAlarmEnable(hw_timer_t* timer);
+void timerAlarmDisable(hw_timer_t* timer);
+void timerEnd(hw_timer_t* timer);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+class String {
+public:
+  String() {}
+  String(const char* s) : s_(s ? s : "") {}
+  String(const std::string& s) : s_(s) {}
+  explicit String(char c) : s_(1, c) {}
+  String(int value, unsigned char base = DEC) : s_(format((long)value, base)) {}
+  String(unsigned int value, unsigned char base = DEC) : s_(formatUnsigned(value, base)) {}
+  String(long value, unsigned char base = DEC) : s_(format(value, base)) {}
+  String(unsigned long value, unsigned char base = DEC) : s_(formatUnsigned(value, base)) {}
+  String(float value, unsigned int decimals = 2) : s_(formatFloat(value, decimals)) {}
+  String(double value, unsigned int decimals = 2) : s_(formatFloat(value, decimals)) {}
+
+  const char* c_str() const { return s_.c_str(); }
+  unsigned int length() const { return s_.size(); }
+  bool isEmpty() const { return s_.empty(); }
+  void reserve(unsigned int size) { s_.reserve(size); }
+  char operator[](unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+
+  bool concat(const char* s) { s_ += s ? s : ""; return true; }
+  bool concat(const char* s, unsigned int n) { s_.append(s, n); return true; }
+  bool concat(char c) { s_ += c; return true; }
+  String& operator+=(const String& rhs) { s_ += rhs.s_; return *this; }
+  String& operator+=(const char* rhs) { concat(rhs); return *this; }
+  String& operator+=(char c) { s_ += c; return *this; }
+
+  bool operator==(const String& rhs) const { return s_ == rhs.s_; }
+  bool operator==(const char* rhs) const { return s_ == (rhs ? rhs : ""); }
+  bool operator!=(const String& rhs) const { return s_ != rhs.s_; }
+  bool operator!=(const char* rhs) const { return !(*this == rhs); }
+  bool equals(const String& rhs) const { return s_ == rhs.s_; }
+
+  bool startsWith(const String& prefix) const { return s_.compare(0, prefix.s_.size(), prefix.s_) == 0; }
+  bool endsWith(const String& suffix) const {
+    return s_.size() >= suffix.s_.size() &&
+           s_.compare(s_.size() - suffix.s_.size(), suffix.s_.size(), suffix.s_) == 0;
+  }
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t at = s_.find(c, from);
+    return at == std::string::npos ? -1 : (int)at;
+  }
+  int indexOf(const String& str, unsigned int from = 0) const {
+    size_t at = s_.find(str.s_, from);
+    return at == std::string::npos ? -1 : (int)at;
+  }
+  String substring(unsigned int begin) const { return begin < s_.size() ? String(s_.substr(begin)) : String(); }
+  String substring(unsigned int begin, unsigned int end) const {
+    if (begin > end) std::swap(begin, end);
+    return begin < s_.size() ? String(s_.substr(begin, end - begin)) : String();
+  }
+  long toInt() const { return atol(s_.c_str()); }
+  float toFloat() const { return (float)atof(s_.c_str()); }
+  void trim() {
+    size_t first = s_.find_first_not_of(" \t\r\n");
+    size_t last = s_.find_last_not_of(" \t\r\n");
+    s_ = first == std::string::npos ? std::string() : s_.substr(first, last - first + 1);
+  }
+
+  friend String operator+(const String& lhs, const String& rhs) { return String(lhs.s_ + rhs.s_); }
+  friend String operator+(const String& lhs, const char* rhs) { return String(lhs.s_ + (rhs ? rhs : "")); }
+  friend String operator+(const char* lhs, const String& rhs) { return String(std::string(lhs ? lhs : "") + rhs.s_); }
+  friend String operator+(const String& lhs, char rhs) { return String(lhs.s_ + rhs); }
+
+private:
+  static std::string format(long value, unsigned char base) {
+    if (base == DEC) return std::to_string(value);
+    return formatUnsigned((unsigned long)value, base);
+  }
+  static std::string formatUnsigned(unsigned long value, unsigned char base) {
+    char buf[8 * sizeof(long) + 1];
+    char* p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    do {
+      unsigned long digit = value % base;
+      *--p = (char)(digit < 10 ? '0' + digit : 'A' + digit - 10);
+      value /= base;
+    } while (value);
+    return p;
+  }
+  static std::string formatFloat(double value, unsigned int decimals) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimals, value);
+    return buf;
+  }
+
+  std::string s_;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+  virtual void flush() {}
+
+  size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+  size_t print(const char* s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+  size_t print(unsigned int n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+  size_t print(long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+  size_t print(unsigned long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+  size_t print(double n, int digits = 2) { return print(String(n, (unsigned int)digits)); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(const T& value) { return print(value) + println(); }
+  template <typename T> size_t println(const T& value, int format) { return print(value, format) + println(); }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  void setTimeout(unsigned long ms) { timeout_ = ms; }
+  size_t readBytes(char* buffer, size_t length);
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+protected:
+  unsigned long timeout_ = 1000;
+};
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long, uint32_t = SERIAL_8N1, int8_t = -1, int8_t = -1) {}
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override { fflush(stdout); }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial2;  // Nothing attached: reads nothing, writes are dropped
+
+class EspClass {
+public:
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  void restart();
+};
+
+extern EspClass ESP;
+
+#include "IPAddress.h"
+#include "Client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
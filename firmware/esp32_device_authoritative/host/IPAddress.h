@@ -0,0 +1,28 @@
+/*
+ * Host stand-in for the Arduino IPAddress class (IPv4 only)
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+class String;
+
+class IPAddress {
+public:
+  IPAddress() : address_(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    : address_((uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24)) {}
+  IPAddress(uint32_t address) : address_(address) {}
+
+  operator uint32_t() const { return address_; }
+  uint8_t operator[](int index) const { return (address_ >> (8 * index)) & 0xFF; }
+  bool operator==(const IPAddress& rhs) const { return address_ == rhs.address_; }
+  bool operator!=(const IPAddress& rhs) const { return address_ != rhs.address_; }
+
+  bool fromString(const char* address);
+  String toString() const;
+
+private:
+  uint32_t address_;  // Network byte order, as on the ESP32
+};
@@ -0,0 +1,29 @@
+/*
+ * Host stand-in for ESP32 Preferences (NVS): in memory, lost on exit
+ */
+
+#pragma once
+
+#include "Arduino.h"
+
+class Preferences {
+public:
+  bool begin(const char* name, bool readOnly = false);
+  void end() { namespace_.clear(); }
+  bool remove(const char* key);
+  bool clear();
+  bool isKey(const char* key);
+
+  size_t putBytes(const char* key, const void* value, size_t len);
+  size_t getBytes(const char* key, void* buf, size_t maxLen);
+  size_t getBytesLength(const char* key);
+  size_t putString(const char* key, const char* value);
+  size_t putString(const char* key, const String& value) { return putString(key, value.c_str()); }
+  String getString(const char* key, const String& defaultValue = String());
+  size_t putUInt(const char* key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+  uint32_t getUInt(const char* key, uint32_t defaultValue = 0);
+
+private:
+  std::string namespace_;
+  bool readOnly_ = false;
+};
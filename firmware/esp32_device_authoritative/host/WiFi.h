@@ -0,0 +1,71 @@
+/*
+ * Host stand-in for the ESP32 WiFi library
+ *
+ * The host is always "connected". WiFiClient is a plain TCP socket; set
+ * HOST_MQTT_ADDR=host:port to redirect every connection (e.g. to a local
+ * broker or the fault-injecting proxy in rtt_bench) regardless of the
+ * broker address compiled into the sketch.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+#define WIFI_STA 1
+
+class WiFiClass {
+public:
+  void begin(const char*, const char*) {}
+  wl_status_t status() { return WL_CONNECTED; }
+  int8_t RSSI() { return -50; }
+  int32_t channel() { return 1; }
+  String BSSIDstr() { return "00:00:00:00:00:00"; }
+  void mode(int) {}
+  void setSleep(bool) {}
+  bool disconnect(bool = false) { return true; }
+  bool reconnect() { return true; }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress gatewayIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress subnetMask() { return IPAddress(255, 0, 0, 0); }
+  IPAddress dnsIP(uint8_t = 0) { return IPAddress(127, 0, 0, 53); }
+  int hostByName(const char* host, IPAddress& result);
+};
+
+extern WiFiClass WiFi;
+
+class WiFiClient : public Client {
+public:
+  WiFiClient() {}
+  ~WiFiClient() { stop(); }
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char* host, uint16_t port) override;
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buf, size_t size) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buf, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return fd_ >= 0; }
+  int fd() const { return fd_; }
+  void setNoDelay(bool) {}
+
+private:
+  WiFiClient(const WiFiClient&);
+  WiFiClient& operator=(const WiFiClient&);
+
+  int fd_ = -1;
+};
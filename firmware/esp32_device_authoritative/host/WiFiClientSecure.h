@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for WiFiClientSecure: plain TCP, certificates are ignored.
+ * Point the sketch at a local non-TLS broker with HOST_MQTT_ADDR.
+ */
+
+#pragma once
+
+#include "WiFi.h"
+
+class WiFiClientSecure : public WiFiClient {
+public:
+  void setCACert(const char*) {}
+  void setCertificate(const char*) {}
+  void setPrivateKey(const char*) {}
+  void setInsecure() {}
+  void setHandshakeTimeout(unsigned long) {}
+  void setTimeout(uint32_t) {}
+};
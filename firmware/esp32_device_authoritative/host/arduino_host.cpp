@@ -0,0 +1,448 @@
+/*
+ * Host (Linux) implementation of the Arduino-ESP32 stand-ins in this folder
+ *
+ * With -DHOST_SIM, time and connections come from the simulation driver
+ * instead of the monotonic clock and real sockets (see host/sim.h).
+ */
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include "Preferences.h"
+#include "base64.h"
+#include "esp_timer.h"
+#include "soc/gpio_reg.h"
+#include "sim.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <map>
+#include <random>
+#include <vector>
+
+HardwareSerial Serial;
+HardwareSerial Serial2;
+EspClass ESP;
+WiFiClass WiFi;
+
+// --- Time -------------------------------------------------------------------
+
+#if defined(HOST_SIM)
+int64_t esp_timer_get_time() { return (int64_t)hostSimReadClockUs(); }
+#else
+static uint64_t monotonicUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const uint64_t bootUs = monotonicUs();
+
+int64_t esp_timer_get_time() { return (int64_t)(monotonicUs() - bootUs); }
+#endif
+
+// --- Hardware timers ------------------------------------------------------------
+
+struct hw_timer_s {
+  uint16_t divider;
+  uint64_t periodUs;
+  uint64_t nextUs;
+  bool enabled;
+  bool autoreload;
+  void (*fn)(void);
+};
+
+static hw_timer_s hwTimers[4];
+
+// Run the callbacks of alarms that are due, like the interrupts they stand in for
+static void runHwTimers() {
+  static bool running = false;
+  if (running) return;
+  running = true;
+  uint64_t now = (uint64_t)esp_timer_get_time();
+  for (hw_timer_s& timer : hwTimers) {
+    while (timer.enabled && timer.fn != NULL && timer.periodUs > 0 && now >= timer.nextUs) {
+      timer.fn();
+      if (!timer.autoreload) timer.enabled = false;
+      timer.nextUs += timer.periodUs;
+    }
+  }
+  running = false;
+}
+
+hw_timer_t* timerBegin(uint8_t num, uint16_t divider, bool) {
+  if (num >= 4) return NULL;
+  hwTimers[num] = hw_timer_s();
+  hwTimers[num].divider = divider ? divider : 1;
+  return &hwTimers[num];
+}
+
+void timerAttachInterrupt(hw_timer_t* timer, void (*fn)(void), bool) { timer->fn = fn; }
+
+void timerAlarmWrite(hw_timer_t* timer, uint64_t alarmValue, bool autoreload) {
+  timer->periodUs = alarmValue * timer->divider / 80;  // 80MHz APB clock
+  timer->autoreload = autoreload;
+}
+
+void timerAlarmEnable(hw_timer_t* timer) {
+  timer->nextUs = (uint64_t)esp_timer_get_time() + timer->periodUs;
+  timer->enabled = true;
+}
+
+void timerAlarmDisable(hw_timer_t* timer) { timer->enabled = false; }
+void timerEnd(hw_timer_t* timer) { *timer = hw_timer_s(); }
+
+unsigned long micros() {
+  runHwTimers();
+  return (unsigned long)(uint32_t)esp_timer_get_time();
+}
+
+unsigned long millis() {
+  runHwTimers();
+  return (unsigned long)(uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void delay(uint32_t ms) {
+#if defined(HOST_SIM)
+  hostSimSleepUs((uint64_t)ms * 1000);
+#else
+  struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000L};
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+#endif
+  runHwTimers();
+}
+
+void delayMicroseconds(uint32_t us) {
+#if defined(HOST_SIM)
+  hostSimSleepUs(us);
+#else
+  struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000L};
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+#endif
+  runHwTimers();
+}
+
+void yield() {}
+
+// --- GPIO / LEDC / ADC --------------------------------------------------------
+
+static uint8_t pinLevels[SOC_GPIO_PIN_COUNT];
+static int pinDuty[SOC_GPIO_PIN_COUNT];
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < SOC_GPIO_PIN_COUNT) pinLevels[pin] = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) { return pin < SOC_GPIO_PIN_COUNT ? pinLevels[pin] : LOW; }
+
+void analogWrite(uint8_t pin, int value) {
+  if (pin < SOC_GPIO_PIN_COUNT) pinDuty[pin] = value;
+}
+
+uint16_t analogRead(uint8_t pin) { return pin < SOC_GPIO_PIN_COUNT ? (uint16_t)(pinDuty[pin] * 16) : 0; }
+
+double ledcSetup(uint8_t, double freq, uint8_t) { return freq; }
+void ledcAttachPin(uint8_t, uint8_t) {}
+void ledcWrite(uint8_t, uint32_t) {}
+
+void hostGpioRegWrite(int reg, uint32_t mask) {
+  int base = (reg == GPIO_OUT1_W1TS_REG || reg == GPIO_OUT1_W1TC_REG) ? 32 : 0;
+  uint8_t level = (reg == GPIO_OUT_W1TS_REG || reg == GPIO_OUT1_W1TS_REG) ? HIGH : LOW;
+  for (int bit = 0; bit < 32 && base + bit < SOC_GPIO_PIN_COUNT; bit++) {
+    if (mask & (1UL << bit)) pinLevels[base + bit] = level;
+  }
+}
+
+// --- Random -------------------------------------------------------------------
+
+static std::mt19937 rng(12345);
+
+long random(long howbig) { return howbig <= 0 ? 0 : (long)(rng() % (unsigned long)howbig); }
+long random(long howsmall, long howbig) { return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall); }
+void randomSeed(unsigned long seed) { rng.seed(seed); }
+
+// --- ESP ----------------------------------------------------------------------
+
+uint32_t EspClass::getFreeHeap() { return 200000; }
+uint32_t EspClass::getMinFreeHeap() { return 180000; }
+
+void EspClass::restart() {
+#if defined(HOST_SIM)
+  hostSimRestart();
+#endif
+  fflush(stdout);
+  exit(0);
+}
+
+// --- Print / Stream / Serial --------------------------------------------------
+
+size_t Print::printf(const char* format, ...) {
+  char buf[512];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len < 0) return 0;
+  return write((const uint8_t*)buf, (size_t)len < sizeof(buf) ? (size_t)len : sizeof(buf) - 1);
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  unsigned long start = millis();
+  while (count < length && millis() - start < timeout_) {
+    int c = read();
+    if (c < 0) {
+      delay(1);
+      continue;
+    }
+    buffer[count++] = (char)c;
+  }
+  return count;
+}
+
+// Only Serial is wired to stdout; other UARTs swallow their output
+#if defined(HOST_SIM)
+static bool serialToStdout(const HardwareSerial* port) { return port == &Serial && hostSimSerialEnabled(); }
+#else
+static bool serialToStdout(const HardwareSerial* port) { return port == &Serial; }
+#endif
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (!serialToStdout(this)) return 1;
+  return fputc(c, stdout) == EOF ? 0 : 1;
+}
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if (!serialToStdout(this)) return size;
+  return fwrite(buffer, 1, size, stdout);
+}
+
+// --- IPAddress ----------------------------------------------------------------
+
+bool IPAddress::fromString(const char* address) {
+  struct in_addr parsed;
+  if (inet_pton(AF_INET, address, &parsed) != 1) return false;
+  address_ = parsed.s_addr;
+  return true;
+}
+
+String IPAddress::toString() const {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+  return String(buf);
+}
+
+// --- WiFi / WiFiClient --------------------------------------------------------
+
+int WiFiClass::hostByName(const char* host, IPAddress& result) {
+#if defined(HOST_SIM)
+  (void)host;
+  result = IPAddress(10, 0, 0, 1);  // Every name is the simulated broker
+  return 1;
+#endif
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  struct addrinfo* info = NULL;
+  if (getaddrinfo(host, NULL, &hints, &info) != 0 || info == NULL) return 0;
+  result = IPAddress((uint32_t)((struct sockaddr_in*)info->ai_addr)->sin_addr.s_addr);
+  freeaddrinfo(info);
+  return 1;
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+  stop();
+#if defined(HOST_SIM)
+  (void)ip;
+  fd_ = hostSimConnect(port);
+  return fd_ >= 0 ? 1 : 0;
+#endif
+  fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd_ < 0) return 0;
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = (uint32_t)ip;
+  if (::connect(fd_, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    stop();
+    return 0;
+  }
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return 1;
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+  // HOST_MQTT_ADDR=host:port overrides the address compiled into the sketch
+  std::string target = host;
+  const char* redirect = getenv("HOST_MQTT_ADDR");
+  if (redirect && *redirect) {
+    std::string value = redirect;
+    size_t colon = value.rfind(':');
+    target = value.substr(0, colon);
+    if (colon != std::string::npos) port = (uint16_t)atoi(value.c_str() + colon + 1);
+  }
+  IPAddress ip;
+  if (!ip.fromString(target.c_str()) && !WiFi.hostByName(target.c_str(), ip)) return 0;
+  return connect(ip, port);
+}
+
+size_t WiFiClient::write(const uint8_t* buf, size_t size) {
+#if defined(HOST_SIM)
+  hostSimPump();  // Let the broker drain its end first
+#endif
+  size_t sent = 0;
+  while (fd_ >= 0 && sent < size) {
+    ssize_t n = send(fd_, buf + sent, size - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      stop();
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+int WiFiClient::available() {
+#if defined(HOST_SIM)
+  hostSimPump();
+#endif
+  if (fd_ < 0) return 0;
+  int count = 0;
+  if (ioctl(fd_, FIONREAD, &count) != 0) return 0;
+  return count;
+}
+
+int WiFiClient::read() {
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+int WiFiClient::read(uint8_t* buf, size_t size) {
+  if (fd_ < 0) return -1;
+  ssize_t n = recv(fd_, buf, size, MSG_DONTWAIT);
+  if (n == 0) {
+    stop();  // Peer closed
+    return -1;
+  }
+  return n < 0 ? -1 : (int)n;
+}
+
+int WiFiClient::peek() {
+  uint8_t b;
+  if (fd_ < 0 || recv(fd_, &b, 1, MSG_PEEK | MSG_DONTWAIT) != 1) return -1;
+  return b;
+}
+
+void WiFiClient::stop() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+uint8_t WiFiClient::connected() {
+#if defined(HOST_SIM)
+  hostSimPump();
+#endif
+  if (fd_ < 0) return 0;
+  struct pollfd pfd = {fd_, POLLIN, 0};
+  if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLIN))) {
+    uint8_t b;
+    ssize_t n = recv(fd_, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      stop();
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// --- Preferences --------------------------------------------------------------
+
+static std::map<std::string, std::vector<uint8_t> > nvs;
+
+bool Preferences::begin(const char* name, bool readOnly) {
+  namespace_ = std::string(name) + "/";
+  readOnly_ = readOnly;
+  return true;
+}
+
+bool Preferences::remove(const char* key) {
+  return !readOnly_ && nvs.erase(namespace_ + key) > 0;
+}
+
+bool Preferences::clear() {
+  if (readOnly_) return false;
+  for (std::map<std::string, std::vector<uint8_t> >::iterator it = nvs.begin(); it != nvs.end();) {
+    if (it->first.compare(0, namespace_.size(), namespace_) == 0) nvs.erase(it++);
+    else ++it;
+  }
+  return true;
+}
+
+bool Preferences::isKey(const char* key) { return nvs.count(namespace_ + key) > 0; }
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) {
+  if (readOnly_) return 0;
+  const uint8_t* bytes = (const uint8_t*)value;
+  nvs[namespace_ + key].assign(bytes, bytes + len);
+  return len;
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+  std::map<std::string, std::vector<uint8_t> >::iterator it = nvs.find(namespace_ + key);
+  if (it == nvs.end() || it->second.size() > maxLen) return 0;
+  if (!it->second.empty()) memcpy(buf, &it->second[0], it->second.size());
+  return it->second.size();
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  std::map<std::string, std::vector<uint8_t> >::iterator it = nvs.find(namespace_ + key);
+  return it == nvs.end() ? 0 : it->second.size();
+}
+
+size_t Preferences::putString(const char* key, const char* value) {
+  return putBytes(key, value, strlen(value) + 1) ? strlen(value) : 0;
+}
+
+String Preferences::getString(const char* key, const String& defaultValue) {
+  std::map<std::string, std::vector<uint8_t> >::iterator it = nvs.find(namespace_ + key);
+  if (it == nvs.end() || it->second.empty()) return defaultValue;
+  return String((const char*)&it->second[0]);
+}
+
+uint32_t Preferences::getUInt(const char* key, uint32_t defaultValue) {
+  uint32_t value;
+  return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+// --- base64 -------------------------------------------------------------------
+
+String base64::encode(const uint8_t* data, size_t length) {
+  static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t chunk = (uint32_t)data[i] << 16;
+    if (i + 1 < length) chunk |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < length) chunk |= data[i + 2];
+    out += table[(chunk >> 18) & 0x3F];
+    out += table[(chunk >> 12) & 0x3F];
+    out += i + 1 < length ? table[(chunk >> 6) & 0x3F] : '=';
+    out += i + 2 < length ? table[chunk & 0x3F] : '=';
+  }
+  return String(out);
+}
@@ -0,0 +1,13 @@
+/*
+ * Host stand-in for the ESP32 base64 helper
+ */
+
+#pragma once
+
+#include "Arduino.h"
+
+class base64 {
+public:
+  static String encode(const uint8_t* data, size_t length);
+  static String encode(const String& text) { return encode((const uint8_t*)text.c_str(), text.length()); }
+};
@@ -0,0 +1,193 @@
+/*
+ * Host benchmark: command decoding, ArduinoJson document vs cmd_decoder.h
+ *
+ * Decodes the OTA sketch's commands both ways and reports time per command
+ * and the stack each path needs:
+ *
+ *   - document: what main_ota.cpp's onCommand did before - deserialize into
+ *     StaticJsonDocument<256>, containsKey() checks, then lookups with
+ *     chained defaults (doc["value"] | doc["state"] | 0)
+ *   - decoder: cmdDecode() with the same schema as main_ota.cpp's Command
+ *
+ * Both paths parse a fresh copy of the payload each time (both write into
+ * it), and the copy is part of the measured time. For payloads both accept,
+ * the decoded fields are compared and "agree" reports whether they match.
+ * Where the document path fails (e.g. extra fields exhaust the document) or
+ * the decoder rejects a value the handler only caught later, the results
+ * differ on purpose.
+ *
+ * Build and run (from firmware/esp32_device_authoritative; ARDUINOJSON is
+ * the src folder of the ArduinoJson 6 library):
+ *   g++ -O2 -std=c++11 -I. -I$ARDUINOJSON host/cmd_bench.cpp -o cmd_bench
+ *   ./cmd_bench                      # built-in commands
+ *   ./cmd_bench --iterations 1000000
+ *
+ * Output is one JSON object per command on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <string>
+#include <vector>
+#include <ArduinoJson.h>
+#include "cmd_decoder.h"
+
+// Same schema as main_ota.cpp
+struct Command {
+  const char* cmdId;
+  const char* action;
+  const char* url;
+  const char* checksum;
+  int32_t pin;
+  bool on;
+};
+
+static const CmdField COMMAND_FIELDS[] = {
+  CMD_FIELD_STR(Command, cmdId, "cmd_id", 64, CMD_REQUIRED),
+  CMD_FIELD_STR(Command, action, "action", 32, CMD_REQUIRED),
+  CMD_FIELD_STR(Command, url, "url", 1024, CMD_OPTIONAL),
+  CMD_FIELD_STR(Command, checksum, "checksum", 64, CMD_OPTIONAL),
+  CMD_FIELD_INT(Command, pin, "pin", -1, 39, -1),
+  CMD_FIELD_BOOL(Command, on, "value|state", 0),
+};
+
+// Fields as a handler sees them, copied out so the two paths can be compared
+struct Decoded {
+  bool ok;
+  std::string error;
+  std::string cmdId;
+  std::string action;
+  std::string url;
+  std::string checksum;
+  int pin;
+  int state;
+};
+
+struct Case {
+  const char* name;
+  std::string payload;
+};
+
+static double nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The previous onCommand parse, field for field
+static bool decodeDocument(char* buffer, size_t length, Decoded& out) {
+  StaticJsonDocument<256> doc;
+  DeserializationError error = deserializeJson(doc, buffer, length);
+  if (error) {
+    out.error = "JSON parsing failed";
+    return false;
+  }
+  if (!doc.containsKey("cmd_id") || !doc.containsKey("action")) {
+    out.error = "Invalid command structure";
+    return false;
+  }
+  out.cmdId = doc["cmd_id"] | "";  // A non-string id is NULL: never hand that to std::string
+  out.action = doc["action"] | "";
+  out.pin = doc["pin"] | -1;
+  out.state = doc["value"] | doc["state"] | 0;
+  const char* url = doc["url"];
+  out.url = url != NULL ? url : "";
+  out.checksum = doc["checksum"] | "";
+  return true;
+}
+
+static bool decodeSchema(char* buffer, size_t length, Decoded& out) {
+  Command cmd;
+  char error[64];
+  if (!cmdDecode(buffer, length, COMMAND_FIELDS, cmd, error, sizeof(error))) {
+    out.error = error;
+    return false;
+  }
+  out.cmdId = cmd.cmdId;
+  out.action = cmd.action;
+  out.url = cmd.url;
+  out.checksum = cmd.checksum;
+  out.pin = cmd.pin;
+  out.state = cmd.on ? 1 : 0;
+  return true;
+}
+
+static bool agree(const Decoded& a, const Decoded& b) {
+  return a.cmdId == b.cmdId && a.action == b.action && a.url == b.url && a.checksum == b.checksum &&
+         a.pin == b.pin && a.state == b.state;
+}
+
+// ns per command, payload copy included
+template <typename Decode>
+static double timeDecode(const std::string& payload, long iterations, Decode decode, Decoded& result) {
+  std::vector<char> buffer(payload.size() + 1);
+  double start = nowNs();
+  for (long i = 0; i < iterations; i++) {
+    memcpy(buffer.data(), payload.data(), payload.size());
+    result.ok = decode(buffer.data(), payload.size(), result);
+  }
+  return (nowNs() - start) / iterations;
+}
+
+static std::vector<Case> builtinCases() {
+  std::string url = "https://abcdefghijklmnop.supabase.co/storage/v1/object/sign/firmware/pump-1/fw-1.4.2.bin?token=";
+  while (url.size() < 600) url += "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9";
+
+  std::vector<Case> cases;
+  cases.push_back({"relay", "{\"cmd_id\":\"CMD_1042\",\"action\":\"relay\",\"pin\":4,\"state\":1}"});
+  cases.push_back({"relay-value-and-state",
+                   "{\"cmd_id\":\"CMD_1043\",\"action\":\"relay\",\"pin\":2,\"state\":0,\"value\":1}"});
+  cases.push_back({"ota-update", "{\"cmd_id\":\"CMD_1044\",\"action\":\"ota_update\",\"url\":\"" + url +
+                                     "\",\"checksum\":\"9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\"}"});
+  cases.push_back({"relay-extra-fields",
+                   "{\"cmd_id\":\"CMD_1045\",\"action\":\"relay\",\"pin\":4,\"state\":1,\"ts\":1718000000,"
+                   "\"source\":\"dashboard\",\"user\":\"3f1c2a9e-7b5d-4e0f-9a61-2c8d4b7e1f30\",\"ttl_ms\":5000,"
+                   "\"meta\":{\"ui\":\"web\",\"version\":\"2.3.1\",\"tags\":[\"pump\",\"north\",\"field-3\"]},"
+                   "\"trace\":{\"id\":\"a1b2c3\",\"span\":7}}"});
+  cases.push_back({"relay-pin-out-of-range", "{\"cmd_id\":\"CMD_1046\",\"action\":\"relay\",\"pin\":99,\"state\":1}"});
+  cases.push_back({"missing-action", "{\"cmd_id\":\"CMD_1047\",\"pin\":4}"});
+  return cases;
+}
+
+int main(int argc, char** argv) {
+  long iterations = 200000;
+
+  static const struct option options[] = {
+    {"iterations", required_argument, NULL, 'n'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "n:h", options, NULL)) != -1) {
+    switch (option) {
+      case 'n': iterations = atol(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [--iterations N]\n", argv[0]);
+        return option == 'h' ? 0 : 2;
+    }
+  }
+  if (iterations <= 0) iterations = 1;
+
+  std::vector<Case> cases = builtinCases();
+  for (size_t i = 0; i < cases.size(); i++) {
+    const Case& c = cases[i];
+    Decoded document = {};
+    Decoded decoder = {};
+    double documentNs = timeDecode(c.payload, iterations, decodeDocument, document);
+    double decoderNs = timeDecode(c.payload, iterations, decodeSchema, decoder);
+
+    printf("{\"case\":\"%s\",\"bytes\":%u,\"document_ns\":%.0f,\"decoder_ns\":%.0f,\"speedup\":%.2f,"
+           "\"document_stack\":%u,\"decoder_stack\":%u,\"document_ok\":%s,\"decoder_ok\":%s",
+           c.name, (unsigned)c.payload.size(), documentNs, decoderNs, documentNs / decoderNs,
+           (unsigned)sizeof(StaticJsonDocument<256>), (unsigned)sizeof(Command),
+           document.ok ? "true" : "false", decoder.ok ? "true" : "false");
+    if (document.ok && decoder.ok) printf(",\"agree\":%s", agree(document, decoder) ? "true" : "false");
+    if (!document.ok) printf(",\"document_error\":\"%s\"", document.error.c_str());
+    if (!decoder.ok) printf(",\"decoder_error\":\"%s\"", decoder.error.c_str());
+    printf("}\n");
+  }
+  return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Host stand-in for FreeRTOS
+ *
+ * There is no scheduler on the host: static task and queue creation fail,
+ * so modules with a dedicated task (e.g. the relay fast path) fall back to
+ * their inline path. Critical sections are no-ops (single-threaded).
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+typedef void* QueueHandle_t;
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+typedef struct { int unused; } StaticQueue_t;
+typedef struct { int unused; } StaticTask_t;
+typedef struct { int unused; } portMUX_TYPE;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define pdMS_TO_TICKS(ms) (ms)
+#define portTICK_PERIOD_MS 1
+#define configMAX_PRIORITIES 25
+#define configMAX_TASK_NAME_LEN 16
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+
+inline QueueHandle_t xQueueCreateStatic(UBaseType_t, UBaseType_t, uint8_t*, StaticQueue_t*) { return NULL; }
+inline BaseType_t xQueueSend(QueueHandle_t, const void*, TickType_t) { return pdFALSE; }
+inline BaseType_t xQueueReceive(QueueHandle_t, void*, TickType_t) { return pdFALSE; }
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct {
+  TaskHandle_t xHandle;
+  const char* pcTaskName;
+  UBaseType_t xTaskNumber;
+  UBaseType_t uxCurrentPriority;
+  UBaseType_t uxBasePriority;
+  uint32_t ulRunTimeCounter;
+  uint32_t usStackHighWaterMark;
+} TaskStatus_t;
+
+inline UBaseType_t uxTaskGetNumberOfTasks() { return 0; }
+inline UBaseType_t uxTaskGetSystemState(TaskStatus_t*, UBaseType_t, uint32_t*) { return 0; }
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) { return 0; }
+inline TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t,
+                                                  StackType_t*, StaticTask_t*, BaseType_t) { return NULL; }
@@ -0,0 +1,17 @@
+/*
+ * Entry point for running a firmware sketch on the host: setup() once,
+ * then loop() forever, like the ESP32 loopTask.
+ */
+
+#include "Arduino.h"
+
+void setup();
+void loop();
+
+int main() {
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  setup();
+  for (;;) {
+    loop();
+  }
+}
@@ -0,0 +1,362 @@
+/*
+ * Modbus poller benchmark (registers/sec)
+ *
+ * Runs the firmware's ModbusPoller (modbus.h) on the host against a Modbus
+ * TCP slave and reports registers and points read per second, requests per
+ * poll cycle and cycle time, with request batching on and off. Every point
+ * read is checked against the slave's register pattern, and one write per
+ * run is verified.
+ *
+ * Without --target a small built-in slave is started on 127.0.0.1 (FC1-6,
+ * FC16; input register N holds N*7+3, holding registers start the same and
+ * are writable). --slave-delay-us adds per-request latency to it, roughly
+ * what a serial gateway or a busy VFD adds. An external simulator can be
+ * used instead, e.g. `diagslave -m tcp -p 1502` with the same pattern
+ * loaded, via --target 127.0.0.1:1502 (pattern checks then only report).
+ *
+ * Build (from firmware/esp32_device_authoritative; ARDUINOJSON is the src
+ * folder of the ArduinoJson library):
+ *   g++ -std=gnu++17 -O2 -DARDUINO=10819 -Ihost -I. -I$ARDUINOJSON \
+ *       host/modbus_bench.cpp host/arduino_host.cpp -lpthread -o modbus_bench
+ *   ./modbus_bench                          # all layouts, batched and unbatched
+ *   ./modbus_bench --slave-delay-us 2000 --points 24 --duration 5
+ *
+ * Output is one JSON object per layout and batching mode on stdout.
+ */
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include "esp_timer.h"
+#include "modbus.h"
+
+#include <getopt.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static uint16_t patternValue(uint32_t address) { return (uint16_t)(address * 7 + 3); }
+
+// --- Built-in Modbus TCP slave -------------------------------------------------
+
+class SimulatedSlave {
+public:
+  explicit SimulatedSlave(uint32_t delayUs) : delayUs_(delayUs), holding_(65536), coils_(65536) {
+    for (uint32_t i = 0; i < 65536; i++) {
+      holding_[i] = patternValue(i);
+      coils_[i] = i % 3 == 0;
+    }
+  }
+
+  ~SimulatedSlave() {
+    stopping_ = true;
+    if (listenFd_ >= 0) shutdown(listenFd_, SHUT_RDWR);
+    if (thread_.joinable()) thread_.join();
+    if (listenFd_ >= 0) close(listenFd_);
+  }
+
+  bool start() {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (listenFd_ < 0 || bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd_, 4) != 0 || getsockname(listenFd_, (struct sockaddr*)&addr, &len) != 0) {
+      return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread(&SimulatedSlave::serve, this);
+    return true;
+  }
+
+  uint16_t port() const { return port_; }
+  uint16_t holding(uint16_t address) const { return holding_[address]; }
+
+private:
+  // One client at a time is all the poller needs
+  void serve() {
+    while (!stopping_) {
+      struct pollfd pfd = {listenFd_, POLLIN, 0};
+      if (poll(&pfd, 1, 100) <= 0) continue;
+      int fd = accept(listenFd_, NULL, NULL);
+      if (fd < 0) continue;
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      handle(fd);
+      close(fd);
+    }
+  }
+
+  void handle(int fd) {
+    uint8_t request[260];
+    size_t have = 0;
+    while (!stopping_) {
+      struct pollfd pfd = {fd, POLLIN, 0};
+      if (poll(&pfd, 1, 100) <= 0) continue;
+      ssize_t n = recv(fd, request + have, sizeof(request) - have, 0);
+      if (n <= 0) return;
+      have += n;
+      while (have >= 7) {
+        size_t frameLength = 6 + ((request[4] << 8) | request[5]);
+        if (frameLength > sizeof(request)) return;
+        if (have < frameLength) break;
+        uint8_t response[260];
+        size_t pduLength = execute(request + 7, frameLength - 7, response + 7);
+        memcpy(response, request, 4);
+        response[4] = (pduLength + 1) >> 8;
+        response[5] = (pduLength + 1) & 0xFF;
+        response[6] = request[6];
+        if (delayUs_) delayMicroseconds(delayUs_);
+        if (send(fd, response, 7 + pduLength, MSG_NOSIGNAL) < 0) return;
+        memmove(request, request + frameLength, have - frameLength);
+        have -= frameLength;
+      }
+    }
+  }
+
+  size_t exception(uint8_t function, uint8_t code, uint8_t* out) {
+    out[0] = function | 0x80;
+    out[1] = code;
+    return 2;
+  }
+
+  size_t execute(const uint8_t* pdu, size_t length, uint8_t* out) {
+    uint8_t function = pdu[0];
+    if (length < 5) return exception(function, 3, out);
+    uint16_t address = (pdu[1] << 8) | pdu[2];
+    uint16_t count = (pdu[3] << 8) | pdu[4];
+    out[0] = function;
+
+    switch (function) {
+      case 1:
+      case 2: {
+        if (count == 0 || count > MODBUS_MAX_READ_BITS || address + count > 65536) return exception(function, 2, out);
+        uint8_t bytes = (count + 7) / 8;
+        out[1] = bytes;
+        memset(out + 2, 0, bytes);
+        for (uint16_t i = 0; i < count; i++) {
+          if (coils_[address + i]) out[2 + i / 8] |= 1 << (i % 8);
+        }
+        return 2 + bytes;
+      }
+      case 3:
+      case 4: {
+        if (count == 0 || count > MODBUS_MAX_READ_REGISTERS || address + count > 65536) return exception(function, 2, out);
+        out[1] = count * 2;
+        for (uint16_t i = 0; i < count; i++) {
+          uint16_t value = function == 3 ? holding_[address + i] : patternValue(address + i);
+          out[2 + i * 2] = value >> 8;
+          out[3 + i * 2] = value & 0xFF;
+        }
+        return 2 + count * 2;
+      }
+      case 5:
+        coils_[address] = pdu[3] == 0xFF;
+        memcpy(out, pdu, 5);
+        return 5;
+      case 6:
+        holding_[address] = count;
+        memcpy(out, pdu, 5);
+        return 5;
+      case 16:
+        if (length < 6 + (size_t)count * 2 || address + count > 65536) return exception(function, 3, out);
+        for (uint16_t i = 0; i < count; i++) holding_[address + i] = (pdu[6 + i * 2] << 8) | pdu[7 + i * 2];
+        memcpy(out, pdu, 5);
+        return 5;
+      default:
+        return exception(function, 1, out);
+    }
+  }
+
+  uint32_t delayUs_;
+  int listenFd_ = -1;
+  uint16_t port_ = 0;
+  std::atomic<bool> stopping_{false};
+  std::thread thread_;
+  std::vector<uint16_t> holding_;
+  std::vector<uint8_t> coils_;
+};
+
+// --- Register maps ---------------------------------------------------------------
+
+// contiguous: one block per table; sparse: 10-register stride (merged across
+// the gaps); scattered: 200-register stride (one request per point)
+static void buildMap(ModbusMap& map, const char* layout, uint8_t points, const char* host, uint16_t port) {
+  memset(&map, 0, sizeof(map));
+  map.version = MODBUS_FORMAT_VERSION;
+  map.transport = MODBUS_TCP;
+  strncpy(map.host, host, MODBUS_MAX_HOST);
+  map.port = port;
+  map.pollMs = 0;  // Back to back: measures throughput
+  map.timeoutMs = 1000;
+
+  uint16_t stride = strcmp(layout, "contiguous") == 0 ? 0 : strcmp(layout, "sparse") == 0 ? 10 : 200;
+  uint16_t nextAddress[4] = {100, 100, 100, 100};
+  for (uint8_t i = 0; i < points; i++) {
+    ModbusPoint& point = map.points[map.count++];
+    snprintf(point.name, sizeof(point.name), "p%u", i);
+    point.unit = 1;
+    point.table = i % 8 == 7 ? MODBUS_COIL : (i % 2 ? MODBUS_HOLDING : MODBUS_INPUT);
+    point.type = modbusIsBitTable(point.table) ? MODBUS_U16 : (i % 4 == 0 ? MODBUS_U32 : MODBUS_U16);
+    point.scale = 1;
+    point.flags = point.table == MODBUS_HOLDING ? MODBUS_FLAG_WRITABLE : 0;
+    point.address = nextAddress[point.table];
+    nextAddress[point.table] += stride ? stride : modbusPointWidth(point);
+  }
+}
+
+static float expectedValue(const ModbusPoint& point) {
+  if (modbusIsBitTable(point.table)) return point.address % 3 == 0 ? 1 : 0;
+  if (point.type == MODBUS_U16) return patternValue(point.address);
+  return (float)(((uint32_t)patternValue(point.address) << 16) | patternValue(point.address + 1));
+}
+
+struct RunResult {
+  bool ok;
+  std::string line;
+};
+
+static RunResult runBench(const char* layout, bool batching, uint8_t points, uint32_t durationS,
+                          const char* host, uint16_t port, SimulatedSlave* slave) {
+  static ModbusMap map;
+  buildMap(map, layout, points, host, port);
+  ModbusTcpTransport transport;
+  transport.setServer(host, port);
+  ModbusPoller poller;
+  poller.begin(map, transport, batching);
+
+  // Measure from the first complete cycle (includes the TCP connect otherwise)
+  uint64_t deadline = esp_timer_get_time() + 2000000ULL;
+  while (poller.stats().cycles == 0 && (uint64_t)esp_timer_get_time() < deadline) poller.update(millis());
+  ModbusStats before = poller.stats();
+  uint64_t start = esp_timer_get_time();
+  uint64_t end = start + durationS * 1000000ULL;
+  while ((uint64_t)esp_timer_get_time() < end) poller.update(millis());
+  double seconds = (esp_timer_get_time() - start) / 1e6;
+  ModbusStats after = poller.stats();
+
+  // Every point must match the slave's pattern
+  uint32_t mismatches = 0;
+  for (uint8_t i = 0; i < map.count; i++) {
+    float value;
+    const ModbusPoint& point = map.points[i];
+    if (!poller.value(i, value) || value != expectedValue(point)) {
+      mismatches++;
+    }
+  }
+
+  // One write, read back through the poller
+  bool writeOk = false;
+  int target = -1;
+  for (uint8_t i = 0; i < map.count && target < 0; i++) {
+    if ((map.points[i].flags & MODBUS_FLAG_WRITABLE) && map.points[i].type == MODBUS_U16) target = i;
+  }
+  if (target >= 0) {
+    String error;
+    poller.queueWrite(map.points[target].name, 4242, "bench-write", error);
+    ModbusWriteResult result;
+    uint64_t writeDeadline = esp_timer_get_time() + 2000000ULL;
+    bool done = false;
+    while (!done && (uint64_t)esp_timer_get_time() < writeDeadline) {
+      poller.update(millis());
+      done = poller.takeWriteResult(result);
+    }
+    writeOk = done && result.ok && (slave == NULL || slave->holding(map.points[target].address) == 4242);
+    // Restore the pattern so later runs still match
+    poller.queueWrite(map.points[target].name, expectedValue(map.points[target]), "bench-restore", error);
+    for (done = false; !done && (uint64_t)esp_timer_get_time() < writeDeadline + 2000000ULL;) {
+      poller.update(millis());
+      done = poller.takeWriteResult(result);
+    }
+  }
+  uint8_t batches = poller.batchCount();
+  poller.stop();
+
+  uint32_t cycles = after.cycles - before.cycles;
+  uint32_t requests = after.requests - before.requests;
+  char line[512];
+  snprintf(line, sizeof(line),
+           "{\"layout\":\"%s\",\"batching\":%s,\"points\":%u,\"requests_per_cycle\":%u,"
+           "\"registers_per_s\":%.0f,\"points_per_s\":%.0f,\"requests_per_s\":%.0f,"
+           "\"cycle_ms\":%.3f,\"timeouts\":%u,\"exceptions\":%u,\"mismatches\":%u,\"write_ok\":%s}",
+           layout, batching ? "true" : "false", map.count, batches,
+           (after.registers - before.registers) / seconds, cycles * map.count / seconds,
+           requests / seconds, cycles ? seconds * 1000.0 / cycles : 0.0,
+           after.timeouts, after.exceptions, mismatches, writeOk ? "true" : "false");
+  RunResult run = {mismatches == 0 && writeOk && after.timeouts == 0 && after.exceptions == 0, line};
+  return run;
+}
+
+int main(int argc, char** argv) {
+  std::string target;
+  uint32_t durationS = 3;
+  uint32_t slaveDelayUs = 0;
+  int points = 24;
+  std::string layout;
+
+  static const struct option longOptions[] = {
+    {"target", required_argument, NULL, 't'},
+    {"duration", required_argument, NULL, 'd'},
+    {"slave-delay-us", required_argument, NULL, 's'},
+    {"points", required_argument, NULL, 'p'},
+    {"layout", required_argument, NULL, 'l'},
+    {NULL, 0, NULL, 0}
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+    switch (opt) {
+      case 't': target = optarg; break;
+      case 'd': durationS = (uint32_t)atoi(optarg); break;
+      case 's': slaveDelayUs = (uint32_t)atoi(optarg); break;
+      case 'p': points = atoi(optarg); break;
+      case 'l': layout = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [--target HOST:PORT] [--duration S] [--slave-delay-us US]\n"
+                        "          [--points N] [--layout contiguous|sparse|scattered]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (points < 1 || points > MODBUS_MAX_POINTS || durationS == 0) {
+    fprintf(stderr, "points must be 1-%d and duration > 0\n", MODBUS_MAX_POINTS);
+    return 2;
+  }
+
+  SimulatedSlave* slave = NULL;
+  std::string host = "127.0.0.1";
+  uint16_t port = 502;
+  if (target.empty()) {
+    slave = new SimulatedSlave(slaveDelayUs);
+    if (!slave->start()) {
+      fprintf(stderr, "Cannot start the built-in slave\n");
+      return 1;
+    }
+    port = slave->port();
+  } else {
+    size_t colon = target.rfind(':');
+    host = target.substr(0, colon);
+    if (colon != std::string::npos) port = (uint16_t)atoi(target.c_str() + colon + 1);
+  }
+
+  const char* const layouts[] = {"contiguous", "sparse", "scattered"};
+  bool ok = true;
+  for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+    if (!layout.empty() && layout != layouts[l]) continue;
+    for (int batching = 1; batching >= 0; batching--) {
+      RunResult run = runBench(layouts[l], batching == 1, (uint8_t)points, durationS, host.c_str(), port, slave);
+      printf("%s\n", run.line.c_str());
+      fflush(stdout);
+      ok = ok && run.ok;
+    }
+  }
+  delete slave;
+  if (!ok) fprintf(stderr, "Timeouts, exceptions or value mismatches (see output)\n");
+  return ok ? 0 : 1;
+}
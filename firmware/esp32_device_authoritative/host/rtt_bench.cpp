@@ -0,0 +1,685 @@
+/*
+ * Command round-trip benchmark (command -> ACK latency)
+ *
+ * Runs the real firmware sketch (main_secure.cpp) as a Linux process against
+ * a local mosquitto, fires a configurable command mix at a fixed rate and
+ * measures the time from publishing each command to receiving its ACK.
+ * Faults are injected by a TCP proxy between the device and the broker:
+ * added latency and jitter, segment loss (modelled as a 200 ms TCP
+ * retransmission stall, since the device talks TCP) and periodic connection
+ * drops that exercise the reconnect path.
+ *
+ * Each scenario prints one JSON line (p50/p95/p99/max latency, throughput,
+ * losses, per-action breakdown) to stdout and optionally appends it to a
+ * file for trend tracking. For a spawned device it also reports the CPU the
+ * device process used while idle and under load; build the device once more
+ * with -DLOOP_WAKEUP_POLL to compare against the old fixed 10 ms loop tick
+ * (CPU figures are -1 when not measured).
+ *
+ * Build (from firmware/esp32_device_authoritative; ARDUINOJSON and
+ * PUBSUBCLIENT are the src folders of the Arduino libraries):
+ *
+ *   FLAGS="-std=gnu++17 -O2 -DARDUINO=10819 -DARDUINOJSON_ENABLE_PROGMEM=0 \
+ *          -Ihost -I. -I$ARDUINOJSON -I$PUBSUBCLIENT"
+ *   g++ $FLAGS -x c++ main_secure.cpp host/host_main.cpp host/arduino_host.cpp \
+ *       $PUBSUBCLIENT/PubSubClient.cpp -o device_host
+ *   g++ $FLAGS host/rtt_bench.cpp host/arduino_host.cpp \
+ *       $PUBSUBCLIENT/PubSubClient.cpp -lpthread -o rtt_bench
+ *
+ * Run (mosquitto listening on 127.0.0.1:1883, anonymous access allowed):
+ *
+ *   ./rtt_bench --device ./device_host --rate 20 --duration 30
+ *   ./rtt_bench --device ./device_host --standard --out rtt.jsonl --label "$(git rev-parse --short HEAD)"
+ *   ./rtt_bench --device ./device_host --scenario wan:delay=80,jitter=20,loss=0.01
+ *
+ * Options:
+ *   --broker HOST:PORT     broker address (default 127.0.0.1:1883)
+ *   --device PATH          spawn this device binary per scenario (otherwise
+ *                          a device must already be connected; no faults)
+ *   --tenant ID, --id ID   device topic prefix (default tenantA / pump-1)
+ *   --rate N               commands per second (default 20)
+ *   --duration S           seconds of load per scenario (default 30)
+ *   --mix SPEC             action weights (default relay=50,pwm=20,read=20,status=10)
+ *                          actions: relay, pwm, read, status, batch
+ *   --batch-size N         commands published back to back per "batch" (default 5)
+ *   --timeout MS           ACK deadline, later ACKs count as lost (default 5000)
+ *   --idle S               seconds without commands before the load, to measure
+ *                          the spawned device's idle CPU (default 5)
+ *   --scenario NAME[:delay=MS,jitter=MS,loss=P,drop=S]   repeatable
+ *   --standard             clean, delay50, loss2 and drop15 scenarios
+ *   --label TEXT           free-form tag copied into every result
+ *   --out FILE             append result lines to FILE
+ *   --device-log           keep the device's serial output
+ */
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include "esp_timer.h"
+#include <PubSubClient.h>
+#include <ArduinoJson.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+enum BenchAction { ACTION_RELAY, ACTION_PWM, ACTION_READ, ACTION_STATUS, ACTION_BATCH, ACTION_COUNT };
+static const char* const ACTION_NAMES[ACTION_COUNT] = {"relay", "pwm", "read", "status", "batch"};
+
+struct Fault {
+  uint32_t delayMs = 0;
+  uint32_t jitterMs = 0;
+  double loss = 0;
+  uint32_t dropEveryS = 0;
+
+  bool active() const { return delayMs || jitterMs || loss > 0 || dropEveryS; }
+};
+
+struct Scenario {
+  std::string name;
+  Fault fault;
+};
+
+struct Options {
+  std::string brokerHost = "127.0.0.1";
+  uint16_t brokerPort = 1883;
+  std::string devicePath;
+  std::string tenant = "tenantA";
+  std::string deviceId = "pump-1";
+  double rate = 20;
+  uint32_t durationS = 30;
+  uint32_t weights[ACTION_COUNT] = {50, 20, 20, 10, 0};
+  uint32_t batchSize = 5;
+  uint32_t timeoutMs = 5000;
+  uint32_t idleS = 5;
+  std::vector<Scenario> scenarios;
+  std::string label;
+  std::string outPath;
+  bool deviceLog = false;
+};
+
+static uint64_t nowUs() { return (uint64_t)esp_timer_get_time(); }
+
+// --- Fault-injecting TCP proxy -------------------------------------------------
+
+class FaultProxy {
+public:
+  FaultProxy(const Fault& fault, const std::string& host, uint16_t port)
+    : fault_(fault), brokerHost_(host), brokerPort_(port), rng_(42) {}
+
+  ~FaultProxy() { stop(); }
+
+  bool start() {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (listenFd_ < 0 || bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd_, 4) != 0 || getsockname(listenFd_, (struct sockaddr*)&addr, &len) != 0) {
+      return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    acceptThread_ = std::thread(&FaultProxy::acceptLoop, this);
+    return true;
+  }
+
+  void stop() {
+    if (stopping_.exchange(true)) return;
+    if (listenFd_ >= 0) shutdown(listenFd_, SHUT_RDWR);
+    if (acceptThread_.joinable()) acceptThread_.join();
+    for (size_t i = 0; i < links_.size(); i++) links_[i].join();
+    if (listenFd_ >= 0) close(listenFd_);
+  }
+
+  uint16_t port() const { return port_; }
+  uint32_t drops() const { return drops_; }
+
+private:
+  struct Segment {
+    uint64_t dueUs;
+    std::vector<uint8_t> data;
+  };
+
+  void acceptLoop() {
+    while (!stopping_) {
+      struct pollfd pfd = {listenFd_, POLLIN, 0};
+      if (poll(&pfd, 1, 100) <= 0) continue;
+      int device = accept(listenFd_, NULL, NULL);
+      if (device < 0) continue;
+      links_.push_back(std::thread(&FaultProxy::link, this, device));
+    }
+  }
+
+  // One device connection: two pumps, and a timer that drops the link
+  void link(int device) {
+    IPAddress ip;
+    if (!ip.fromString(brokerHost_.c_str()) && !WiFi.hostByName(brokerHost_.c_str(), ip)) {
+      close(device);
+      return;
+    }
+    int broker = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(brokerPort_);
+    addr.sin_addr.s_addr = (uint32_t)ip;
+    if (broker < 0 || connect(broker, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      if (broker >= 0) close(broker);
+      close(device);
+      return;
+    }
+
+    std::atomic<bool> done(false);
+    std::thread up(&FaultProxy::pump, this, device, broker, std::ref(done));
+    std::thread down(&FaultProxy::pump, this, broker, device, std::ref(done));
+
+    uint64_t opened = nowUs();
+    while (!done && !stopping_) {
+      if (fault_.dropEveryS && nowUs() - opened > fault_.dropEveryS * 1000000ULL) {
+        drops_++;
+        break;
+      }
+      delay(50);
+    }
+    done = true;
+    shutdown(device, SHUT_RDWR);
+    shutdown(broker, SHUT_RDWR);
+    up.join();
+    down.join();
+    close(device);
+    close(broker);
+  }
+
+  // Forward bytes from -> to, each segment released after the injected delay.
+  // Segments stay in order, so a "lost" one stalls everything behind it.
+  void pump(int from, int to, std::atomic<bool>& done) {
+    std::deque<Segment> queue;
+    uint64_t lastDueUs = 0;
+    uint8_t buf[4096];
+
+    while (!done && !stopping_) {
+      int timeoutMs = 50;
+      if (!queue.empty()) {
+        uint64_t now = nowUs();
+        timeoutMs = queue.front().dueUs > now ? (int)((queue.front().dueUs - now + 999) / 1000) : 0;
+        if (timeoutMs > 50) timeoutMs = 50;
+      }
+      struct pollfd pfd = {from, POLLIN, 0};
+      if (poll(&pfd, 1, timeoutMs) > 0) {
+        ssize_t n = recv(from, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        Segment segment;
+        segment.dueUs = nowUs() + sampleDelayUs();
+        if (segment.dueUs < lastDueUs) segment.dueUs = lastDueUs;
+        lastDueUs = segment.dueUs;
+        segment.data.assign(buf, buf + n);
+        queue.push_back(segment);
+      }
+      while (!queue.empty() && queue.front().dueUs <= nowUs()) {
+        const std::vector<uint8_t>& data = queue.front().data;
+        if (send(to, &data[0], data.size(), MSG_NOSIGNAL) != (ssize_t)data.size()) {
+          done = true;
+          return;
+        }
+        queue.pop_front();
+      }
+    }
+    done = true;
+  }
+
+  uint64_t sampleDelayUs() {
+    std::lock_guard<std::mutex> lock(rngMutex_);
+    uint64_t delayUs = fault_.delayMs * 1000ULL;
+    if (fault_.jitterMs) delayUs += rng_() % (fault_.jitterMs * 1000ULL);
+    if (fault_.loss > 0 && std::uniform_real_distribution<double>(0, 1)(rng_) < fault_.loss) {
+      delayUs += 200000;  // Minimum TCP retransmission timeout on Linux
+    }
+    return delayUs;
+  }
+
+  Fault fault_;
+  std::string brokerHost_;
+  uint16_t brokerPort_;
+  int listenFd_ = -1;
+  uint16_t port_ = 0;
+  std::atomic<bool> stopping_{false};
+  std::atomic<uint32_t> drops_{0};
+  std::thread acceptThread_;
+  std::vector<std::thread> links_;
+  std::mt19937_64 rng_;
+  std::mutex rngMutex_;
+};
+
+// --- Device process ------------------------------------------------------------
+
+static pid_t spawnDevice(const Options& options, const std::string& mqttAddr) {
+  pid_t pid = fork();
+  if (pid != 0) return pid;
+
+  setenv("HOST_MQTT_ADDR", mqttAddr.c_str(), 1);
+  if (!options.deviceLog && freopen("/dev/null", "w", stdout) == NULL) _exit(126);
+  execl(options.devicePath.c_str(), options.devicePath.c_str(), (char*)NULL);
+  _exit(127);
+}
+
+// CPU time (user + system) the device process has used so far, -1 if unknown
+static double deviceCpuSeconds(pid_t pid) {
+  if (pid <= 0) return -1;
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  FILE* f = fopen(path, "r");
+  if (f == NULL) return -1;
+  char stat[1024];
+  size_t n = fread(stat, 1, sizeof(stat) - 1, f);
+  fclose(f);
+  stat[n] = '\0';
+
+  // Fields after the parenthesised command name: state is field 3, utime 14, stime 15
+  const char* p = strrchr(stat, ')');
+  unsigned long utime = 0, stime = 0;
+  if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+    return -1;
+  }
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double cpuPercent(double startS, double endS, uint64_t wallUs) {
+  if (startS < 0 || endS < 0 || wallUs == 0) return -1;
+  return (endS - startS) * 100.0 / (wallUs / 1e6);
+}
+
+static void stopDevice(pid_t pid) {
+  if (pid <= 0) return;
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+// --- Load generator ------------------------------------------------------------
+
+struct Pending {
+  uint64_t sentUs;
+  uint8_t action;
+};
+
+struct Results {
+  uint32_t sent[ACTION_COUNT] = {0};
+  uint32_t failed = 0;  // ACKed with ok:false
+  std::vector<double> latencyMs[ACTION_COUNT];
+};
+
+static std::map<std::string, Pending> pending;
+static Results* results = NULL;
+static uint64_t lastAckUs = 0;
+
+static void onAck(char* topic, byte* payload, unsigned int length) {
+  StaticJsonDocument<512> ack;
+  if (deserializeJson(ack, payload, length)) return;
+  const char* cmdId = ack["cmd_id"] | "";
+  std::map<std::string, Pending>::iterator it = pending.find(cmdId);
+  if (it == pending.end()) return;  // Retained ACK from an earlier run, or a late one
+
+  uint64_t now = nowUs();
+  if (results != NULL) {
+    results->latencyMs[it->second.action].push_back((now - it->second.sentUs) / 1000.0);
+    if (!(ack["ok"] | false)) results->failed++;
+  }
+  lastAckUs = now;
+  pending.erase(it);
+}
+
+static std::string deviceTopic(const Options& options, const char* path) {
+  return "saphari/" + options.tenant + "/devices/" + options.deviceId + "/" + path;
+}
+
+static bool publishCommand(PubSubClient& client, const Options& options, uint8_t action,
+                           const std::string& cmdId, uint32_t sequence) {
+  char payload[160];
+  switch (action) {
+    case ACTION_RELAY:
+    case ACTION_BATCH:
+      snprintf(payload, sizeof(payload), "{\"cmd_id\":\"%s\",\"action\":\"relay\",\"pin\":4,\"state\":%u}",
+               cmdId.c_str(), sequence % 2);
+      break;
+    case ACTION_PWM:
+      snprintf(payload, sizeof(payload), "{\"cmd_id\":\"%s\",\"action\":\"pwm\",\"pin\":5,\"value\":%u}",
+               cmdId.c_str(), sequence % 256);
+      break;
+    case ACTION_READ:
+      snprintf(payload, sizeof(payload), "{\"cmd_id\":\"%s\",\"action\":\"digital_read\",\"pin\":4}",
+               cmdId.c_str());
+      break;
+    default:
+      snprintf(payload, sizeof(payload), "{\"cmd_id\":\"%s\",\"action\":\"status_request\"}", cmdId.c_str());
+      break;
+  }
+  Pending entry = {nowUs(), action};
+  pending[cmdId] = entry;
+  return client.publish(deviceTopic(options, "cmd").c_str(), payload);
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t index = (size_t)ceil(p / 100.0 * sorted.size());
+  return sorted[index == 0 ? 0 : index - 1];
+}
+
+static std::string latencyJson(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  double sum = 0;
+  for (size_t i = 0; i < samples.size(); i++) sum += samples[i];
+  char buf[192];
+  snprintf(buf, sizeof(buf), "{\"p50\":%.2f,\"p95\":%.2f,\"p99\":%.2f,\"max\":%.2f,\"mean\":%.2f}",
+           percentile(samples, 50), percentile(samples, 95), percentile(samples, 99),
+           samples.empty() ? 0 : samples.back(), samples.empty() ? 0 : sum / samples.size());
+  return buf;
+}
+
+static bool runScenario(const Options& options, const Scenario& scenario, std::string& line) {
+  std::unique_ptr<FaultProxy> proxy;
+  pid_t device = -1;
+  char addr[300];
+  snprintf(addr, sizeof(addr), "%s:%u", options.brokerHost.c_str(), options.brokerPort);
+
+  if (scenario.fault.active()) {
+    if (options.devicePath.empty()) {
+      fprintf(stderr, "Scenario %s injects faults and needs --device\n", scenario.name.c_str());
+      return false;
+    }
+    proxy.reset(new FaultProxy(scenario.fault, options.brokerHost, options.brokerPort));
+    if (!proxy->start()) {
+      fprintf(stderr, "Failed to start fault proxy\n");
+      return false;
+    }
+    snprintf(addr, sizeof(addr), "127.0.0.1:%u", proxy->port());
+  }
+  if (!options.devicePath.empty()) device = spawnDevice(options, addr);
+
+  WiFiClient net;
+  PubSubClient client(net);
+  client.setServer(options.brokerHost.c_str(), options.brokerPort);
+  client.setCallback(onAck);
+  client.setBufferSize(1024);
+  char clientId[32];
+  snprintf(clientId, sizeof(clientId), "rtt-bench-%d", (int)getpid());
+  if (!client.connect(clientId) || !client.subscribe(deviceTopic(options, "ack").c_str(), 0)) {
+    fprintf(stderr, "Cannot connect to broker %s:%u\n", options.brokerHost.c_str(), options.brokerPort);
+    stopDevice(device);
+    return false;
+  }
+
+  // Wait until the device answers before loading it
+  pending.clear();
+  results = NULL;
+  bool ready = false;
+  uint64_t warmupStart = nowUs();
+  for (uint32_t probe = 0; !ready && nowUs() - warmupStart < 20000000ULL; probe++) {
+    std::string cmdId = "warmup-" + std::to_string(probe);
+    publishCommand(client, options, ACTION_STATUS, cmdId, probe);
+    for (uint64_t wait = nowUs(); nowUs() - wait < 500000ULL && !ready; delay(1)) {
+      client.loop();
+      ready = pending.count(cmdId) == 0;
+    }
+  }
+  if (!ready) {
+    fprintf(stderr, "Device did not answer within 20 s\n");
+    stopDevice(device);
+    return false;
+  }
+  pending.clear();
+
+  // Idle window: the device only runs its own timers
+  double idleCpuPct = -1;
+  if (device > 0 && options.idleS > 0) {
+    double cpuStart = deviceCpuSeconds(device);
+    uint64_t idleStart = nowUs();
+    while (nowUs() - idleStart < options.idleS * 1000000ULL) {
+      client.loop();
+      delay(5);
+    }
+    idleCpuPct = cpuPercent(cpuStart, deviceCpuSeconds(device), nowUs() - idleStart);
+  }
+
+  Results run;
+  results = &run;
+  uint32_t totalWeight = 0;
+  for (int a = 0; a < ACTION_COUNT; a++) totalWeight += options.weights[a];
+  std::mt19937 rng(7);
+  uint64_t intervalUs = (uint64_t)(1000000.0 / options.rate);
+  uint64_t start = nowUs();
+  uint64_t nextSend = start;
+  uint64_t end = start + options.durationS * 1000000ULL;
+  uint32_t sequence = 0;
+  uint32_t publishErrors = 0;
+  double loadCpuStart = deviceCpuSeconds(device);
+
+  while (nowUs() < end) {
+    client.loop();
+    if (!client.connected()) client.connect(clientId) && client.subscribe(deviceTopic(options, "ack").c_str(), 0);
+    if (nowUs() < nextSend) {
+      delayMicroseconds(200);
+      continue;
+    }
+    nextSend += intervalUs;
+
+    uint32_t pick = rng() % totalWeight;
+    uint8_t action = 0;
+    while (pick >= options.weights[action]) pick -= options.weights[action++];
+    uint32_t count = action == ACTION_BATCH ? options.batchSize : 1;
+    for (uint32_t i = 0; i < count; i++, sequence++) {
+      std::string cmdId = "rtt-" + std::to_string(getpid()) + "-" + std::to_string(sequence);
+      if (!publishCommand(client, options, action, cmdId, sequence)) publishErrors++;
+      run.sent[action]++;
+    }
+  }
+
+  double loadCpuPct = cpuPercent(loadCpuStart, deviceCpuSeconds(device), nowUs() - start);
+
+  // Drain: anything not ACKed within the deadline is lost
+  uint64_t drainStart = nowUs();
+  while (!pending.empty() && nowUs() - drainStart < options.timeoutMs * 1000ULL) {
+    client.loop();
+    delay(1);
+  }
+  uint64_t elapsedUs = (lastAckUs > start ? lastAckUs : nowUs()) - start;
+
+  results = NULL;
+  client.disconnect();
+  stopDevice(device);
+  uint32_t drops = proxy ? proxy->drops() : 0;
+  if (proxy) proxy->stop();
+
+  // Late ACKs count as lost
+  std::vector<double> all;
+  uint32_t sent = 0;
+  uint32_t acked = 0;
+  std::string perAction;
+  for (int a = 0; a < ACTION_COUNT; a++) {
+    std::vector<double>& samples = run.latencyMs[a];
+    std::vector<double> onTime;
+    for (size_t i = 0; i < samples.size(); i++) {
+      if (samples[i] <= options.timeoutMs) onTime.push_back(samples[i]);
+    }
+    all.insert(all.end(), onTime.begin(), onTime.end());
+    sent += run.sent[a];
+    acked += onTime.size();
+    if (run.sent[a] == 0) continue;
+    char buf[96];
+    snprintf(buf, sizeof(buf), "%s\"%s\":{\"sent\":%u,\"acked\":%u,\"latency_ms\":",
+             perAction.empty() ? "" : ",", ACTION_NAMES[a], run.sent[a], (unsigned)onTime.size());
+    perAction += buf + latencyJson(onTime) + "}";
+  }
+
+  char head[1024];
+  snprintf(head, sizeof(head),
+           "{\"label\":\"%s\",\"scenario\":\"%s\",\"delay_ms\":%u,\"jitter_ms\":%u,\"loss\":%.4f,"
+           "\"drop_every_s\":%u,\"drops\":%u,\"rate\":%.1f,\"duration_s\":%u,\"sent\":%u,\"acked\":%u,"
+           "\"lost\":%u,\"failed\":%u,\"publish_errors\":%u,\"throughput_per_s\":%.2f,"
+           "\"device_cpu_idle_pct\":%.2f,\"device_cpu_load_pct\":%.2f,\"latency_ms\":",
+           options.label.c_str(), scenario.name.c_str(), scenario.fault.delayMs, scenario.fault.jitterMs,
+           scenario.fault.loss, scenario.fault.dropEveryS, drops, options.rate, options.durationS,
+           sent, acked, sent - acked, run.failed, publishErrors,
+           elapsedUs ? acked * 1e6 / elapsedUs : 0.0, idleCpuPct, loadCpuPct);
+  line = std::string(head) + latencyJson(all) + ",\"actions\":{" + perAction + "}}";
+  return true;
+}
+
+// --- Options -------------------------------------------------------------------
+
+static bool parseScenario(const char* spec, Scenario& scenario) {
+  std::string text = spec;
+  size_t colon = text.find(':');
+  scenario.name = text.substr(0, colon);
+  if (scenario.name.empty()) return false;
+  if (colon == std::string::npos) return true;
+
+  std::string params = text.substr(colon + 1) + ",";
+  for (size_t pos = 0, comma; (comma = params.find(',', pos)) != std::string::npos; pos = comma + 1) {
+    std::string item = params.substr(pos, comma - pos);
+    size_t eq = item.find('=');
+    if (item.empty()) continue;
+    if (eq == std::string::npos) return false;
+    std::string key = item.substr(0, eq);
+    double value = atof(item.c_str() + eq + 1);
+    if (key == "delay") scenario.fault.delayMs = (uint32_t)value;
+    else if (key == "jitter") scenario.fault.jitterMs = (uint32_t)value;
+    else if (key == "loss") scenario.fault.loss = value;
+    else if (key == "drop") scenario.fault.dropEveryS = (uint32_t)value;
+    else return false;
+  }
+  return true;
+}
+
+static bool parseMix(const char* spec, Options& options) {
+  memset(options.weights, 0, sizeof(options.weights));
+  std::string params = std::string(spec) + ",";
+  uint32_t total = 0;
+  for (size_t pos = 0, comma; (comma = params.find(',', pos)) != std::string::npos; pos = comma + 1) {
+    std::string item = params.substr(pos, comma - pos);
+    size_t eq = item.find('=');
+    if (item.empty()) continue;
+    if (eq == std::string::npos) return false;
+    int action = -1;
+    for (int a = 0; a < ACTION_COUNT; a++) {
+      if (item.compare(0, eq, ACTION_NAMES[a]) == 0 && strlen(ACTION_NAMES[a]) == eq) action = a;
+    }
+    if (action < 0) return false;
+    options.weights[action] = (uint32_t)atoi(item.c_str() + eq + 1);
+    total += options.weights[action];
+  }
+  return total > 0;
+}
+
+static bool parseBroker(const char* spec, Options& options) {
+  std::string text = spec;
+  size_t colon = text.rfind(':');
+  options.brokerHost = text.substr(0, colon);
+  if (colon != std::string::npos) options.brokerPort = (uint16_t)atoi(text.c_str() + colon + 1);
+  return !options.brokerHost.empty() && options.brokerPort != 0;
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [--broker HOST:PORT] [--device PATH] [--rate N] [--duration S]\n"
+          "          [--mix relay=50,pwm=20,read=20,status=10,batch=0] [--batch-size N]\n"
+          "          [--timeout MS] [--idle S] [--scenario NAME[:delay=MS,jitter=MS,loss=P,drop=S]]...\n"
+          "          [--standard] [--label TEXT] [--out FILE] [--device-log]\n"
+          "          [--tenant ID] [--id DEVICE_ID]\n",
+          argv0);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  static const struct option longOptions[] = {
+    {"broker", required_argument, NULL, 'b'},
+    {"device", required_argument, NULL, 'd'},
+    {"tenant", required_argument, NULL, 'T'},
+    {"id", required_argument, NULL, 'i'},
+    {"rate", required_argument, NULL, 'r'},
+    {"duration", required_argument, NULL, 't'},
+    {"mix", required_argument, NULL, 'm'},
+    {"batch-size", required_argument, NULL, 'B'},
+    {"timeout", required_argument, NULL, 'w'},
+    {"idle", required_argument, NULL, 'I'},
+    {"scenario", required_argument, NULL, 's'},
+    {"standard", no_argument, NULL, 'S'},
+    {"label", required_argument, NULL, 'l'},
+    {"out", required_argument, NULL, 'o'},
+    {"device-log", no_argument, NULL, 'L'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+    Scenario scenario;
+    bool ok = true;
+    switch (opt) {
+      case 'b': ok = parseBroker(optarg, options); break;
+      case 'd': options.devicePath = optarg; break;
+      case 'T': options.tenant = optarg; break;
+      case 'i': options.deviceId = optarg; break;
+      case 'r': options.rate = atof(optarg); ok = options.rate > 0; break;
+      case 't': options.durationS = (uint32_t)atoi(optarg); ok = options.durationS > 0; break;
+      case 'm': ok = parseMix(optarg, options); break;
+      case 'B': options.batchSize = (uint32_t)atoi(optarg); ok = options.batchSize > 0; break;
+      case 'w': options.timeoutMs = (uint32_t)atoi(optarg); break;
+      case 'I': options.idleS = (uint32_t)atoi(optarg); break;
+      case 's': ok = parseScenario(optarg, scenario); options.scenarios.push_back(scenario); break;
+      case 'S': {
+        const char* const standard[] = {"clean", "delay50:delay=50,jitter=10", "loss2:loss=0.02", "drop15:drop=15"};
+        for (size_t i = 0; i < sizeof(standard) / sizeof(standard[0]); i++) {
+          parseScenario(standard[i], scenario);
+          options.scenarios.push_back(scenario);
+          scenario = Scenario();
+        }
+        break;
+      }
+      case 'l': options.label = optarg; break;
+      case 'o': options.outPath = optarg; break;
+      case 'L': options.deviceLog = true; break;
+      default: ok = false; break;
+    }
+    if (!ok) {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (options.scenarios.empty()) {
+    Scenario clean;
+    clean.name = "clean";
+    options.scenarios.push_back(clean);
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < options.scenarios.size(); i++) {
+    std::string line;
+    if (!runScenario(options, options.scenarios[i], line)) {
+      ok = false;
+      continue;
+    }
+    printf("%s\n", line.c_str());
+    fflush(stdout);
+    if (!options.outPath.empty()) {
+      FILE* out = fopen(options.outPath.c_str(), "a");
+      if (out != NULL) {
+        fprintf(out, "%s\n", line.c_str());
+        fclose(out);
+      }
+    }
+  }
+  return ok ? 0 : 1;
+}
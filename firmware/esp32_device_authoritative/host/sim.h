@@ -0,0 +1,39 @@
+/*
+ * Virtual-time hooks for the host core (build with -DHOST_SIM)
+ *
+ * With HOST_SIM, arduino_host.cpp does not use the monotonic clock or real
+ * sockets. Time is a virtual microsecond counter, and connections go to a
+ * simulated broker. The simulation driver (host/soak_sim.cpp) implements
+ * these hooks:
+ *
+ *   - Reading the clock costs HOST_SIM_READ_COST_US, so a sketch that spins
+ *     on millis() still makes progress.
+ *   - delay() jumps the clock forward and runs every event due on the way.
+ *   - WiFiClient::connect() gets one end of a socketpair, and the driver's
+ *     broker serves the other end. Real fds keep select() in loop_wakeup.h
+ *     and FIONREAD in available() working unchanged.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define HOST_SIM_READ_COST_US 1
+
+// Current virtual time since boot, and advancing it by one clock read
+uint64_t hostSimReadClockUs();
+
+// Sleep: advance the clock by `us`, running events that fall due
+void hostSimSleepUs(uint64_t us);
+
+// Exchange pending bytes with the simulated broker (no time passes)
+void hostSimPump();
+
+// Connect to the simulated broker: device end of the connection, or -1
+int hostSimConnect(uint16_t port);
+
+// The sketch called ESP.restart()
+void hostSimRestart();
+
+// Whether Serial output reaches stdout
+bool hostSimSerialEnabled();
@@ -0,0 +1,892 @@
+/*
+ * Accelerated soak test in virtual time
+ *
+ * Runs the real firmware sketch (main_secure.cpp) for days of simulated
+ * operation in a few minutes of wall time. The host core is built with
+ * -DHOST_SIM (see host/sim.h). millis(), micros() and delay() then run on a
+ * virtual clock, and the broker is simulated in this process with a
+ * deterministic event queue:
+ *
+ *   - Every broker-to-device packet is delivered after a seeded latency and
+ *     jitter, in order.
+ *   - Commands arrive at a steady rate, plus periodic bursts (the
+ *     rtt_bench mix: relay, pwm, digital_read, status_request).
+ *   - Faults are scheduled: connection drops, broker outages (reconnect
+ *     storms against a refusing broker) and black holes (the connection
+ *     stays up but nothing comes back, so only the keepalive can detect it).
+ *
+ * When the loop sleeps in select() or delay(), the clock jumps straight to
+ * the next event or deadline. A week of mostly idle firmware is about six
+ * million loop passes.
+ *
+ * The boot time is offset so that millis() wraps (every 49.7 days on a real
+ * device) partway through the run; micros() wraps every 71.6 minutes anyway.
+ *
+ * Checks (any failure makes the exit status 1):
+ *   heap       in-use heap (mallinfo2) sampled every simulated hour; the
+ *              least-squares growth after warm-up must stay under
+ *              --max-heap-growth bytes per day
+ *   state      the gap between retained state snapshots on a healthy
+ *              connection must not exceed twice the state period plus one
+ *              second; mean interval is reported to show scheduling drift
+ *   loop       a loop() pass on a healthy connection must not hold the
+ *              loop for longer than --max-loop-ms
+ *   acks       a command must be ACKed within --ack-timeout on the
+ *              connection it was sent on; commands cut off by a fault are
+ *              counted separately
+ *   reconnect  after an outage ends, the device must be back within
+ *              --max-reconnect-s
+ *   restart    the sketch must not call ESP.restart()
+ *
+ * Anomalies are printed to stderr with the simulated day/time and millis()
+ * as they happen, with a progress line per simulated day. The summary is one
+ * JSON line on stdout, optionally appended to a file.
+ *
+ * The simulation covers the default build. ASYNC_CORE resolves the broker
+ * with getaddrinfo, which the simulation does not intercept.
+ *
+ * Build (from firmware/esp32_device_authoritative; ARDUINOJSON and
+ * PUBSUBCLIENT are the src folders of the Arduino libraries):
+ *
+ *   FLAGS="-std=gnu++17 -O2 -DARDUINO=10819 -DARDUINOJSON_ENABLE_PROGMEM=0 -DHOST_SIM \
+ *          -Ihost -I. -I$ARDUINOJSON -I$PUBSUBCLIENT"
+ *   g++ $FLAGS -x c++ main_secure.cpp host/soak_sim.cpp host/arduino_host.cpp \
+ *       $PUBSUBCLIENT/PubSubClient.cpp -o soak_sim
+ *
+ * Run:
+ *
+ *   ./soak_sim                                  # one week, default faults
+ *   ./soak_sim --days 30 --seed 7 --out soak.jsonl --label "$(git rev-parse --short HEAD)"
+ *   ./soak_sim --days 1 --drop-every-h 0.25 --device-log | less
+ *
+ * Options:
+ *   --days N               simulated duration (default 7)
+ *   --seed N               seed for latency, jitter and command timing (default 1)
+ *   --latency MS           broker-to-device latency (default 20)
+ *   --jitter MS            extra random latency, 0..MS (default 10)
+ *   --cmd-per-min N        steady command rate (default 6)
+ *   --burst-every-min N    minutes between command bursts, 0 = none (default 60)
+ *   --burst-size N         commands per burst (default 10)
+ *   --drop-every-h H       hours between connection drops, 0 = none (default 6)
+ *   --outage-every-h H     hours between broker outages, 0 = none (default 24)
+ *   --outage-s S           outage length (default 600)
+ *   --blackhole-every-h H  hours between black-holed connections, 0 = none (default 12)
+ *   --rollover-h H         hours into the run at which millis() wraps,
+ *                          negative = boot at 0 (default 24)
+ *   --state-period MS      the sketch's STATE_PERIOD (default 3000)
+ *   --ack-timeout MS       ACK deadline (default 5000)
+ *   --max-loop-ms MS       longest healthy loop() pass (default 1000)
+ *   --max-reconnect-s S    longest reconnect after an outage (default 60)
+ *   --max-heap-growth B    heap growth limit, bytes per simulated day (default 4096)
+ *   --tenant ID, --id ID   device topic prefix (default tenantA / pump-1)
+ *   --label TEXT           free-form tag copied into the summary
+ *   --out FILE             append the summary line to FILE
+ *   --device-log           pass the sketch's serial output through to stdout
+ */
+
+#include "Arduino.h"
+#include "sim.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <map>
+#include <random>
+#include <string>
+
+void setup();
+void loop();
+
+struct Options {
+  double days = 7;
+  uint32_t seed = 1;
+  uint32_t latencyMs = 20;
+  uint32_t jitterMs = 10;
+  double cmdPerMin = 6;
+  double burstEveryMin = 60;
+  uint32_t burstSize = 10;
+  double dropEveryH = 6;
+  double outageEveryH = 24;
+  uint32_t outageS = 600;
+  double blackholeEveryH = 12;
+  double rolloverH = 24;
+  uint32_t statePeriodMs = 3000;
+  uint32_t ackTimeoutMs = 5000;
+  uint32_t maxLoopMs = 1000;
+  uint32_t maxReconnectS = 60;
+  int64_t maxHeapGrowth = 4096;
+  std::string tenant = "tenantA";
+  std::string deviceId = "pump-1";
+  std::string label;
+  std::string outPath;
+  bool deviceLog = false;
+};
+
+static Options options;
+
+static const uint64_t US_PER_HOUR = 3600ULL * 1000000ULL;
+static const uint64_t MILLIS_WRAP_US = 4294967296ULL * 1000ULL;  // 2^32 ms
+
+// --- Virtual clock and event queue ------------------------------------------------
+
+enum EventType {
+  EVENT_DELIVER,         // Broker-to-device bytes reach the device
+  EVENT_COMMAND,         // Next steady-rate command
+  EVENT_BURST,           // Next command burst
+  EVENT_DROP,            // Broker closes the connection
+  EVENT_OUTAGE_START,    // Broker goes away and refuses connections
+  EVENT_OUTAGE_END,
+  EVENT_BLACKHOLE,       // Connection stays open, broker stops answering
+  EVENT_SAMPLE           // Hourly heap sample and pending-command sweep
+};
+
+struct Event {
+  EventType type;
+  uint32_t conn;
+  std::string bytes;
+};
+
+static uint64_t clockUs = 0;
+static uint64_t startUs = 0;
+static uint64_t eventSeq = 0;
+static std::map<std::pair<uint64_t, uint64_t>, Event> events;  // (time, seq): FIFO at equal times
+static std::mt19937 rng;
+
+static void runEvent(uint64_t atUs, Event& event);
+static void drainInbound();
+
+static void schedule(uint64_t atUs, EventType type, uint32_t conn = 0, const std::string& bytes = std::string()) {
+  Event event = {type, conn, bytes};
+  events.insert(std::make_pair(std::make_pair(atUs, eventSeq++), event));
+}
+
+static uint64_t nextEventUs() {
+  return events.empty() ? UINT64_MAX : events.begin()->first.first;
+}
+
+// Run every event due by now
+static void runDue() {
+  while (!events.empty() && events.begin()->first.first <= clockUs) {
+    uint64_t atUs = events.begin()->first.first;
+    Event event = events.begin()->second;
+    events.erase(events.begin());
+    runEvent(atUs, event);
+  }
+}
+
+// Move the clock to `targetUs`, running events in order on the way
+static void advanceTo(uint64_t targetUs) {
+  drainInbound();
+  while (!events.empty() && events.begin()->first.first <= targetUs) {
+    if (events.begin()->first.first > clockUs) clockUs = events.begin()->first.first;
+    runDue();
+  }
+  if (targetUs > clockUs) clockUs = targetUs;
+}
+
+static uint64_t hoursUs(double hours) { return (uint64_t)(hours * US_PER_HOUR); }
+
+// --- Results ------------------------------------------------------------------------
+
+#define LATENCY_BUCKETS 1001  // 1 ms buckets, the last one collects >= 1000 ms
+
+struct Results {
+  uint64_t loops = 0;
+  uint64_t maxLoopUs = 0;
+  uint64_t bootUs = 0;
+  uint32_t connects = 0;
+  uint32_t refusedConnects = 0;
+  uint32_t drops = 0;
+  uint32_t outages = 0;
+  uint32_t blackholes = 0;
+  uint64_t maxReconnectUs = 0;
+  uint64_t maxBlackholeDetectUs = 0;
+  uint32_t commandsSent = 0;
+  uint32_t commandsSkipped = 0;  // Device offline when the command was due
+  uint32_t acks = 0;
+  uint32_t failedAcks = 0;
+  uint32_t lostAcks = 0;
+  uint32_t interrupted = 0;     // Sent on a connection a fault then cut off
+  uint32_t latency[LATENCY_BUCKETS] = {0};
+  uint32_t states = 0;
+  uint32_t statesAfterRollover = 0;
+  uint64_t stateIntervalSumUs = 0;
+  uint32_t stateIntervals = 0;
+  uint64_t maxStateGapUs = 0;
+  uint32_t publishes = 0;
+  uint64_t publishBytes = 0;
+  uint32_t anomalies = 0;
+  bool restarted = false;
+};
+
+static Results results;
+
+#define HEAP_MAX_SAMPLES (24 * 400)
+#define HEAP_WARMUP_HOURS 2
+
+static int64_t heapSamples[HEAP_MAX_SAMPLES];
+static uint32_t heapSampleCount = 0;
+static bool sampleDue = false;
+
+static int64_t heapInUse() {
+  struct mallinfo2 info = mallinfo2();
+  return (int64_t)info.uordblks;
+}
+
+// "d2 04:13:22.120" relative to the start of the run
+static std::string simTime() {
+  uint64_t ms = (clockUs - startUs) / 1000;
+  char buf[48];
+  snprintf(buf, sizeof(buf), "d%llu %02llu:%02llu:%02llu.%03llu", (unsigned long long)(ms / 86400000ULL),
+           (unsigned long long)(ms / 3600000ULL % 24), (unsigned long long)(ms / 60000ULL % 60),
+           (unsigned long long)(ms / 1000ULL % 60), (unsigned long long)(ms % 1000));
+  return buf;
+}
+
+static void anomaly(const char* what, uint64_t valueMs) {
+  results.anomalies++;
+  fprintf(stderr, "[%s millis=%lu] %s: %llu ms\n", simTime().c_str(), (unsigned long)(uint32_t)(clockUs / 1000),
+          what, (unsigned long long)valueMs);
+}
+
+// --- Simulated broker -----------------------------------------------------------------
+
+struct Connection {
+  uint32_t id = 0;
+  int fd = -1;               // Broker end of the socketpair
+  bool connected = false;    // CONNECT received
+  bool subscribed = false;   // Device subscribed to its command topic
+  bool blackholed = false;
+  uint64_t blackholeSinceUs = 0;
+  uint64_t connectedUs = 0;
+  uint64_t lastStateUs = 0;
+  bool stateGapReported = false;
+  uint64_t lastDeliverUs = 0;
+  std::string inbox;
+};
+
+struct PendingCommand {
+  uint64_t sentUs;
+  uint32_t conn;
+};
+
+static Connection conn;
+static uint32_t nextConnId = 0;
+static bool outage = false;
+static uint64_t outageEndedUs = 0;  // Waiting for the first connect after an outage
+static std::map<std::string, PendingCommand> pending;
+static uint32_t commandSeq = 0;
+static std::string inboundBuffer;
+
+static std::string deviceTopic(const char* path) {
+  return "saphari/" + options.tenant + "/devices/" + options.deviceId + "/" + path;
+}
+
+static bool endsWith(const std::string& s, const char* suffix) {
+  size_t len = strlen(suffix);
+  return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+static bool healthy() {
+  return conn.fd >= 0 && conn.connected && !conn.blackholed && !outage;
+}
+
+static void closeConnection() {
+  if (conn.fd < 0) return;
+  close(conn.fd);
+  conn.fd = -1;
+  conn.connected = false;
+  conn.subscribed = false;
+  conn.inbox.clear();
+}
+
+// Queue bytes for the device behind the link latency, keeping TCP order
+static void sendToDevice(const std::string& bytes) {
+  uint64_t atUs = clockUs + (uint64_t)options.latencyMs * 1000;
+  if (options.jitterMs > 0) atUs += rng() % ((uint64_t)options.jitterMs * 1000);
+  if (atUs < conn.lastDeliverUs) atUs = conn.lastDeliverUs;
+  conn.lastDeliverUs = atUs;
+  schedule(atUs, EVENT_DELIVER, conn.id, bytes);
+}
+
+static std::string packet(uint8_t header, const std::string& body) {
+  std::string out(1, (char)header);
+  size_t length = body.size();
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    out += (char)(length > 0 ? digit | 0x80 : digit);
+  } while (length > 0);
+  return out + body;
+}
+
+static void publishCommand() {
+  if (!conn.subscribed || conn.blackholed) {
+    results.commandsSkipped++;
+    return;
+  }
+  char cmdId[24];
+  snprintf(cmdId, sizeof(cmdId), "SIM_%u", ++commandSeq);
+  char payload[160];
+  switch (rng() % 10) {
+    case 0: case 1: case 2: case 3: case 4:
+      snprintf(payload, sizeof(payload), "{\"cmd_id\":\"%s\",\"action\":\"relay\",\"pin\":4,\"state\":%u}",
+               cmdId, commandSeq % 2);
+      break;
+    case 5: case 6:
+      snprintf(payload, sizeof(payload), "{\"cmd_id\":\"%s\",\"action\":\"pwm\",\"pin\":5,\"value\":%u}",
+               cmdId, commandSeq % 256);
+      break;
+    case 7: case 8:
+      snprintf(payload, sizeof(payload), "{\"cmd_id\":\"%s\",\"action\":\"digital_read\",\"pin\":4}", cmdId);
+      break;
+    default:
+      snprintf(payload, sizeof(payload), "{\"cmd_id\":\"%s\",\"action\":\"status_request\"}", cmdId);
+      break;
+  }
+  std::string topic = deviceTopic("cmd");
+  std::string body;
+  body += (char)(topic.size() >> 8);
+  body += (char)(topic.size() & 0xFF);
+  body += topic;
+  body += payload;
+  sendToDevice(packet(0x30, body));  // QoS 0
+
+  PendingCommand entry = {clockUs, conn.id};
+  pending[cmdId] = entry;
+  results.commandsSent++;
+}
+
+// Settle commands past their deadline: lost if their connection stayed healthy
+static void sweepPending(bool all) {
+  for (std::map<std::string, PendingCommand>::iterator it = pending.begin(); it != pending.end();) {
+    if (!all && clockUs - it->second.sentUs < (uint64_t)options.ackTimeoutMs * 1000) {
+      ++it;
+      continue;
+    }
+    if (it->second.conn == conn.id && healthy()) {
+      results.lostAcks++;
+      anomaly(("no ACK for " + it->first).c_str(), (clockUs - it->second.sentUs) / 1000);
+    } else {
+      results.interrupted++;
+    }
+    pending.erase(it++);
+  }
+}
+
+static void onAck(const std::string& payload) {
+  size_t start = payload.find("\"cmd_id\":\"");
+  if (start == std::string::npos) return;
+  start += 10;
+  size_t end = payload.find('"', start);
+  if (end == std::string::npos) return;
+  std::map<std::string, PendingCommand>::iterator it = pending.find(payload.substr(start, end - start));
+  if (it == pending.end()) return;
+
+  uint64_t latencyMs = (clockUs - it->second.sentUs) / 1000;
+  results.latency[latencyMs < LATENCY_BUCKETS - 1 ? latencyMs : LATENCY_BUCKETS - 1]++;
+  results.acks++;
+  if (payload.find("\"ok\":false") != std::string::npos) results.failedAcks++;
+  if (latencyMs > options.ackTimeoutMs && conn.id == it->second.conn) {
+    results.lostAcks++;
+    anomaly(("late ACK for " + it->first).c_str(), latencyMs);
+  }
+  pending.erase(it);
+}
+
+static bool rolledOver() {
+  return options.rolloverH >= 0 && clockUs >= MILLIS_WRAP_US;
+}
+
+static uint64_t stateGapLimitUs() {
+  return (uint64_t)(2 * options.statePeriodMs + 1000) * 1000;
+}
+
+// A scheduler that stopped firing never produces the next snapshot, so the
+// open gap is checked after every pass as well
+static void checkStateGap() {
+  if (!healthy() || conn.stateGapReported) return;
+  uint64_t sinceUs = conn.lastStateUs > conn.connectedUs ? conn.lastStateUs : conn.connectedUs;
+  if (clockUs - sinceUs > stateGapLimitUs()) {
+    conn.stateGapReported = true;
+    anomaly("no state snapshot since", (clockUs - sinceUs) / 1000);
+  }
+}
+
+static void onState() {
+  results.states++;
+  if (rolledOver()) results.statesAfterRollover++;
+  if (conn.lastStateUs != 0) {
+    uint64_t gapUs = clockUs - conn.lastStateUs;
+    results.stateIntervalSumUs += gapUs;
+    results.stateIntervals++;
+    if (gapUs > results.maxStateGapUs) results.maxStateGapUs = gapUs;
+    if (gapUs > stateGapLimitUs() && !conn.stateGapReported) anomaly("state gap", gapUs / 1000);
+  }
+  conn.lastStateUs = clockUs;
+  conn.stateGapReported = false;
+}
+
+static void onPublish(uint8_t flags, const std::string& body) {
+  if (body.size() < 2) return;
+  size_t topicLength = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+  if (body.size() < 2 + topicLength) return;
+  std::string topic = body.substr(2, topicLength);
+  size_t offset = 2 + topicLength;
+  uint8_t qos = (flags >> 1) & 3;
+  if (qos > 0) {
+    sendToDevice(packet(0x40, body.substr(offset, 2)));  // PUBACK
+    offset += 2;
+  }
+  results.publishes++;
+  results.publishBytes += body.size();
+
+  if (endsWith(topic, "/ack")) onAck(body.substr(offset));
+  else if (endsWith(topic, "/state")) onState();
+}
+
+static void onSubscribe(const std::string& body) {
+  if (body.size() < 2) return;
+  std::string granted = body.substr(0, 2);  // Packet id
+  size_t offset = 2;
+  while (offset + 2 <= body.size()) {
+    size_t length = ((uint8_t)body[offset] << 8) | (uint8_t)body[offset + 1];
+    std::string filter = body.substr(offset + 2, length);
+    offset += 2 + length + 1;
+    if (filter == deviceTopic("cmd")) conn.subscribed = true;
+    granted += (char)0;
+  }
+  sendToDevice(packet(0x90, granted));
+}
+
+static void onPacket(uint8_t header, const std::string& body) {
+  switch (header >> 4) {
+    case 1:  // CONNECT
+      conn.connected = true;
+      conn.connectedUs = clockUs;
+      results.connects++;
+      if (outageEndedUs != 0) {
+        uint64_t reconnectUs = clockUs - outageEndedUs;
+        if (reconnectUs > results.maxReconnectUs) results.maxReconnectUs = reconnectUs;
+        if (reconnectUs > (uint64_t)options.maxReconnectS * 1000000) anomaly("slow reconnect after outage", reconnectUs / 1000);
+        outageEndedUs = 0;
+      }
+      sendToDevice(packet(0x20, std::string("\0\0", 2)));  // CONNACK, accepted
+      break;
+    case 3:
+      onPublish(header & 0x0F, body);
+      break;
+    case 8:
+      onSubscribe(body);
+      break;
+    case 12:  // PINGREQ
+      sendToDevice(packet(0xD0, std::string()));
+      break;
+    case 14:  // DISCONNECT
+      closeConnection();
+      break;
+    default:
+      break;
+  }
+}
+
+// Read what the device wrote and handle every complete packet
+static void drainInbound() {
+  while (conn.fd >= 0) {
+    char buf[2048];
+    ssize_t n = recv(conn.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0) {  // Device closed its end
+      if (conn.blackholed) {
+        uint64_t detectUs = clockUs - conn.blackholeSinceUs;
+        if (detectUs > results.maxBlackholeDetectUs) results.maxBlackholeDetectUs = detectUs;
+      }
+      closeConnection();
+      return;
+    }
+    if (n < 0) break;
+    if (!conn.blackholed) conn.inbox.append(buf, n);
+  }
+
+  for (;;) {
+    std::string& inbox = conn.inbox;
+    size_t length = 0;
+    size_t index = 1;
+    uint32_t multiplier = 1;
+    bool complete = false;
+    while (index < inbox.size() && index < 5) {
+      uint8_t digit = inbox[index++];
+      length += (digit & 0x7F) * multiplier;
+      multiplier *= 128;
+      if ((digit & 0x80) == 0) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete || inbox.size() < index + length) return;
+    uint8_t header = inbox[0];
+    std::string body = inbox.substr(index, length);
+    inbox.erase(0, index + length);
+    onPacket(header, body);
+    if (conn.fd < 0) return;
+  }
+}
+
+static void runEvent(uint64_t atUs, Event& event) {
+  (void)atUs;
+  switch (event.type) {
+    case EVENT_DELIVER:
+      if (event.conn == conn.id && conn.fd >= 0 && !conn.blackholed) {
+        if (send(conn.fd, event.bytes.data(), event.bytes.size(), MSG_DONTWAIT | MSG_NOSIGNAL) !=
+            (ssize_t)event.bytes.size()) {
+          anomaly("device receive buffer full, bytes dropped", 0);
+        }
+      }
+      break;
+    case EVENT_COMMAND:
+      publishCommand();
+      sweepPending(false);
+      schedule(clockUs + (uint64_t)(60e6 / options.cmdPerMin * (0.5 + (rng() % 1000) / 1000.0)), EVENT_COMMAND);
+      break;
+    case EVENT_BURST:
+      for (uint32_t i = 0; i < options.burstSize; i++) publishCommand();
+      schedule(clockUs + (uint64_t)(options.burstEveryMin * 60e6), EVENT_BURST);
+      break;
+    case EVENT_DROP:
+      if (conn.fd >= 0) results.drops++;
+      closeConnection();
+      schedule(clockUs + hoursUs(options.dropEveryH), EVENT_DROP);
+      break;
+    case EVENT_OUTAGE_START:
+      results.outages++;
+      outage = true;
+      closeConnection();
+      schedule(clockUs + (uint64_t)options.outageS * 1000000, EVENT_OUTAGE_END);
+      schedule(clockUs + hoursUs(options.outageEveryH), EVENT_OUTAGE_START);
+      break;
+    case EVENT_OUTAGE_END:
+      outage = false;
+      outageEndedUs = clockUs;
+      break;
+    case EVENT_BLACKHOLE:
+      if (conn.fd >= 0 && conn.connected && !conn.blackholed) {
+        results.blackholes++;
+        conn.blackholed = true;
+        conn.blackholeSinceUs = clockUs;
+        conn.inbox.clear();
+      }
+      schedule(clockUs + hoursUs(options.blackholeEveryH), EVENT_BLACKHOLE);
+      break;
+    case EVENT_SAMPLE:
+      sampleDue = true;
+      sweepPending(false);
+      schedule(clockUs + US_PER_HOUR, EVENT_SAMPLE);
+      break;
+  }
+}
+
+// --- Hooks for the host core (host/sim.h) ------------------------------------------
+
+uint64_t hostSimReadClockUs() {
+  clockUs += HOST_SIM_READ_COST_US;
+  return clockUs;
+}
+
+void hostSimSleepUs(uint64_t us) { advanceTo(clockUs + us); }
+
+void hostSimPump() {
+  static bool pumping = false;
+  if (pumping) return;
+  pumping = true;
+  drainInbound();
+  runDue();
+  pumping = false;
+}
+
+int hostSimConnect(uint16_t port) {
+  (void)port;
+  closeConnection();
+  if (outage) {
+    results.refusedConnects++;
+    return -1;
+  }
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) return -1;
+  fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+  conn = Connection();
+  conn.id = ++nextConnId;
+  conn.fd = fds[1];
+  return fds[0];
+}
+
+bool hostSimSerialEnabled() { return options.deviceLog; }
+
+static void finish();
+
+void hostSimRestart() {
+  results.restarted = true;
+  anomaly("device restarted", 0);
+  finish();
+}
+
+// loop_wakeup.h sleeps in select(); this definition takes precedence over
+// the C library's, so the sleep happens on the virtual clock
+extern "C" int select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds, struct timeval* timeout) {
+  (void)exceptfds;
+  uint64_t deadlineUs = timeout == NULL ? UINT64_MAX
+                                        : clockUs + (uint64_t)timeout->tv_sec * 1000000 + timeout->tv_usec;
+  struct pollfd fds[FD_SETSIZE];
+  int count = 0;
+  for (int fd = 0; fd < nfds; fd++) {
+    short wanted = 0;
+    if (readfds != NULL && FD_ISSET(fd, readfds)) wanted |= POLLIN;
+    if (writefds != NULL && FD_ISSET(fd, writefds)) wanted |= POLLOUT;
+    if (wanted == 0) continue;
+    fds[count].fd = fd;
+    fds[count].events = wanted;
+    fds[count].revents = 0;
+    count++;
+  }
+
+  for (;;) {
+    hostSimPump();
+    int ready = poll(fds, count, 0);
+    if (ready < 0) return -1;
+    if (ready > 0 || clockUs >= deadlineUs) break;
+    uint64_t nextUs = nextEventUs();
+    advanceTo(nextUs < deadlineUs ? nextUs : deadlineUs);
+  }
+
+  int bits = 0;
+  if (readfds != NULL) FD_ZERO(readfds);
+  if (writefds != NULL) FD_ZERO(writefds);
+  for (int i = 0; i < count; i++) {
+    if (readfds != NULL && (fds[i].events & POLLIN) && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+      FD_SET(fds[i].fd, readfds);
+      bits++;
+    }
+    if (writefds != NULL && (fds[i].events & POLLOUT) && (fds[i].revents & (POLLOUT | POLLERR))) {
+      FD_SET(fds[i].fd, writefds);
+      bits++;
+    }
+  }
+  return bits;
+}
+
+// --- Checks and summary ------------------------------------------------------------
+
+static void sampleHeap() {
+  if (heapSampleCount < HEAP_MAX_SAMPLES) heapSamples[heapSampleCount++] = heapInUse();
+}
+
+// Least-squares heap growth after warm-up, bytes per simulated day
+static double heapGrowthPerDay() {
+  if (heapSampleCount < HEAP_WARMUP_HOURS + 2) return 0;
+  double n = 0, sumX = 0, sumY = 0, sumXY = 0, sumXX = 0;
+  for (uint32_t i = HEAP_WARMUP_HOURS; i < heapSampleCount; i++) {
+    n++;
+    sumX += i;
+    sumY += heapSamples[i];
+    sumXY += (double)i * heapSamples[i];
+    sumXX += (double)i * i;
+  }
+  double denominator = n * sumXX - sumX * sumX;
+  return denominator == 0 ? 0 : (n * sumXY - sumX * sumY) / denominator * 24;
+}
+
+static uint32_t latencyPercentile(double p) {
+  if (results.acks == 0) return 0;
+  uint64_t rank = (uint64_t)ceil(p / 100.0 * results.acks);
+  uint64_t seen = 0;
+  for (uint32_t ms = 0; ms < LATENCY_BUCKETS; ms++) {
+    seen += results.latency[ms];
+    if (seen >= rank && rank > 0) return ms;
+  }
+  return LATENCY_BUCKETS - 1;
+}
+
+static void progress() {
+  fprintf(stderr, "[%s] loops %llu connects %u drops %u outages %u blackholes %u cmds %u acks %u heap %lld\n",
+          simTime().c_str(), (unsigned long long)results.loops, results.connects, results.drops,
+          results.outages, results.blackholes, results.commandsSent, results.acks,
+          (long long)heapInUse());
+}
+
+static struct timespec wallStart;
+
+static void finish() {
+  sweepPending(true);
+  if (options.rolloverH >= 0 && clockUs >= MILLIS_WRAP_US + stateGapLimitUs() && results.statesAfterRollover == 0) {
+    anomaly("no state snapshot after millis() rollover", (clockUs - MILLIS_WRAP_US) / 1000);
+  }
+
+  double growth = heapGrowthPerDay();
+  bool heapOk = growth <= options.maxHeapGrowth;
+  bool pass = heapOk && results.anomalies == 0 && !results.restarted;
+
+  struct timespec wallEnd;
+  clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+  double wallS = (wallEnd.tv_sec - wallStart.tv_sec) + (wallEnd.tv_nsec - wallStart.tv_nsec) / 1e9;
+
+  char line[2048];
+  snprintf(line, sizeof(line),
+           "{\"label\":\"%s\",\"seed\":%u,\"sim_days\":%.2f,\"wall_s\":%.1f,\"pass\":%s,"
+           "\"loops\":%llu,\"boot_ms\":%llu,\"max_loop_ms\":%llu,"
+           "\"heap\":{\"first\":%lld,\"last\":%lld,\"growth_per_day\":%.0f,\"ok\":%s},"
+           "\"state\":{\"count\":%u,\"mean_interval_ms\":%.1f,\"max_gap_ms\":%llu,\"after_rollover\":%u},"
+           "\"commands\":{\"sent\":%u,\"skipped\":%u,\"acked\":%u,\"failed\":%u,\"lost\":%u,\"interrupted\":%u,"
+           "\"p50_ms\":%u,\"p99_ms\":%u,\"max_ms\":%u},"
+           "\"faults\":{\"drops\":%u,\"outages\":%u,\"blackholes\":%u,\"connects\":%u,\"refused\":%u,"
+           "\"max_reconnect_ms\":%llu,\"max_blackhole_detect_ms\":%llu},"
+           "\"publishes\":%u,\"publish_bytes\":%llu,\"anomalies\":%u,\"restarted\":%s}",
+           options.label.c_str(), options.seed, (clockUs - startUs) / 86400e6, wallS, pass ? "true" : "false",
+           (unsigned long long)results.loops, (unsigned long long)(results.bootUs / 1000),
+           (unsigned long long)(results.maxLoopUs / 1000),
+           (long long)(heapSampleCount > HEAP_WARMUP_HOURS ? heapSamples[HEAP_WARMUP_HOURS] : 0),
+           (long long)(heapSampleCount > 0 ? heapSamples[heapSampleCount - 1] : 0), growth,
+           heapOk ? "true" : "false", results.states,
+           results.stateIntervals ? results.stateIntervalSumUs / 1000.0 / results.stateIntervals : 0.0,
+           (unsigned long long)(results.maxStateGapUs / 1000), results.statesAfterRollover,
+           results.commandsSent, results.commandsSkipped, results.acks, results.failedAcks, results.lostAcks,
+           results.interrupted, latencyPercentile(50), latencyPercentile(99), latencyPercentile(100),
+           results.drops, results.outages, results.blackholes, results.connects, results.refusedConnects,
+           (unsigned long long)(results.maxReconnectUs / 1000),
+           (unsigned long long)(results.maxBlackholeDetectUs / 1000), results.publishes,
+           (unsigned long long)results.publishBytes, results.anomalies, results.restarted ? "true" : "false");
+
+  printf("%s\n", line);
+  fflush(stdout);
+  if (!options.outPath.empty()) {
+    FILE* out = fopen(options.outPath.c_str(), "a");
+    if (out != NULL) {
+      fprintf(out, "%s\n", line);
+      fclose(out);
+    }
+  }
+  exit(pass ? 0 : 1);
+}
+
+// --- Main ---------------------------------------------------------------------------
+
+static void usage() {
+  fprintf(stderr, "usage: soak_sim [--days N] [--seed N] [--latency MS] [--jitter MS] [--cmd-per-min N]\n"
+                  "                [--burst-every-min N] [--burst-size N] [--drop-every-h H]\n"
+                  "                [--outage-every-h H] [--outage-s S] [--blackhole-every-h H]\n"
+                  "                [--rollover-h H] [--state-period MS] [--ack-timeout MS]\n"
+                  "                [--max-loop-ms MS] [--max-reconnect-s S] [--max-heap-growth B]\n"
+                  "                [--tenant ID] [--id ID] [--label TEXT] [--out FILE] [--device-log]\n");
+  exit(2);
+}
+
+static void parseOptions(int argc, char** argv) {
+  static const struct option longOptions[] = {
+    {"days", required_argument, NULL, 'd'},
+    {"seed", required_argument, NULL, 's'},
+    {"latency", required_argument, NULL, 'l'},
+    {"jitter", required_argument, NULL, 'j'},
+    {"cmd-per-min", required_argument, NULL, 'c'},
+    {"burst-every-min", required_argument, NULL, 'b'},
+    {"burst-size", required_argument, NULL, 'B'},
+    {"drop-every-h", required_argument, NULL, 'D'},
+    {"outage-every-h", required_argument, NULL, 'o'},
+    {"outage-s", required_argument, NULL, 'O'},
+    {"blackhole-every-h", required_argument, NULL, 'k'},
+    {"rollover-h", required_argument, NULL, 'r'},
+    {"state-period", required_argument, NULL, 'p'},
+    {"ack-timeout", required_argument, NULL, 'a'},
+    {"max-loop-ms", required_argument, NULL, 'm'},
+    {"max-reconnect-s", required_argument, NULL, 'R'},
+    {"max-heap-growth", required_argument, NULL, 'H'},
+    {"tenant", required_argument, NULL, 't'},
+    {"id", required_argument, NULL, 'i'},
+    {"label", required_argument, NULL, 'L'},
+    {"out", required_argument, NULL, 'f'},
+    {"device-log", no_argument, NULL, 'g'},
+    {NULL, 0, NULL, 0}
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+    switch (opt) {
+      case 'd': options.days = atof(optarg); break;
+      case 's': options.seed = (uint32_t)atoi(optarg); break;
+      case 'l': options.latencyMs = (uint32_t)atoi(optarg); break;
+      case 'j': options.jitterMs = (uint32_t)atoi(optarg); break;
+      case 'c': options.cmdPerMin = atof(optarg); break;
+      case 'b': options.burstEveryMin = atof(optarg); break;
+      case 'B': options.burstSize = (uint32_t)atoi(optarg); break;
+      case 'D': options.dropEveryH = atof(optarg); break;
+      case 'o': options.outageEveryH = atof(optarg); break;
+      case 'O': options.outageS = (uint32_t)atoi(optarg); break;
+      case 'k': options.blackholeEveryH = atof(optarg); break;
+      case 'r': options.rolloverH = atof(optarg); break;
+      case 'p': options.statePeriodMs = (uint32_t)atoi(optarg); break;
+      case 'a': options.ackTimeoutMs = (uint32_t)atoi(optarg); break;
+      case 'm': options.maxLoopMs = (uint32_t)atoi(optarg); break;
+      case 'R': options.maxReconnectS = (uint32_t)atoi(optarg); break;
+      case 'H': options.maxHeapGrowth = atoll(optarg); break;
+      case 't': options.tenant = optarg; break;
+      case 'i': options.deviceId = optarg; break;
+      case 'L': options.label = optarg; break;
+      case 'f': options.outPath = optarg; break;
+      case 'g': options.deviceLog = true; break;
+      default: usage();
+    }
+  }
+  if (options.days <= 0 || options.rolloverH >= 49 * 24) usage();
+}
+
+int main(int argc, char** argv) {
+  parseOptions(argc, argv);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  clock_gettime(CLOCK_MONOTONIC, &wallStart);
+  rng.seed(options.seed);
+  randomSeed(options.seed);
+
+  // Boot so that millis() wraps rolloverH hours into the run
+  if (options.rolloverH >= 0) clockUs = MILLIS_WRAP_US - hoursUs(options.rolloverH);
+  startUs = clockUs;
+
+  if (options.cmdPerMin > 0) schedule(clockUs + 60000000, EVENT_COMMAND);
+  if (options.burstEveryMin > 0) schedule(clockUs + (uint64_t)(options.burstEveryMin * 60e6), EVENT_BURST);
+  if (options.dropEveryH > 0) schedule(clockUs + hoursUs(options.dropEveryH), EVENT_DROP);
+  if (options.outageEveryH > 0) schedule(clockUs + hoursUs(options.outageEveryH) + 1800000000ULL, EVENT_OUTAGE_START);
+  if (options.blackholeEveryH > 0) schedule(clockUs + hoursUs(options.blackholeEveryH) + 900000000ULL, EVENT_BLACKHOLE);
+  schedule(clockUs + US_PER_HOUR, EVENT_SAMPLE);
+
+  setup();
+  results.bootUs = clockUs - startUs;
+
+  uint64_t endUs = startUs + (uint64_t)(options.days * 86400e6);
+  uint64_t nextProgressUs = startUs + 86400000000ULL;
+  while (clockUs < endUs) {
+    uint64_t passStartUs = clockUs;
+    uint32_t passConn = conn.id;
+    bool wasHealthy = healthy();
+    loop();
+    results.loops++;
+
+    // A pass includes its closing wait (capped by LOOP_WAKEUP_MAX_IDLE_MS);
+    // anything much longer on a healthy connection is a blocking call
+    if (wasHealthy && healthy() && conn.id == passConn) {
+      uint64_t passUs = clockUs - passStartUs;
+      if (passUs > results.maxLoopUs) results.maxLoopUs = passUs;
+      if (passUs > (uint64_t)options.maxLoopMs * 1000) anomaly("loop stall", passUs / 1000);
+    }
+
+    checkStateGap();
+    if (sampleDue) {
+      sampleDue = false;
+      sampleHeap();
+    }
+    if (clockUs >= nextProgressUs) {
+      nextProgressUs += 86400000000ULL;
+      progress();
+    }
+  }
+  finish();
+}
@@ -0,0 +1,16 @@
+/*
+ * Host stand-in: GPIO set/clear registers map onto the in-memory pin table
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define SOC_GPIO_PIN_COUNT 40
+#define GPIO_OUT_W1TS_REG 0
+#define GPIO_OUT_W1TC_REG 1
+#define GPIO_OUT1_W1TS_REG 2
+#define GPIO_OUT1_W1TC_REG 3
+
+void hostGpioRegWrite(int reg, uint32_t mask);
+#define REG_WRITE(reg, value) hostGpioRegWrite((reg), (value))
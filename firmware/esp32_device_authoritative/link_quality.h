@@ -0,0 +1,211 @@
+/*
+ * Broker link quality estimator
+ *
+ * WiFi.RSSI() only describes the radio hop. Command responsiveness depends on
+ * the whole path to the broker, so this module tracks:
+ *
+ * - Broker RTT: smoothed RTT + variance (RFC 6298 style) from echo probes
+ *   (a sequence number published to our own probe topic and received back
+ *   through the broker). PubSubClient hides its keepalive PINGRESP, so the
+ *   probe stands in for it. CONNECT -> CONNACK time (TLS handshake
+ *   included) is tracked separately since it would skew the RTT estimate.
+ * - Loss: failed publishes and unanswered probes over a sliding window
+ * - Stability: reconnects over a sliding one-hour window
+ *
+ * score() folds these into 0-100 so other subsystems (telemetry scheduling,
+ * broker selection, health checks) can make decisions without re-deriving
+ * thresholds. All timing is passed in by the caller (millis()), and every
+ * comparison is rollover safe.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Fixed number of time buckets, rotated as time passes. Each bucket holds
+// an ok/fail pair; the totals cover the last BUCKETS * bucketMs.
+template <uint8_t BUCKETS>
+class SlidingWindow {
+public:
+  explicit SlidingWindow(unsigned long bucketMs) : bucketMs_(bucketMs) {}
+
+  void add(unsigned long now, uint16_t ok, uint16_t fail) {
+    advance(now);
+    ok_[head_] += ok;
+    fail_[head_] += fail;
+  }
+
+  void totals(unsigned long now, uint32_t& ok, uint32_t& fail) {
+    advance(now);
+    ok = 0;
+    fail = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+      ok += ok_[i];
+      fail += fail_[i];
+    }
+  }
+
+  unsigned long spanMs() const { return bucketMs_ * BUCKETS; }
+
+private:
+  void advance(unsigned long now) {
+    if (!started_) {
+      started_ = true;
+      headStart_ = now;
+      return;
+    }
+    unsigned long steps = (now - headStart_) / bucketMs_;
+    if (steps == 0) return;
+    if (steps > BUCKETS) steps = BUCKETS;
+    for (unsigned long i = 0; i < steps; i++) {
+      head_ = (head_ + 1) % BUCKETS;
+      ok_[head_] = 0;
+      fail_[head_] = 0;
+    }
+    headStart_ = now - ((now - headStart_) % bucketMs_);
+  }
+
+  unsigned long bucketMs_;
+  unsigned long headStart_ = 0;
+  bool started_ = false;
+  uint8_t head_ = 0;
+  uint16_t ok_[BUCKETS] = {0};
+  uint16_t fail_[BUCKETS] = {0};
+};
+
+class LinkQuality {
+public:
+  static const unsigned long PROBE_TIMEOUT_MS = 10000;
+
+  LinkQuality() : delivery_(10000), reconnects_(300000) {}
+
+  // Feed one broker round trip measurement
+  void recordRtt(unsigned long rttMs) {
+    lastRtt_ = rttMs;
+    if (srtt_ == 0) {
+      srtt_ = rttMs;
+      rttVar_ = rttMs / 2;
+    } else {
+      long delta = (long)rttMs - (long)srtt_;
+      rttVar_ = (3 * rttVar_ + (unsigned long)labs(delta)) / 4;
+      srtt_ = (7 * srtt_ + rttMs) / 8;
+    }
+  }
+
+  void recordPublish(bool ok, unsigned long now) {
+    delivery_.add(now, ok ? 1 : 0, ok ? 0 : 1);
+  }
+
+  void recordConnectTime(unsigned long connectMs) {
+    lastConnectMs_ = connectMs;
+  }
+
+  void recordReconnect(unsigned long now) {
+    reconnects_.add(now, 1, 0);
+    reconnectTotal_++;
+  }
+
+  // Start a probe. Returns the sequence number to publish to the probe
+  // topic, or 0 if a probe is still outstanding.
+  uint32_t startProbe(unsigned long now) {
+    if (probeSeq_ != 0) return 0;
+    probeSeq_ = ++lastSeq_;
+    if (probeSeq_ == 0) probeSeq_ = ++lastSeq_;
+    probeSentAt_ = now;
+    return probeSeq_;
+  }
+
+  // Probe payload came back through the broker
+  void onProbeEcho(uint32_t seq, unsigned long now) {
+    if (seq == 0 || seq != probeSeq_) return; // late or foreign echo
+    recordRtt(now - probeSentAt_);
+    delivery_.add(now, 1, 0);
+    probeSeq_ = 0;
+  }
+
+  // A probe that could not be sent at all counts as a loss
+  void cancelProbe(unsigned long now) {
+    if (probeSeq_ == 0) return;
+    delivery_.add(now, 0, 1);
+    probeSeq_ = 0;
+  }
+
+  // Expire unanswered probes
+  void update(unsigned long now) {
+    if (probeSeq_ != 0 && now - probeSentAt_ > PROBE_TIMEOUT_MS) {
+      delivery_.add(now, 0, 1);
+      probeTimeouts_++;
+      probeSeq_ = 0;
+    }
+  }
+
+  unsigned long srtt() const { return srtt_; }
+  unsigned long rttVar() const { return rttVar_; }
+  unsigned long lastRtt() const { return lastRtt_; }
+
+  // Fraction of failed publishes + lost probes over the delivery window
+  float lossRatio(unsigned long now) {
+    uint32_t ok, fail;
+    delivery_.totals(now, ok, fail);
+    if (ok + fail == 0) return 0.0f;
+    return (float)fail / (float)(ok + fail);
+  }
+
+  uint32_t reconnectsLastHour(unsigned long now) {
+    uint32_t count, unused;
+    reconnects_.totals(now, count, unused);
+    return count;
+  }
+
+  // 100 = fast, lossless, stable broker path. Each dimension can remove at
+  // most a fixed share so one bad signal does not zero the score alone.
+  uint8_t score(unsigned long now) {
+    int s = 100;
+
+    // RTT: free up to 100ms, -40 at 2s and beyond
+    if (srtt_ > 100) {
+      unsigned long excess = srtt_ > 2000 ? 1900 : srtt_ - 100;
+      s -= (int)(excess * 40 / 1900);
+    }
+
+    // Loss: -2 per percent, capped at -40
+    int lossPenalty = (int)(lossRatio(now) * 200.0f);
+    s -= lossPenalty > 40 ? 40 : lossPenalty;
+
+    // Reconnects: -5 each in the last hour, capped at -20
+    uint32_t reconnects = reconnectsLastHour(now);
+    s -= reconnects > 4 ? 20 : (int)reconnects * 5;
+
+    return s < 0 ? 0 : (uint8_t)s;
+  }
+
+  void report(JsonObject out, unsigned long now) {
+    uint32_t ok, fail;
+    delivery_.totals(now, ok, fail);
+    out["score"] = score(now);
+    out["rttMs"] = srtt_;
+    out["rttVarMs"] = rttVar_;
+    out["lastRttMs"] = lastRtt_;
+    out["connectMs"] = lastConnectMs_;
+    out["loss"] = lossRatio(now);
+    out["delivered"] = ok;
+    out["failed"] = fail;
+    out["reconnects1h"] = reconnectsLastHour(now);
+    out["reconnects"] = reconnectTotal_;
+    out["probeTimeouts"] = probeTimeouts_;
+  }
+
+private:
+  SlidingWindow<12> delivery_;    // 12 x 10s = last 2 minutes
+  SlidingWindow<12> reconnects_;  // 12 x 5min = last hour
+  unsigned long srtt_ = 0;
+  unsigned long rttVar_ = 0;
+  unsigned long lastRtt_ = 0;
+  unsigned long lastConnectMs_ = 0;
+  unsigned long probeSentAt_ = 0;
+  unsigned long probeTimeouts_ = 0;
+  unsigned long reconnectTotal_ = 0;
+  uint32_t probeSeq_ = 0;
+  uint32_t lastSeq_ = 0;
+};
@@ -0,0 +1,177 @@
+/*
+ * Event-driven loop wakeup
+ *
+ * Replaces the delay(10) at the end of loop(). wait() blocks the loop task in
+ * select() until one of these happens:
+ *   - the MQTT socket is readable (an inbound command is handled at once
+ *     instead of after up to 10 ms plus a pass of the loop)
+ *   - signal() / signalFromISR() is called by another task, a timer callback
+ *     or a GPIO interrupt (an eventfd in the same select)
+ *   - the nearest deadline registered with due()/dueIn() for this pass, capped
+ *     at LOOP_WAKEUP_MAX_IDLE_MS so keepalives and coarse timers still run
+ * An idle device wakes ~10 times a second instead of 100.
+ *
+ * Data already decrypted and buffered inside the TLS client is not visible
+ * to select(), so wait() returns immediately while client.available() > 0.
+ * A client whose fd() is -1 (disconnected) only wakes on signals and
+ * deadlines.
+ *
+ * Build with -DLOOP_WAKEUP_POLL to get the old fixed delay(10) tick, e.g. to
+ * compare command latency and CPU use on the host (host/rtt_bench.cpp).
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <esp_timer.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/eventfd.h>
+
+#if defined(ESP_PLATFORM)
+#include <esp_vfs_eventfd.h>
+#define LOOP_WAKEUP_EVENTFD_FLAGS EFD_SUPPORT_ISR
+#else
+#define LOOP_WAKEUP_EVENTFD_FLAGS EFD_NONBLOCK
+#endif
+
+#define LOOP_WAKEUP_MAX_IDLE_MS 100
+#define LOOP_WAKEUP_POLL_MS 10
+
+enum WakeReason : uint8_t {
+  WAKE_SOCKET = 0,   // MQTT socket readable or TLS data buffered
+  WAKE_SIGNAL = 1,   // signal() from a task, timer or ISR
+  WAKE_DEADLINE = 2, // due()/dueIn() deadline or idle cap
+  WAKE_REASONS = 3
+};
+
+struct LoopWakeupStats {
+  uint32_t wakes[WAKE_REASONS];
+  uint64_t idleUs;      // Time spent blocked in wait()
+  uint64_t sinceUs;     // Start of the measurement window
+};
+
+class LoopWakeup {
+public:
+  // Create the eventfd used by signal(). Without it wait() still wakes on
+  // the socket and deadlines.
+  bool begin() {
+#if defined(ESP_PLATFORM)
+    esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t err = esp_vfs_eventfd_register(&config);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return false;  // INVALID_STATE: already registered
+#endif
+    eventFd_ = eventfd(0, LOOP_WAKEUP_EVENTFD_FLAGS);
+    resetStats();
+    return eventFd_ >= 0;
+  }
+
+  // Wake the loop from another task or a timer callback
+  void signal() {
+    if (eventFd_ < 0) return;
+    uint64_t one = 1;
+    if (write(eventFd_, &one, sizeof(one)) < 0) {
+      // Counter saturated: a wakeup is pending anyway
+    }
+  }
+
+  // Same from a GPIO interrupt (the eventfd is created with EFD_SUPPORT_ISR)
+  void IRAM_ATTR signalFromISR() { signal(); }
+
+  // Deadlines for the current pass; wait() clears them
+  void due(unsigned long atMs) {
+    long remaining = (long)(atMs - millis());
+    dueIn(remaining > 0 ? (uint32_t)remaining : 0);
+  }
+  void dueIn(uint32_t ms) {
+    if (ms < nextMs_) nextMs_ = ms;
+  }
+
+  // Block until the client has data, a signal arrives or the nearest
+  // deadline passes
+  template <typename ClientT>
+  WakeReason wait(ClientT& client) {
+    uint32_t timeoutMs = nextMs_ < LOOP_WAKEUP_MAX_IDLE_MS ? nextMs_ : LOOP_WAKEUP_MAX_IDLE_MS;
+    nextMs_ = UINT32_MAX;
+
+#ifdef LOOP_WAKEUP_POLL
+    (void)timeoutMs;
+    uint64_t pollStart = esp_timer_get_time();
+    delay(LOOP_WAKEUP_POLL_MS);
+    stats_.idleUs += esp_timer_get_time() - pollStart;
+    stats_.wakes[WAKE_DEADLINE]++;
+    return WAKE_DEADLINE;
+#else
+    if (client.available() > 0) return count(WAKE_SOCKET);
+    if (timeoutMs == 0) return count(WAKE_DEADLINE);
+
+    int socketFd = client.connected() ? client.fd() : -1;
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    int maxFd = -1;
+    if (socketFd >= 0) {
+      FD_SET(socketFd, &readSet);
+      maxFd = socketFd;
+    }
+    if (eventFd_ >= 0) {
+      FD_SET(eventFd_, &readSet);
+      if (eventFd_ > maxFd) maxFd = eventFd_;
+    }
+
+    uint64_t start = esp_timer_get_time();
+    int ready = 0;
+    if (maxFd < 0) {
+      delay(timeoutMs);
+    } else {
+      struct timeval timeout = {(time_t)(timeoutMs / 1000), (suseconds_t)((timeoutMs % 1000) * 1000)};
+      ready = select(maxFd + 1, &readSet, NULL, NULL, &timeout);
+      if (ready < 0 && errno != EINTR) delay(LOOP_WAKEUP_POLL_MS);  // Don't spin on a broken fd
+    }
+    stats_.idleUs += esp_timer_get_time() - start;
+
+    if (ready <= 0) return count(WAKE_DEADLINE);
+    if (eventFd_ >= 0 && FD_ISSET(eventFd_, &readSet)) {
+      uint64_t pending;
+      if (read(eventFd_, &pending, sizeof(pending)) < 0) {
+        // Already drained
+      }
+      if (socketFd < 0 || !FD_ISSET(socketFd, &readSet)) return count(WAKE_SIGNAL);
+    }
+    return count(WAKE_SOCKET);
+#endif
+  }
+
+  const LoopWakeupStats& stats() const { return stats_; }
+
+  void resetStats() {
+    memset(&stats_, 0, sizeof(stats_));
+    stats_.sinceUs = esp_timer_get_time();
+  }
+
+  // Wakeups by reason and the share of time the loop spent blocked since the
+  // last reset
+  void report(JsonObject out) {
+    uint64_t windowUs = esp_timer_get_time() - stats_.sinceUs;
+    out["socket"] = stats_.wakes[WAKE_SOCKET];
+    out["signal"] = stats_.wakes[WAKE_SIGNAL];
+    out["deadline"] = stats_.wakes[WAKE_DEADLINE];
+    out["window_s"] = (uint32_t)(windowUs / 1000000);
+    if (windowUs > 0) {
+      out["idle_pct"] = (float)(stats_.idleUs * 100.0 / windowUs);
+      out["wakes_per_s"] = (float)((stats_.wakes[WAKE_SOCKET] + stats_.wakes[WAKE_SIGNAL] +
+                                    stats_.wakes[WAKE_DEADLINE]) * 1e6 / windowUs);
+    }
+  }
+
+private:
+  WakeReason count(WakeReason reason) {
+    stats_.wakes[reason]++;
+    return reason;
+  }
+
+  int eventFd_ = -1;
+  uint32_t nextMs_ = UINT32_MAX;
+  LoopWakeupStats stats_ = {};
+};
@@ -15,6 +15,10 @@
 #include <WiFi.h>
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
+#include "mqtt_stream.h"
+#include "loop_wakeup.h"
+#include "state_coalescer.h"
+#include "servo_motion.h"
 
 // WiFi Configuration
 const char* WIFI_SSID = "YOUR_WIFI";
@@ -28,15 +32,30 @@ const char* DEVICE_ID = "pump-1";
 // Hardware Configuration
 const int PIN4 = 4;  // Example controlled pin
 const int LED_PIN = 2; // Built-in LED
+const int VALVE_SERVO_PIN = 18; // Valve servo (default for "servo" commands)
 
 WiFiClient espClient;
 PubSubClient client(espClient);
+LoopWakeup loopWakeup;
+MqttStreamPublisher publisher(client);
+StateCoalescer stateChanges;
+ServoMotion servoMotion;
 
 // State management
 unsigned long lastStateMs = 0;
 const unsigned long STATE_PERIOD = 3000; // Publish state every 3 seconds
 bool deviceOnline = false;
 
+// Pins a servo may drive: output-capable, not the relay, LED, UART0, flash
+// (6-11) or strapping pins (0, 5, 12, 15), and not input-only (34-39)
+bool isServoPin(int pin) {
+  static const int8_t allowed[] = {13, 14, 16, 17, 18, 19, 21, 22, 23, 25, 26, 27, 32, 33};
+  for (int8_t p : allowed) {
+    if (p == pin) return true;
+  }
+  return false;
+}
+
 // Helper function to build MQTT topics
 String shadowTopic(const char* path) {
   String t = "devices/";
@@ -48,15 +67,23 @@ String shadowTopic(const char* path) {
 
 // Publish device status (online/offline)
 void publishStatus(const char* status) {
-  client.publish(shadowTopic("status").c_str(), status, true);
+  if (!publisher.publish(shadowTopic("status").c_str(), status, true)) {
+    Serial.println("Failed to publish status: " + String(status));
+    return;
+  }
   Serial.println("Published status: " + String(status));
 }
 
 // Publish complete device state
 void publishState() {
+  // Covers any command-driven change still waiting to settle; if it fails,
+  // the periodic publish retries
+  stateChanges.published();
+  
   StaticJsonDocument<512> doc;
   doc["deviceId"] = DEVICE_ID;
   doc["timestamp"] = millis();
+  doc["publishFailures"] = publisher.failures();
   
   // GPIO state
   JsonObject gpio = doc.createNestedObject("gpio");
@@ -74,15 +101,25 @@ void publishState() {
   gauges["waterLevel"] = random(0, 100); // Simulated water level
   gauges["battery"] = random(80, 100); // Simulated battery level
   
-  // Servo positions (example)
+  // Servo positions: the commanded trajectory, null until the valve is first driven
   JsonObject servos = doc.createNestedObject("servos");
-  servos["valve"] = random(0, 180); // Simulated valve position
+  float valve;
+  if (servoMotion.position(VALVE_SERVO_PIN, valve)) {
+    servos["valve"] = valve;
+    servos["valveTarget"] = servoMotion.target(VALVE_SERVO_PIN);
+  } else {
+    servos["valve"] = nullptr;
+  }
 
-  char buffer[512];
-  size_t n = serializeJson(doc, buffer);
-  client.publish(shadowTopic("state").c_str(), buffer, true);
+  // Stream straight into the socket - 512 bytes exceeds the default MQTT buffer
+  if (!publisher.publishJson(shadowTopic("state").c_str(), doc, true)) {
+    Serial.println("Failed to publish state (failures: " + String(publisher.failures()) + ")");
+    return;
+  }
   
-  Serial.println("Published state: " + String(buffer));
+  Serial.print("Published state: ");
+  serializeJson(doc, Serial);
+  Serial.println();
 }
 
 // Send ACK response for commands
@@ -93,11 +130,14 @@ void sendAck(const String& reqId, bool ok, const char* detail) {
   doc["detail"] = detail;
   doc["timestamp"] = millis();
   
-  char buffer[128];
-  size_t n = serializeJson(doc, buffer);
-  client.publish(shadowTopic("ack").c_str(), buffer, false);
+  if (!publisher.publishJson(shadowTopic("ack").c_str(), doc, false)) {
+    Serial.println("Failed to send ACK for " + reqId);
+    return;
+  }
   
-  Serial.println("Sent ACK: " + String(buffer));
+  Serial.print("Sent ACK: ");
+  serializeJson(doc, Serial);
+  Serial.println();
 }
 
 // Handle incoming commands
@@ -125,36 +165,44 @@ void onCommand(char* topic, byte* payload, unsigned int len) {
     if (pin == PIN4) {
       pinMode(pin, OUTPUT);
       digitalWrite(pin, value ? HIGH : LOW);
-      delay(2); // Small delay to ensure pin state is set
       success = true;
       detail = "GPIO " + String(pin) + " set to " + String(value);
       
-      // Publish state immediately after GPIO change
-      publishState();
+      // ACK first; the state snapshot follows once commands settle
+      stateChanges.markDirty(millis());
     } else if (pin == LED_PIN) {
       pinMode(pin, OUTPUT);
       digitalWrite(pin, value ? HIGH : LOW);
-      delay(2);
       success = true;
       detail = "LED set to " + String(value);
-      publishState();
+      stateChanges.markDirty(millis());
     } else {
       detail = "Unsupported pin: " + String(pin);
     }
   } else if (strcmp(type, "servo") == 0) {
-    // Simulate servo control (replace with actual servo code)
-    if (pin >= 0 && pin <= 180) {
-      success = true;
-      detail = "Servo " + String(pin) + " set to " + String(value) + " degrees";
-      publishState();
-    } else {
+    // Start a profiled move; the timer ISR drives it to the target
+    int servoPin = pin >= 0 ? pin : VALVE_SERVO_PIN;
+    int velocity = doc["speed"] | SERVO_DEFAULT_VELOCITY;
+    int accel = doc["accel"] | SERVO_DEFAULT_ACCEL;
+    if (value < 0 || value > 180) {
       detail = "Invalid servo angle: " + String(value);
+    } else if (!isServoPin(servoPin)) {
+      detail = "Invalid servo pin: " + String(servoPin);
+    } else if (velocity < 0 || velocity > SERVO_MAX_VELOCITY || accel < 1 || accel > SERVO_MAX_ACCEL) {
+      detail = "Invalid servo profile (speed 0-" + String(SERVO_MAX_VELOCITY) + " deg/s, accel 1-" +
+               String(SERVO_MAX_ACCEL) + " deg/s^2)";
+    } else if (!servoMotion.moveTo(servoPin, value, velocity, accel)) {
+      detail = "No free servo channel for pin " + String(servoPin);
+    } else {
+      success = true;
+      detail = "Servo " + String(servoPin) + " moving to " + String(value) + " degrees";
+      stateChanges.markDirty(millis());
     }
   } else if (strcmp(type, "gauge") == 0) {
     // Simulate gauge control
     success = true;
     detail = "Gauge set to " + String(value);
-    publishState();
+    stateChanges.markDirty(millis());
   } else {
     detail = "Unsupported command type: " + String(type);
   }
@@ -204,6 +252,9 @@ void ensureMqttConnection() {
 
 void setup() {
   Serial.begin(115200);
+  if (!loopWakeup.begin()) {
+    Serial.println("Loop wakeup signal unavailable, waking on socket and timers only");
+  }
   Serial.println("ESP32 Device-Authoritative Firmware Starting...");
   
   // Initialize pins
@@ -211,6 +262,9 @@ void setup() {
   digitalWrite(PIN4, LOW);
   pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
+  if (!servoMotion.begin()) {
+    Serial.println("Servo timer unavailable");
+  }
   
   // Connect to WiFi
   WiFi.begin(WIFI_SSID, WIFI_PASS);
@@ -246,7 +300,15 @@ void loop() {
   if (now - lastStateMs > STATE_PERIOD) {
     lastStateMs = now;
     publishState();
+  } else if (stateChanges.due(now)) {
+    publishState();
+  }
+  
+  // A servo reached its target: report where it stopped
+  if (servoMotion.takeArrived()) {
+    stateChanges.markDirty(now);
   }
+  loopWakeup.dueIn(stateChanges.msUntilDue(now));
   
   // Simulate sensor readings changing over time
   static unsigned long lastSensorUpdate = 0;
@@ -255,8 +317,8 @@ void loop() {
     publishState();
   }
   
-  // Small delay to prevent watchdog issues
-  delay(10);
+  // Sleep until a command arrives, something signals the loop or a timer is due
+  loopWakeup.wait(espClient);
 }
 
 /*
@@ -272,8 +334,12 @@ void loop() {
  * - Publish "online" status with LWT "offline"
  * - Publish state snapshots every 3 seconds
  * - Accept GPIO, servo, and gauge commands
+ *   Servo: {"type":"servo","reqId":"r1","pin":18,"value":90,"speed":90,"accel":180}
+ *   (pin defaults to the valve, speed in deg/s with 0 = jump, accel in deg/s^2);
+ *   the move is ACKed at once and state reports the valve along its trajectory
  * - Send ACK responses for all commands
- * - Update state immediately after commands
+ * - ACK commands immediately and publish one state snapshot once a burst
+ *   of commands has settled (state_coalescer.h)
  * 
  * MQTT Topics Used:
  * - devices/pump-1/status: "online" or "offline"
@@ -6,13 +6,25 @@
  * - DNS lookup debugging with detailed error messages
  * - Fallback to direct IP if hostname fails
  * - Automatic retry with exponential backoff
+ * - Non-blocking "diagnose" command: gateway, DNS, TCP and TLS checks
+ *   with per-stage timings, published to saphari/ID/diagnostics
  * 
  * This version helps debug "hostByName(): DNS Failed" errors
+ *
+ * Diagnose (runs in the background, the device keeps handling commands):
+ *   {"action":"diagnose","reqId":"r1"}
+ *   -> {"reqId":"r1","wifi":{...},"gateway":{"result":"refused","ms":4},
+ *       "dns":{...},"tcp":{...},"tls":{...},"verdict":"OK"}
+ *   While a probe is running, another diagnose is refused:
+ *   -> {"reqId":"r2","ok":false,"error":"Diagnostics already running"}
  */
 
 #include <WiFi.h>
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
+#include "mqtt_stream.h"
+#include "loop_wakeup.h"
+#include "net_probe.h"
 
 // ============= USER CONFIGURATION =============
 // WiFi Configuration
@@ -34,6 +46,7 @@ const char* MQTT_FALLBACK_IP = "18.185.216.21";  // broker.emqx.io approximate I
 const bool USE_FALLBACK_IP = true;  // Set to false to disable fallback
 
 const uint16_t MQTT_PORT = 1883;     // Non-TLS port (use 8883 for TLS)
+const uint16_t MQTT_TLS_PORT = 8883; // Only probed by the diagnose command
 const char* DEVICE_ID = "esp32-001"; // Change this for each device!
 
 // Hardware Configuration
@@ -47,6 +60,9 @@ IPAddress dns2(1, 1, 1, 1);      // Cloudflare DNS
 
 WiFiClient espClient;
 PubSubClient mqtt(espClient);
+LoopWakeup loopWakeup;
+MqttStreamPublisher publisher(mqtt);
+NetProbe netProbe;
 
 // State tracking
 bool usingFallbackIP = false;
@@ -187,6 +203,80 @@ String statusOnlineTopic() {
   return topic("status/online");  // saphari/ID/status/online (dashboard expects this)
 }
 
+// ============= MQTT PUBLISHING =============
+
+void publishState() {
+  if (!mqtt.connected()) return;
+  
+  StaticJsonDocument<512> doc;
+  doc["device_id"] = DEVICE_ID;
+  doc["timestamp"] = millis();
+  doc["using_fallback_ip"] = usingFallbackIP;
+  doc["publish_failures"] = publisher.failures();
+  
+  // GPIO states
+  JsonObject gpio = doc.createNestedObject("gpio");
+  gpio[String(CONTROL_PIN)] = digitalRead(CONTROL_PIN);
+  gpio[String(LED_PIN)] = digitalRead(LED_PIN);
+  
+  // Network info
+  JsonObject network = doc.createNestedObject("network");
+  network["rssi"] = WiFi.RSSI();
+  network["ip"] = WiFi.localIP().toString();
+  
+  // Stream straight into the socket - 512 bytes exceeds the default MQTT buffer
+  if (!publisher.publishJson(topic("state").c_str(), doc, true)) {  // retained
+    Serial.println("❌ State publish failed");
+    return;
+  }
+  Serial.println("📤 Published state");
+}
+
+void publishOnline() {
+  if (!publisher.publish(statusOnlineTopic().c_str(), "online", true)) {  // retained
+    Serial.println("❌ Online status publish failed");
+    return;
+  }
+  Serial.println("📤 Published: online");
+}
+
+// Completed probe report: always to serial, to MQTT when connected
+void publishDiagnostics() {
+  DynamicJsonDocument doc(1536);
+  if (netProbe.requestId()[0] != '\0') doc["reqId"] = netProbe.requestId();
+  doc["device_id"] = DEVICE_ID;
+  netProbe.report(doc.as<JsonObject>());
+
+  Serial.print("🩺 Diagnostics: ");
+  serializeJson(doc, Serial);
+  Serial.println();
+
+  if (mqtt.connected() && !publisher.publishJson(topic("diagnostics").c_str(), doc, false)) {
+    Serial.println("❌ Diagnostics publish failed");
+  }
+}
+
+bool startDiagnostics(const char* reqId) {
+  NetProbeTarget target = {MQTT_HOST, MQTT_PORT, MQTT_TLS_PORT, "google.com"};
+  if (!netProbe.start(target, reqId)) return false;
+  Serial.println("🩺 Running network diagnostics in the background");
+  return true;
+}
+
+// Answer a diagnose that arrived while a probe was still running, so the
+// requester is not left waiting for a report that will carry another reqId
+void publishDiagnosticsBusy(const char* reqId) {
+  Serial.println("   ⚠️  Diagnostics already running");
+  StaticJsonDocument<192> doc;
+  if (reqId[0] != '\0') doc["reqId"] = reqId;
+  doc["device_id"] = DEVICE_ID;
+  doc["ok"] = false;
+  doc["error"] = "Diagnostics already running";
+  if (mqtt.connected() && !publisher.publishJson(topic("diagnostics").c_str(), doc, false)) {
+    Serial.println("❌ Diagnostics publish failed");
+  }
+}
+
 // ============= MQTT CALLBACKS =============
 
 void onMqttMessage(char* topic, byte* payload, unsigned int length) {
@@ -215,6 +305,12 @@ void onMqttMessage(char* topic, byte* payload, unsigned int length) {
   int pin = doc["pin"] | -1;
   int value = doc["value"] | doc["state"] | 0;
   
+  if (strcmp(action, "diagnose") == 0) {
+    const char* reqId = doc["reqId"] | "";
+    if (!startDiagnostics(reqId)) publishDiagnosticsBusy(reqId);
+    return;
+  }
+  
   if (pin == CONTROL_PIN || pin == LED_PIN) {
     digitalWrite(pin, value ? HIGH : LOW);
     Serial.print("   ✅ Set GPIO ");
@@ -227,38 +323,6 @@ void onMqttMessage(char* topic, byte* payload, unsigned int length) {
   }
 }
 
-// ============= MQTT PUBLISHING =============
-
-void publishState() {
-  if (!mqtt.connected()) return;
-  
-  StaticJsonDocument<512> doc;
-  doc["device_id"] = DEVICE_ID;
-  doc["timestamp"] = millis();
-  doc["using_fallback_ip"] = usingFallbackIP;
-  
-  // GPIO states
-  JsonObject gpio = doc.createNestedObject("gpio");
-  gpio[String(CONTROL_PIN)] = digitalRead(CONTROL_PIN);
-  gpio[String(LED_PIN)] = digitalRead(LED_PIN);
-  
-  // Network info
-  JsonObject network = doc.createNestedObject("network");
-  network["rssi"] = WiFi.RSSI();
-  network["ip"] = WiFi.localIP().toString();
-  
-  char buffer[512];
-  serializeJson(doc, buffer);
-  
-  mqtt.publish(topic("state").c_str(), buffer, true);  // retained
-  Serial.println("📤 Published state");
-}
-
-void publishOnline() {
-  mqtt.publish(statusOnlineTopic().c_str(), "online", true);  // retained
-  Serial.println("📤 Published: online");
-}
-
 // ============= MQTT CONNECTION =============
 
 bool connectMQTT() {
@@ -369,7 +433,7 @@ void ensureMQTTConnection() {
   if (!connectMQTT()) {
     if (reconnectAttempts >= 5) {
       Serial.println("\n⚠️  Multiple MQTT failures. Running diagnostics...");
-      printNetworkDebug();
+      startDiagnostics("");
     }
   }
 }
@@ -410,6 +474,9 @@ void connectWiFi() {
 
 void setup() {
   Serial.begin(115200);
+  if (!loopWakeup.begin()) {
+    Serial.println("Loop wakeup signal unavailable, waking on socket and timers only");
+  }
   delay(1000);
   
   Serial.println("\n");
@@ -468,7 +535,12 @@ void loop() {
     publishState();
   }
   
-  delay(10);
+  // Advance a running diagnose one step; its socket polls are non-blocking
+  if (netProbe.update(now)) publishDiagnostics();
+  loopWakeup.dueIn(netProbe.msUntilNextStep());
+  
+  // Sleep until a command arrives, something signals the loop or a timer is due
+  loopWakeup.wait(espClient);
 }
 
 /*
@@ -8,6 +8,8 @@
  * - Signed URL security with expiration
  * - Update progress tracking and reporting
  * - Safe boot detection and rollback on failure
+ * - Small TLS records on the MQTT connection (max_fragment_length)
+ * - One CA store for MQTT and OTA, parsed once at boot
  * 
  * OTA Features:
  * - Secure HTTPS downloads from Supabase Storage
@@ -28,6 +30,15 @@
 #include <esp_https_ota.h>
 #include <mbedtls/sha256.h>
 #include <base64.h>
+#include <Preferences.h>
+#include <esp_heap_caps.h>
+#include "mqtt_stream.h"
+#include "link_quality.h"
+#include "memory_governor.h"
+#include "loop_wakeup.h"
+#include "tls_profile.h"
+#include "ca_certs.h"
+#include "cmd_decoder.h"
 
 // WiFi Configuration
 const char* WIFI_SSID = "YOUR_WIFI";
@@ -49,20 +60,31 @@ String currentJWT = "";
 const int PIN4 = 4;
 const int LED_PIN = 2;
 
-// OTA Configuration
-const char* OTA_SERVER_CERT = \
-"-----BEGIN CERTIFICATE-----\n" \
-"MIIFazF1kSNXkJc0ARj20yf\n" \
-"-----END CERTIFICATE-----\n";
+// TLS trust: the CA store (ca_certs.h, DER) is parsed once at boot and
+// shared by MQTT and OTA downloads. Add the OTA storage host's root CA to
+// CA_CERTS. Optional pin for the broker connection only: base64 SHA-256 of
+// the broker's (or its intermediate's) public key, see ca_store.h.
+const char* BROKER_SPKI_PIN = "";
 
-// Root CA Certificate for broker.emqx.io (EMQX)
-const char* ROOT_CA = \
-"-----BEGIN CERTIFICATE-----\n" \
-"MIIFazF1kSNXkJc0ARj20yf\n" \
-"-----END CERTIFICATE-----\n";
+CaStore caStore;
+SpkiPins brokerPins;
 
-WiFiClientSecure secureClient;
+// MQTT over MbedTlsClient so the broker can be asked for small records
+// (tls_profile.h); the OTA download keeps esp_https_ota's own TLS session
+MbedTlsClient secureClient;
 PubSubClient mqttClient(secureClient);
+LoopWakeup loopWakeup;
+MqttStreamPublisher publisher(mqttClient);
+LinkQuality linkQuality;
+MemoryGovernor memoryGovernor;
+
+// MQTT buffer sizes (inbound commands; publishes are streamed)
+const uint16_t MQTT_BUFFER_NORMAL = 1024; // Signed OTA URLs need the headroom
+const uint16_t MQTT_BUFFER_CONSERVE = 512;
+
+// Largest TLS record requested from the broker: a full inbound command
+// (MQTT_BUFFER_NORMAL) fits in one record
+const uint16_t TLS_MQTT_MAX_FRAGMENT = 2048;
 
 // OTA State Management
 struct OTAState {
@@ -72,6 +94,8 @@ struct OTAState {
   size_t totalSize = 0;
   size_t downloadedSize = 0;
   unsigned long startTime = 0;
+  uint32_t throughputBps = 0;   // Download rate of the last finished update
+  uint32_t tlsPeakHeap = 0;     // Peak mbedTLS heap during the download
   int retryCount = 0;
   const int maxRetries = 3;
 };
@@ -88,6 +112,12 @@ struct HealthState {
   int heartbeatInterval = 60000; // 1 minute
   int stateInterval = 30000; // 30 seconds
   int healthCheckInterval = 300000; // 5 minutes
+  int probeInterval = 30000; // 30 seconds
+  unsigned long lastProbe = 0;
+  uint8_t minLinkScore = 40; // Below this the broker link counts as unhealthy
+  int memorySampleInterval = 1000; // 1 second
+  unsigned long lastMemorySample = 0;
+  String lastRestartReason = ""; // Persisted by a controlled restart, cleared once reported
   bool isHealthy = true;
   String lastError = "";
   int errorCount = 0;
@@ -162,25 +192,58 @@ void publishOTAStatus(const String& status, const String& message = "", int prog
   doc["deviceId"] = DEVICE_ID;
   doc["totalSize"] = otaState.totalSize;
   doc["downloadedSize"] = otaState.downloadedSize;
+  if (otaState.throughputBps > 0) {
+    doc["throughputBps"] = otaState.throughputBps;
+    doc["tlsPeakHeap"] = otaState.tlsPeakHeap;
+  }
   
-  char buffer[256];
-  serializeJson(doc, buffer);
-  mqttClient.publish(secureTopic("ota_status").c_str(), buffer, false);
+  if (!publisher.publishJson(secureTopic("ota_status").c_str(), doc, false)) {
+    Serial.println("Failed to publish OTA status: " + status);
+    return;
+  }
   
   Serial.println("OTA Status: " + status + " - " + message);
 }
 
 // Publish device status
 void publishStatus(const char* status) {
-  mqttClient.publish(secureTopic("status").c_str(), status, true);
+  if (!publisher.publish(secureTopic("status").c_str(), status, true)) {
+    Serial.println("Failed to publish status: " + String(status));
+    return;
+  }
   Serial.println("Published status: " + String(status));
 }
 
+// Set while the probe is published: its echo (or cancelProbe) is what counts
+bool publishingProbe = false;
+
+// Feed every publish result except probes into the link quality estimator
+void onPublishOutcome(bool ok) {
+  if (publishingProbe) return;
+  linkQuality.recordPublish(ok, millis());
+}
+
+// Publish a probe to our own probe topic; the echo gives the broker RTT
+void sendLinkProbe() {
+  healthState.lastProbe = millis();
+  if (!mqttClient.connected()) return;
+  
+  uint32_t seq = linkQuality.startProbe(millis());
+  if (seq == 0) return; // Previous probe still outstanding
+  
+  publishingProbe = true;
+  bool sent = publisher.publish(secureTopic("probe").c_str(), String(seq).c_str(), false);
+  publishingProbe = false;
+  if (!sent) {
+    linkQuality.cancelProbe(millis());
+  }
+}
+
 // Publish device heartbeat
 void publishHeartbeat() {
   if (!mqttClient.connected()) return;
   
-  StaticJsonDocument<256> heartbeat;
+  StaticJsonDocument<512> heartbeat;
   heartbeat["deviceId"] = DEVICE_ID;
   heartbeat["tenantId"] = TENANT_ID;
   heartbeat["timestamp"] = millis();
@@ -189,17 +252,44 @@ void publishHeartbeat() {
   heartbeat["wifiRSSI"] = WiFi.RSSI();
   heartbeat["isHealthy"] = healthState.isHealthy;
   heartbeat["errorCount"] = healthState.errorCount;
+  heartbeat["publishFailures"] = publisher.failures();
+  
+  JsonObject link = heartbeat.createNestedObject("link");
+  linkQuality.report(link, millis());
+  
+  JsonObject memory = heartbeat.createNestedObject("memory");
+  memory["stage"] = memoryStageName(memoryGovernor.stage());
+  memory["largestBlock"] = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  memory["minFreeHeap"] = memoryGovernor.minFreeHeap();
+  memory["transitions"] = memoryGovernor.transitions();
+  
+  // TLS heap (all sessions) and the MQTT connection's record size and buffers
+  JsonObject tls = heartbeat.createNestedObject("tls");
+  tls["heap"] = TlsHeapMeter::current();
+  secureClient.reportBuffers(tls.createNestedObject("mqtt"));
+  caStore.report(tls.createNestedObject("ca"));
+  if (brokerPins.count() > 0) tls["pin_rejects"] = brokerPins.rejected();
+  
+  if (healthState.lastRestartReason.length() > 0) {
+    heartbeat["lastRestartReason"] = healthState.lastRestartReason;
+  }
   
   if (healthState.lastError.length() > 0) {
     heartbeat["lastError"] = healthState.lastError;
   }
   
-  char buffer[256];
-  serializeJson(heartbeat, buffer);
-  mqttClient.publish(secureTopic("heartbeat").c_str(), buffer, false);
-  
   healthState.lastHeartbeat = millis();
-  Serial.println("Published heartbeat: " + String(buffer));
+  if (!publisher.publishJson(secureTopic("heartbeat").c_str(), heartbeat, false)) {
+    Serial.println("Failed to publish heartbeat");
+    return;
+  }
+  healthState.lastRestartReason = ""; // Reported once, on the first heartbeat after boot
+  
+  if (memoryGovernor.verboseLoggingAllowed()) {
+    Serial.print("Published heartbeat: ");
+    serializeJson(heartbeat, Serial);
+    Serial.println();
+  }
 }
 
 // Publish device state with health information
@@ -217,25 +307,105 @@ void publishState() {
   health["wifiRSSI"] = WiFi.RSSI();
   health["isHealthy"] = healthState.isHealthy;
   health["errorCount"] = healthState.errorCount;
+  health["publishFailures"] = publisher.failures();
   health["lastHeartbeat"] = healthState.lastHeartbeat;
+  health["memoryStage"] = memoryStageName(memoryGovernor.stage());
   
   // GPIO state
   JsonObject gpio = doc.createNestedObject("gpio");
   gpio["4"] = (digitalRead(PIN4) == HIGH) ? 1 : 0;
   gpio["2"] = (digitalRead(LED_PIN) == HIGH) ? 1 : 0;
   
-  // Sensor readings
-  JsonObject sensors = doc.createNestedObject("sensors");
-  sensors["tempC"] = 25.3 + (random(0, 100) / 10.0);
-  sensors["humidity"] = 60 + random(0, 20);
-  sensors["pressure"] = 1013.25 + random(-10, 10);
-  
-  char buffer[512];
-  size_t n = serializeJson(doc, buffer);
-  mqttClient.publish(secureTopic("state").c_str(), buffer, true);
+  // Sensor readings (bulk telemetry - dropped under memory pressure)
+  if (memoryGovernor.bulkTelemetryAllowed()) {
+    JsonObject sensors = doc.createNestedObject("sensors");
+    sensors["tempC"] = 25.3 + (random(0, 100) / 10.0);
+    sensors["humidity"] = 60 + random(0, 20);
+    sensors["pressure"] = 1013.25 + random(-10, 10);
+  }
   
+  // Stream straight into the TLS socket - 512 bytes exceeds the default MQTT buffer
   healthState.lastStatePublish = millis();
-  Serial.println("Published state: " + String(buffer));
+  if (!publisher.publishJson(secureTopic("state").c_str(), doc, true)) {
+    Serial.println("Failed to publish state (failures: " + String(publisher.failures()) + ")");
+    return;
+  }
+  
+  if (memoryGovernor.verboseLoggingAllowed()) {
+    Serial.print("Published state: ");
+    serializeJson(doc, Serial);
+    Serial.println();
+  }
+}
+
+// Apply the actions for a new memory stage and report the transition
+void onMemoryTransition(MemoryStage from, MemoryStage to, uint32_t freeHeap, uint32_t largestBlock) {
+  Serial.printf("Memory governor: %s -> %s (free=%lu, largest=%lu)\n",
+                memoryStageName(from), memoryStageName(to),
+                (unsigned long)freeHeap, (unsigned long)largestBlock);
+  
+  // Stage 1: shrink optional buffers (only when crossing the CONSERVE boundary)
+  if ((from >= MEM_CONSERVE) != (to >= MEM_CONSERVE)) {
+    mqttClient.setBufferSize(to >= MEM_CONSERVE ? MQTT_BUFFER_CONSERVE : MQTT_BUFFER_NORMAL);
+  }
+  
+  // Transitions are always reported, even while non-critical publishes are deferred
+  if (mqttClient.connected()) {
+    StaticJsonDocument<192> event;
+    event["type"] = "memory_governor";
+    event["from"] = memoryStageName(from);
+    event["to"] = memoryStageName(to);
+    event["freeHeap"] = freeHeap;
+    event["largestBlock"] = largestBlock;
+    event["timestamp"] = millis();
+    publisher.publishJson(secureTopic("event").c_str(), event, false);
+  }
+}
+
+// Persist the reason and restart before the heap is exhausted
+void controlledRestart(const char* reason) {
+  Serial.println("Controlled restart: " + String(reason));
+  
+  Preferences prefs;
+  prefs.begin("governor", false);
+  prefs.putString("reason", reason);
+  prefs.putUInt("count", prefs.getUInt("count", 0) + 1);
+  prefs.end();
+  
+  if (mqttClient.connected()) {
+    publishStatus("offline");
+    mqttClient.disconnect();
+  }
+  delay(100);
+  ESP.restart();
+}
+
+// Load (and clear) the reason left by a previous controlled restart
+void loadRestartReason() {
+  Preferences prefs;
+  prefs.begin("governor", false);
+  healthState.lastRestartReason = prefs.getString("reason", "");
+  if (healthState.lastRestartReason.length() > 0) {
+    Serial.println("Previous controlled restart: " + healthState.lastRestartReason);
+    prefs.remove("reason");
+  }
+  prefs.end();
+}
+
+// Sample heap and let the governor pick the load-shedding stage
+void sampleMemory() {
+  healthState.lastMemorySample = millis();
+  
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  memoryGovernor.evaluate(freeHeap, largestBlock);
+  
+  if (memoryGovernor.restartRequired()) {
+    char reason[64];
+    snprintf(reason, sizeof(reason), "memory critical: free=%lu largest=%lu",
+             (unsigned long)freeHeap, (unsigned long)largestBlock);
+    controlledRestart(reason);
+  }
 }
 
 // Perform health check
@@ -257,13 +427,20 @@ void performHealthCheck() {
     healthState.errorCount++;
   }
   
-  // Check free heap memory
-  if (ESP.getFreeHeap() < 10000) { // Less than 10KB free
+  // Check free heap memory (the governor is already shedding load)
+  if (memoryGovernor.stage() >= MEM_SHED) {
     healthState.isHealthy = false;
     healthState.lastError = "Low memory";
     healthState.errorCount++;
   }
   
+  // Check broker path quality (RTT, loss, reconnects)
+  if (linkQuality.score(millis()) < healthState.minLinkScore) {
+    healthState.isHealthy = false;
+    healthState.lastError = "Poor broker link";
+    healthState.errorCount++;
+  }
+  
   // Check WiFi signal strength
   if (WiFi.RSSI() < -80) { // Weak signal
     healthState.isHealthy = false;
@@ -306,11 +483,11 @@ void sendCommandAck(const String& cmd_id, bool ok, const String& error_msg = "",
     ack["result"] = result;
   }
   
-  char payload[256];
-  serializeJson(ack, payload);
-  
   String ackTopic = secureTopic("ack");
-  mqttClient.publish(ackTopic.c_str(), payload, true);
+  if (!publisher.publishJson(ackTopic.c_str(), ack, true)) {
+    Serial.println("Failed to send ACK: " + cmd_id);
+    return;
+  }
   
   Serial.print("ACK sent: ");
   Serial.print(cmd_id);
@@ -318,6 +495,13 @@ void sendCommandAck(const String& cmd_id, bool ok, const String& error_msg = "",
   Serial.println(ok ? "SUCCESS" : "FAILED");
 }
 
+// esp_http_client hook: trust the shared CA store instead of a PEM that
+// would be parsed again for every download
+esp_err_t attachOtaTrust(void* conf) {
+  caStore.attach((mbedtls_ssl_config*)conf);
+  return ESP_OK;
+}
+
 // OTA progress callback
 esp_err_t otaProgressCallback(esp_http_client_event_t *evt) {
   switch (evt->event_id) {
@@ -379,19 +563,27 @@ bool performOTAUpdate(const String& url, const String& expectedChecksum) {
   otaState.expectedChecksum = expectedChecksum;
   otaState.totalSize = 0;
   otaState.downloadedSize = 0;
+  otaState.throughputBps = 0;
+  otaState.tlsPeakHeap = 0;
   otaState.startTime = millis();
   
   // Configure HTTPS OTA
   esp_http_client_config_t config = {
     .url = url.c_str(),
-    .cert_pem = OTA_SERVER_CERT,
     .timeout_ms = 30000,
     .keep_alive_enable = true,
     .event_handler = otaProgressCallback,
   };
+  config.crt_bundle_attach = attachOtaTrust;
   
+  TlsHeapMeter::startWindow();
   esp_err_t ret = esp_https_ota(&config);
   
+  // Download rate and the TLS heap the download needed on top of MQTT's
+  unsigned long elapsed = millis() - otaState.startTime;
+  otaState.throughputBps = elapsed > 0 ? (uint32_t)((uint64_t)otaState.downloadedSize * 1000 / elapsed) : 0;
+  otaState.tlsPeakHeap = TlsHeapMeter::peak();
+  
   if (ret == ESP_OK) {
     Serial.println("OTA update completed successfully");
     publishOTAStatus("success", "OTA update completed successfully");
@@ -452,62 +644,69 @@ void handleOTACommand(const String& cmd_id, const String& url, const String& che
   }
 }
 
+// Command schema, decoded in one pass straight into the struct
+// (cmd_decoder.h); strings point into the MQTT payload
+struct Command {
+  const char* cmdId;
+  const char* action;
+  const char* url;
+  const char* checksum;
+  int32_t pin;
+  bool on;
+};
+
+static const CmdField COMMAND_FIELDS[] = {
+  CMD_FIELD_STR(Command, cmdId, "cmd_id", 64, CMD_REQUIRED),
+  CMD_FIELD_STR(Command, action, "action", 32, CMD_REQUIRED),
+  CMD_FIELD_STR(Command, url, "url", MQTT_BUFFER_NORMAL, CMD_OPTIONAL),
+  CMD_FIELD_STR(Command, checksum, "checksum", 64, CMD_OPTIONAL),
+  CMD_FIELD_INT(Command, pin, "pin", -1, 39, -1),
+  CMD_FIELD_BOOL(Command, on, "value|state", 0),
+};
+
 // Handle incoming commands
 void onCommand(char* topic, byte* payload, unsigned int len) {
-  StaticJsonDocument<256> doc;
-  DeserializationError error = deserializeJson(doc, payload, len);
-  
-  if (error) {
-    Serial.println("Failed to parse command JSON");
-    sendCommandAck("", false, "JSON parsing failed");
+  Command cmd;
+  char error[64];
+  if (!cmdDecode((char*)payload, len, COMMAND_FIELDS, cmd, error, sizeof(error))) {
+    Serial.println("Invalid command: " + String(error));
+    sendCommandAck(cmd.cmdId, false, error);
     return;
   }
   
-  if (!doc.containsKey("cmd_id") || !doc.containsKey("action")) {
-    Serial.println("Invalid command structure");
-    sendCommandAck("", false, "Invalid command structure");
-    return;
-  }
-  
-  const char* cmd_id = doc["cmd_id"];
-  const char* action = doc["action"];
-  const int pin = doc["pin"] | -1;
-  const int state = doc["value"] | doc["state"] | 0;
-  
-  Serial.println("Received command: " + String(cmd_id) + " action=" + String(action));
+  Serial.println("Received command: " + String(cmd.cmdId) + " action=" + String(cmd.action));
   
-  if (strcmp(action, "ota_update") == 0) {
-    const char* url = doc["url"];
-    const char* checksum = doc["checksum"] | "";
-    
-    if (!url) {
-      sendCommandAck(cmd_id, false, "OTA URL required");
+  if (strcmp(cmd.action, "ota_update") == 0) {
+    if (cmd.url[0] == '\0') {
+      sendCommandAck(cmd.cmdId, false, "OTA URL required");
       return;
     }
     
-    handleOTACommand(cmd_id, String(url), String(checksum));
+    handleOTACommand(cmd.cmdId, String(cmd.url), String(cmd.checksum));
     return;
   }
   
-  // Handle other commands (relay, etc.)
+  // Handle other commands (relay, etc.). cmd's strings point into the MQTT
+  // buffer, which the next publish overwrites: keep the id for the ACK.
+  String cmdId = cmd.cmdId;
   bool success = false;
   String error_msg = "";
   
-  if (strcmp(action, "relay") == 0) {
-    if (pin == PIN4 || pin == LED_PIN) {
-      pinMode(pin, OUTPUT);
-      digitalWrite(pin, state ? HIGH : LOW);
+  if (strcmp(cmd.action, "relay") == 0) {
+    if (cmd.pin == PIN4 || cmd.pin == LED_PIN) {
+      pinMode(cmd.pin, OUTPUT);
+      digitalWrite(cmd.pin, cmd.on ? HIGH : LOW);
       success = true;
-      Serial.println("Relay " + String(pin) + " set to " + String(state));
+      Serial.println("Relay " + String(cmd.pin) + " set to " + String(cmd.on ? 1 : 0));
       publishState();
     } else {
-      error_msg = "Unsupported pin for relay: " + String(pin);
+      error_msg = "Unsupported pin for relay: " + String(cmd.pin);
     }
   } else {
-    error_msg = "Unknown action: " + String(action);
+    error_msg = "Unknown action: " + String(cmd.action);
   }
   
-  sendCommandAck(cmd_id, success, error_msg);
+  sendCommandAck(cmdId, success, error_msg);
 }
 
 // MQTT message callback
@@ -521,11 +720,19 @@ void mqttCallback(char* topic, byte* payload, unsigned int len) {
   
   if (topicStr.endsWith("/cmd")) {
     onCommand(topic, payload, len);
+  } else if (topicStr.endsWith("/probe")) {
+    char seq[12];
+    unsigned int n = len < sizeof(seq) - 1 ? len : sizeof(seq) - 1;
+    memcpy(seq, payload, n);
+    seq[n] = '\0';
+    linkQuality.onProbeEcho(strtoul(seq, NULL, 10), millis());
   }
 }
 
 // Ensure secure MQTT connection
 void ensureSecureMqttConnection() {
+  static bool connectedBefore = false;
+  
   while (!mqttClient.connected()) {
     if (needsJWTRefresh()) {
       currentJWT = generateJWT();
@@ -537,6 +744,7 @@ void ensureSecureMqttConnection() {
     
     Serial.println("Attempting secure MQTT connection...");
     
+    unsigned long connectStart = millis();
     if (mqttClient.connect(clientId.c_str(), 
                           currentJWT.c_str(),
                           NULL,
@@ -546,7 +754,14 @@ void ensureSecureMqttConnection() {
                           "offline")) {
       Serial.println("Secure MQTT connected with JWT");
       
+      linkQuality.recordConnectTime(millis() - connectStart);
+      if (connectedBefore) {
+        linkQuality.recordReconnect(millis());
+      }
+      connectedBefore = true;
+      
       mqttClient.subscribe(secureTopic("cmd").c_str());
+      mqttClient.subscribe(secureTopic("probe").c_str());
       publishStatus("online");
       publishState();
     } else {
@@ -586,6 +801,9 @@ void checkBootFailure() {
 
 void setup() {
   Serial.begin(115200);
+  if (!loopWakeup.begin()) {
+    Serial.println("Loop wakeup signal unavailable, waking on socket and timers only");
+  }
   Serial.println("ESP32 Device-Authoritative Firmware (OTA) Starting...");
   
   // Check for boot failure and rollback if needed
@@ -602,6 +820,8 @@ void setup() {
   healthState.lastHeartbeat = 0;
   healthState.lastStatePublish = 0;
   healthState.lastHealthCheck = 0;
+  loadRestartReason();
+  memoryGovernor.onTransition(onMemoryTransition);
   
   // Connect to WiFi
   WiFi.begin(WIFI_SSID, WIFI_PASS);
@@ -614,10 +834,25 @@ void setup() {
   Serial.println("WiFi connected");
   Serial.println("IP address: " + WiFi.localIP().toString());
   
-  // Setup secure MQTT with TLS
-  secureClient.setCACert(ROOT_CA);
+  // Count mbedTLS heap before the first TLS allocation
+  if (!TlsHeapMeter::install()) {
+    Serial.println("mbedTLS allocator not replaceable, TLS heap not metered");
+  }
+  
+  // Setup secure MQTT with TLS, asking the broker for small records
+  uint8_t anchors = caStore.begin(CA_CERTS, CA_CERT_COUNT);
+  if (anchors == 0) {
+    Serial.println("No usable CA certificates, TLS will fail");
+  }
+  if (BROKER_SPKI_PIN[0] != '\0' && !brokerPins.add(BROKER_SPKI_PIN)) {
+    Serial.println("BROKER_SPKI_PIN is not a base64 SHA-256, pinning disabled");
+  }
+  secureClient.setTrust(caStore, &brokerPins);
+  secureClient.setMaxFragmentLength(TLS_MQTT_MAX_FRAGMENT);
   mqttClient.setServer(MQTT_HOST, MQTT_PORT);
   mqttClient.setCallback(mqttCallback);
+  mqttClient.setBufferSize(MQTT_BUFFER_NORMAL);
+  publisher.setOutcomeCallback(onPublishOutcome);
   
   // Generate initial JWT
   currentJWT = generateJWT();
@@ -639,14 +874,27 @@ void loop() {
     ensureSecureMqttConnection();
   }
   mqttClient.loop();
+  linkQuality.update(now);
+  
+  // Memory governor (may restart the device)
+  if (now - healthState.lastMemorySample > healthState.memorySampleInterval) {
+    sampleMemory();
+  }
+  
+  // Measure broker round trip (non-critical, deferred under memory pressure)
+  if (memoryGovernor.nonCriticalPublishAllowed() &&
+      now - healthState.lastProbe > healthState.probeInterval) {
+    sendLinkProbe();
+  }
   
   // Publish heartbeat every minute
   if (now - healthState.lastHeartbeat > healthState.heartbeatInterval) {
     publishHeartbeat();
   }
   
-  // Publish state periodically (less frequent during OTA)
-  if (!otaState.inProgress && (now - healthState.lastStatePublish > healthState.stateInterval)) {
+  // Publish state periodically (less frequent during OTA, deferred under memory pressure)
+  if (!otaState.inProgress && memoryGovernor.nonCriticalPublishAllowed() &&
+      (now - healthState.lastStatePublish > healthState.stateInterval)) {
     publishState();
   }
   
@@ -655,8 +903,8 @@ void loop() {
     performHealthCheck();
   }
   
-  // Small delay to prevent watchdog issues
-  delay(10);
+  // Sleep until a command arrives, something signals the loop or a timer is due
+  loopWakeup.wait(secureClient);
 }
 
 /*
@@ -693,4 +941,25 @@ void loop() {
  * 4. Monitor progress via MQTT ota_status topic
  * 5. Device automatically reboots on success
  * 6. Automatic rollback on failure
+ * 
+ * TLS MEMORY:
+ * The MQTT connection asks the broker for records of at most
+ * TLS_MQTT_MAX_FRAGMENT bytes (max_fragment_length). The heartbeat reports
+ * "tls": {"heap", "mqtt": {"mfl_requested", "mfl", "session_heap",
+ * "in_content_len", "out_content_len", "dynamic_buffers"}}; "mfl" is 16384
+ * when the broker ignored the request. The ota_status "success" message
+ * carries throughputBps and tlsPeakHeap for the download.
+ * Buffers only shrink with a matching mbedTLS build (sdkconfig):
+ *   CONFIG_MBEDTLS_DYNAMIC_BUFFER=y - per-record buffers; OTA servers that
+ *   send 16KB records still work. Preferred.
+ *   CONFIG_MBEDTLS_ASYMMETRIC_CONTENT_LEN=y with IN_CONTENT_LEN=4096 - fixed
+ *   buffers; only if every TLS server (including OTA) accepts the extension.
+ * broker/ has a local mosquitto setup that accepts the extension.
+ * 
+ * TLS TRUST (ca_store.h):
+ * Root CAs live in ca_certs.h as DER and are parsed once at boot; MQTT and
+ * every OTA download point at the same parsed chain. The OTA storage host's
+ * root must be listed there too. BROKER_SPKI_PIN additionally pins the
+ * broker's key; the heartbeat reports "tls": {"ca": {"count", "parse_ms",
+ * "heap"}, "pin_rejects"}.
  */
\ No newline at end of file
@@ -3,6 +3,7 @@
  * 
  * Features:
  * - MQTT over TLS (port 8883) with LWT for presence
+ * - CA certificates parsed once at boot (DER), optional broker key pinning
  * - Heartbeat every 25 seconds to prevent idle timeout
  * - MQTT stale watchdog (90s timeout)
  * - Silent dead TLS socket detection
@@ -12,9 +13,12 @@
  */
 
 #include <WiFi.h>
-#include <WiFiClientSecure.h>
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
+#include "mqtt_stream.h"
+#include "loop_wakeup.h"
+#include "tls_profile.h"
+#include "ca_certs.h"
 
 // ===== CONFIGURATION - UPDATE THESE =====
 const char* WIFI_SSID = "YOUR_WIFI_SSID";
@@ -38,35 +42,19 @@ const unsigned long MQTT_STALE_TIMEOUT_MS = 90000;       // 90 seconds
 const unsigned long WIFI_CHECK_INTERVAL_MS = 10000;      // 10 seconds
 const unsigned long MQTT_RECONNECT_DELAY_MS = 5000;      // 5 seconds between reconnect attempts
 
-// ===== EMQX CA Certificate =====
-const char* ROOT_CA = R"(
------BEGIN CERTIFICATE-----
-MIIDjjCCAnagAwIBAgIQAzrx5qcRqaC7KGSxHQn65TANBgkqhkiG9w0BAQsFADBh
-MQswCQYDVQQGEwJVUzEVMBMGA1UEChMMRGlnaUNlcnQgSW5jMRkwFwYDVQQLExB3
-d3cuZGlnaWNlcnQuY29tMSAwHgYDVQQDExdEaWdpQ2VydCBHbG9iYWwgUm9vdCBH
-MjAeFw0xMzA4MDExMjAwMDBaFw0zODAxMTUxMjAwMDBaMGExCzAJBgNVBAYTAlVT
-MRUwEwYDVQQKEwxEaWdpQ2VydCBJbmMxGTAXBgNVBAsTEHd3dy5kaWdpY2VydC5j
-b20xIDAeBgNVBAMTF0RpZ2lDZXJ0IEdsb2JhbCBSb290IEcyMIIBIjANBgkqhkiG
-9w0BAQEFAAOCAQ8AMIIBCgKCAQEAuzfNNNx7a8myaJCtSnX/RrohCgiN9RlUyfuI
-2/Ou8jqJkTx65qsGGmvPrC3oXgkkRLpimn7Wo6h+4FR1IAWsULecYxpsMNzaHxmx
-1x7e/dfgy5SDN67sH0NO3Xss0r0upS/kqbitOtSZpLYl6ZtrAGCSYP9PIUkY92eQ
-q2EGnI/yuum06ZIya7XzV+hdG82MHauVBJVJ8zUtluNJbd134/tJS7SsVQepj5Wz
-tCO7TG1F8PapspUwtP1MVYwnSlcUfIKdzXOS0xZKBgyMUNGPHgm+F6HmIcr9g+UQ
-vIOlCsRnKPZzFBQ9RnbDhxSJITRNrw9FDKZJobq7nMWxM4MphQIDAQABo0IwQDAP
-BgNVHRMBAf8EBTADAQH/MA4GA1UdDwEB/wQEAwIBhjAdBgNVHQ4EFgQUTiJUIBiV
-5uNu5g/6+rkS7QYXjzkwDQYJKoZIhvcNAQELBQADggEBAGBnKJRvDkhj6zHd6mcY
-1Yl9PMCcit4HLJSIhjn7TG1GxMXQJVdIDJ9BKsOIf3LKJXO9e4B/iG2gCg0KX3rD
-q2gCioXUvMnVMrzEr7Pe2C8bYDLLQVGk9nQ4aX9T+xjUwzaB9lBEzQ7Xn0FfLw1D
-H166yTqe9PQLnkDVzv5fN6D8dJZeJBogXC4ny/TCUe/Fl1VGuFwP/w9mYLJpcnDE
-S4JewxEtHXqTcy4q8MpoM7t1Gv9Xvd+c3xtLT6k8qr3fKSfhQk1jLyB1Gsk8DEJL
-p/a5AIudBcZae5jTfH+X8f/rI9Nl6xZHjMkxRhSSFmipv4y3Mx6h1rXG7CSIBQCD
-JwM=
------END CERTIFICATE-----
-)";
+// ===== TLS TRUST =====
+// The broker CA (DigiCert Global Root G2) is in ca_certs.h as DER. Optional
+// pin: base64 SHA-256 of the broker's (or its intermediate's) public key,
+// see ca_store.h. Empty = CA validation only.
+const char* BROKER_SPKI_PIN = "";
 
 // ===== GLOBAL OBJECTS =====
-WiFiClientSecure tlsClient;
+CaStore caStore;
+SpkiPins brokerPins;
+MbedTlsClient tlsClient;
 PubSubClient mqtt(tlsClient);
+LoopWakeup loopWakeup;
+MqttStreamPublisher publisher(mqtt);
 
 // ===== STATE TRACKING =====
 int gpioStates[NUM_GPIO_PINS] = {0};
@@ -150,7 +138,7 @@ bool publishWithRetry(const char* topic, const char* payload, bool retain = fals
     return false;
   }
   
-  bool success = mqtt.publish(topic, payload, retain);
+  bool success = publisher.publish(topic, payload, retain);
   if (success) {
     lastMqttOk = millis();
     Serial.printf("📤 Published [%s]: %s\n", topic, payload);
@@ -160,6 +148,21 @@ bool publishWithRetry(const char* topic, const char* payload, bool retain = fals
   return success;
 }
 
+bool publishJsonWithRetry(const char* topic, const JsonDocument& doc, bool retain = false) {
+  if (!mqtt.connected()) {
+    return false;
+  }
+  
+  bool success = publisher.publishJson(topic, doc, retain);
+  if (success) {
+    lastMqttOk = millis();
+    Serial.printf("📤 Published [%s] (%u bytes)\n", topic, (unsigned)measureJson(doc));
+  } else {
+    Serial.printf("❌ Publish failed [%s] (failures: %lu)\n", topic, publisher.failures());
+  }
+  return success;
+}
+
 // ===== STATUS PUBLISHING =====
 void publishOnlineStatus() {
   String topic = buildStatusOnlineTopic();
@@ -174,12 +177,10 @@ void publishHeartbeat() {
   doc["uptime"] = uptime;
   doc["rssi"] = rssi;
   doc["heap"] = ESP.getFreeHeap();
-  
-  char payload[128];
-  serializeJson(doc, payload);
+  doc["publishFailures"] = publisher.failures();
   
   String topic = buildTopic("heartbeat");
-  publishWithRetry(topic.c_str(), payload, false);
+  publishJsonWithRetry(topic.c_str(), doc, false);
 }
 
 void publishGpioState(int pin, int value) {
@@ -199,23 +200,21 @@ void publishDeviceState() {
   doc["uptime"] = (millis() - bootTime) / 1000;
   doc["rssi"] = WiFi.RSSI();
   doc["heap"] = ESP.getFreeHeap();
+  doc["publishFailures"] = publisher.failures();
   
   JsonObject gpio = doc.createNestedObject("gpio");
   for (int i = 0; i < NUM_GPIO_PINS; i++) {
     gpio[String(GPIO_PINS[i])] = gpioStates[i];
   }
   
-  char payload[512];
-  serializeJson(doc, payload);
-  
   String topic = buildTopic("state");
-  publishWithRetry(topic.c_str(), payload, true);
+  publishJsonWithRetry(topic.c_str(), doc, true);
 }
 
 // ===== COMMAND HANDLING =====
-void handleToggleCommand(const char* payload) {
+void handleToggleCommand(const byte* payload, unsigned int length) {
   StaticJsonDocument<256> doc;
-  DeserializationError error = deserializeJson(doc, payload);
+  DeserializationError error = deserializeJson(doc, payload, length);
   
   if (error) {
     Serial.printf("❌ JSON parse error: %s\n", error.c_str());
@@ -257,16 +256,13 @@ void handleToggleCommand(const char* payload) {
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
   lastMqttOk = millis();
   
-  char message[length + 1];
-  memcpy(message, payload, length);
-  message[length] = '\0';
-  
-  Serial.printf("📥 Received [%s]: %s\n", topic, message);
+  // Print straight from the payload - no payload-sized copy on the stack
+  Serial.printf("📥 Received [%s]: %.*s\n", topic, (int)length, (const char*)payload);
   
   // Handle toggle commands
   String cmdTopic = buildTopic("cmd/toggle");
   if (String(topic) == cmdTopic) {
-    handleToggleCommand(message);
+    handleToggleCommand(payload, length);
   }
 }
 
@@ -292,12 +288,10 @@ bool connectMqtt() {
   Serial.println("Connecting to MQTT broker...");
   Serial.printf("Host: %s:%d\n", MQTT_HOST, MQTT_PORT);
   
-  // Setup TLS
-  tlsClient.setCACert(ROOT_CA);
   mqtt.setServer(MQTT_HOST, MQTT_PORT);
   mqtt.setCallback(mqttCallback);
   mqtt.setKeepAlive(60);
-  mqtt.setBufferSize(1024);
+  mqtt.setBufferSize(1024);  // Inbound commands only - publishes are streamed
   
   // Build LWT topic: saphari/ID/status/online (dashboard expects this)
   String statusTopic = buildStatusOnlineTopic();
@@ -335,6 +329,9 @@ bool connectMqtt() {
   } else {
     int state = mqtt.state();
     Serial.printf("❌ MQTT connection failed, state: %d\n", state);
+    if (brokerPins.rejected() > 0) {
+      Serial.printf("🔒 Broker key pin mismatches so far: %lu\n", (unsigned long)brokerPins.rejected());
+    }
     return false;
   }
 }
@@ -363,7 +360,7 @@ void checkHeartbeatHealth() {
   String topic = buildTopic("heartbeat");
   String payload = String(uptime);
   
-  bool success = mqtt.publish(topic.c_str(), payload.c_str(), false);
+  bool success = publisher.publish(topic.c_str(), payload.c_str(), false);
   
   if (!success) {
     Serial.println("⚠️ Heartbeat publish failed! TLS socket may be dead. Forcing reconnect...");
@@ -377,6 +374,9 @@ void checkHeartbeatHealth() {
 // ===== SETUP =====
 void setup() {
   Serial.begin(115200);
+  if (!loopWakeup.begin()) {
+    Serial.println("Loop wakeup signal unavailable, waking on socket and timers only");
+  }
   delay(1000);
   
   Serial.println("\n========================================");
@@ -396,6 +396,18 @@ void setup() {
     gpioStates[i] = 0;
   }
   
+  // Parse the trust anchors once; every reconnect reuses them
+  uint8_t anchors = caStore.begin(CA_CERTS, CA_CERT_COUNT);
+  if (anchors == 0) {
+    Serial.println("❌ No usable CA certificates, TLS will fail");
+  } else {
+    Serial.printf("🔒 CA store: %u certificates\n", anchors);
+  }
+  if (BROKER_SPKI_PIN[0] != '\0' && !brokerPins.add(BROKER_SPKI_PIN)) {
+    Serial.println("❌ BROKER_SPKI_PIN is not a base64 SHA-256, pinning disabled");
+  }
+  tlsClient.setTrust(caStore, &brokerPins);
+  
   // Connect to WiFi
   setupWiFi();
   
@@ -449,6 +461,6 @@ void loop() {
     }
   }
   
-  // Small delay to prevent CPU hogging
-  delay(10);
+  // Sleep until a command arrives, something signals the loop or a timer is due
+  loopWakeup.wait(tlsClient);
 }
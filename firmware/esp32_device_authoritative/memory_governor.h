@@ -0,0 +1,124 @@
+/*
+ * Memory-pressure governor
+ *
+ * Watches free heap and the largest free block (fragmentation) and moves
+ * through staged load-shedding levels instead of waiting for an allocation
+ * to fail:
+ *
+ *   NORMAL   - everything enabled
+ *   CONSERVE - shrink optional buffers, pause verbose logging
+ *   SHED     - also drop bulk telemetry and defer non-critical publishes
+ *   CRITICAL - controlled restart (reason persisted by the caller)
+ *
+ * Escalation is immediate; recovery needs the heap to clear the threshold by
+ * a hysteresis margin so the device doesn't flap between stages. CRITICAL
+ * only requests a restart after it has persisted for several samples, so a
+ * transient dip (e.g. during a TLS handshake) doesn't reboot the device.
+ *
+ * The governor only decides - the firmware applies each stage's actions.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+enum MemoryStage : uint8_t {
+  MEM_NORMAL = 0,
+  MEM_CONSERVE = 1,
+  MEM_SHED = 2,
+  MEM_CRITICAL = 3
+};
+
+inline const char* memoryStageName(MemoryStage stage) {
+  switch (stage) {
+    case MEM_NORMAL:   return "normal";
+    case MEM_CONSERVE: return "conserve";
+    case MEM_SHED:     return "shed";
+    case MEM_CRITICAL: return "critical";
+  }
+  return "unknown";
+}
+
+struct MemoryThresholds {
+  uint32_t freeHeap;     // Enter stage when free heap drops below this
+  uint32_t largestBlock; // ...or when the largest free block drops below this
+};
+
+class MemoryGovernor {
+public:
+  // Called on every stage change with the sample that caused it
+  typedef void (*TransitionCallback)(MemoryStage from, MemoryStage to,
+                                     uint32_t freeHeap, uint32_t largestBlock);
+
+  static const uint32_t HYSTERESIS_BYTES = 4096;
+  static const uint8_t CRITICAL_SAMPLES_BEFORE_RESTART = 3;
+
+  MemoryGovernor() {
+    thresholds_[MEM_CONSERVE] = {40000, 16384};
+    thresholds_[MEM_SHED] = {24000, 8192};
+    thresholds_[MEM_CRITICAL] = {10000, 4096};
+  }
+
+  void setThresholds(MemoryStage stage, uint32_t freeHeap, uint32_t largestBlock) {
+    if (stage == MEM_NORMAL) return;
+    thresholds_[stage] = {freeHeap, largestBlock};
+  }
+
+  void onTransition(TransitionCallback callback) { callback_ = callback; }
+
+  // Feed one sample; returns the stage now in effect
+  MemoryStage evaluate(uint32_t freeHeap, uint32_t largestBlock) {
+    if (freeHeap < minFreeHeap_) minFreeHeap_ = freeHeap;
+    if (largestBlock < minLargestBlock_) minLargestBlock_ = largestBlock;
+
+    MemoryStage target = MEM_NORMAL;
+    for (uint8_t s = MEM_CRITICAL; s > MEM_NORMAL; s--) {
+      const MemoryThresholds& t = thresholds_[s];
+      // Stages at or below the current one need the margin to be left
+      uint32_t margin = (s <= stage_) ? HYSTERESIS_BYTES : 0;
+      if (freeHeap < t.freeHeap + margin || largestBlock < t.largestBlock + margin) {
+        target = (MemoryStage)s;
+        break;
+      }
+    }
+
+    if (target == MEM_CRITICAL) {
+      if (criticalSamples_ < 255) criticalSamples_++;
+    } else {
+      criticalSamples_ = 0;
+    }
+
+    if (target != stage_) {
+      MemoryStage from = stage_;
+      stage_ = target;
+      transitions_++;
+      if (callback_) callback_(from, target, freeHeap, largestBlock);
+    }
+    return stage_;
+  }
+
+  MemoryStage stage() const { return stage_; }
+
+  // True once CRITICAL has held long enough to justify a restart
+  bool restartRequired() const {
+    return criticalSamples_ >= CRITICAL_SAMPLES_BEFORE_RESTART;
+  }
+
+  // Stage helpers for the firmware's load-shedding decisions
+  bool verboseLoggingAllowed() const { return stage_ < MEM_CONSERVE; }
+  bool bulkTelemetryAllowed() const { return stage_ < MEM_SHED; }
+  bool nonCriticalPublishAllowed() const { return stage_ < MEM_SHED; }
+
+  uint32_t minFreeHeap() const { return minFreeHeap_; }
+  uint32_t minLargestBlock() const { return minLargestBlock_; }
+  unsigned long transitions() const { return transitions_; }
+
+private:
+  MemoryThresholds thresholds_[4] = {};
+  MemoryStage stage_ = MEM_NORMAL;
+  uint8_t criticalSamples_ = 0;
+  uint32_t minFreeHeap_ = UINT32_MAX;
+  uint32_t minLargestBlock_ = UINT32_MAX;
+  unsigned long transitions_ = 0;
+  TransitionCallback callback_ = nullptr;
+};
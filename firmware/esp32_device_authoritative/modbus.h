@@ -0,0 +1,912 @@
+/*
+ * Modbus TCP/RTU polling bridge
+ *
+ * Reads VFDs, flow meters and other Modbus slaves directly from the device,
+ * replacing the separate gateway. A register map (named points: unit,
+ * table, address, type, scale, dead-band) is pushed with a config command,
+ * stored in NVS (namespace "modbus") and polled without blocking the loop:
+ *
+ * - Points of the same unit and table are merged into as few requests as
+ *   possible: neighbouring ranges are joined across gaps of up to
+ *   MODBUS_MAX_GAP unused registers, within the spec's per-request limits.
+ * - ModbusPoller runs one request at a time as a state machine driven from
+ *   loop(): send, then collect the response on later update() calls until it
+ *   completes or times out. Queued writes go out before the next read.
+ * - takeChanges() returns only points that moved by more than their
+ *   dead-band since the last call, for event publishing; report() gives all
+ *   current values for the state snapshot.
+ *
+ * Transports: ModbusTcpTransport (non-blocking socket, MBAP framing) and
+ * ModbusRtuTransport (a Stream such as Serial2, CRC framing, optional RS-485
+ * driver-enable pin). Host benchmark: host/modbus_bench.cpp.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <IPAddress.h>
+#include <Preferences.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define MODBUS_MAX_POINTS 24
+#define MODBUS_MAX_NAME 15
+#define MODBUS_MAX_HOST 39
+#define MODBUS_MAX_READ_REGISTERS 125   // FC3/FC4 spec limit
+#define MODBUS_MAX_READ_BITS 2000       // FC1/FC2 spec limit
+#define MODBUS_MAX_GAP 8                // Unused registers read to merge two ranges
+#define MODBUS_MAX_PDU 253
+#define MODBUS_WRITE_QUEUE 4
+#define MODBUS_RECONNECT_MS 5000
+#define MODBUS_CONNECT_TIMEOUT_MS 3000
+#define MODBUS_CONNECT_POLL_MS 10       // Loop wakeup while a TCP connect is in progress
+#define MODBUS_MAX_FAILURES 3           // Consecutive timeouts before reconnecting
+#define MODBUS_FORMAT_VERSION 1
+
+enum ModbusTable : uint8_t {
+  MODBUS_COIL = 0,      // FC1 read, FC5 write
+  MODBUS_DISCRETE = 1,  // FC2
+  MODBUS_HOLDING = 2,   // FC3 read, FC6/FC16 write
+  MODBUS_INPUT = 3      // FC4
+};
+
+enum ModbusType : uint8_t {
+  MODBUS_U16 = 0,
+  MODBUS_S16 = 1,
+  MODBUS_U32 = 2,
+  MODBUS_S32 = 3,
+  MODBUS_F32 = 4
+};
+
+enum ModbusTransportType : uint8_t {
+  MODBUS_TCP = 0,
+  MODBUS_RTU = 1
+};
+
+#define MODBUS_FLAG_WRITABLE 0x01
+#define MODBUS_FLAG_SWAP_WORDS 0x02     // 32-bit values sent low word first
+
+struct ModbusPoint {
+  char name[MODBUS_MAX_NAME + 1];
+  uint8_t unit;
+  uint8_t table;
+  uint8_t type;
+  uint8_t flags;
+  uint16_t address;
+  float scale;       // Engineering value = raw * scale
+  float deadband;    // Publish when the value moves by more than this
+};
+
+struct ModbusMap {
+  uint8_t version;
+  uint8_t transport;
+  uint16_t port;
+  uint32_t baud;
+  uint16_t pollMs;
+  uint16_t timeoutMs;
+  char host[MODBUS_MAX_HOST + 1];
+  uint8_t count;
+  ModbusPoint points[MODBUS_MAX_POINTS];
+};
+
+inline uint8_t modbusPointWidth(const ModbusPoint& point) {
+  return point.type >= MODBUS_U32 ? 2 : 1;
+}
+
+inline bool modbusIsBitTable(uint8_t table) {
+  return table == MODBUS_COIL || table == MODBUS_DISCRETE;
+}
+
+inline uint16_t modbusCrc16(const uint8_t* data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+// Build a map from a "modbus_config" command. Checks structure and ranges.
+inline bool parseModbusMap(JsonObjectConst config, ModbusMap& map, String& error) {
+  memset(&map, 0, sizeof(map));
+  map.version = MODBUS_FORMAT_VERSION;
+
+  const char* transport = config["transport"] | "tcp";
+  if (strcmp(transport, "tcp") == 0) {
+    map.transport = MODBUS_TCP;
+    const char* host = config["host"] | "";
+    IPAddress address;
+    // No name lookup: a DNS query would stall the poller like a blocking connect
+    if (strlen(host) == 0 || strlen(host) > MODBUS_MAX_HOST || !address.fromString(host)) {
+      error = "Modbus TCP host must be an IPv4 address";
+      return false;
+    }
+    strcpy(map.host, host);
+    map.port = config["port"] | 502;
+  } else if (strcmp(transport, "rtu") == 0) {
+    map.transport = MODBUS_RTU;
+    map.baud = config["baud"] | 9600UL;
+    if (map.baud < 1200 || map.baud > 115200) { error = "Invalid RTU baud rate"; return false; }
+  } else {
+    error = "Unknown Modbus transport: " + String(transport);
+    return false;
+  }
+
+  long pollMs = config["poll_ms"] | 1000L;
+  long timeoutMs = config["timeout_ms"] | 500L;
+  if (pollMs < 0 || pollMs > 60000) { error = "Invalid poll_ms"; return false; }
+  if (timeoutMs < 20 || timeoutMs > 5000) { error = "Invalid timeout_ms"; return false; }
+  map.pollMs = (uint16_t)pollMs;
+  map.timeoutMs = (uint16_t)timeoutMs;
+
+  JsonArrayConst points = config["points"].as<JsonArrayConst>();
+  if (points.isNull() || points.size() == 0) { error = "Map needs at least one point"; return false; }
+  if (points.size() > MODBUS_MAX_POINTS) { error = "Too many points (max " + String(MODBUS_MAX_POINTS) + ")"; return false; }
+
+  for (JsonObjectConst p : points) {
+    ModbusPoint& point = map.points[map.count];
+    const char* name = p["name"] | "";
+    const char* table = p["table"] | "holding";
+    const char* type = p["type"] | "u16";
+    long unit = p["unit"] | 1L;
+    long address = p["addr"] | -1L;
+
+    if (strlen(name) == 0 || strlen(name) > MODBUS_MAX_NAME) { error = "Invalid point name"; return false; }
+    for (uint8_t i = 0; i < map.count; i++) {
+      if (strcmp(map.points[i].name, name) == 0) { error = "Duplicate point: " + String(name); return false; }
+    }
+    if (unit < 0 || unit > 247) { error = "Invalid unit for " + String(name); return false; }
+    if (address < 0 || address > 65535) { error = "Invalid address for " + String(name); return false; }
+    strcpy(point.name, name);
+    point.unit = (uint8_t)unit;
+    point.address = (uint16_t)address;
+
+    if (strcmp(table, "coil") == 0) point.table = MODBUS_COIL;
+    else if (strcmp(table, "discrete") == 0) point.table = MODBUS_DISCRETE;
+    else if (strcmp(table, "holding") == 0) point.table = MODBUS_HOLDING;
+    else if (strcmp(table, "input") == 0) point.table = MODBUS_INPUT;
+    else { error = "Unknown table for " + String(name); return false; }
+
+    if (strcmp(type, "u16") == 0) point.type = MODBUS_U16;
+    else if (strcmp(type, "s16") == 0) point.type = MODBUS_S16;
+    else if (strcmp(type, "u32") == 0) point.type = MODBUS_U32;
+    else if (strcmp(type, "s32") == 0) point.type = MODBUS_S32;
+    else if (strcmp(type, "f32") == 0) point.type = MODBUS_F32;
+    else { error = "Unknown type for " + String(name); return false; }
+    if (modbusIsBitTable(point.table)) point.type = MODBUS_U16;
+    if (point.address + modbusPointWidth(point) > 65536) { error = "Address out of range for " + String(name); return false; }
+
+    point.scale = p["scale"] | 1.0f;
+    point.deadband = p["deadband"] | 0.0f;
+    if (point.scale == 0 || point.deadband < 0) { error = "Invalid scale or deadband for " + String(name); return false; }
+    if (p["write"] | false) {
+      if (point.table != MODBUS_COIL && point.table != MODBUS_HOLDING) {
+        error = "Only coils and holding registers are writable";
+        return false;
+      }
+      point.flags |= MODBUS_FLAG_WRITABLE;
+    }
+    if (p["swap"] | false) point.flags |= MODBUS_FLAG_SWAP_WORDS;
+    map.count++;
+  }
+  return true;
+}
+
+class ModbusMapStore {
+public:
+  bool save(const ModbusMap& map) {
+    Preferences prefs;
+    if (!prefs.begin("modbus", false)) return false;
+    size_t size = offsetof(ModbusMap, points) + map.count * sizeof(ModbusPoint);
+    bool ok = prefs.putBytes("map", &map, size) == size;
+    prefs.end();
+    return ok;
+  }
+
+  bool load(ModbusMap& map) {
+    Preferences prefs;
+    if (!prefs.begin("modbus", true)) return false;
+    size_t size = prefs.getBytesLength("map");
+    bool ok = size >= offsetof(ModbusMap, points) && size <= sizeof(ModbusMap) &&
+              prefs.getBytes("map", &map, size) == size;
+    prefs.end();
+    return ok && map.version == MODBUS_FORMAT_VERSION && map.count <= MODBUS_MAX_POINTS &&
+           size == offsetof(ModbusMap, points) + map.count * sizeof(ModbusPoint);
+  }
+
+  bool remove() {
+    Preferences prefs;
+    if (!prefs.begin("modbus", false)) return false;
+    bool ok = prefs.remove("map");
+    prefs.end();
+    return ok;
+  }
+};
+
+// --- Transports ----------------------------------------------------------------
+
+class ModbusTransport {
+public:
+  virtual ~ModbusTransport() {}
+  // Ready to send (TCP starts or polls its connect here, rate limited)
+  virtual bool open() = 0;
+  // open() is waiting for a connect to complete; not a failure yet
+  virtual bool connecting() const { return false; }
+  virtual void close() = 0;
+  virtual bool send(uint8_t unit, const uint8_t* pdu, uint8_t length) = 0;
+  // Length of the response PDU once it is complete, 0 while waiting,
+  // -1 for a malformed frame
+  virtual int receive(uint8_t unit, uint8_t* pdu) = 0;
+};
+
+// Connects without blocking: open() starts a non-blocking connect and later
+// calls poll it with a zero select() timeout, so an offline slave never
+// stalls the loop
+class ModbusTcpTransport : public ModbusTransport {
+public:
+  ~ModbusTcpTransport() { close(); }
+
+  // host must be an IPv4 address (parseModbusMap checks this)
+  void setServer(const char* host, uint16_t port) {
+    close();
+    hasAddress_ = address_.fromString(host);
+    port_ = port;
+  }
+
+  bool open() override {
+    if (connected_) return true;
+    unsigned long now = millis();
+    if (fd_ >= 0) return pollConnect(now);
+    if (!hasAddress_) return false;
+    if (attempted_ && now - lastAttemptMs_ < MODBUS_RECONNECT_MS) return false;
+    attempted_ = true;
+    lastAttemptMs_ = now;
+    rxLength_ = 0;
+    if (!startConnect()) return false;
+    return pollConnect(now);
+  }
+
+  bool connecting() const override { return fd_ >= 0 && !connected_; }
+
+  void close() override {
+    closeSocket();
+    attempted_ = false;
+  }
+
+  bool send(uint8_t unit, const uint8_t* pdu, uint8_t length) override {
+    if (!connected_) return false;
+    uint8_t frame[7 + MODBUS_MAX_PDU];
+    transactionId_++;
+    frame[0] = transactionId_ >> 8;
+    frame[1] = transactionId_ & 0xFF;
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[4] = (length + 1) >> 8;
+    frame[5] = (length + 1) & 0xFF;
+    frame[6] = unit;
+    memcpy(frame + 7, pdu, length);
+    rxLength_ = 0;
+    return ::send(fd_, frame, 7 + length, SEND_FLAGS) == (ssize_t)(7 + length);
+  }
+
+  int receive(uint8_t unit, uint8_t* pdu) override {
+    if (connected_ && rxLength_ < sizeof(rx_)) {
+      ssize_t n = recv(fd_, rx_ + rxLength_, sizeof(rx_) - rxLength_, 0);
+      if (n > 0) {
+        rxLength_ += n;
+      } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        closeSocket();  // Slave hung up; the next open() reconnects
+        return 0;
+      }
+    }
+    while (rxLength_ >= 7) {
+      uint16_t length = (rx_[4] << 8) | rx_[5];
+      size_t frameLength = 6 + length;
+      if (length < 2 || frameLength > sizeof(rx_)) {
+        rxLength_ = 0;
+        return -1;
+      }
+      if (rxLength_ < frameLength) return 0;
+      uint16_t transactionId = (rx_[0] << 8) | rx_[1];
+      if (transactionId == transactionId_ && rx_[6] == unit) {
+        memcpy(pdu, rx_ + 7, length - 1);
+        rxLength_ = 0;
+        return length - 1;
+      }
+      // Late answer to a request that already timed out: drop it
+      memmove(rx_, rx_ + frameLength, rxLength_ - frameLength);
+      rxLength_ -= frameLength;
+    }
+    return 0;
+  }
+
+private:
+#ifdef MSG_NOSIGNAL
+  static const int SEND_FLAGS = MSG_NOSIGNAL;  // Host: no SIGPIPE when a slave drops
+#else
+  static const int SEND_FLAGS = 0;
+#endif
+
+  bool startConnect() {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0) return false;
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    addr.sin_addr.s_addr = (uint32_t)address_;
+    if (::connect(fd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+      closeSocket();
+      return false;
+    }
+    return true;
+  }
+
+  // true once connected; a failed or timed-out attempt closes the socket
+  bool pollConnect(unsigned long now) {
+    fd_set writeSet;
+    FD_ZERO(&writeSet);
+    FD_SET(fd_, &writeSet);
+    struct timeval zero = {0, 0};
+    if (select(fd_ + 1, NULL, &writeSet, NULL, &zero) > 0) {
+      int error = 0;
+      socklen_t len = sizeof(error);
+      getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len);
+      if (error == 0) {
+        connected_ = true;
+        return true;
+      }
+      closeSocket();
+    } else if (now - lastAttemptMs_ >= MODBUS_CONNECT_TIMEOUT_MS) {
+      closeSocket();
+    }
+    return false;
+  }
+
+  // Keeps attempted_, so the reconnect rate limit still applies
+  void closeSocket() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    connected_ = false;
+    rxLength_ = 0;
+  }
+
+  IPAddress address_;
+  bool hasAddress_ = false;
+  uint16_t port_ = 502;
+  int fd_ = -1;
+  bool connected_ = false;
+  uint16_t transactionId_ = 0;
+  bool attempted_ = false;
+  unsigned long lastAttemptMs_ = 0;
+  uint8_t rx_[7 + MODBUS_MAX_PDU];
+  size_t rxLength_ = 0;
+};
+
+class ModbusRtuTransport : public ModbusTransport {
+public:
+  // dePin drives an RS-485 transceiver's driver enable (-1 if not used)
+  ModbusRtuTransport(Stream& serial, int dePin = -1) : serial_(serial), dePin_(dePin) {}
+
+  // Frame gap: 3.5 character times, fixed at 1750us above 19200 baud
+  void setBaud(uint32_t baud) {
+    frameGapUs_ = baud > 19200 ? 1750 : (uint32_t)(3.5 * 11 * 1000000UL / baud);
+    if (dePin_ >= 0) {
+      pinMode(dePin_, OUTPUT);
+      digitalWrite(dePin_, LOW);
+    }
+  }
+
+  bool open() override { return true; }
+
+  void close() override { rxLength_ = 0; }
+
+  bool send(uint8_t unit, const uint8_t* pdu, uint8_t length) override {
+    uint8_t frame[1 + MODBUS_MAX_PDU + 2];
+    frame[0] = unit;
+    memcpy(frame + 1, pdu, length);
+    uint16_t crc = modbusCrc16(frame, 1 + length);
+    frame[1 + length] = crc & 0xFF;
+    frame[2 + length] = crc >> 8;
+
+    while (serial_.available() > 0) serial_.read();  // Drop line noise and late answers
+    rxLength_ = 0;
+    if (dePin_ >= 0) digitalWrite(dePin_, HIGH);
+    size_t written = serial_.write(frame, 3 + length);
+    serial_.flush();  // Wait for the last bit before releasing the bus
+    if (dePin_ >= 0) digitalWrite(dePin_, LOW);
+    return written == (size_t)(3 + length);
+  }
+
+  int receive(uint8_t unit, uint8_t* pdu) override {
+    while (serial_.available() > 0) {
+      int c = serial_.read();
+      if (c < 0) break;
+      if (rxLength_ < sizeof(rx_)) rx_[rxLength_++] = (uint8_t)c;
+      lastByteUs_ = micros();
+    }
+    // A frame ends with 3.5 characters of silence
+    if (rxLength_ == 0 || micros() - lastByteUs_ < frameGapUs_) return 0;
+
+    size_t length = rxLength_;
+    rxLength_ = 0;
+    if (length < 4 || rx_[0] != unit) return -1;
+    uint16_t crc = rx_[length - 2] | (rx_[length - 1] << 8);
+    if (modbusCrc16(rx_, length - 2) != crc) return -1;
+    memcpy(pdu, rx_ + 1, length - 3);
+    return (int)(length - 3);
+  }
+
+private:
+  Stream& serial_;
+  int dePin_;
+  uint32_t frameGapUs_ = 1750;
+  uint8_t rx_[1 + MODBUS_MAX_PDU + 2];
+  size_t rxLength_ = 0;
+  uint32_t lastByteUs_ = 0;
+};
+
+// --- Poller --------------------------------------------------------------------
+
+struct ModbusStats {
+  uint32_t requests;
+  uint32_t responses;
+  uint32_t timeouts;
+  uint32_t exceptions;
+  uint32_t malformed;
+  uint32_t registers;     // Registers/bits delivered by read responses
+  uint32_t cycles;        // Completed poll cycles
+  uint32_t lastCycleMs;   // Duration of the last complete cycle
+  uint32_t writes;
+};
+
+struct ModbusWriteResult {
+  char cmdId[40];
+  bool ok;
+  char error[48];
+};
+
+class ModbusPoller {
+public:
+  // Plan batched requests for map and start polling. With batching off
+  // every point is read with its own request (for comparison).
+  void begin(const ModbusMap& map, ModbusTransport& transport, bool batching = true) {
+    map_ = &map;
+    transport_ = &transport;
+    memset(&stats_, 0, sizeof(stats_));
+    for (uint8_t i = 0; i < MODBUS_MAX_POINTS; i++) {
+      valid_[i] = false;
+      publishedValid_[i] = false;
+    }
+    // Results already queued stay for takeWriteResult()
+    failWrites("Modbus map replaced");
+    waiting_ = false;
+    failures_ = 0;
+    planBatches(batching);
+    nextBatch_ = batchCount_;
+    pollNow_ = true;
+  }
+
+  void stop() {
+    failWrites("Modbus map replaced");
+    if (transport_ != NULL) transport_->close();
+    map_ = NULL;
+    transport_ = NULL;
+    batchCount_ = 0;
+  }
+
+  bool active() const { return map_ != NULL; }
+  uint8_t batchCount() const { return batchCount_; }
+  const ModbusStats& stats() const { return stats_; }
+
+  // Advance the request state machine. Never blocks: a TCP (re)connect,
+  // at most every MODBUS_RECONNECT_MS, is polled across calls.
+  void update(unsigned long now) {
+    if (map_ == NULL) return;
+
+    if (waiting_) {
+      int length = transport_->receive(expectUnit_, pdu_);
+      if (length == 0 && now - sentAtMs_ < map_->timeoutMs) return;
+      waiting_ = false;
+      if (length > 0) {
+        failures_ = 0;
+        handleResponse((uint8_t)length, now);
+      } else {
+        if (length < 0) stats_.malformed++;
+        else stats_.timeouts++;
+        failRequest(length < 0 ? "Malformed Modbus response" : "Modbus timeout");
+        if (++failures_ >= MODBUS_MAX_FAILURES) {
+          failures_ = 0;
+          transport_->close();
+        }
+      }
+    }
+
+    // Writes go out before the next read
+    if (writeCount_ == 0 && nextBatch_ >= batchCount_) {
+      if (!pollNow_ && now - cycleStartMs_ < map_->pollMs) return;
+      if (batchCount_ == 0) return;
+      pollNow_ = false;
+      cycleStartMs_ = now;
+      nextBatch_ = 0;
+    }
+    if (!transport_->open()) {
+      if (transport_->connecting()) return;  // Requests go out once connected
+      invalidateAll();
+      return;
+    }
+    if (writeCount_ > 0) {
+      sendWrite(now);
+    } else {
+      sendRead(nextBatch_, now);
+    }
+  }
+
+  // Time until update() has something to do, for the loop wakeup
+  uint32_t msUntilNextPoll(unsigned long now) const {
+    if (map_ == NULL) return UINT32_MAX;
+    if (transport_->connecting()) return MODBUS_CONNECT_POLL_MS;
+    if (waiting_ || writeCount_ > 0 || pollNow_ || nextBatch_ < batchCount_) return 1;
+    unsigned long elapsed = now - cycleStartMs_;
+    return elapsed >= map_->pollMs ? 0 : (uint32_t)(map_->pollMs - elapsed);
+  }
+
+  int pointIndex(const char* name) const {
+    if (map_ == NULL) return -1;
+    for (uint8_t i = 0; i < map_->count; i++) {
+      if (strcmp(map_->points[i].name, name) == 0) return i;
+    }
+    return -1;
+  }
+
+  bool value(uint8_t index, float& out) const {
+    if (map_ == NULL || index >= map_->count || !valid_[index]) return false;
+    out = values_[index];
+    return true;
+  }
+
+  // All points; null while a point has no valid reading
+  void report(JsonObject out) const {
+    if (map_ == NULL) return;
+    for (uint8_t i = 0; i < map_->count; i++) {
+      if (valid_[i]) out[map_->points[i].name] = values_[i];
+      else out[map_->points[i].name] = nullptr;
+    }
+  }
+
+  // Points that moved beyond their dead-band (or became valid/invalid)
+  // since the last call. Returns how many were added.
+  uint8_t takeChanges(JsonObject out) {
+    if (map_ == NULL) return 0;
+    uint8_t changed = 0;
+    for (uint8_t i = 0; i < map_->count; i++) {
+      bool moved = valid_[i] != publishedValid_[i] ||
+                   (valid_[i] && fabsf(values_[i] - published_[i]) > map_->points[i].deadband);
+      if (!moved) continue;
+      if (valid_[i]) out[map_->points[i].name] = values_[i];
+      else out[map_->points[i].name] = nullptr;
+      published_[i] = values_[i];
+      publishedValid_[i] = valid_[i];
+      changed++;
+    }
+    return changed;
+  }
+
+  // Queue a write of an engineering value; the result is reported through
+  // takeWriteResult() once the slave has answered
+  bool queueWrite(const char* name, float value, const char* cmdId, String& error) {
+    int index = pointIndex(name);
+    if (index < 0) { error = "Unknown Modbus point: " + String(name); return false; }
+    const ModbusPoint& point = map_->points[index];
+    if (!(point.flags & MODBUS_FLAG_WRITABLE)) { error = "Modbus point is read-only: " + String(name); return false; }
+    if (writeCount_ >= MODBUS_WRITE_QUEUE) { error = "Modbus write queue full"; return false; }
+
+    PendingWrite& write = writes_[(writeHead_ + writeCount_) % MODBUS_WRITE_QUEUE];
+    write.point = (uint8_t)index;
+    strncpy(write.cmdId, cmdId, sizeof(write.cmdId) - 1);
+    write.cmdId[sizeof(write.cmdId) - 1] = '\0';
+
+    if (point.table == MODBUS_COIL) {
+      write.raw = value != 0 ? 1 : 0;
+    } else if (point.type == MODBUS_F32) {
+      float raw = value / point.scale;
+      memcpy(&write.raw, &raw, sizeof(raw));
+    } else {
+      double raw = round(value / point.scale);
+      double low = point.type == MODBUS_S16 ? -32768.0 : point.type == MODBUS_S32 ? -2147483648.0 : 0;
+      double high = point.type == MODBUS_U16 ? 65535.0 : point.type == MODBUS_S16 ? 32767.0 :
+                    point.type == MODBUS_S32 ? 2147483647.0 : 4294967295.0;
+      if (raw < low || raw > high) { error = "Value out of range for " + String(name); return false; }
+      write.raw = point.type == MODBUS_S16 || point.type == MODBUS_S32 ? (uint32_t)(int32_t)raw : (uint32_t)raw;
+    }
+    writeCount_++;
+    return true;
+  }
+
+  bool takeWriteResult(ModbusWriteResult& result) {
+    if (resultCount_ == 0) return false;
+    result = results_[0];
+    resultCount_--;
+    memmove(results_, results_ + 1, resultCount_ * sizeof(ModbusWriteResult));
+    return true;
+  }
+
+  void reportStats(JsonObject out) const {
+    out["batches"] = batchCount_;
+    out["requests"] = stats_.requests;
+    out["responses"] = stats_.responses;
+    out["timeouts"] = stats_.timeouts;
+    out["exceptions"] = stats_.exceptions;
+    out["malformed"] = stats_.malformed;
+    out["registers"] = stats_.registers;
+    out["cycles"] = stats_.cycles;
+    out["cycle_ms"] = stats_.lastCycleMs;
+    out["writes"] = stats_.writes;
+  }
+
+private:
+  struct Batch {
+    uint8_t unit;
+    uint8_t table;
+    uint16_t start;
+    uint16_t count;      // Registers or bits
+    uint8_t first;       // Range in order_
+    uint8_t points;
+  };
+
+  struct PendingWrite {
+    uint8_t point;
+    uint32_t raw;
+    char cmdId[40];
+  };
+
+  enum RequestKind : uint8_t { REQUEST_READ, REQUEST_WRITE };
+
+  void planBatches(bool batching) {
+    uint8_t count = map_->count;
+    for (uint8_t i = 0; i < count; i++) order_[i] = i;
+    // Insertion sort by unit, table, address (a few dozen points at most)
+    for (uint8_t i = 1; i < count; i++) {
+      uint8_t current = order_[i];
+      int j = i - 1;
+      while (j >= 0 && comesAfter(order_[j], current)) {
+        order_[j + 1] = order_[j];
+        j--;
+      }
+      order_[j + 1] = current;
+    }
+
+    batchCount_ = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      const ModbusPoint& point = map_->points[order_[i]];
+      uint32_t end = point.address + modbusPointWidth(point);
+      if (batching && batchCount_ > 0) {
+        Batch& batch = batches_[batchCount_ - 1];
+        bool bits = modbusIsBitTable(point.table);
+        uint32_t batchEnd = batch.start + batch.count;
+        uint32_t gap = point.address > batchEnd ? point.address - batchEnd : 0;
+        uint32_t newCount = (end > batchEnd ? end : batchEnd) - batch.start;
+        if (batch.unit == point.unit && batch.table == point.table &&
+            gap <= (bits ? MODBUS_MAX_GAP * 16 : MODBUS_MAX_GAP) &&
+            newCount <= (bits ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS)) {
+          batch.count = (uint16_t)newCount;
+          batch.points++;
+          continue;
+        }
+      }
+      Batch& batch = batches_[batchCount_++];
+      batch.unit = point.unit;
+      batch.table = point.table;
+      batch.start = point.address;
+      batch.count = modbusPointWidth(point);
+      batch.first = i;
+      batch.points = 1;
+    }
+  }
+
+  bool comesAfter(uint8_t a, uint8_t b) const {
+    const ModbusPoint& pa = map_->points[a];
+    const ModbusPoint& pb = map_->points[b];
+    if (pa.unit != pb.unit) return pa.unit > pb.unit;
+    if (pa.table != pb.table) return pa.table > pb.table;
+    return pa.address > pb.address;
+  }
+
+  void sendRead(uint8_t index, unsigned long now) {
+    const Batch& batch = batches_[index];
+    uint8_t request[5] = {
+      (uint8_t)(batch.table + 1),  // FC1..FC4 in table order
+      (uint8_t)(batch.start >> 8), (uint8_t)(batch.start & 0xFF),
+      (uint8_t)(batch.count >> 8), (uint8_t)(batch.count & 0xFF)
+    };
+    requestKind_ = REQUEST_READ;
+    currentBatch_ = index;
+    transmit(batch.unit, request, sizeof(request), now);
+  }
+
+  void sendWrite(unsigned long now) {
+    const PendingWrite& write = writes_[writeHead_];
+    const ModbusPoint& point = map_->points[write.point];
+    uint8_t request[10];
+    uint8_t length;
+    request[1] = point.address >> 8;
+    request[2] = point.address & 0xFF;
+    if (point.table == MODBUS_COIL) {
+      request[0] = 5;
+      request[3] = write.raw ? 0xFF : 0x00;
+      request[4] = 0;
+      length = 5;
+    } else if (modbusPointWidth(point) == 1) {
+      request[0] = 6;
+      request[3] = (write.raw >> 8) & 0xFF;
+      request[4] = write.raw & 0xFF;
+      length = 5;
+    } else {
+      uint16_t high = write.raw >> 16;
+      uint16_t low = write.raw & 0xFFFF;
+      if (point.flags & MODBUS_FLAG_SWAP_WORDS) std::swap(high, low);
+      request[0] = 16;
+      request[3] = 0;
+      request[4] = 2;   // Registers
+      request[5] = 4;   // Bytes
+      request[6] = high >> 8;
+      request[7] = high & 0xFF;
+      request[8] = low >> 8;
+      request[9] = low & 0xFF;
+      length = 10;
+    }
+    requestKind_ = REQUEST_WRITE;
+    transmit(point.unit, request, length, now);
+  }
+
+  void transmit(uint8_t unit, const uint8_t* request, uint8_t length, unsigned long now) {
+    expectFunction_ = request[0];
+    expectUnit_ = unit;
+    sentAtMs_ = now;
+    stats_.requests++;
+    if (!transport_->send(unit, request, length)) {
+      stats_.timeouts++;
+      failRequest("Modbus send failed");
+      transport_->close();
+      return;
+    }
+    waiting_ = true;
+  }
+
+  void handleResponse(uint8_t length, unsigned long now) {
+    stats_.responses++;
+    if (pdu_[0] == (expectFunction_ | 0x80)) {
+      stats_.exceptions++;
+      char error[32];
+      snprintf(error, sizeof(error), "Modbus exception %u", length > 1 ? pdu_[1] : 0);
+      failRequest(error);
+      return;
+    }
+    if (pdu_[0] != expectFunction_) {
+      stats_.malformed++;
+      failRequest("Unexpected Modbus function");
+      return;
+    }
+
+    if (requestKind_ == REQUEST_WRITE) {
+      stats_.writes++;
+      finishWrite(true, "");
+      pollNow_ = true;  // Read back the new value
+      return;
+    }
+
+    const Batch& batch = batches_[currentBatch_];
+    bool bits = modbusIsBitTable(batch.table);
+    uint16_t expected = bits ? (batch.count + 7) / 8 : batch.count * 2;
+    if (length < 2 || pdu_[1] != expected || length < 2 + expected) {
+      stats_.malformed++;
+      failRequest("Short Modbus response");
+      return;
+    }
+    const uint8_t* data = pdu_ + 2;
+    for (uint8_t i = 0; i < batch.points; i++) {
+      uint8_t index = order_[batch.first + i];
+      const ModbusPoint& point = map_->points[index];
+      uint16_t offset = point.address - batch.start;
+      values_[index] = bits ? ((data[offset / 8] >> (offset % 8)) & 1) : decode(point, data + offset * 2);
+      valid_[index] = true;
+    }
+    stats_.registers += batch.count;
+    if (++nextBatch_ >= batchCount_) {
+      stats_.cycles++;
+      stats_.lastCycleMs = now - cycleStartMs_;
+    }
+  }
+
+  static float decode(const ModbusPoint& point, const uint8_t* data) {
+    uint16_t first = (data[0] << 8) | data[1];
+    switch (point.type) {
+      case MODBUS_U16: return first * point.scale;
+      case MODBUS_S16: return (int16_t)first * point.scale;
+      default: break;
+    }
+    uint16_t second = (data[2] << 8) | data[3];
+    uint32_t raw = (point.flags & MODBUS_FLAG_SWAP_WORDS) ? ((uint32_t)second << 16) | first
+                                                         : ((uint32_t)first << 16) | second;
+    if (point.type == MODBUS_U32) return raw * point.scale;
+    if (point.type == MODBUS_S32) return (int32_t)raw * point.scale;
+    float value;
+    memcpy(&value, &raw, sizeof(value));
+    return value * point.scale;
+  }
+
+  void failRequest(const char* error) {
+    if (requestKind_ == REQUEST_WRITE) {
+      finishWrite(false, error);
+      return;
+    }
+    // Points of a failed read are reported as null until read again
+    const Batch& batch = batches_[currentBatch_];
+    for (uint8_t i = 0; i < batch.points; i++) valid_[order_[batch.first + i]] = false;
+    nextBatch_++;
+  }
+
+  void finishWrite(bool ok, const char* error) {
+    const PendingWrite& write = writes_[writeHead_];
+    if (resultCount_ < MODBUS_WRITE_QUEUE) {
+      ModbusWriteResult& result = results_[resultCount_++];
+      strcpy(result.cmdId, write.cmdId);
+      result.ok = ok;
+      strncpy(result.error, error, sizeof(result.error) - 1);
+      result.error[sizeof(result.error) - 1] = '\0';
+    }
+    writeHead_ = (writeHead_ + 1) % MODBUS_WRITE_QUEUE;
+    writeCount_--;
+  }
+
+  // Every queued write gets a result, so each modbus_write is ACKed once
+  void failWrites(const char* error) {
+    while (writeCount_ > 0) finishWrite(false, error);
+  }
+
+  void invalidateAll() {
+    for (uint8_t i = 0; i < map_->count; i++) valid_[i] = false;
+    nextBatch_ = batchCount_;
+    failWrites("Modbus slave unreachable");
+  }
+
+  const ModbusMap* map_ = NULL;
+  ModbusTransport* transport_ = NULL;
+  ModbusStats stats_ = {};
+
+  uint8_t order_[MODBUS_MAX_POINTS];
+  Batch batches_[MODBUS_MAX_POINTS];
+  uint8_t batchCount_ = 0;
+  uint8_t nextBatch_ = 0;
+  uint8_t currentBatch_ = 0;
+  unsigned long cycleStartMs_ = 0;
+  bool pollNow_ = false;
+
+  float values_[MODBUS_MAX_POINTS];
+  float published_[MODBUS_MAX_POINTS];
+  bool valid_[MODBUS_MAX_POINTS];
+  bool publishedValid_[MODBUS_MAX_POINTS];
+
+  PendingWrite writes_[MODBUS_WRITE_QUEUE];
+  uint8_t writeHead_ = 0;
+  uint8_t writeCount_ = 0;
+  ModbusWriteResult results_[MODBUS_WRITE_QUEUE];
+  uint8_t resultCount_ = 0;
+
+  bool waiting_ = false;
+  RequestKind requestKind_ = REQUEST_READ;
+  uint8_t expectFunction_ = 0;
+  uint8_t expectUnit_ = 0;
+  unsigned long sentAtMs_ = 0;
+  uint8_t failures_ = 0;
+  uint8_t pdu_[MODBUS_MAX_PDU];
+};
@@ -0,0 +1,118 @@
+/*
+ * Streaming MQTT publisher
+ *
+ * Serializes payloads straight into the MQTT connection using PubSubClient's
+ * beginPublish() / write() / endPublish() sequence:
+ *
+ *   1. measureJson() computes the exact payload length (no output)
+ *   2. beginPublish() writes the PUBLISH header + topic with that length
+ *   3. serializeJson() streams the document into the socket
+ *   4. endPublish() completes the packet
+ *
+ * There is no full-payload char buffer and the publish no longer depends on
+ * PubSubClient's buffer size (256 bytes unless setBufferSize() is called),
+ * which used to make the 512-byte state snapshot fail silently.
+ *
+ * Writes are coalesced through a small fixed chunk so TLS clients don't
+ * emit one record per JSON token. Every failed publish is counted, and an
+ * optional outcome callback lets link monitoring see each result.
+ */
+
+#pragma once
+
+#include <PubSubClient.h>
+#include <ArduinoJson.h>
+
+class MqttStreamPublisher {
+public:
+  explicit MqttStreamPublisher(PubSubClient& client) : client_(client), writer_(client) {}
+
+  // Stream a JSON document to topic. Returns false (and counts a failure)
+  // if the client is disconnected or the socket accepts fewer bytes.
+  bool publishJson(const char* topic, const JsonDocument& doc, bool retained = false) {
+    size_t length = measureJson(doc);
+    if (!client_.beginPublish(topic, length, retained)) {
+      return fail();
+    }
+    writer_.reset();
+    serializeJson(doc, writer_);
+    writer_.flush();
+    return finish(writer_.written(), length);
+  }
+
+  // Publish a plain string payload through the same path
+  bool publish(const char* topic, const char* payload, bool retained = false) {
+    size_t length = strlen(payload);
+    if (!client_.beginPublish(topic, length, retained)) {
+      return fail();
+    }
+    size_t written = client_.write((const uint8_t*)payload, length);
+    return finish(written, length);
+  }
+
+  // Called with the result of every publish attempt
+  void setOutcomeCallback(void (*callback)(bool ok)) { outcome_ = callback; }
+
+  unsigned long published() const { return published_; }
+  unsigned long failures() const { return failures_; }
+
+private:
+  // Coalesces ArduinoJson's small writes into socket-sized chunks
+  class ChunkWriter : public Print {
+  public:
+    explicit ChunkWriter(PubSubClient& client) : client_(client) {}
+
+    void reset() { used_ = 0; written_ = 0; }
+    size_t written() const { return written_; }
+
+    size_t write(uint8_t c) override {
+      if (used_ == sizeof(chunk_)) flush();
+      chunk_[used_++] = c;
+      return 1;
+    }
+
+    size_t write(const uint8_t* data, size_t len) override {
+      for (size_t i = 0; i < len; i++) write(data[i]);
+      return len;
+    }
+
+    void flush() override {
+      if (used_ == 0) return;
+      written_ += client_.write(chunk_, used_);
+      used_ = 0;
+    }
+
+  private:
+    PubSubClient& client_;
+    uint8_t chunk_[64];
+    size_t used_ = 0;
+    size_t written_ = 0;
+  };
+
+  bool finish(size_t written, size_t expected) {
+    if (written != expected) {
+      // A short write leaves the MQTT framing broken - drop the connection
+      // so the reconnect logic starts from a clean stream
+      client_.disconnect();
+      return fail();
+    }
+    if (!client_.endPublish()) {
+      return fail();
+    }
+    published_++;
+    if (outcome_) outcome_(true);
+    return true;
+  }
+
+  bool fail() {
+    failures_++;
+    if (outcome_) outcome_(false);
+    return false;
+  }
+
+  PubSubClient& client_;
+  ChunkWriter writer_;
+  unsigned long published_ = 0;
+  unsigned long failures_ = 0;
+  void (*outcome_)(bool ok) = nullptr;
+};
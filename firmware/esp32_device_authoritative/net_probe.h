@@ -0,0 +1,583 @@
+/*
+ * Non-blocking network diagnostics
+ *
+ * Runs the checks field support needs to locate a connectivity problem, one
+ * after another, without blocking the loop:
+ *
+ *   wifi     link status, RSSI, channel, addresses (instant)
+ *   gateway  TCP connect to the gateway (port 53); "refused" still proves
+ *            the gateway answers and gives its round trip time
+ *   dns      the broker host and a reference host, through lwIP's
+ *            asynchronous resolver
+ *   tcp      connect to the broker's MQTT port
+ *   tls      connect plus TLS handshake on the broker's TLS port, using a
+ *            non-blocking mbedTLS context (certificate not verified: this
+ *            measures reachability and handshake time, not trust)
+ *
+ * update() is called from loop() and advances whichever probe is running by
+ * polling its socket with a zero timeout; every probe has its own deadline.
+ * Each result carries its own timing, and report() returns them as one JSON
+ * object with a one-line verdict.
+ *
+ * The TLS probe holds an mbedTLS context (~40KB with default buffers) only
+ * while it runs. Host builds have no TLS stack and report it as skipped.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <WiFi.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#if defined(ESP_PLATFORM)
+#include <esp_netif.h>
+#include <lwip/dns.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#else
+#include <netdb.h>
+#endif
+
+#define NET_PROBE_TIMEOUT_MS 5000     // Per probe
+#define NET_PROBE_GATEWAY_PORT 53
+#define NET_PROBE_MAX_HOST 63
+#define NET_PROBE_POLL_MS 5           // Loop wakeup interval while a probe runs
+
+enum NetProbeResult : uint8_t {
+  PROBE_NOT_RUN = 0,
+  PROBE_OK = 1,
+  PROBE_REFUSED = 2,   // TCP RST: host reachable, port closed
+  PROBE_TIMEOUT = 3,
+  PROBE_FAILED = 4,
+  PROBE_SKIPPED = 5
+};
+
+struct NetProbeTarget {
+  const char* host;           // Broker host name or dotted IP
+  uint16_t tcpPort;           // Plain MQTT port
+  uint16_t tlsPort;           // 0 = skip the TLS probe
+  const char* referenceHost;  // Known-good name, tells "DNS broken" from "host missing"
+};
+
+struct NetProbeTiming {
+  uint8_t result;
+  uint32_t ms;
+};
+
+struct NetProbeReport {
+  uint32_t startedMs;
+  uint32_t totalMs;
+  NetProbeTiming gateway;
+  NetProbeTiming dnsTarget;
+  NetProbeTiming dnsReference;
+  NetProbeTiming tcp;
+  NetProbeTiming tlsConnect;
+  NetProbeTiming tlsHandshake;
+  IPAddress targetIp;
+  IPAddress referenceIp;
+  int tlsError;
+  char tlsVersion[12];
+  char tlsCipher[48];
+};
+
+inline const char* netProbeResultName(uint8_t result) {
+  switch (result) {
+    case PROBE_OK: return "ok";
+    case PROBE_REFUSED: return "refused";
+    case PROBE_TIMEOUT: return "timeout";
+    case PROBE_FAILED: return "failed";
+    case PROBE_SKIPPED: return "skipped";
+    default: return "not_run";
+  }
+}
+
+class NetProbe {
+public:
+  ~NetProbe() { finish(); }
+
+  bool running() const { return stage_ != STAGE_IDLE && stage_ != STAGE_DONE; }
+  const char* requestId() const { return requestId_; }
+
+  // Start a full probe run. Returns false if one is already running.
+  bool start(const NetProbeTarget& target, const char* requestId) {
+    if (running()) return false;
+    target_ = target;
+    strncpy(host_, target.host, NET_PROBE_MAX_HOST);
+    host_[NET_PROBE_MAX_HOST] = '\0';
+    strncpy(requestId_, requestId ? requestId : "", sizeof(requestId_) - 1);
+    requestId_[sizeof(requestId_) - 1] = '\0';
+    report_ = NetProbeReport();
+    report_.startedMs = millis();
+    report_.tlsError = 0;
+    enter(STAGE_GATEWAY);
+    return true;
+  }
+
+  // Advance the running probe. Returns true once, when the report is complete.
+  bool update(unsigned long now) {
+    switch (stage_) {
+      case STAGE_GATEWAY: {
+        uint8_t result;
+        if (!pollConnect(now, result)) return false;
+        record(report_.gateway, result, now);
+        closeSocket();
+        return advance(STAGE_DNS_TARGET);
+      }
+      case STAGE_DNS_TARGET: {
+        uint8_t result;
+        if (!pollLookup(now, report_.targetIp, result)) return false;
+        record(report_.dnsTarget, result, now);
+        return advance(STAGE_DNS_REFERENCE);
+      }
+      case STAGE_DNS_REFERENCE: {
+        uint8_t result;
+        if (!pollLookup(now, report_.referenceIp, result)) return false;
+        record(report_.dnsReference, result, now);
+        return advance(STAGE_TCP);
+      }
+      case STAGE_TCP: {
+        uint8_t result;
+        if (!pollConnect(now, result)) return false;
+        record(report_.tcp, result, now);
+        closeSocket();
+        return advance(STAGE_TLS_CONNECT);
+      }
+      case STAGE_TLS_CONNECT: {
+        uint8_t result;
+        if (!pollConnect(now, result)) return false;
+        record(report_.tlsConnect, result, now);
+        if (result != PROBE_OK) {
+          report_.tlsHandshake.result = PROBE_SKIPPED;
+          return complete(now);
+        }
+        return advance(STAGE_TLS_HANDSHAKE);
+      }
+      case STAGE_TLS_HANDSHAKE: {
+        uint8_t result;
+        if (!pollHandshake(now, result)) return false;
+        record(report_.tlsHandshake, result, now);
+        return complete(now);
+      }
+      default:
+        return false;
+    }
+  }
+
+  // How long the loop may sleep while a probe is in flight
+  uint32_t msUntilNextStep() const {
+    return running() ? NET_PROBE_POLL_MS : UINT32_MAX;
+  }
+
+  const NetProbeReport& results() const { return report_; }
+
+  void report(JsonObject out) const {
+    out["started_ms"] = report_.startedMs;
+    out["total_ms"] = report_.totalMs;
+
+    JsonObject wifi = out.createNestedObject("wifi");
+    wifi["status"] = (int)WiFi.status();
+    wifi["rssi"] = WiFi.RSSI();
+    wifi["channel"] = WiFi.channel();
+    wifi["bssid"] = WiFi.BSSIDstr();
+    wifi["ip"] = WiFi.localIP().toString();
+    wifi["gateway"] = WiFi.gatewayIP().toString();
+    wifi["subnet"] = WiFi.subnetMask().toString();
+    JsonArray dnsServers = wifi.createNestedArray("dns_servers");
+    dnsServers.add(WiFi.dnsIP(0).toString());
+    dnsServers.add(WiFi.dnsIP(1).toString());
+
+    addTiming(out.createNestedObject("gateway"), report_.gateway);
+
+    JsonObject dns = out.createNestedObject("dns");
+    JsonObject target = dns.createNestedObject("target");
+    target["host"] = (const char*)host_;
+    addTiming(target, report_.dnsTarget);
+    if (report_.dnsTarget.result == PROBE_OK) target["ip"] = report_.targetIp.toString();
+    JsonObject reference = dns.createNestedObject("reference");
+    reference["host"] = target_.referenceHost;
+    addTiming(reference, report_.dnsReference);
+    if (report_.dnsReference.result == PROBE_OK) reference["ip"] = report_.referenceIp.toString();
+
+    JsonObject tcp = out.createNestedObject("tcp");
+    tcp["port"] = target_.tcpPort;
+    addTiming(tcp, report_.tcp);
+
+    JsonObject tls = out.createNestedObject("tls");
+    tls["port"] = target_.tlsPort;
+    addTiming(tls.createNestedObject("connect"), report_.tlsConnect);
+    addTiming(tls.createNestedObject("handshake"), report_.tlsHandshake);
+    if (report_.tlsHandshake.result == PROBE_OK) {
+      tls["version"] = (const char*)report_.tlsVersion;
+      tls["cipher"] = (const char*)report_.tlsCipher;
+    } else if (report_.tlsError != 0) {
+      tls["error"] = report_.tlsError;
+    }
+
+    out["verdict"] = verdict();
+  }
+
+  // One line naming the first thing that is wrong
+  const char* verdict() const {
+    if (WiFi.status() != WL_CONNECTED) return "WiFi not connected";
+    if (report_.gateway.result == PROBE_TIMEOUT || report_.gateway.result == PROBE_FAILED) {
+      return "Gateway unreachable";
+    }
+    if (report_.dnsTarget.result != PROBE_OK) {
+      return report_.dnsReference.result == PROBE_OK ? "Broker host name does not resolve"
+                                                     : "DNS not working";
+    }
+    if (report_.tcp.result == PROBE_REFUSED) return "Broker refuses the MQTT port";
+    if (report_.tcp.result != PROBE_OK) return "Broker unreachable";
+    if (report_.tlsConnect.result == PROBE_OK && report_.tlsHandshake.result != PROBE_OK &&
+        report_.tlsHandshake.result != PROBE_SKIPPED) {
+      return "TLS handshake failed";
+    }
+    return "OK";
+  }
+
+private:
+  enum Stage : uint8_t {
+    STAGE_IDLE,
+    STAGE_GATEWAY,
+    STAGE_DNS_TARGET,
+    STAGE_DNS_REFERENCE,
+    STAGE_TCP,
+    STAGE_TLS_CONNECT,
+    STAGE_TLS_HANDSHAKE,
+    STAGE_DONE
+  };
+
+  static void addTiming(JsonObject out, const NetProbeTiming& timing) {
+    out["result"] = netProbeResultName(timing.result);
+    if (timing.result != PROBE_NOT_RUN && timing.result != PROBE_SKIPPED) out["ms"] = timing.ms;
+  }
+
+  void record(NetProbeTiming& timing, uint8_t result, unsigned long now) {
+    timing.result = result;
+    timing.ms = now - stageStartMs_;
+  }
+
+  bool complete(unsigned long now) {
+    finish();
+    report_.totalMs = now - report_.startedMs;
+    stage_ = STAGE_DONE;
+    return true;
+  }
+
+  // Enter the next stage. True if that finished the run: every remaining
+  // stage was skipped and complete() already ran inside enter().
+  bool advance(Stage stage) {
+    enter(stage);
+    return stage_ == STAGE_DONE;
+  }
+
+  // Set up the next stage; stages that cannot run are recorded and skipped
+  void enter(Stage stage) {
+    stage_ = stage;
+    stageStartMs_ = millis();
+    switch (stage) {
+      case STAGE_GATEWAY:
+        if (WiFi.status() != WL_CONNECTED || !startConnect(WiFi.gatewayIP(), NET_PROBE_GATEWAY_PORT)) {
+          report_.gateway.result = WiFi.status() != WL_CONNECTED ? PROBE_SKIPPED : PROBE_FAILED;
+          enter(STAGE_DNS_TARGET);
+        }
+        break;
+      case STAGE_DNS_TARGET:
+        startLookup(host_);
+        break;
+      case STAGE_DNS_REFERENCE:
+        if (target_.referenceHost == NULL || target_.referenceHost[0] == '\0') {
+          report_.dnsReference.result = PROBE_SKIPPED;
+          enter(STAGE_TCP);
+        } else {
+          startLookup(target_.referenceHost);
+        }
+        break;
+      case STAGE_TCP:
+        if (report_.dnsTarget.result != PROBE_OK || !startConnect(report_.targetIp, target_.tcpPort)) {
+          report_.tcp.result = report_.dnsTarget.result != PROBE_OK ? PROBE_SKIPPED : PROBE_FAILED;
+          enter(STAGE_TLS_CONNECT);
+        }
+        break;
+      case STAGE_TLS_CONNECT:
+        if (target_.tlsPort == 0 || report_.dnsTarget.result != PROBE_OK ||
+            !startConnect(report_.targetIp, target_.tlsPort)) {
+          report_.tlsConnect.result = target_.tlsPort == 0 || report_.dnsTarget.result != PROBE_OK
+                                        ? PROBE_SKIPPED : PROBE_FAILED;
+          report_.tlsHandshake.result = PROBE_SKIPPED;
+          complete(millis());
+        }
+        break;
+      case STAGE_TLS_HANDSHAKE:
+        if (!startHandshake()) {
+          report_.tlsHandshake.result = tlsSupported() ? PROBE_FAILED : PROBE_SKIPPED;
+          complete(millis());
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  // --- TCP ---------------------------------------------------------------------
+
+  bool startConnect(IPAddress ip, uint16_t port) {
+    closeSocket();
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0) return false;
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = (uint32_t)ip;
+    connectErrno_ = 0;
+    if (::connect(fd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+      connectErrno_ = errno;  // Reported by the first poll
+    }
+    return true;
+  }
+
+  // true once the connect attempt has an outcome
+  bool pollConnect(unsigned long now, uint8_t& result) {
+    if (connectErrno_ != 0) {
+      result = connectErrno_ == ECONNREFUSED ? PROBE_REFUSED : PROBE_FAILED;
+      return true;
+    }
+    fd_set writeSet;
+    FD_ZERO(&writeSet);
+    FD_SET(fd_, &writeSet);
+    struct timeval zero = {0, 0};
+    if (select(fd_ + 1, NULL, &writeSet, NULL, &zero) > 0) {
+      int error = 0;
+      socklen_t len = sizeof(error);
+      getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len);
+      result = error == 0 ? PROBE_OK : error == ECONNREFUSED ? PROBE_REFUSED : PROBE_FAILED;
+      return true;
+    }
+    if (now - stageStartMs_ >= NET_PROBE_TIMEOUT_MS) {
+      result = PROBE_TIMEOUT;
+      return true;
+    }
+    return false;
+  }
+
+  void closeSocket() {
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+  }
+
+  // --- DNS -----------------------------------------------------------------------
+
+#if defined(ESP_PLATFORM)
+  // The lwIP callback can fire after the probe gave up, so the query lives
+  // in a static slot that is reused only once its callback has run
+  struct DnsQuery {
+    volatile bool busy;
+    volatile bool done;
+    bool found;
+    char host[NET_PROBE_MAX_HOST + 1];
+    ip_addr_t address;
+  };
+
+  static DnsQuery& dnsQuery() {
+    static DnsQuery query;
+    return query;
+  }
+
+  // Runs in the lwIP thread; esp_netif_tcpip_exec() hands the err_t back as is
+  static esp_err_t startDnsQuery(void* context) {
+    DnsQuery* query = (DnsQuery*)context;
+    return (esp_err_t)dns_gethostbyname(query->host, &query->address, dnsFound, query);
+  }
+
+  static void dnsFound(const char* name, const ip_addr_t* address, void* context) {
+    DnsQuery* query = (DnsQuery*)context;
+    query->found = address != NULL && IP_IS_V4(address);
+    if (query->found) query->address = *address;
+    query->done = true;
+    query->busy = false;
+  }
+#endif
+
+  void startLookup(const char* host) {
+    lookupResult_ = PROBE_NOT_RUN;
+    IPAddress literal;
+    if (literal.fromString(host)) {
+      lookupIp_ = literal;
+      lookupResult_ = PROBE_OK;
+      return;
+    }
+#if defined(ESP_PLATFORM)
+    DnsQuery& query = dnsQuery();
+    if (query.busy) {  // A timed-out lookup is still in flight
+      lookupResult_ = PROBE_FAILED;
+      return;
+    }
+    query.busy = true;
+    query.done = false;
+    query.found = false;
+    strncpy(query.host, host, NET_PROBE_MAX_HOST);
+    query.host[NET_PROBE_MAX_HOST] = '\0';
+    err_t err = (err_t)esp_netif_tcpip_exec(startDnsQuery, &query);
+    if (err == ERR_OK) {  // Answered from the cache
+      query.busy = false;
+      lookupIp_ = IPAddress(ip4_addr_get_u32(ip_2_ip4(&query.address)));
+      lookupResult_ = PROBE_OK;
+    } else if (err != ERR_INPROGRESS) {
+      query.busy = false;
+      lookupResult_ = PROBE_FAILED;
+    }
+#else
+    // Host builds resolve synchronously
+    struct addrinfo hints;
+    struct addrinfo* info = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(host, NULL, &hints, &info) != 0 || info == NULL) {
+      lookupResult_ = PROBE_FAILED;
+      return;
+    }
+    lookupIp_ = IPAddress((uint32_t)((struct sockaddr_in*)info->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(info);
+    lookupResult_ = PROBE_OK;
+#endif
+  }
+
+  bool pollLookup(unsigned long now, IPAddress& ip, uint8_t& result) {
+#if defined(ESP_PLATFORM)
+    DnsQuery& query = dnsQuery();
+    if (lookupResult_ == PROBE_NOT_RUN && query.done) {
+      lookupResult_ = query.found ? PROBE_OK : PROBE_FAILED;
+      if (query.found) lookupIp_ = IPAddress(ip4_addr_get_u32(ip_2_ip4(&query.address)));
+    }
+#endif
+    if (lookupResult_ == PROBE_NOT_RUN) {
+      if (now - stageStartMs_ < NET_PROBE_TIMEOUT_MS) return false;
+      lookupResult_ = PROBE_TIMEOUT;
+    }
+    result = lookupResult_;
+    if (result == PROBE_OK) ip = lookupIp_;
+    return true;
+  }
+
+  // --- TLS -----------------------------------------------------------------------
+
+#if defined(ESP_PLATFORM)
+  struct TlsState {
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config config;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_net_context net;
+  };
+#endif
+
+  static bool tlsSupported() {
+#if defined(ESP_PLATFORM)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool startHandshake() {
+#if defined(ESP_PLATFORM)
+    tls_ = new (std::nothrow) TlsState;
+    if (tls_ == NULL) return false;
+    mbedtls_ssl_init(&tls_->ssl);
+    mbedtls_ssl_config_init(&tls_->config);
+    mbedtls_entropy_init(&tls_->entropy);
+    mbedtls_ctr_drbg_init(&tls_->drbg);
+    mbedtls_net_init(&tls_->net);
+    tls_->net.fd = fd_;  // Owned by the TLS state from here on
+    fd_ = -1;
+
+    int ret = mbedtls_ctr_drbg_seed(&tls_->drbg, mbedtls_entropy_func, &tls_->entropy, NULL, 0);
+    if (ret == 0) {
+      ret = mbedtls_ssl_config_defaults(&tls_->config, MBEDTLS_SSL_IS_CLIENT,
+                                        MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if (ret == 0) {
+      mbedtls_ssl_conf_authmode(&tls_->config, MBEDTLS_SSL_VERIFY_NONE);
+      mbedtls_ssl_conf_rng(&tls_->config, mbedtls_ctr_drbg_random, &tls_->drbg);
+      ret = mbedtls_ssl_setup(&tls_->ssl, &tls_->config);
+    }
+    if (ret == 0) ret = mbedtls_ssl_set_hostname(&tls_->ssl, host_);
+    if (ret == 0) ret = mbedtls_net_set_nonblock(&tls_->net);
+    if (ret != 0) {
+      report_.tlsError = ret;
+      finish();
+      return false;
+    }
+    mbedtls_ssl_set_bio(&tls_->ssl, &tls_->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+    return true;
+#else
+    closeSocket();
+    return false;
+#endif
+  }
+
+  bool pollHandshake(unsigned long now, uint8_t& result) {
+#if defined(ESP_PLATFORM)
+    int ret = mbedtls_ssl_handshake(&tls_->ssl);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      if (now - stageStartMs_ < NET_PROBE_TIMEOUT_MS) return false;
+      result = PROBE_TIMEOUT;
+      return true;
+    }
+    if (ret == 0) {
+      strncpy(report_.tlsVersion, mbedtls_ssl_get_version(&tls_->ssl), sizeof(report_.tlsVersion) - 1);
+      strncpy(report_.tlsCipher, mbedtls_ssl_get_ciphersuite(&tls_->ssl), sizeof(report_.tlsCipher) - 1);
+      result = PROBE_OK;
+    } else {
+      report_.tlsError = ret;
+      result = PROBE_FAILED;
+    }
+    return true;
+#else
+    (void)now;
+    result = PROBE_SKIPPED;
+    return true;
+#endif
+  }
+
+  // Release the socket and any TLS state
+  void finish() {
+    closeSocket();
+#if defined(ESP_PLATFORM)
+    if (tls_ != NULL) {
+      mbedtls_net_free(&tls_->net);
+      mbedtls_ssl_free(&tls_->ssl);
+      mbedtls_ssl_config_free(&tls_->config);
+      mbedtls_ctr_drbg_free(&tls_->drbg);
+      mbedtls_entropy_free(&tls_->entropy);
+      delete tls_;
+      tls_ = NULL;
+    }
+#endif
+  }
+
+  NetProbeTarget target_ = {};
+  char host_[NET_PROBE_MAX_HOST + 1] = {0};
+  char requestId_[40] = {0};
+  Stage stage_ = STAGE_IDLE;
+  unsigned long stageStartMs_ = 0;
+  NetProbeReport report_ = {};
+  int fd_ = -1;
+  int connectErrno_ = 0;
+  IPAddress lookupIp_;
+  uint8_t lookupResult_ = PROBE_NOT_RUN;
+#if defined(ESP_PLATFORM)
+  TlsState* tls_ = NULL;
+#endif
+};
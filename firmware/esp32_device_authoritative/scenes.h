@@ -0,0 +1,184 @@
+/*
+ * Device-stored scenes
+ *
+ * A scene is a named list of actuator steps (relay, PWM, servo) with an
+ * optional delay before each step, e.g. "fill" = open valve, wait 500ms,
+ * start pump. Scenes are defined once via a config command, stored in NVS
+ * (namespace "scenes", key = scene name) and triggered by name with a single
+ * short command.
+ *
+ * SceneRunner applies a scene without blocking the loop: steps with no delay
+ * are applied back to back in the same pass, delayed steps are applied by
+ * later update() calls. The caller ACKs and publishes state once, when
+ * update() reports completion.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+
+#define SCENE_MAX_STEPS 16
+#define SCENE_MAX_NAME 15        // NVS key length limit
+#define SCENE_MAX_STEP_DELAY_MS 60000
+#define SCENE_FORMAT_VERSION 1
+
+enum SceneStepType : uint8_t {
+  SCENE_STEP_RELAY = 0,
+  SCENE_STEP_PWM = 1,
+  SCENE_STEP_SERVO = 2
+};
+
+struct SceneStep {
+  uint8_t type;
+  uint8_t pin;
+  uint16_t value;
+  uint16_t delayMs;  // Wait before applying this step
+};
+
+struct Scene {
+  uint8_t version;
+  uint8_t count;
+  SceneStep steps[SCENE_MAX_STEPS];
+};
+
+inline bool isValidSceneName(const char* name) {
+  size_t len = name ? strlen(name) : 0;
+  if (len == 0 || len > SCENE_MAX_NAME) return false;
+  for (size_t i = 0; i < len; i++) {
+    char c = name[i];
+    if (!isalnum((unsigned char)c) && c != '_' && c != '-') return false;
+  }
+  return true;
+}
+
+// Build a scene from the command's "steps" array. Checks structure and
+// value ranges; pin policy (which pins may be driven) is left to the caller.
+inline bool parseScene(JsonArrayConst steps, Scene& scene, String& error) {
+  scene.version = SCENE_FORMAT_VERSION;
+  scene.count = 0;
+
+  if (steps.isNull() || steps.size() == 0) {
+    error = "Scene needs at least one step";
+    return false;
+  }
+  if (steps.size() > SCENE_MAX_STEPS) {
+    error = "Too many steps (max " + String(SCENE_MAX_STEPS) + ")";
+    return false;
+  }
+
+  for (JsonObjectConst s : steps) {
+    const char* type = s["type"] | "";
+    int pin = s["pin"] | -1;
+    int value = s["value"] | s["state"] | 0;
+    long delayMs = s["delay"] | 0L;
+
+    SceneStep& step = scene.steps[scene.count];
+    if (strcmp(type, "relay") == 0) {
+      step.type = SCENE_STEP_RELAY;
+      if (value != 0 && value != 1) { error = "Relay value must be 0 or 1"; return false; }
+    } else if (strcmp(type, "pwm") == 0) {
+      step.type = SCENE_STEP_PWM;
+      if (value < 0 || value > 255) { error = "PWM value must be 0-255"; return false; }
+    } else if (strcmp(type, "servo") == 0) {
+      step.type = SCENE_STEP_SERVO;
+      if (value < 0 || value > 180) { error = "Servo angle must be 0-180"; return false; }
+    } else {
+      error = "Unknown step type: " + String(type);
+      return false;
+    }
+
+    if (pin < 0 || pin > 39) { error = "Invalid pin: " + String(pin); return false; }
+    if (delayMs < 0 || delayMs > SCENE_MAX_STEP_DELAY_MS) { error = "Invalid step delay"; return false; }
+
+    step.pin = (uint8_t)pin;
+    step.value = (uint16_t)value;
+    step.delayMs = (uint16_t)delayMs;
+    scene.count++;
+  }
+  return true;
+}
+
+class SceneStore {
+public:
+  bool save(const char* name, const Scene& scene) {
+    Preferences prefs;
+    if (!prefs.begin("scenes", false)) return false;
+    size_t size = offsetof(Scene, steps) + scene.count * sizeof(SceneStep);
+    bool ok = prefs.putBytes(name, &scene, size) == size;
+    prefs.end();
+    return ok;
+  }
+
+  bool load(const char* name, Scene& scene) {
+    Preferences prefs;
+    if (!prefs.begin("scenes", true)) return false;
+    size_t size = prefs.getBytesLength(name);
+    bool ok = size >= offsetof(Scene, steps) && size <= sizeof(Scene) &&
+              prefs.getBytes(name, &scene, size) == size;
+    prefs.end();
+    return ok && scene.version == SCENE_FORMAT_VERSION &&
+           size == offsetof(Scene, steps) + scene.count * sizeof(SceneStep);
+  }
+
+  bool remove(const char* name) {
+    Preferences prefs;
+    if (!prefs.begin("scenes", false)) return false;
+    bool ok = prefs.remove(name);
+    prefs.end();
+    return ok;
+  }
+};
+
+class SceneRunner {
+public:
+  typedef void (*StepHandler)(const SceneStep& step);
+
+  bool running() const { return running_; }
+  const char* cmdId() const { return cmdId_; }
+  const char* name() const { return name_; }
+
+  void start(const char* name, const Scene& scene, const char* cmdId, unsigned long now) {
+    scene_ = scene;
+    strncpy(name_, name, sizeof(name_) - 1);
+    name_[sizeof(name_) - 1] = '\0';
+    strncpy(cmdId_, cmdId, sizeof(cmdId_) - 1);
+    cmdId_[sizeof(cmdId_) - 1] = '\0';
+    next_ = 0;
+    stepStart_ = now;
+    running_ = true;
+  }
+
+  // Apply every step that is due. Returns true once, when the last step
+  // has been applied.
+  bool update(unsigned long now, StepHandler apply) {
+    if (!running_) return false;
+    while (next_ < scene_.count) {
+      const SceneStep& step = scene_.steps[next_];
+      if (now - stepStart_ < step.delayMs) return false;
+      apply(step);
+      next_++;
+      stepStart_ = now;
+    }
+    running_ = false;
+    return true;
+  }
+
+  // Time until the next step is due (UINT32_MAX when idle)
+  uint32_t msUntilNextStep(unsigned long now) const {
+    if (!running_) return UINT32_MAX;
+    if (next_ >= scene_.count) return 0;
+    unsigned long elapsed = now - stepStart_;
+    uint32_t delayMs = scene_.steps[next_].delayMs;
+    return elapsed >= delayMs ? 0 : (uint32_t)(delayMs - elapsed);
+  }
+
+private:
+  Scene scene_;
+  char name_[SCENE_MAX_NAME + 1] = {0};
+  char cmdId_[40] = {0};
+  uint8_t next_ = 0;
+  unsigned long stepStart_ = 0;
+  bool running_ = false;
+};
@@ -0,0 +1,270 @@
+/*
+ * Hardware-timed servo motion
+ *
+ * Servo pulses come from LEDC (50Hz frame, 0.5-2.5ms pulse for 0-180
+ * degrees), so the output timing never depends on the loop. A hardware
+ * timer interrupt fires once per frame and advances every axis one step
+ * along a trapezoidal profile toward its target - accelerate at `accel`,
+ * cruise at `velocity`, decelerate to stop on the target - then writes the
+ * new pulse width. A valve swings smoothly without any stepping in loop(),
+ * and a new target mid-move blends from the current speed instead of
+ * jerking.
+ *
+ * The ISR does integer math only (the Xtensa FPU is not saved across
+ * interrupts): positions are micro-degrees, speeds micro-degrees per frame.
+ * Shared axis state is guarded by a spinlock; LEDC is written outside it.
+ *
+ * position() is the trajectory actually being commanded, so state reports
+ * show the valve moving rather than jumping to the target. A servo's
+ * physical position is unknown until its first pulse, so the first move on
+ * a pin starts at its target. velocity = 0 (or no hardware timer) jumps
+ * immediately.
+ *
+ * Servo channels are set up explicitly, at the end of the LEDC channel range
+ * that analogWrite() reaches last: core 2.x hands its channels out from 15
+ * downward, core 3.x takes the lowest free one. Channels 2n and 2n+1 share a
+ * timer, so the servo block is kept on whole channel pairs. Timer and LEDC
+ * calls follow the core's API (2.x by channel, 3.x by pin).
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+#define SERVO_CORE_3 1
+#endif
+
+#define SERVO_MOTION_MAX 4
+#define SERVO_MOTION_TIMER 0             // Hardware timer 0 on core 2.x; 1MHz tick
+#ifdef SERVO_CORE_3
+#define SERVO_LEDC_FIRST_CHANNEL 12      // Channels 12-15
+#else
+#define SERVO_LEDC_FIRST_CHANNEL 0       // Channels 0-3
+#endif
+#define SERVO_MOTION_FRAME_US 20000      // One profile step per 50Hz servo frame
+#define SERVO_DEFAULT_VELOCITY 90        // deg/s
+#define SERVO_DEFAULT_ACCEL 180          // deg/s^2
+#define SERVO_MAX_VELOCITY 600
+#define SERVO_MAX_ACCEL 5000
+#define SERVO_UDEG 1000000L              // Position unit: micro-degrees
+
+class ServoMotion {
+public:
+  // LEDC channels are taken from firstChannel upward, one per pin
+  bool begin(uint8_t firstChannel = SERVO_LEDC_FIRST_CHANNEL) {
+    firstChannel_ = firstChannel;
+    instance() = this;
+#ifdef SERVO_CORE_3
+    timer_ = timerBegin(1000000);
+    if (timer_ == NULL) return false;
+    timerAttachInterrupt(timer_, &onTimer);
+    timerAlarm(timer_, SERVO_MOTION_FRAME_US, true, 0);
+#else
+    timer_ = timerBegin(SERVO_MOTION_TIMER, 80, true);
+    if (timer_ == NULL) return false;
+    timerAttachInterrupt(timer_, &onTimer, true);
+    timerAlarmWrite(timer_, SERVO_MOTION_FRAME_US, true);
+    timerAlarmEnable(timer_);
+#endif
+    return true;
+  }
+
+  // Start a move to `angle` (0-180) with the given profile (deg/s, deg/s^2).
+  // Returns false when every channel is in use by other pins.
+  bool moveTo(uint8_t pin, int angle, uint16_t velocity, uint16_t accel) {
+    int slot = slotFor(pin);
+    if (slot < 0) return false;
+    Axis& axis = axes_[slot];
+    bool attach = axis.pin != pin;
+    if (attach) {
+#ifdef SERVO_CORE_3
+      ledcAttachChannel(pin, 50, 16, firstChannel_ + slot);
+#else
+      ledcSetup(firstChannel_ + slot, 50, 16);
+      ledcAttachPin(pin, firstChannel_ + slot);
+#endif
+    }
+
+    int32_t target = (int32_t)constrain(angle, 0, 180) * SERVO_UDEG;
+    bool jump = attach || velocity == 0 || accel == 0 || timer_ == NULL;  // No timer: no profile
+    portENTER_CRITICAL(&mux_);
+    axis.pin = pin;
+    axis.target = target;
+    axis.maxSpeed = (int32_t)min((int)velocity, SERVO_MAX_VELOCITY) * SERVO_MOTION_FRAME_US;
+    axis.accel = (int32_t)min((int)accel, SERVO_MAX_ACCEL) * (SERVO_MOTION_FRAME_US / 1000) *
+                 (SERVO_MOTION_FRAME_US / 1000);
+    if (jump) {
+      axis.position = target;
+      axis.speed = 0;
+      axis.moving = false;
+    } else {
+      axis.moving = axis.position != target || axis.speed != 0;
+    }
+    portEXIT_CRITICAL(&mux_);
+
+    if (jump) writePulse(slot, pin, duty(target));
+    return true;
+  }
+
+  bool attached(uint8_t pin) const { return find(pin) >= 0; }
+
+  // Commanded position right now, in degrees
+  bool position(uint8_t pin, float& degrees) {
+    int slot = find(pin);
+    if (slot < 0) return false;
+    portENTER_CRITICAL(&mux_);
+    int32_t position = axes_[slot].position;
+    portEXIT_CRITICAL(&mux_);
+    degrees = roundf(position / (SERVO_UDEG / 10.0f)) / 10.0f;
+    return true;
+  }
+
+  // Target of the current (or last) move, in whole degrees
+  int target(uint8_t pin) const {
+    int slot = find(pin);
+    return slot < 0 ? -1 : (int)(axes_[slot].target / SERVO_UDEG);
+  }
+
+  uint8_t count() const {
+    uint8_t n = 0;
+    for (int i = 0; i < SERVO_MOTION_MAX; i++) {
+      if (axes_[i].pin >= 0) n++;
+    }
+    return n;
+  }
+
+  // Pin of the n-th attached servo, for iterating
+  int pinAt(uint8_t n) const {
+    for (int i = 0; i < SERVO_MOTION_MAX; i++) {
+      if (axes_[i].pin >= 0 && n-- == 0) return axes_[i].pin;
+    }
+    return -1;
+  }
+
+  // True once after any axis has reached its target
+  bool takeArrived() {
+    portENTER_CRITICAL(&mux_);
+    bool arrived = arrived_;
+    arrived_ = false;
+    portEXIT_CRITICAL(&mux_);
+    return arrived;
+  }
+
+  // Per pin: commanded position, target and whether it is still moving
+  void report(JsonObject out) {
+    for (int i = 0; i < SERVO_MOTION_MAX; i++) {
+      if (axes_[i].pin < 0) continue;
+      float degrees = 0;
+      position(axes_[i].pin, degrees);
+      JsonObject axis = out.createNestedObject(String(axes_[i].pin));
+      axis["pos"] = degrees;
+      axis["target"] = target(axes_[i].pin);
+      axis["moving"] = axes_[i].moving;
+    }
+  }
+
+private:
+  struct Axis {
+    int8_t pin = -1;
+    bool moving = false;
+    int32_t position = 0;   // micro-degrees
+    int32_t target = 0;
+    int32_t speed = 0;      // micro-degrees per frame, signed
+    int32_t maxSpeed = 0;
+    int32_t accel = 0;      // micro-degrees per frame per frame
+  };
+
+  int find(uint8_t pin) const {
+    for (int i = 0; i < SERVO_MOTION_MAX; i++) {
+      if (axes_[i].pin == pin) return i;
+    }
+    return -1;
+  }
+
+  int slotFor(uint8_t pin) const {
+    int slot = find(pin);
+    if (slot >= 0) return slot;
+    for (int i = 0; i < SERVO_MOTION_MAX; i++) {
+      if (axes_[i].pin < 0) return i;
+    }
+    return -1;
+  }
+
+  // Pulse width for a position as a 16-bit duty of the 20ms frame
+  static uint32_t IRAM_ATTR duty(int32_t position) {
+    int64_t pulseNs = 500000LL + position / 90;  // 2000us over 180 degrees
+    return (uint32_t)(pulseNs * 65535 / 20000000LL);
+  }
+
+  void IRAM_ATTR writePulse(int slot, uint8_t pin, uint32_t value) {
+#ifdef SERVO_CORE_3
+    ledcWrite(pin, value);
+#else
+    ledcWrite(firstChannel_ + slot, value);
+#endif
+  }
+
+  // The timer callback takes no argument, so the (single) engine is found here
+  static ServoMotion*& instance() {
+    static ServoMotion* engine = NULL;
+    return engine;
+  }
+
+  static void IRAM_ATTR onTimer() {
+    ServoMotion* engine = instance();
+    if (engine != NULL) engine->step();
+  }
+
+  // One profile step for every moving axis
+  void IRAM_ATTR step() {
+    uint32_t duties[SERVO_MOTION_MAX];
+    bool write[SERVO_MOTION_MAX] = {false};
+
+    portENTER_CRITICAL_ISR(&mux_);
+    for (int i = 0; i < SERVO_MOTION_MAX; i++) {
+      Axis& axis = axes_[i];
+      if (!axis.moving) continue;
+
+      int32_t remaining = axis.target - axis.position;
+      int32_t dir = remaining >= 0 ? 1 : -1;
+      int64_t distance = remaining >= 0 ? remaining : -(int64_t)remaining;
+      int32_t speed = axis.speed * dir;  // Toward the target; negative = moving away
+
+      if (speed < 0) {
+        speed = min(speed + axis.accel, (int32_t)0);  // Retargeted behind us: brake first
+      } else {
+        // Frames of deceleration from this speed cover about v^2/2a + v/2
+        int64_t stopping = (int64_t)speed * speed / (2 * axis.accel) + speed / 2;
+        if (stopping >= distance) speed = max(speed - axis.accel, axis.accel);
+        else if (speed > axis.maxSpeed) speed = max(speed - axis.accel, axis.maxSpeed);
+        else speed = min(speed + axis.accel, axis.maxSpeed);
+      }
+
+      if (speed >= 0 && speed >= distance) {
+        axis.position = axis.target;
+        axis.speed = 0;
+        axis.moving = false;
+        arrived_ = true;
+      } else {
+        axis.position += speed * dir;
+        axis.speed = speed * dir;
+      }
+      duties[i] = duty(axis.position);
+      write[i] = true;
+    }
+    portEXIT_CRITICAL_ISR(&mux_);
+
+    for (int i = 0; i < SERVO_MOTION_MAX; i++) {
+      if (write[i]) writePulse(i, axes_[i].pin, duties[i]);
+    }
+  }
+
+  hw_timer_t* timer_ = NULL;
+  uint8_t firstChannel_ = SERVO_LEDC_FIRST_CHANNEL;
+  Axis axes_[SERVO_MOTION_MAX];
+  volatile bool arrived_ = false;
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+};
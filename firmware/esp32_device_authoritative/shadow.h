@@ -0,0 +1,153 @@
+/*
+ * Device shadow: versioned desired state + delta-reported state
+ *
+ * Desired state lives on a retained topic as
+ *   {"version": 7, "state": {"gpio": {"4": 1}, "pwm": {"5": 128}, "servo": {"18": 90}}}
+ * The broker redelivers it on every (re)subscribe. The device ignores any
+ * version it has already applied, and for a newer version applies only the
+ * entries that differ from its current actuator state.
+ *
+ * Reported state is published as deltas: only entries that changed since the
+ * last successful report, tagged with the desired version they reflect and a
+ * sequence number so the backend can detect a gap and ask for a full report.
+ * After a reconnect the first report carries just what changed while offline.
+ *
+ * The applied version is kept in RAM on purpose: after a reboot the outputs
+ * are back at their defaults, so the retained desired document must be
+ * re-applied (as a delta against the real hardware state).
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define SHADOW_MAX_ENTRIES 24
+
+enum ShadowSection : uint8_t {
+  SHADOW_GPIO = 0,
+  SHADOW_PWM = 1,
+  SHADOW_SERVO = 2,
+  SHADOW_SECTION_COUNT = 3
+};
+
+inline const char* shadowSectionName(uint8_t section) {
+  static const char* const names[SHADOW_SECTION_COUNT] = {"gpio", "pwm", "servo"};
+  return section < SHADOW_SECTION_COUNT ? names[section] : "";
+}
+
+struct ShadowEntry {
+  uint8_t section;
+  uint8_t pin;
+  int32_t value;
+};
+
+// Flat set of (section, pin) -> value
+class ShadowState {
+public:
+  void clear() { count_ = 0; }
+
+  bool set(uint8_t section, uint8_t pin, int32_t value) {
+    ShadowEntry* entry = find(section, pin);
+    if (entry == NULL) {
+      if (count_ == SHADOW_MAX_ENTRIES) return false;
+      entry = &entries_[count_++];
+      entry->section = section;
+      entry->pin = pin;
+    }
+    entry->value = value;
+    return true;
+  }
+
+  const ShadowEntry* get(uint8_t section, uint8_t pin) const {
+    for (uint8_t i = 0; i < count_; i++) {
+      if (entries_[i].section == section && entries_[i].pin == pin) return &entries_[i];
+    }
+    return NULL;
+  }
+
+  uint8_t count() const { return count_; }
+  const ShadowEntry& at(uint8_t i) const { return entries_[i]; }
+
+private:
+  ShadowEntry* find(uint8_t section, uint8_t pin) {
+    return const_cast<ShadowEntry*>(get(section, pin));
+  }
+
+  ShadowEntry entries_[SHADOW_MAX_ENTRIES];
+  uint8_t count_ = 0;
+};
+
+class DeviceShadow {
+public:
+  uint32_t appliedVersion() const { return appliedVersion_; }
+  void setAppliedVersion(uint32_t version) { appliedVersion_ = version; }
+
+  // True if this desired version has not been applied yet
+  bool isNewVersion(uint32_t version) const { return version > appliedVersion_; }
+
+  // Entries of the desired "state" object that differ from current
+  uint8_t desiredDelta(JsonObjectConst desired, const ShadowState& current, ShadowState& delta) const {
+    delta.clear();
+    for (uint8_t section = 0; section < SHADOW_SECTION_COUNT; section++) {
+      JsonObjectConst values = desired[shadowSectionName(section)];
+      if (values.isNull()) continue;
+      for (JsonPairConst kv : values) {
+        if (!kv.value().is<int>()) continue;
+        int pin = atoi(kv.key().c_str());
+        if (pin < 0 || pin > 39) continue;
+        int32_t value = kv.value().as<int32_t>();
+        const ShadowEntry* now = current.get(section, pin);
+        if (now == NULL || now->value != value) {
+          delta.set(section, pin, value);
+        }
+      }
+    }
+    return delta.count();
+  }
+
+  // Write entries that changed since the last committed report into state
+  // (nested by section). Returns the number of changed entries.
+  uint8_t reportedDelta(const ShadowState& current, JsonObject state) const {
+    uint8_t changed = 0;
+    for (uint8_t i = 0; i < current.count(); i++) {
+      const ShadowEntry& entry = current.at(i);
+      const ShadowEntry* last = fullReportPending_ ? NULL : reported_.get(entry.section, entry.pin);
+      if (last != NULL && last->value == entry.value) continue;
+
+      const char* name = shadowSectionName(entry.section);
+      JsonObject section = state[name].as<JsonObject>();
+      if (section.isNull()) section = state.createNestedObject(name);
+      section[String(entry.pin)] = entry.value;
+      changed++;
+    }
+    return changed;
+  }
+
+  // Call after a report was published successfully
+  void commitReported(const ShadowState& current) {
+    for (uint8_t i = 0; i < current.count(); i++) {
+      const ShadowEntry& entry = current.at(i);
+      reported_.set(entry.section, entry.pin, entry.value);
+    }
+    fullReportPending_ = false;
+    reportedVersion_ = appliedVersion_;
+    reportSeq_++;
+  }
+
+  // A newly applied version must be reported even if nothing changed
+  bool versionPending() const { return reportedVersion_ != appliedVersion_; }
+
+  // Next report carries every entry (e.g. backend detected a sequence gap)
+  void requestFullReport() { fullReportPending_ = true; }
+  bool fullReportPending() const { return fullReportPending_; }
+
+  uint32_t reportSeq() const { return reportSeq_; }
+
+private:
+  ShadowState reported_;
+  uint32_t appliedVersion_ = 0;
+  uint32_t reportedVersion_ = 0;
+  uint32_t reportSeq_ = 0;
+  bool fullReportPending_ = true;
+};
@@ -0,0 +1,154 @@
+/*
+ * Per-task stack high-water-mark monitor
+ *
+ * Periodically walks every FreeRTOS task with uxTaskGetSystemState() and
+ * keeps the current and lowest observed free stack per task (ESP-IDF reports
+ * the high-water mark in bytes). The report lets us right-size task stacks
+ * from field data instead of guessing, and spot tasks close to overflow.
+ *
+ * Debug builds (-DSTACK_PROFILE) additionally attribute stack usage to
+ * command actions: a StackProbe placed in the command handler records the
+ * loop task's watermark after each action and counts which actions pushed
+ * it to a new low.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define STACK_MONITOR_MAX_TASKS 16
+#define STACK_MONITOR_MAX_COMMANDS 12
+
+struct TaskStackSample {
+  char name[configMAX_TASK_NAME_LEN];
+  uint32_t freeBytes;
+  uint32_t minFreeBytes;
+  bool alive;
+};
+
+struct CommandStackSample {
+  char action[24];
+  uint32_t minFreeBytes;  // Loop task watermark after this action ran
+  uint32_t count;
+  uint32_t newLows;       // Times this action lowered the watermark
+};
+
+class StackMonitor {
+public:
+  // Refresh the watermark of every task. Allocates a temporary status array
+  // on the heap so the sampler itself stays light on stack.
+  void sample() {
+    UBaseType_t count = uxTaskGetNumberOfTasks();
+    TaskStatus_t* status = (TaskStatus_t*)malloc(count * sizeof(TaskStatus_t));
+    if (status == NULL) return;
+
+    count = uxTaskGetSystemState(status, count, NULL);
+
+    for (uint8_t i = 0; i < numTasks_; i++) tasks_[i].alive = false;
+
+    for (UBaseType_t i = 0; i < count; i++) {
+      TaskStackSample* task = findTask(status[i].pcTaskName);
+      if (task == NULL) continue;
+      uint32_t freeBytes = status[i].usStackHighWaterMark;
+      task->freeBytes = freeBytes;
+      if (freeBytes < task->minFreeBytes) task->minFreeBytes = freeBytes;
+      task->alive = true;
+    }
+
+    free(status);
+    samples_++;
+  }
+
+  // Lowest free stack among live tasks, and which task it belongs to
+  uint32_t lowestFree(const char** name = NULL) const {
+    uint32_t lowest = UINT32_MAX;
+    for (uint8_t i = 0; i < numTasks_; i++) {
+      if (tasks_[i].alive && tasks_[i].freeBytes < lowest) {
+        lowest = tasks_[i].freeBytes;
+        if (name) *name = tasks_[i].name;
+      }
+    }
+    return lowest;
+  }
+
+  void recordCommand(const char* action, uint32_t before, uint32_t after) {
+    CommandStackSample* cmd = findCommand(action);
+    if (cmd == NULL) return;
+    cmd->count++;
+    if (after < cmd->minFreeBytes) cmd->minFreeBytes = after;
+    if (after < before) cmd->newLows++;
+  }
+
+  void report(JsonObject out) const {
+    out["samples"] = samples_;
+    JsonArray tasks = out.createNestedArray("tasks");
+    for (uint8_t i = 0; i < numTasks_; i++) {
+      if (!tasks_[i].alive) continue;
+      JsonObject task = tasks.createNestedObject();
+      task["name"] = (const char*)tasks_[i].name;
+      task["free"] = tasks_[i].freeBytes;
+      task["min"] = tasks_[i].minFreeBytes;
+    }
+
+    if (numCommands_ == 0) return;
+    JsonArray commands = out.createNestedArray("commands");
+    for (uint8_t i = 0; i < numCommands_; i++) {
+      JsonObject cmd = commands.createNestedObject();
+      cmd["action"] = (const char*)commands_[i].action;
+      cmd["min"] = commands_[i].minFreeBytes;
+      cmd["count"] = commands_[i].count;
+      cmd["newLows"] = commands_[i].newLows;
+    }
+  }
+
+private:
+  TaskStackSample* findTask(const char* name) {
+    for (uint8_t i = 0; i < numTasks_; i++) {
+      if (strncmp(tasks_[i].name, name, sizeof(tasks_[i].name)) == 0) return &tasks_[i];
+    }
+    if (numTasks_ == STACK_MONITOR_MAX_TASKS) return NULL;
+    TaskStackSample* task = &tasks_[numTasks_++];
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    task->name[sizeof(task->name) - 1] = '\0';
+    task->minFreeBytes = UINT32_MAX;
+    return task;
+  }
+
+  CommandStackSample* findCommand(const char* action) {
+    for (uint8_t i = 0; i < numCommands_; i++) {
+      if (strncmp(commands_[i].action, action, sizeof(commands_[i].action)) == 0) return &commands_[i];
+    }
+    if (numCommands_ == STACK_MONITOR_MAX_COMMANDS) return NULL;
+    CommandStackSample* cmd = &commands_[numCommands_++];
+    strncpy(cmd->action, action, sizeof(cmd->action) - 1);
+    cmd->action[sizeof(cmd->action) - 1] = '\0';
+    cmd->minFreeBytes = UINT32_MAX;
+    return cmd;
+  }
+
+  TaskStackSample tasks_[STACK_MONITOR_MAX_TASKS] = {};
+  CommandStackSample commands_[STACK_MONITOR_MAX_COMMANDS] = {};
+  uint8_t numTasks_ = 0;
+  uint8_t numCommands_ = 0;
+  unsigned long samples_ = 0;
+};
+
+// Scope guard for the command handler: records the calling task's
+// watermark before and after the action. Meant for STACK_PROFILE builds.
+class StackProbe {
+public:
+  StackProbe(StackMonitor& monitor, const char* action)
+    : monitor_(monitor), action_(action), before_(uxTaskGetStackHighWaterMark(NULL)) {}
+
+  ~StackProbe() {
+    monitor_.recordCommand(action_, before_, uxTaskGetStackHighWaterMark(NULL));
+  }
+
+private:
+  StackMonitor& monitor_;
+  const char* action_;
+  uint32_t before_;
+};
@@ -0,0 +1,74 @@
+/*
+ * Deferred, coalesced state publication
+ *
+ * Commands used to call publishState() before sending their ACK, so the ACK
+ * waited behind building and streaming the retained snapshot, and a burst of
+ * five commands produced five snapshots. Now a command actuates, ACKs and
+ * calls markDirty(); the loop publishes one snapshot once the state has
+ * settled:
+ *
+ *   - STATE_SETTLE_MS after the last change, so a burst collapses into one
+ *     snapshot taken after its final command
+ *   - at most STATE_MAX_DEFER_MS after the first change, so a steady stream
+ *     of commands can't hold the snapshot back indefinitely
+ *
+ * Any snapshot (periodic or on reconnect) satisfies a pending change, so the
+ * caller reports every publish through published().
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define STATE_SETTLE_MS 50
+#define STATE_MAX_DEFER_MS 250
+
+class StateCoalescer {
+public:
+  void markDirty(unsigned long now) {
+    if (!dirty_) {
+      dirty_ = true;
+      firstMs_ = now;
+    }
+    lastMs_ = now;
+    marks_++;
+  }
+
+  bool dirty() const { return dirty_; }
+
+  // A pending change has settled (or waited long enough) to be published
+  bool due(unsigned long now) const {
+    return dirty_ && msUntilDue(now) == 0;
+  }
+
+  // Time until due() turns true (UINT32_MAX when nothing is pending)
+  uint32_t msUntilDue(unsigned long now) const {
+    if (!dirty_) return UINT32_MAX;
+    unsigned long settled = now - lastMs_;
+    unsigned long waited = now - firstMs_;
+    if (settled >= STATE_SETTLE_MS || waited >= STATE_MAX_DEFER_MS) return 0;
+    uint32_t untilSettled = STATE_SETTLE_MS - settled;
+    uint32_t untilCap = STATE_MAX_DEFER_MS - waited;
+    return untilSettled < untilCap ? untilSettled : untilCap;
+  }
+
+  // A snapshot went out: it covers every change marked so far
+  void published() {
+    if (dirty_) coalesced_++;
+    dirty_ = false;
+  }
+
+  // Changes marked vs snapshots published for them
+  void report(JsonObject out) const {
+    out["changes"] = marks_;
+    out["snapshots"] = coalesced_;
+  }
+
+private:
+  bool dirty_ = false;
+  unsigned long firstMs_ = 0;
+  unsigned long lastMs_ = 0;
+  uint32_t marks_ = 0;
+  uint32_t coalesced_ = 0;
+};
@@ -0,0 +1,662 @@
+/*
+ * mbedTLS clients (lean record buffers, ECDSA mutual TLS) and handshake
+ * benchmark
+ *
+ * WiFiClientSecure takes mbedTLS's default configuration: every compiled-in
+ * cipher suite and curve is offered, the broker usually picks an RSA chain,
+ * and each connection holds record buffers for 16KB records. MbedTlsClient
+ * is a drop-in Client for PubSubClient that keeps the default suites but
+ * can request the max_fragment_length extension: a broker that accepts it
+ * (any OpenSSL-based one, e.g. mosquitto) sends records of at most that
+ * size. Whether the buffers shrink to match depends on the mbedTLS build:
+ *
+ *   - CONFIG_MBEDTLS_DYNAMIC_BUFFER (ESP-IDF): record buffers are allocated
+ *     per record, so small records mean small buffers. 16KB records from
+ *     servers without the extension (OTA downloads) still work.
+ *   - CONFIG_MBEDTLS_ASYMMETRIC_CONTENT_LEN with a small IN_CONTENT_LEN:
+ *     fixed smaller buffers, but every TLS server the device talks to must
+ *     accept the extension.
+ *
+ * reportBuffers() shows which one the firmware was built with, the
+ * negotiated record size and the heap the connection holds.
+ *
+ * EcdsaTlsClient is MbedTlsClient with a narrow profile:
+ *
+ *   - TLS 1.2 only, one suite: ECDHE-ECDSA-AES128-GCM-SHA256. AES-GCM and
+ *     SHA-256 run on the ESP32's AES/SHA accelerators, and the P-256 math
+ *     on its MPI accelerator.
+ *   - One curve (secp256r1) and SHA-256 signatures. The ClientHello stays
+ *     small and the broker cannot negotiate anything slower.
+ *   - Mutual TLS: the device presents an ECDSA P-256 certificate. The
+ *     broker CA must be ECDSA too.
+ *
+ * The CA, certificate and key are parsed on the first connect and kept, so
+ * a reconnect only pays for the handshake; setTrust() skips even the first
+ * CA parse by sharing a store parsed at boot (ca_store.h). The handshake runs on a
+ * non-blocking socket bounded by the handshake timeout. fd() and
+ * available() behave like WiFiClientSecure's, so loop_wakeup.h works
+ * unchanged.
+ *
+ * TlsHeapMeter routes mbedTLS allocations through a counter (same internal
+ * RAM as before) so the peak heap a handshake needs can be measured for
+ * either client. TlsBench runs handshakes one per loop pass against both
+ * profiles and reports time and peak heap for each.
+ *
+ * Host builds have no TLS stack: both clients are the host WiFiClientSecure
+ * (plain TCP) and the meter reads 0.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <WiFiClientSecure.h>
+#include "ca_store.h"
+
+#if defined(ESP_PLATFORM)
+#include <esp_heap_caps.h>
+#include <mbedtls/version.h>
+#include <mbedtls/platform.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/pk.h>
+#endif
+
+#define TLS_HANDSHAKE_TIMEOUT_MS 10000
+#define TLS_IO_TIMEOUT_MS 5000
+#define TLS_BENCH_MAX_COUNT 10
+
+struct TlsHandshakeStats {
+  uint32_t handshakes;
+  uint32_t failures;
+  uint32_t lastMs;
+  uint32_t minMs;
+  uint32_t maxMs;
+  uint32_t totalMs;
+  uint32_t peakHeap;     // Largest mbedTLS heap growth during one handshake
+  int lastError;         // mbedTLS error code of the last failure
+};
+
+inline void recordHandshake(TlsHandshakeStats& stats, bool ok, uint32_t ms, uint32_t peakHeap, int error) {
+  if (!ok) {
+    stats.failures++;
+    stats.lastError = error;
+    return;
+  }
+  stats.handshakes++;
+  stats.lastMs = ms;
+  stats.totalMs += ms;
+  if (stats.handshakes == 1 || ms < stats.minMs) stats.minMs = ms;
+  if (ms > stats.maxMs) stats.maxMs = ms;
+  if (peakHeap > stats.peakHeap) stats.peakHeap = peakHeap;
+}
+
+inline void reportHandshakes(const TlsHandshakeStats& stats, JsonObject out) {
+  out["ok"] = stats.handshakes;
+  out["failed"] = stats.failures;
+  if (stats.handshakes > 0) {
+    out["avg_ms"] = stats.totalMs / stats.handshakes;
+    out["min_ms"] = stats.minMs;
+    out["max_ms"] = stats.maxMs;
+  }
+  out["peak_heap"] = stats.peakHeap;
+  if (stats.failures > 0) out["error"] = stats.lastError;
+}
+
+// --- mbedTLS heap meter -----------------------------------------------------------
+
+class TlsHeapMeter {
+public:
+  // Install before the first TLS connection; blocks allocated earlier would
+  // be freed through the counter without having been counted
+  static bool install() {
+#if defined(ESP_PLATFORM) && defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+    mbedtls_platform_set_calloc_free(countingCalloc, countingFree);
+    installed() = true;
+#endif
+    return installed();
+  }
+
+  static bool available() { return installed(); }
+  static uint32_t current() { return (uint32_t)max((int32_t)0, counter().current); }
+
+  // Start a measurement window: peak() is relative to the heap in use now
+  static void startWindow() {
+    counter().base = counter().current;
+    counter().peak = counter().current;
+  }
+  static uint32_t peak() { return (uint32_t)max((int32_t)0, counter().peak - counter().base); }
+
+private:
+  struct Counter {
+    int32_t current = 0;
+    int32_t peak = 0;
+    int32_t base = 0;
+  };
+
+  static Counter& counter() {
+    static Counter instance;
+    return instance;
+  }
+
+  static bool& installed() {
+    static bool flag = false;
+    return flag;
+  }
+
+#if defined(ESP_PLATFORM)
+  // Same internal RAM the default mbedTLS allocator uses
+  static void* countingCalloc(size_t n, size_t size) {
+    void* p = heap_caps_calloc(n, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (p != NULL) {
+      Counter& c = counter();
+      c.current += (int32_t)heap_caps_get_allocated_size(p);
+      if (c.current > c.peak) c.peak = c.current;
+    }
+    return p;
+  }
+
+  static void countingFree(void* p) {
+    if (p == NULL) return;
+    counter().current -= (int32_t)heap_caps_get_allocated_size(p);
+    heap_caps_free(p);
+  }
+#endif
+};
+
+// --- mbedTLS client -------------------------------------------------------------------
+
+// Record-size limits a client can request (RFC 6066 max_fragment_length)
+inline bool validMaxFragmentLength(uint16_t bytes) {
+  return bytes == 0 || bytes == 512 || bytes == 1024 || bytes == 2048 || bytes == 4096;
+}
+
+#if defined(ESP_PLATFORM)
+
+// Server-authenticated TLS with mbedTLS's default suites, an optional client
+// certificate and an optional max_fragment_length request
+class MbedTlsClient : public Client {
+public:
+  MbedTlsClient() {
+    mbedtls_net_init(&net_);
+    mbedtls_ssl_init(&ssl_);
+    mbedtls_ssl_config_init(&config_);
+    mbedtls_entropy_init(&entropy_);
+    mbedtls_ctr_drbg_init(&drbg_);
+    mbedtls_x509_crt_init(&ca_);
+    mbedtls_x509_crt_init(&cert_);
+    mbedtls_pk_init(&key_);
+  }
+
+  virtual ~MbedTlsClient() {
+    stop();
+    mbedtls_ssl_config_free(&config_);
+    mbedtls_ctr_drbg_free(&drbg_);
+    mbedtls_entropy_free(&entropy_);
+    mbedtls_x509_crt_free(&ca_);
+    mbedtls_x509_crt_free(&cert_);
+    mbedtls_pk_free(&key_);
+  }
+
+  // PEM strings; they must stay valid until the first connect
+  void setCACert(const char* pem) { caPem_ = pem; configured_ = false; }
+  void setCertificate(const char* pem) { certPem_ = pem; configured_ = false; }
+  void setPrivateKey(const char* pem) { keyPem_ = pem; configured_ = false; }
+  void setHandshakeTimeout(unsigned long seconds) { handshakeTimeoutMs_ = seconds * 1000; }
+
+  // Trust a shared, already parsed CA store instead of a PEM (ca_store.h);
+  // pins, if given, must outlive the client
+  void setTrust(CaStore& store, SpkiPins* pins = NULL) {
+    store_ = &store;
+    pins_ = pins;
+    configured_ = false;
+  }
+
+  // Ask the server for records of at most `bytes` (512-4096, 0 = no limit).
+  // Servers that ignore the extension still send up to 16KB records.
+  bool setMaxFragmentLength(uint16_t bytes) {
+    if (!validMaxFragmentLength(bytes)) return false;
+    maxFragment_ = bytes;
+    configured_ = false;
+    return true;
+  }
+
+  int connect(IPAddress ip, uint16_t port) override {
+    return open(ip.toString().c_str(), port, false);
+  }
+
+  int connect(const char* host, uint16_t port) override {
+    return open(host, port, true);
+  }
+
+  size_t write(uint8_t b) override { return write(&b, 1); }
+
+  size_t write(const uint8_t* buf, size_t size) override {
+    size_t sent = 0;
+    unsigned long start = millis();
+    while (connected_ && sent < size) {
+      int ret = mbedtls_ssl_write(&ssl_, buf + sent, size - sent);
+      if (ret > 0) {
+        sent += ret;
+      } else if ((ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ) &&
+                 millis() - start < TLS_IO_TIMEOUT_MS) {
+        mbedtls_net_poll(&net_, MBEDTLS_NET_POLL_WRITE, 10);
+      } else {
+        stop();
+      }
+    }
+    return sent;
+  }
+  using Print::write;
+
+  int available() override {
+    if (!connected_) return 0;
+    if (peek_ >= 0) return 1 + (int)mbedtls_ssl_get_bytes_avail(&ssl_);
+    int ret = mbedtls_ssl_read(&ssl_, NULL, 0);  // Process a pending record, if any
+    if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      stop();
+      return 0;
+    }
+    return (int)mbedtls_ssl_get_bytes_avail(&ssl_);
+  }
+
+  int read() override {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+
+  int read(uint8_t* buf, size_t size) override {
+    if (size == 0 || !connected_) return -1;
+    size_t offset = 0;
+    if (peek_ >= 0) {
+      buf[offset++] = (uint8_t)peek_;
+      peek_ = -1;
+      if (offset == size) return (int)offset;
+    }
+    int ret = mbedtls_ssl_read(&ssl_, buf + offset, size - offset);
+    if (ret > 0) return (int)offset + ret;
+    if (ret == 0 || (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)) stop();
+    return offset > 0 ? (int)offset : -1;
+  }
+
+  int peek() override {
+    if (peek_ < 0 && available() > 0) peek_ = read();
+    return peek_;
+  }
+
+  void flush() override {}
+
+  void stop() override {
+    if (connected_) mbedtls_ssl_close_notify(&ssl_);
+    connected_ = false;
+    peek_ = -1;
+    sessionHeap_ = 0;
+    mbedtls_net_free(&net_);
+    mbedtls_ssl_free(&ssl_);  // Releases the record buffers between connections
+    mbedtls_ssl_init(&ssl_);
+  }
+
+  uint8_t connected() override {
+    if (connected_) available();  // Notices a close from the peer
+    return connected_;
+  }
+
+  operator bool() override { return connected(); }
+
+  int fd() const { return connected_ ? net_.fd : -1; }
+
+  const char* cipher() const { return connected_ ? mbedtls_ssl_get_ciphersuite(&ssl_) : ""; }
+  const TlsHandshakeStats& stats() const { return stats_; }
+
+  // Largest record the server may send on this connection: the negotiated
+  // max_fragment_length, or 16KB when the server ignored the request
+  uint16_t maxFragmentLength() const {
+    if (!connected_) return 0;
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    return (uint16_t)mbedtls_ssl_get_input_max_frag_len(&ssl_);
+#else
+    return MBEDTLS_SSL_IN_CONTENT_LEN;
+#endif
+  }
+
+  // mbedTLS heap this connection holds after the handshake (record buffers
+  // and session); 0 when the meter is not installed
+  uint32_t sessionHeap() const { return sessionHeap_; }
+
+  // Requested and negotiated record size, connection heap and the build's
+  // record buffer configuration
+  void reportBuffers(JsonObject out) const {
+    out["mfl_requested"] = maxFragment_;
+    out["mfl"] = maxFragmentLength();
+    out["session_heap"] = sessionHeap_;
+    out["in_content_len"] = MBEDTLS_SSL_IN_CONTENT_LEN;
+    out["out_content_len"] = MBEDTLS_SSL_OUT_CONTENT_LEN;
+#if defined(CONFIG_MBEDTLS_DYNAMIC_BUFFER)
+    out["dynamic_buffers"] = true;
+#elif defined(MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH)
+    out["variable_buffers"] = true;
+#endif
+  }
+
+protected:
+  // Profile hook: restrict the configuration after the defaults are applied
+  virtual int configureProfile() { return 0; }
+
+  mbedtls_ssl_config config_;
+  mbedtls_pk_context key_;
+  const char* certPem_ = NULL;
+  const char* keyPem_ = NULL;
+
+private:
+  // Parse credentials and build the configuration, once
+  int configure() {
+    if (configured_) return 0;
+    if ((caPem_ == NULL && store_ == NULL) || (certPem_ == NULL) != (keyPem_ == NULL)) {
+      return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+
+    mbedtls_x509_crt_free(&ca_);
+    mbedtls_x509_crt_free(&cert_);
+    mbedtls_pk_free(&key_);
+    mbedtls_x509_crt_init(&ca_);
+    mbedtls_x509_crt_init(&cert_);
+    mbedtls_pk_init(&key_);
+
+    int ret = 0;
+    if (!seeded_) {
+      ret = mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_, NULL, 0);
+      if (ret != 0) return ret;
+      seeded_ = true;
+    }
+    if (store_ == NULL) ret = mbedtls_x509_crt_parse(&ca_, (const unsigned char*)caPem_, strlen(caPem_) + 1);
+    if (ret == 0 && certPem_ != NULL) {
+      ret = mbedtls_x509_crt_parse(&cert_, (const unsigned char*)certPem_, strlen(certPem_) + 1);
+#if MBEDTLS_VERSION_MAJOR >= 3
+      if (ret == 0) {
+        ret = mbedtls_pk_parse_key(&key_, (const unsigned char*)keyPem_, strlen(keyPem_) + 1, NULL, 0,
+                                   mbedtls_ctr_drbg_random, &drbg_);
+      }
+#else
+      if (ret == 0) ret = mbedtls_pk_parse_key(&key_, (const unsigned char*)keyPem_, strlen(keyPem_) + 1, NULL, 0);
+#endif
+    }
+    if (ret != 0) return ret;
+
+    ret = mbedtls_ssl_config_defaults(&config_, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) return ret;
+    mbedtls_ssl_conf_authmode(&config_, MBEDTLS_SSL_VERIFY_REQUIRED);
+    if (store_ != NULL) store_->attach(&config_, pins_);
+    else mbedtls_ssl_conf_ca_chain(&config_, &ca_, NULL);
+    mbedtls_ssl_conf_rng(&config_, mbedtls_ctr_drbg_random, &drbg_);
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    ret = mbedtls_ssl_conf_max_frag_len(&config_, maxFragmentCode(maxFragment_));
+    if (ret != 0) return ret;
+#endif
+    ret = configureProfile();
+    if (ret == 0 && certPem_ != NULL) ret = mbedtls_ssl_conf_own_cert(&config_, &cert_, &key_);
+    if (ret != 0) return ret;
+    configured_ = true;
+    return 0;
+  }
+
+  int open(const char* host, uint16_t port, bool verifyName) {
+    stop();
+    unsigned long start = millis();
+    TlsHeapMeter::startWindow();
+
+    int ret = configure();
+    uint32_t heapBefore = TlsHeapMeter::current();  // Parsed credentials stay across connections
+    char portText[6];
+    snprintf(portText, sizeof(portText), "%u", port);
+    if (ret == 0) ret = mbedtls_net_connect(&net_, host, portText, MBEDTLS_NET_PROTO_TCP);
+    if (ret == 0) ret = mbedtls_ssl_setup(&ssl_, &config_);
+    if (ret == 0 && verifyName) ret = mbedtls_ssl_set_hostname(&ssl_, host);
+    if (ret == 0) ret = mbedtls_net_set_nonblock(&net_);
+    if (ret == 0) {
+      mbedtls_ssl_set_bio(&ssl_, &net_, mbedtls_net_send, mbedtls_net_recv, NULL);
+      while ((ret = mbedtls_ssl_handshake(&ssl_)) != 0) {
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) break;
+        if (millis() - start >= handshakeTimeoutMs_) {
+          ret = MBEDTLS_ERR_SSL_TIMEOUT;
+          break;
+        }
+        mbedtls_net_poll(&net_, ret == MBEDTLS_ERR_SSL_WANT_READ ? MBEDTLS_NET_POLL_READ : MBEDTLS_NET_POLL_WRITE, 50);
+      }
+    }
+
+    recordHandshake(stats_, ret == 0, millis() - start, TlsHeapMeter::peak(), ret);
+    if (ret != 0) {
+      Serial.printf("TLS connect to %s:%u failed: -0x%04x\n", host, port, -ret);
+      stop();
+      return 0;
+    }
+    connected_ = true;
+    uint32_t heapAfter = TlsHeapMeter::current();
+    sessionHeap_ = heapAfter > heapBefore ? heapAfter - heapBefore : 0;
+    return 1;
+  }
+
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+  static unsigned char maxFragmentCode(uint16_t bytes) {
+    switch (bytes) {
+      case 512: return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+      case 1024: return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+      case 2048: return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+      case 4096: return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+      default: return MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+    }
+  }
+#endif
+
+  mbedtls_net_context net_;
+  mbedtls_ssl_context ssl_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_ctr_drbg_context drbg_;
+  mbedtls_x509_crt ca_;
+  mbedtls_x509_crt cert_;
+  const char* caPem_ = NULL;
+  CaStore* store_ = NULL;
+  SpkiPins* pins_ = NULL;
+  bool configured_ = false;
+  bool seeded_ = false;
+  bool connected_ = false;
+  int peek_ = -1;
+  uint16_t maxFragment_ = 0;
+  uint32_t sessionHeap_ = 0;
+  unsigned long handshakeTimeoutMs_ = TLS_HANDSHAKE_TIMEOUT_MS;
+  TlsHandshakeStats stats_ = {};
+};
+
+// --- ECDSA mutual-TLS client ----------------------------------------------------------
+
+class EcdsaTlsClient : public MbedTlsClient {
+protected:
+  // Device certificate required; one suite, one curve, TLS 1.2 only
+  int configureProfile() override {
+    if (certPem_ == NULL) return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    if (!mbedtls_pk_can_do(&key_, MBEDTLS_PK_ECDSA)) return MBEDTLS_ERR_PK_TYPE_MISMATCH;
+    mbedtls_ssl_conf_ciphersuites(&config_, ciphersuites());
+#if MBEDTLS_VERSION_MAJOR >= 3
+    mbedtls_ssl_conf_min_tls_version(&config_, MBEDTLS_SSL_VERSION_TLS1_2);
+    mbedtls_ssl_conf_max_tls_version(&config_, MBEDTLS_SSL_VERSION_TLS1_2);
+    mbedtls_ssl_conf_groups(&config_, groups());
+#else
+    mbedtls_ssl_conf_min_version(&config_, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+    mbedtls_ssl_conf_max_version(&config_, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+    mbedtls_ssl_conf_curves(&config_, curves());
+    mbedtls_ssl_conf_sig_hashes(&config_, sigHashes());
+#endif
+    return 0;
+  }
+
+private:
+  // mbedTLS keeps pointers to these lists, so they are static
+  static const int* ciphersuites() {
+    static const int list[] = {MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256, 0};
+    return list;
+  }
+#if MBEDTLS_VERSION_MAJOR >= 3
+  static const uint16_t* groups() {
+    static const uint16_t list[] = {MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1, MBEDTLS_SSL_IANA_TLS_GROUP_NONE};
+    return list;
+  }
+#else
+  static const mbedtls_ecp_group_id* curves() {
+    static const mbedtls_ecp_group_id list[] = {MBEDTLS_ECP_DP_SECP256R1, MBEDTLS_ECP_DP_NONE};
+    return list;
+  }
+  static const int* sigHashes() {
+    static const int list[] = {MBEDTLS_MD_SHA256, MBEDTLS_MD_NONE};
+    return list;
+  }
+#endif
+};
+
+#else
+
+// Host: plain TCP like the host WiFiClientSecure, with the same interface
+class MbedTlsClient : public WiFiClientSecure {
+public:
+  int connect(IPAddress ip, uint16_t port) override { return track(WiFiClientSecure::connect(ip, port)); }
+  int connect(const char* host, uint16_t port) override { return track(WiFiClientSecure::connect(host, port)); }
+  bool setMaxFragmentLength(uint16_t bytes) {
+    if (!validMaxFragmentLength(bytes)) return false;
+    maxFragment_ = bytes;
+    return true;
+  }
+  void setTrust(CaStore&, SpkiPins* = NULL) {}
+  const char* cipher() const { return ""; }
+  const TlsHandshakeStats& stats() const { return stats_; }
+  uint16_t maxFragmentLength() const { return 0; }
+  uint32_t sessionHeap() const { return 0; }
+  void reportBuffers(JsonObject out) const {
+    out["mfl_requested"] = maxFragment_;
+    out["mfl"] = 0;
+    out["session_heap"] = 0;
+  }
+
+private:
+  int track(int result) {
+    recordHandshake(stats_, result != 0, 0, 0, -1);
+    return result;
+  }
+
+  uint16_t maxFragment_ = 0;
+  TlsHandshakeStats stats_ = {};
+};
+
+class EcdsaTlsClient : public MbedTlsClient {};
+
+#endif
+
+// --- Handshake benchmark ------------------------------------------------------------------
+
+struct TlsBenchCredentials {
+  const char* rsaCa;       // Current profile: CA only, default suites
+  const char* ecdsaCa;
+  const char* ecdsaCert;
+  const char* ecdsaKey;
+};
+
+class TlsBench {
+public:
+  bool running() const { return remaining_ > 0; }
+  const char* cmdId() const { return cmdId_; }
+
+  // Queue `count` handshakes per profile against host:port (one port per profile)
+  bool start(const TlsBenchCredentials& credentials, const char* host, uint16_t rsaPort, uint16_t ecdsaPort,
+             uint8_t count, bool rsa, bool ecdsa, const char* cmdId, String& error) {
+    if (running()) {
+      error = "TLS bench " + String(cmdId_) + " still running";
+      return false;
+    }
+    if (count == 0 || count > TLS_BENCH_MAX_COUNT || (!rsa && !ecdsa)) {
+      error = "Count must be 1-" + String(TLS_BENCH_MAX_COUNT);
+      return false;
+    }
+    credentials_ = credentials;
+    host_ = host;
+    rsaPort_ = rsaPort;
+    ecdsaPort_ = ecdsaPort;
+    rsa_ = rsa;
+    ecdsa_ = ecdsa;
+    perProfile_ = count;
+    remaining_ = count * ((rsa ? 1 : 0) + (ecdsa ? 1 : 0));
+    memset(&rsaStats_, 0, sizeof(rsaStats_));
+    memset(&ecdsaStats_, 0, sizeof(ecdsaStats_));
+    strncpy(cmdId_, cmdId, sizeof(cmdId_) - 1);
+    cmdId_[sizeof(cmdId_) - 1] = '\0';
+    return true;
+  }
+
+  // One blocking handshake per call; returns true once, after the last one
+  bool step() {
+    if (!running()) return false;
+    bool rsaTurn = rsa_ && (!ecdsa_ || remaining_ > perProfile_);
+    if (rsaTurn) stepRsa();
+    else stepEcdsa();
+    remaining_--;
+    return remaining_ == 0;
+  }
+
+  void report(JsonObject out) const {
+    out["host"] = host_;
+    out["heap_metered"] = TlsHeapMeter::available();
+    if (rsa_) {
+      JsonObject rsa = out.createNestedObject("default");
+      rsa["port"] = rsaPort_;
+      reportHandshakes(rsaStats_, rsa);
+    }
+    if (ecdsa_) {
+      JsonObject ecdsa = out.createNestedObject("ecdsa");
+      ecdsa["port"] = ecdsaPort_;
+      ecdsa["cipher"] = cipher_;
+      reportHandshakes(ecdsaStats_, ecdsa);
+    }
+  }
+
+private:
+  // Both clients are created per handshake, so each run includes credential
+  // parsing and DRBG seeding, as a device's first connect does
+  void stepRsa() {
+    WiFiClientSecure* client = new WiFiClientSecure();
+    client->setCACert(credentials_.rsaCa);
+    unsigned long start = millis();
+    TlsHeapMeter::startWindow();
+    bool ok = client->connect(host_.c_str(), rsaPort_);
+    recordHandshake(rsaStats_, ok, millis() - start, TlsHeapMeter::peak(), -1);
+    client->stop();
+    delete client;
+  }
+
+  void stepEcdsa() {
+    EcdsaTlsClient* client = new EcdsaTlsClient();
+    client->setCACert(credentials_.ecdsaCa);
+    client->setCertificate(credentials_.ecdsaCert);
+    client->setPrivateKey(credentials_.ecdsaKey);
+    TlsHeapMeter::startWindow();
+    bool ok = client->connect(host_.c_str(), ecdsaPort_);
+    const TlsHandshakeStats& stats = client->stats();
+    recordHandshake(ecdsaStats_, ok, stats.lastMs, TlsHeapMeter::peak(), stats.lastError);
+    if (ok) cipher_ = client->cipher();
+    client->stop();
+    delete client;
+  }
+
+  TlsBenchCredentials credentials_ = {};
+  String host_;
+  String cipher_;
+  uint16_t rsaPort_ = 0;
+  uint16_t ecdsaPort_ = 0;
+  bool rsa_ = false;
+  bool ecdsa_ = false;
+  uint8_t perProfile_ = 0;
+  uint16_t remaining_ = 0;
+  char cmdId_[40] = {0};
+  TlsHandshakeStats rsaStats_ = {};
+  TlsHandshakeStats ecdsaStats_ = {};
+};
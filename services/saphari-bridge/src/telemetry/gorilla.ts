@@ -0,0 +1,115 @@
+/**
+ * Decoder for Gorilla-encoded telemetry batches from the firmware
+ * (firmware/esp32_device_authoritative/gorilla.h, format version 1).
+ * Columnar: delta-of-delta uint32 ms timestamps, then XOR float32 value columns.
+ */
+
+export const GORILLA_FORMAT_VERSION = 1;
+const HEADER_BYTES = 4;
+
+export interface TelemetryBatch {
+  /** Sample timestamps (device ms, uint32) */
+  timestamps: number[];
+  /** One array per value column; NaN marks a gap */
+  columns: number[][];
+}
+
+class BitReader {
+  private bitPos = 0;
+
+  constructor(private readonly buf: Uint8Array) {}
+
+  /** Read up to 32 bits MSB first, as an unsigned number */
+  read(bits: number): number {
+    if (this.bitPos + bits > this.buf.length * 8) {
+      throw new Error('Gorilla batch truncated');
+    }
+    let value = 0;
+    while (bits > 0) {
+      const used = this.bitPos & 7;
+      const room = 8 - used;
+      const n = Math.min(bits, room);
+      const chunk = (this.buf[this.bitPos >> 3] >> (room - n)) & ((1 << n) - 1);
+      value = value * (1 << n) + chunk;
+      bits -= n;
+      this.bitPos += n;
+    }
+    return value;
+  }
+}
+
+function signExtend(value: number, bits: number): number {
+  return value >= 2 ** (bits - 1) ? value - 2 ** bits : value;
+}
+
+const floatView = new DataView(new ArrayBuffer(4));
+
+function bitsToFloat(bits: number): number {
+  floatView.setUint32(0, bits >>> 0);
+  return floatView.getFloat32(0);
+}
+
+function decodeTimestamps(reader: BitReader, count: number): number[] {
+  const out: number[] = [];
+  let prev = 0;
+  let prevDelta = 0;
+  for (let i = 0; i < count; i++) {
+    if (i === 0) {
+      prev = reader.read(32);
+      out.push(prev);
+      continue;
+    }
+    let dod: number;
+    if (reader.read(1) === 0) dod = 0;
+    else if (reader.read(1) === 0) dod = signExtend(reader.read(7), 7);
+    else if (reader.read(1) === 0) dod = signExtend(reader.read(9), 9);
+    else if (reader.read(1) === 0) dod = signExtend(reader.read(12), 12);
+    else dod = reader.read(32);
+    // uint32 arithmetic, same wraparound as the device
+    prevDelta = (prevDelta + dod) >>> 0;
+    prev = (prev + prevDelta) >>> 0;
+    out.push(prev);
+  }
+  return out;
+}
+
+function decodeValues(reader: BitReader, count: number): number[] {
+  const out: number[] = [];
+  let prev = 0;
+  let leading = 0;
+  let trailing = 0;
+  for (let i = 0; i < count; i++) {
+    if (i === 0) {
+      prev = reader.read(32);
+    } else if (reader.read(1) === 1) {
+      if (reader.read(1) === 1) {
+        leading = reader.read(5);
+        const length = reader.read(5) + 1;
+        trailing = 32 - leading - length;
+      }
+      const meaningful = reader.read(32 - leading - trailing);
+      prev = (prev ^ (meaningful * 2 ** trailing)) >>> 0;
+    }
+    out.push(bitsToFloat(prev));
+  }
+  return out;
+}
+
+/**
+ * Decode one batch. Throws on unknown version or truncated data.
+ */
+export function decodeGorillaBatch(data: Uint8Array): TelemetryBatch {
+  if (data.length < HEADER_BYTES || data[0] !== GORILLA_FORMAT_VERSION) {
+    throw new Error('Unsupported Gorilla batch');
+  }
+  const columnCount = data[1];
+  const count = data[2] | (data[3] << 8);
+  const reader = new BitReader(data.subarray(HEADER_BYTES));
+
+  const timestamps = decodeTimestamps(reader, count);
+  const columns: number[][] = [];
+  for (let c = 0; c < columnCount; c++) {
+    columns.push(decodeValues(reader, count));
+  }
+  return { timestamps, columns };
+}